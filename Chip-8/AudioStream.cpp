@@ -0,0 +1,117 @@
+#include "AudioStream.h"
+
+AudioStream::AudioStream(unsigned int sampleRate, size_t capacity) :
+	m_mask(0),
+	m_sampleRate((0 == sampleRate) ? DEFAULT_SAMPLE_RATE : sampleRate),
+	m_framesPerSecond(60),
+	m_remainder(0),
+	m_phase(0),
+	m_phaseStep(0),
+	m_amplitude(DEFAULT_AMPLITUDE),
+	m_dropped(0),
+	m_tail(0),
+	m_cachedHead(0),
+	m_head(0),
+	m_cachedTail(0)
+{
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	m_samples.reset(new short[size]);
+	m_mask = size - 1;
+	SetTone(DEFAULT_FREQUENCY, DEFAULT_AMPLITUDE);
+}
+
+
+AudioStream::~AudioStream()
+{
+}
+
+unsigned int AudioStream::GetSampleRate()
+{
+	return m_sampleRate;
+}
+
+void AudioStream::SetFrameRate(unsigned int framesPerSecond)
+{
+	m_framesPerSecond = (0 == framesPerSecond) ? 60 : framesPerSecond;
+	m_remainder = 0;
+}
+
+void AudioStream::SetTone(unsigned int frequency, short amplitude)
+{
+	m_phaseStep = (unsigned int)(((unsigned long long)frequency << 32) / m_sampleRate);
+	m_amplitude = amplitude;
+}
+
+/*****************************************************************************************************************************************/
+//
+// GenerateFrame - Adds one frame of samples to the ring
+//
+// Inputs - soundOn (the sound timer was running during the frame)
+//
+// Outputs - Samples produced for the frame
+//
+// Notes - The samples are written straight into the ring, in at most two runs when they wrap past its end. The wave keeps its
+//         phase through silence, so a tone that stops and starts again comes back in step
+/*****************************************************************************************************************************************/
+unsigned int AudioStream::GenerateFrame(bool soundOn)
+{
+	unsigned int count = m_sampleRate / m_framesPerSecond;
+	m_remainder += m_sampleRate % m_framesPerSecond;
+	if (m_remainder >= m_framesPerSecond)
+	{
+		m_remainder -= m_framesPerSecond;
+		count++;
+	}
+
+	size_t tail = m_tail.load(std::memory_order_relaxed);
+	size_t space = m_mask + 1 - (tail - m_cachedHead);
+	if (space < count)
+	{
+		m_cachedHead = m_head.load(std::memory_order_acquire);
+		space = m_mask + 1 - (tail - m_cachedHead);
+	}
+	size_t writing = (space < count) ? space : count;
+
+	for (size_t sample = 0; sample < writing; sample++)
+	{
+		short value = 0;
+		if (soundOn)
+			value = (m_phase & 0x80000000) ? (short)-m_amplitude : m_amplitude;
+		m_samples[(tail + sample) & m_mask] = value;
+		m_phase += m_phaseStep;
+	}
+	// Dropped samples still move the wave on, so what is heard stays in time with the machine
+	m_phase += (unsigned int)(count - writing) * m_phaseStep;
+	m_tail.store(tail + writing, std::memory_order_release);
+
+	if (writing < count)
+		m_dropped.fetch_add(count - writing, std::memory_order_relaxed);
+	return count;
+}
+
+unsigned long long AudioStream::GetDroppedSamples()
+{
+	return m_dropped.load(std::memory_order_relaxed);
+}
+
+size_t AudioStream::GetAvailable()
+{
+	m_cachedTail = m_tail.load(std::memory_order_acquire);
+	return m_cachedTail - m_head.load(std::memory_order_relaxed);
+}
+
+size_t AudioStream::Read(short *samples, size_t count)
+{
+	size_t head = m_head.load(std::memory_order_relaxed);
+	if (m_cachedTail - head < count)
+		m_cachedTail = m_tail.load(std::memory_order_acquire);
+
+	size_t available = m_cachedTail - head;
+	size_t reading = (available < count) ? available : count;
+	for (size_t sample = 0; sample < reading; sample++)
+		samples[sample] = m_samples[(head + sample) & m_mask];
+	m_head.store(head + reading, std::memory_order_release);
+	return reading;
+}
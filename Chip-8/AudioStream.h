@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/*****************************************************************************************************************************************/
+//
+// AudioStream - Turns the sound timer into 16 bit mono PCM for an audio backend
+//
+// Notes - The emulator calls GenerateFrame once per frame with whether the sound timer was running in it, and gets that frame's
+//         share of samples: a square wave while the timer runs, silence otherwise. The share is spread like Pacer spreads
+//         instructions, so exactly the sample rate worth of samples is produced per emulated second, and the wave's phase carries
+//         on from frame to frame so a long tone has no seams.
+//
+//         Samples go into a single producer, single consumer ring that the backend drains with Read from its own thread. When
+//         the backend falls behind (or the emulator runs faster than real time) samples that do not fit are dropped and counted,
+//         the emulator never waits.
+/*****************************************************************************************************************************************/
+class AudioStream
+{
+public:
+	// capacity is in samples and rounded up to a power of two
+	AudioStream(unsigned int sampleRate = DEFAULT_SAMPLE_RATE, size_t capacity = DEFAULT_CAPACITY);
+	~AudioStream();
+	AudioStream(const AudioStream&) = delete;
+	AudioStream& operator=(const AudioStream&) = delete;
+
+	unsigned int GetSampleRate();
+
+	// Producer side
+	void SetFrameRate(unsigned int framesPerSecond);
+	void SetTone(unsigned int frequency, short amplitude);
+	// Returns the number of samples the frame produced, including any that were dropped
+	unsigned int GenerateFrame(bool soundOn);
+	unsigned long long GetDroppedSamples();
+
+	// Consumer side
+	size_t GetAvailable();
+	size_t Read(short *samples, size_t count);
+
+	static constexpr unsigned int DEFAULT_SAMPLE_RATE = 44100;
+	static constexpr size_t DEFAULT_CAPACITY = 16384;  // About a third of a second at the default rate
+	static constexpr unsigned int DEFAULT_FREQUENCY = 750;
+	static constexpr short DEFAULT_AMPLITUDE = 8000;
+
+private:
+	std::unique_ptr<short[]> m_samples;
+	size_t m_mask;
+	unsigned int m_sampleRate;
+
+	// Only used by the producer
+	unsigned int m_framesPerSecond;
+	unsigned int m_remainder;              // Samples per second left over by the division, carried frame to frame
+	unsigned int m_phase;                  // Position in the wave, a full cycle is 2^32
+	unsigned int m_phaseStep;
+	short m_amplitude;
+	std::atomic<unsigned long long> m_dropped;
+
+	alignas(64) std::atomic<size_t> m_tail;   // Next sample the producer writes
+	size_t m_cachedHead;
+	alignas(64) std::atomic<size_t> m_head;   // Next sample the consumer reads
+	size_t m_cachedTail;
+};
@@ -0,0 +1,302 @@
+// Batch.cpp : Command line runner that executes many ROM jobs in parallel, one Chip8 per job, and reports the final state of each
+//             along with the combined throughput.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "BatchRunner.h"
+#include "LockstepBatch.h"
+#include "RomArchive.h"
+
+static void PrintUsage(const char *program)
+{
+	std::cerr << "Usage: " << program << " [<rom>...] [--archive FILE] [--instructions N] [--ipf N] [--repeat N] [--threads N] [--engine interpreter|blocks|jit] [--quirks chip8|vip|schip|xochip] [--key N:K]... [--seed N] [--lockstep N]" << std::endl
+	          << "       " << program << " <rom>... --pack FILE" << std::endl
+	          << "  --archive FILE    Add a job for every ROM in the archive FILE" << std::endl
+	          << "  --instructions N  Execute N instructions per job (default 1000000)" << std::endl
+	          << "  --ipf N           Instructions per 60 Hz frame (default 10)" << std::endl
+	          << "  --repeat N        Run every ROM N times (default 1)" << std::endl
+	          << "  --threads N       Worker threads (default one per hardware thread)" << std::endl
+	          << "  --engine E        Execution engine: interpreter (default), blocks or jit" << std::endl
+	          << "  --quirks Q        Rules to run by: chip8 (default), vip for the COSMAC VIP, schip for SUPER-CHIP or xochip for XO-CHIP" << std::endl
+	          << "  --key N:K         Press keyboard key K after N instructions, in every job" << std::endl
+	          << "  --seed N          Random seed for every job (default 1)" << std::endl
+	          << "  --lockstep N      Run N lanes of every job in lockstep, lane L seeded with the seed plus L (chip8 rules only, no --key)" << std::endl
+	          << "  --pack FILE       Pack the ROMs into the archive FILE instead of running them" << std::endl;
+}
+
+// Runs every job as a LockstepBatch of the given number of lanes and prints one line per lane
+static int RunLockstep(const std::vector<BatchJob>& jobs, unsigned int lanes, unsigned int threads)
+{
+	std::vector<std::vector<BatchResult>> results(jobs.size());
+	WorkStealingPool pool(threads);
+	auto start = std::chrono::steady_clock::now();
+	pool.ForEach(jobs.size(), [&jobs, &results, lanes](size_t index, unsigned int worker)
+	{
+		const BatchJob& job = jobs[index];
+		LockstepBatch batch(lanes);
+		std::vector<BatchResult>& laneResults = results[index];
+		laneResults.assign(lanes, BatchResult());
+		if (0 != batch.LoadProgram(job.rom, job.romSize))
+		{
+			for (auto& result : laneResults)
+				result.stop = BatchStop::INVALID_ROM;
+			return;
+		}
+		for (unsigned int lane = 0; lane < lanes; lane++)
+			batch.SetRandomSeed(lane, job.randomSeed + lane);
+		batch.Reset();
+
+		auto jobStart = std::chrono::steady_clock::now();
+		unsigned long long executed = 0;
+		while (executed < job.instructions)
+		{
+			unsigned long long remaining = job.instructions - executed;
+			unsigned int steps = 0;
+			batch.RunFrame((unsigned int)((remaining < job.cyclesPerFrame) ? remaining : job.cyclesPerFrame), steps);
+			executed += steps;
+			if (0 == steps)
+				break;
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - jobStart).count();
+
+		for (unsigned int lane = 0; lane < lanes; lane++)
+		{
+			BatchResult& result = laneResults[lane];
+			result.stop = batch.IsStopped(lane) ? BatchStop::BAD_OPCODE : (batch.IsWaitingForInput(lane) ? BatchStop::WAITING_FOR_INPUT : BatchStop::COMPLETED);
+			result.executed = executed;
+			result.pc = batch.GetPC(lane);
+			result.addressRegister = batch.GetAddressRegister(lane);
+			for (unsigned char x = 0; x < 16; x++)
+				result.registers[x] = batch.GetRegister(lane, x);
+			result.displayHash = batch.GetDisplayHash(lane);
+			result.seconds = seconds;
+			result.worker = worker;
+		}
+	});
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	int exitCode = 0;
+	unsigned long long laneSteps = 0;
+	std::cout << "job,lane,rom,stopped,pc,steps,hash,seconds,worker" << std::endl;
+	for (size_t x = 0; x < jobs.size(); x++)
+	{
+		for (unsigned int lane = 0; lane < lanes; lane++)
+		{
+			const BatchResult& result = results[x][lane];
+			std::cout << x << "," << lane << "," << jobs[x].name << "," << BatchRunner::GetStopName(result.stop)
+			          << ",0x" << std::hex << std::uppercase << std::setfill('0') << std::setw(4) << result.pc << std::dec
+			          << "," << result.executed
+			          << ",0x" << std::hex << std::setw(16) << result.displayHash << std::dec
+			          << "," << std::fixed << std::setprecision(6) << result.seconds
+			          << "," << result.worker << std::endl;
+			laneSteps += result.executed;
+			if (BatchStop::COMPLETED != result.stop)
+				exitCode = 2;
+		}
+	}
+
+	// Lanes that stopped early are still counted for every step, so this is an upper bound when lanes stop
+	std::cerr << "jobs:               " << jobs.size() << " x " << lanes << " lanes" << std::endl
+	          << "threads:            " << pool.GetThreadCount() << std::endl
+	          << "lane steps:         " << laneSteps << std::endl
+	          << "seconds:            " << std::fixed << std::setprecision(6) << seconds << std::endl
+	          << "lane steps/sec:     " << std::setprecision(0) << (seconds > 0 ? laneSteps / seconds : 0.0) << std::endl;
+	return exitCode;
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<const char *> romPaths;
+	const char *archivePath = nullptr;
+	const char *packPath = nullptr;
+	std::vector<BatchKeyPress> keyPresses;
+	unsigned long long instructions = 1000000;
+	unsigned int instructionsPerFrame = 10;
+	unsigned long long repeat = 1;
+	unsigned int threads = 0;
+	unsigned int lanes = 0;
+	unsigned int randomSeed = 1;
+	ExecutionEngine engine = ExecutionEngine::INTERPRETER;
+	QuirkProfile quirks = QuirkProfile::CHIP_8;
+
+	for (int x = 1; x < argc; x++)
+	{
+		if ((0 == std::strcmp(argv[x], "--instructions")) && (x + 1 < argc))
+			instructions = std::strtoull(argv[++x], nullptr, 0);
+		else if ((0 == std::strcmp(argv[x], "--ipf")) && (x + 1 < argc))
+			instructionsPerFrame = (unsigned int)std::strtoul(argv[++x], nullptr, 0);
+		else if ((0 == std::strcmp(argv[x], "--repeat")) && (x + 1 < argc))
+			repeat = std::strtoull(argv[++x], nullptr, 0);
+		else if ((0 == std::strcmp(argv[x], "--threads")) && (x + 1 < argc))
+			threads = (unsigned int)std::strtoul(argv[++x], nullptr, 0);
+		else if ((0 == std::strcmp(argv[x], "--archive")) && (x + 1 < argc))
+			archivePath = argv[++x];
+		else if ((0 == std::strcmp(argv[x], "--pack")) && (x + 1 < argc))
+			packPath = argv[++x];
+		else if ((0 == std::strcmp(argv[x], "--seed")) && (x + 1 < argc))
+			randomSeed = (unsigned int)std::strtoul(argv[++x], nullptr, 0);
+		else if ((0 == std::strcmp(argv[x], "--lockstep")) && (x + 1 < argc))
+			lanes = (unsigned int)std::strtoul(argv[++x], nullptr, 0);
+		else if ((0 == std::strcmp(argv[x], "--engine")) && (x + 1 < argc))
+		{
+			const char *name = argv[++x];
+			if (0 == std::strcmp(name, "interpreter"))
+				engine = ExecutionEngine::INTERPRETER;
+			else if (0 == std::strcmp(name, "blocks"))
+				engine = ExecutionEngine::BLOCK_CACHE;
+			else if (0 == std::strcmp(name, "jit"))
+				engine = ExecutionEngine::JIT;
+			else
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+		}
+		else if ((0 == std::strcmp(argv[x], "--quirks")) && (x + 1 < argc))
+		{
+			const char *name = argv[++x];
+			if (0 == std::strcmp(name, "chip8"))
+				quirks = QuirkProfile::CHIP_8;
+			else if (0 == std::strcmp(name, "vip"))
+				quirks = QuirkProfile::COSMAC_VIP;
+			else if (0 == std::strcmp(name, "schip"))
+				quirks = QuirkProfile::SUPER_CHIP;
+			else if (0 == std::strcmp(name, "xochip"))
+				quirks = QuirkProfile::XO_CHIP;
+			else
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+		}
+		else if ((0 == std::strcmp(argv[x], "--key")) && (x + 1 < argc))
+		{
+			char *separator;
+			BatchKeyPress press;
+			press.instruction = std::strtoull(argv[++x], &separator, 0);
+			if ((':' != separator[0]) || (0 == separator[1]))
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+			press.key = separator[1];
+			keyPresses.push_back(press);
+		}
+		else if ('-' != argv[x][0])
+			romPaths.push_back(argv[x]);
+		else
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((romPaths.empty() && (nullptr == archivePath)) || ((nullptr != packPath) && (romPaths.empty() || (nullptr != archivePath))) || (0 == repeat) || (0 == instructionsPerFrame) ||
+		((0 != lanes) && (!keyPresses.empty() || (QuirkProfile::CHIP_8 != quirks))))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	std::stable_sort(keyPresses.begin(), keyPresses.end(), [](const BatchKeyPress& a, const BatchKeyPress& b) { return a.instruction < b.instruction; });
+
+	// Jobs point at the ROMs rather than owning them, so these hold the ROMs until the jobs are done
+	auto loadStart = std::chrono::steady_clock::now();
+	std::vector<RomArchiveFile> romFiles(romPaths.size());
+	for (size_t x = 0; x < romPaths.size(); x++)
+	{
+		romFiles[x].name = romPaths[x];
+		if (!BatchRunner::ReadRomFile(romPaths[x], romFiles[x].bytes))
+		{
+			std::cerr << "Unable to read ROM " << romPaths[x] << " (max size is " << XO_CHIP_MAX_PROGRAM_SIZE << " bytes)" << std::endl;
+			return 1;
+		}
+	}
+
+	if (nullptr != packPath)
+	{
+		// ROMs are packed under their file names, without the directories they came from
+		for (RomArchiveFile& rom : romFiles)
+			rom.name = rom.name.substr(rom.name.find_last_of("/\\") + 1);
+		if (0 != RomArchive::Write(packPath, romFiles))
+		{
+			std::cerr << "Unable to write archive " << packPath << " (ROM names must be unique)" << std::endl;
+			return 1;
+		}
+		std::cerr << "packed:             " << romFiles.size() << " ROMs into " << packPath << std::endl;
+		return 0;
+	}
+
+	RomArchive archive;
+	if ((nullptr != archivePath) && (0 != archive.Open(archivePath)))
+	{
+		std::cerr << "Unable to open archive " << archivePath << std::endl;
+		return 1;
+	}
+
+	BatchJob job;
+	job.instructions = instructions;
+	job.cyclesPerFrame = instructionsPerFrame;
+	job.engine = engine;
+	job.quirks = quirks;
+	job.randomSeed = randomSeed;
+	job.keyPresses = keyPresses;
+	std::vector<BatchJob> jobs;
+	for (const RomArchiveFile& rom : romFiles)
+	{
+		job.name = rom.name;
+		job.rom = rom.bytes.data();
+		job.romSize = (int)rom.bytes.size();
+		for (unsigned long long copy = 0; copy < repeat; copy++)
+			jobs.push_back(job);
+	}
+	for (unsigned int index = 0; index < archive.GetCount(); index++)
+	{
+		job.name = archive.GetName(index);
+		job.rom = archive.GetRom(index, job.romSize);
+		for (unsigned long long copy = 0; copy < repeat; copy++)
+			jobs.push_back(job);
+	}
+	std::cerr << "roms loaded:        " << romFiles.size() + archive.GetCount() << " in " << std::fixed << std::setprecision(3)
+	          << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count() << " ms" << std::endl;
+
+	if (0 != lanes)
+		return RunLockstep(jobs, lanes, threads);
+
+	BatchRunner runner(threads);
+	auto start = std::chrono::steady_clock::now();
+	std::vector<BatchResult> results = runner.Run(jobs);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// One comma separated line per job so the output can be diffed between runs or loaded into a spreadsheet
+	int exitCode = 0;
+	unsigned long long totalExecuted = 0;
+	std::cout << "job,rom,stopped,pc,instructions,hash,seconds,worker" << std::endl;
+	for (size_t x = 0; x < jobs.size(); x++)
+	{
+		const BatchResult& result = results[x];
+		std::cout << x << "," << jobs[x].name << "," << BatchRunner::GetStopName(result.stop)
+		          << ",0x" << std::hex << std::uppercase << std::setfill('0') << std::setw(4) << result.pc << std::dec
+		          << "," << result.executed
+		          << ",0x" << std::hex << std::setw(16) << result.displayHash << std::dec
+		          << "," << std::fixed << std::setprecision(6) << result.seconds
+		          << "," << result.worker << std::endl;
+		totalExecuted += result.executed;
+		if (BatchStop::COMPLETED != result.stop)
+			exitCode = 2;
+	}
+
+	std::cerr << "jobs:               " << jobs.size() << std::endl
+	          << "threads:            " << runner.GetThreadCount() << std::endl
+	          << "instructions:       " << totalExecuted << std::endl
+	          << "seconds:            " << std::fixed << std::setprecision(6) << seconds << std::endl
+	          << "instructions/sec:   " << std::setprecision(0) << (seconds > 0 ? totalExecuted / seconds : 0.0) << std::endl;
+
+	return exitCode;
+}
@@ -0,0 +1,135 @@
+#include "BatchRunner.h"
+#include <chrono>
+#include <fstream>
+
+BatchRunner::BatchRunner(unsigned int threads) :
+	m_pool(threads)
+{
+}
+
+unsigned int BatchRunner::GetThreadCount()
+{
+	return m_pool.GetThreadCount();
+}
+
+/*****************************************************************************************************************************************/
+//
+// Run - Runs every job and collects the results
+//
+// Inputs - jobs (the jobs to run. They are only read, so the same ROM can be shared between jobs)
+//
+// Outputs - One result per job, in the same order as the jobs
+/*****************************************************************************************************************************************/
+std::vector<BatchResult> BatchRunner::Run(const std::vector<BatchJob>& jobs)
+{
+	std::vector<BatchResult> results(jobs.size());
+	m_pool.ForEach(jobs.size(), [&jobs, &results](size_t index, unsigned int worker)
+	{
+		results[index] = RunJob(jobs[index]);
+		results[index].worker = worker;
+	});
+	return results;
+}
+
+/*****************************************************************************************************************************************/
+//
+// RunJob - Runs one job start to finish on a fresh machine
+//
+// Inputs - job (ROM, instruction budget, frame size, engine, quirk profile and scripted input)
+//
+// Outputs - The final machine state and why the run stopped
+//
+// Notes - The job runs as frames of Chip8::RunFrame so the timers tick at 60 Hz of emulated time. Key presses are made between
+//         frames, so the machine is never touched while it is executing. A machine that
+//         blocks on FX0A gets the next scripted key straight away; it only stops waiting for input when the script has run out
+/*****************************************************************************************************************************************/
+BatchResult BatchRunner::RunJob(const BatchJob& job)
+{
+	BatchResult result = {};
+	Chip8 chip;
+
+	// The profile decides how much memory there is, so it is set before the ROM is loaded
+	chip.SetQuirkProfile(job.quirks);
+	if (0 != chip.LoadProgram(job.rom, job.romSize))
+	{
+		result.stop = BatchStop::INVALID_ROM;
+		return result;
+	}
+
+	chip.SetRandomSeed(job.randomSeed);
+	chip.Reset();
+	if (0 != chip.SetExecutionEngine(job.engine))
+	{
+		result.stop = BatchStop::ENGINE_UNAVAILABLE;
+		return result;
+	}
+	chip.Executing();
+
+	result.stop = BatchStop::COMPLETED;
+	size_t nextKey = 0;
+	auto start = std::chrono::steady_clock::now();
+	while ((result.executed < job.instructions) && (0 != job.cyclesPerFrame))
+	{
+		while ((nextKey < job.keyPresses.size()) && (job.keyPresses[nextKey].instruction <= result.executed))
+			chip.KeyPress(job.keyPresses[nextKey++].key);
+
+		unsigned long long remaining = job.instructions - result.executed;
+		unsigned int ran = 0;
+		int status = chip.RunFrame((unsigned int)((remaining < job.cyclesPerFrame) ? remaining : job.cyclesPerFrame), ran);
+		result.executed += ran;
+		if (status & 0x1)
+		{
+			if (status & 0x80)
+				result.stop = BatchStop::EXITED;
+			else
+				result.stop = (status & 0x20) ? BatchStop::STACK_OVERFLOW : ((status & 0x40) ? BatchStop::STACK_UNDERFLOW : BatchStop::BAD_OPCODE);
+			break;
+		}
+		if (status & 0x10)
+		{
+			if (nextKey == job.keyPresses.size())
+			{
+				result.stop = BatchStop::WAITING_FOR_INPUT;
+				break;
+			}
+			chip.KeyPress(job.keyPresses[nextKey++].key);
+		}
+	}
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	result.pc = chip.GetPC();
+	result.addressRegister = chip.GetAddressRegister();
+	for (unsigned char x = 0; x < 16; x++)
+		result.registers[x] = chip.GetRegister(x);
+	result.displayHash = chip.GetDisplayHash();
+	return result;
+}
+
+bool BatchRunner::ReadRomFile(const char *path, std::vector<unsigned char>& rom)
+{
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	// Read no more than one byte past the largest program, so a huge file is rejected without being loaded
+	rom.resize(XO_CHIP_MAX_PROGRAM_SIZE + 1);
+	file.read((char *)rom.data(), rom.size());
+	rom.resize((size_t)file.gcount());
+	return rom.size() <= XO_CHIP_MAX_PROGRAM_SIZE;
+}
+
+const char* BatchRunner::GetStopName(BatchStop stop)
+{
+	switch (stop)
+	{
+		case BatchStop::COMPLETED:          return "completed";
+		case BatchStop::BAD_OPCODE:         return "bad opcode";
+		case BatchStop::STACK_OVERFLOW:     return "stack overflow";
+		case BatchStop::STACK_UNDERFLOW:    return "stack underflow";
+		case BatchStop::EXITED:             return "exited";
+		case BatchStop::WAITING_FOR_INPUT:  return "waiting for input";
+		case BatchStop::INVALID_ROM:        return "invalid rom";
+		case BatchStop::ENGINE_UNAVAILABLE: return "engine unavailable";
+		default:                            return "unknown";
+	}
+}
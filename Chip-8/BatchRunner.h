@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Chip8.h"
+#include "WorkStealingPool.h"
+
+// A scripted key press, made at the start of the first frame after the machine has executed the given number of instructions
+struct BatchKeyPress
+{
+	unsigned long long instruction;
+	char key;                       // Keyboard key as passed to Chip8::KeyPress
+};
+
+struct BatchJob
+{
+	std::string name;
+	const unsigned char *rom;       // Not owned. Many jobs can share one ROM, which may be in a RomArchive
+	int romSize;
+	unsigned long long instructions;
+	unsigned int cyclesPerFrame;    // Instructions per 60 Hz timer tick
+	ExecutionEngine engine;
+	QuirkProfile quirks;
+	unsigned int randomSeed;        // Passed to Chip8::SetRandomSeed, so repeats of a job draw the same numbers
+	std::vector<BatchKeyPress> keyPresses; // Sorted by instruction
+};
+
+enum class BatchStop
+{
+	COMPLETED,
+	BAD_OPCODE,
+	STACK_OVERFLOW,
+	STACK_UNDERFLOW,
+	EXITED,                         // The program ran the SUPER-CHIP 00FD
+	WAITING_FOR_INPUT,
+	INVALID_ROM,
+	ENGINE_UNAVAILABLE,
+};
+
+struct BatchResult
+{
+	BatchStop stop;
+	unsigned long long executed;
+	unsigned short pc;
+	unsigned short addressRegister;
+	unsigned char registers[16];
+	unsigned long long displayHash;
+	double seconds;
+	unsigned int worker;            // Worker thread that ran the job
+};
+
+/*****************************************************************************************************************************************/
+//
+// BatchRunner - Runs many independent ROM jobs across all cores
+//
+// Notes - Every job gets its own Chip8, so nothing is shared between workers and each result is exactly what a single threaded run
+//         of the same job produces. Jobs are spread over a WorkStealingPool so long and short jobs can be mixed freely.
+/*****************************************************************************************************************************************/
+class BatchRunner
+{
+public:
+	explicit BatchRunner(unsigned int threads = 0); // 0 uses one thread per hardware thread
+
+	unsigned int GetThreadCount();
+	std::vector<BatchResult> Run(const std::vector<BatchJob>& jobs);
+
+	static BatchResult RunJob(const BatchJob& job);
+	// Takes ROMs up to XO_CHIP_MAX_PROGRAM_SIZE. A job whose ROM is too big for its profile stops with INVALID_ROM
+	static bool ReadRomFile(const char *path, std::vector<unsigned char>& rom);
+	static const char* GetStopName(BatchStop stop);
+
+private:
+	WorkStealingPool m_pool;
+};
@@ -0,0 +1,601 @@
+#include "BlockCache.h"
+
+BlockCache::BlockCache()
+{
+}
+
+BlockCache::~BlockCache()
+{
+}
+
+/*****************************************************************************************************************************************/
+//
+// Run - Executes up to maxInstructions from the cached blocks, building blocks the first time they are reached
+//
+// Inputs - chip (machine to run)
+//          maxInstructions (upper bound on the number of instructions to execute)
+//          executed (set to the number of instructions actually executed)
+//
+// Outputs - The status bits of every executed instruction ORed together, the same as the interpreter returns
+//
+// Notes - A block is only entered when it fits in the remaining instruction budget. Otherwise the interpreter finishes the run one
+//         instruction at a time so both engines stop on exactly the same instruction
+/*****************************************************************************************************************************************/
+int BlockCache::Run(Chip8& chip, unsigned int maxInstructions, unsigned int& executed)
+{
+	int returnValue = 0;
+	executed = 0;
+
+	while (executed < maxInstructions)
+	{
+		unsigned short pc = chip.m_pc;
+		Block *block = nullptr;
+
+		if (pc < CHIP_8_MEMORY_SIZE)
+		{
+			block = m_blocks[pc].get();
+			if (nullptr == block)
+				block = Build(chip, pc);
+		}
+
+		if ((nullptr == block) || (block->instructionCount > (maxInstructions - executed)))
+		{
+			returnValue |= chip.Execute(chip.m_pc);
+			executed++;
+		}
+		else
+		{
+			for (const BlockOperation *operation = block->operations.data(); ; operation++)
+			{
+				returnValue |= operation->handler(chip, *operation);
+				if (operation->terminator)
+					break;
+			}
+			executed += block->instructionCount;
+		}
+
+		if ((returnValue & 0x1) || (Chip8::STATE_PAUSED_FOR_INPUT == chip.m_executionState))
+			break;
+	}
+
+	m_retired.clear();
+	return returnValue;
+}
+
+/*****************************************************************************************************************************************/
+//
+// Invalidate - Drops every block that decoded any byte in the written range
+//
+// Inputs - address (first byte written)
+//          length (number of bytes written)
+//
+// Outputs - None
+//
+// Notes - Called by the machine for FX33 and FX55. Both end their block, so a block never keeps running after its own code changed
+/*****************************************************************************************************************************************/
+void BlockCache::Invalidate(unsigned short address, unsigned short length)
+{
+	if ((0 == length) || (address >= CHIP_8_MEMORY_SIZE))
+		return;
+
+	unsigned int last = address + length - 1;
+	if (last >= CHIP_8_MEMORY_SIZE)
+		last = CHIP_8_MEMORY_SIZE - 1;
+
+	for (unsigned int page = address >> PAGE_SHIFT; page <= (last >> PAGE_SHIFT); page++)
+	{
+		std::vector<unsigned short>& starts = m_blocksByPage[page];
+		for (size_t x = 0; x < starts.size(); )
+		{
+			Block *block = m_blocks[starts[x]].get();
+			if ((nullptr != block) && (block->start <= last) && (block->end > address))
+			{
+				Remove(block->start); // Removes the entry from this list too, so do not advance
+			}
+			else
+			{
+				x++;
+			}
+		}
+	}
+}
+
+void BlockCache::InvalidateAll()
+{
+	for (int x = 0; x < CHIP_8_MEMORY_SIZE; x++)
+	{
+		if (nullptr != m_blocks[x])
+			m_retired.push_back(std::move(m_blocks[x]));
+	}
+	for (int page = 0; page < NUMBER_OF_PAGES; page++)
+		m_blocksByPage[page].clear();
+}
+
+void BlockCache::Remove(unsigned short start)
+{
+	Block *block = m_blocks[start].get();
+	for (unsigned int page = block->start >> PAGE_SHIFT; page <= (unsigned int)((block->end - 1) >> PAGE_SHIFT) && page < NUMBER_OF_PAGES; page++)
+	{
+		std::vector<unsigned short>& starts = m_blocksByPage[page];
+		for (size_t x = 0; x < starts.size(); x++)
+		{
+			if (starts[x] == start)
+			{
+				starts[x] = starts.back();
+				starts.pop_back();
+				break;
+			}
+		}
+	}
+	m_retired.push_back(std::move(m_blocks[start]));
+}
+
+/*****************************************************************************************************************************************/
+//
+// Build - Decodes the basic block starting at start and caches it
+//
+// Inputs - chip (machine whose memory holds the code)
+//          start (address of the first instruction)
+//
+// Outputs - The new block
+//
+// Notes - Decoding stops at the first instruction that changes the PC, can fail or writes memory. ANNN followed by DXYN and 7XNN
+//         followed by 3XNN/4XNN are fused into single superinstructions
+/*****************************************************************************************************************************************/
+Block* BlockCache::Build(Chip8& chip, unsigned short start)
+{
+	std::unique_ptr<Block> block(new Block);
+	block->start = start;
+	block->instructionCount = 0;
+	block->operations.reserve(16);
+
+	unsigned short pc = start;
+	while (true)
+	{
+		BlockOperation operation;
+		Decode(chip, pc, operation);
+
+		if (!operation.terminator)
+		{
+			BlockOperation second;
+			Decode(chip, operation.next, second);
+			if ((&LoadAddress == operation.handler) && (&Draw == second.handler))
+			{
+				operation.handler = &LoadAddressDraw;
+				operation.x = second.x;
+				operation.y = second.y;
+				operation.n = second.n;
+			}
+			else if ((&AddConst == operation.handler) && ((&SkipEqualConst == second.handler) || (&SkipNotEqualConst == second.handler)))
+			{
+				operation.handler = (&SkipEqualConst == second.handler) ? &AddConstSkipEqual : &AddConstSkipNotEqual;
+				operation.x2 = second.x;
+				operation.nn2 = second.nn;
+				operation.terminator = true;
+			}
+			if (&LoadAddressDraw == operation.handler || operation.terminator)
+			{
+				operation.next = second.next;
+				operation.instructions = 2;
+			}
+		}
+
+		block->operations.push_back(operation);
+		block->instructionCount += operation.instructions;
+		pc = operation.next;
+
+		if (operation.terminator)
+			break;
+
+		if (block->operations.size() >= MAX_BLOCK_OPERATIONS)
+		{
+			BlockOperation fallThrough = {};
+			fallThrough.handler = &FallThrough;
+			fallThrough.pc = pc;
+			fallThrough.next = pc;
+			fallThrough.terminator = true;
+			block->operations.push_back(fallThrough);
+			break;
+		}
+	}
+	block->end = (pc > start) ? pc : start + 2;
+
+	for (unsigned int page = start >> PAGE_SHIFT; page <= (unsigned int)((block->end - 1) >> PAGE_SHIFT) && page < NUMBER_OF_PAGES; page++)
+		m_blocksByPage[page].push_back(start);
+
+	m_blocks[start] = std::move(block);
+	return m_blocks[start].get();
+}
+
+/*****************************************************************************************************************************************/
+//
+// Decode - Resolves the instruction at pc into a block operation
+//
+// Inputs - chip (machine whose memory holds the code)
+//          pc (address of the instruction)
+//          operation (filled in)
+//
+// Outputs - true if the operation ends the block
+//
+// Notes - Anything that is not worth handling natively becomes an Interpret operation, which runs the interpreter for that one
+//         instruction and ends the block
+/*****************************************************************************************************************************************/
+bool BlockCache::Decode(Chip8& chip, unsigned short pc, BlockOperation& operation)
+{
+	Instruction instruction = Disassembler::Decode(pc, chip.GetOpcode(pc));
+
+	operation.handler = &Interpret;
+	operation.pc = pc;
+	operation.next = pc + 2;
+	operation.nnn = instruction.nnn;
+	operation.x = instruction.x;
+	operation.y = instruction.y;
+	operation.n = instruction.n;
+	operation.nn = instruction.nn;
+	operation.x2 = 0;
+	operation.nn2 = 0;
+	operation.instructions = 1;
+	operation.terminator = false;
+
+	// The quirks are settled here, by picking the handler built for them, so no handler has to test one
+	const Chip8Quirks quirks = GetQuirks(chip.m_quirkProfile);
+	bool inProgram = quirks.jumpAnywhere || ((instruction.nnn > START_CHIP_8_PROGRAM) && (instruction.nnn < (START_CHIP_8_PROGRAM + chip.m_programSize)));
+
+	switch (instruction.mnemonic)
+	{
+		case Mnemonic::CLS:         operation.handler = &ClearScreen; break;
+		case Mnemonic::RET:         operation.handler = &Return; operation.terminator = true; break;
+		case Mnemonic::JP:
+			// Unless the profile allows it the interpreter ignores jumps outside the program, which is just a jump to the next instruction
+			operation.handler = &Jump;
+			operation.nnn = inProgram ? instruction.nnn : operation.next;
+			operation.terminator = true;
+			break;
+		case Mnemonic::CALL:
+			if (inProgram)
+			{
+				operation.handler = &Call;
+				operation.terminator = true;
+			}
+			break;
+		case Mnemonic::SE_VX_NN:    operation.handler = &SkipEqualConst; operation.terminator = true; break;
+		case Mnemonic::SNE_VX_NN:   operation.handler = &SkipNotEqualConst; operation.terminator = true; break;
+		case Mnemonic::SE_VX_VY:    operation.handler = &SkipEqualRegister; operation.terminator = true; break;
+		case Mnemonic::SNE_VX_VY:   operation.handler = &SkipNotEqualRegister; operation.terminator = true; break;
+		case Mnemonic::LD_VX_NN:    operation.handler = &LoadConst; break;
+		case Mnemonic::ADD_VX_NN:   operation.handler = &AddConst; break;
+		case Mnemonic::LD_VX_VY:    operation.handler = &LoadRegister; break;
+		case Mnemonic::OR_VX_VY:    operation.handler = quirks.logicResetsVF ? &Or<true> : &Or<false>; break;
+		case Mnemonic::AND_VX_VY:   operation.handler = quirks.logicResetsVF ? &And<true> : &And<false>; break;
+		case Mnemonic::XOR_VX_VY:   operation.handler = quirks.logicResetsVF ? &Xor<true> : &Xor<false>; break;
+		case Mnemonic::ADD_VX_VY:   operation.handler = &AddRegister; break;
+		case Mnemonic::SUB_VX_VY:   operation.handler = &Subtract; break;
+		case Mnemonic::SHR_VX_VY:   operation.handler = quirks.shiftInPlace ? &ShiftRight<true> : &ShiftRight<false>; break;
+		case Mnemonic::SUBN_VX_VY:  operation.handler = &SubtractReverse; break;
+		case Mnemonic::SHL_VX_VY:   operation.handler = quirks.shiftInPlace ? &ShiftLeft<true> : &ShiftLeft<false>; break;
+		case Mnemonic::LD_I_NNN:    operation.handler = &LoadAddress; break;
+		case Mnemonic::JP_V0_NNN:
+			// The offset comes from V0, or from VX when the profile makes this BXNN
+			operation.handler = &JumpOffset;
+			operation.x = quirks.jumpPlusVX ? instruction.x : 0;
+			operation.terminator = true;
+			break;
+		case Mnemonic::RND_VX_NN:   operation.handler = &Random; break;
+		case Mnemonic::DRW_VX_VY_N: operation.handler = (quirks.superChip && (0 == instruction.n)) ? &DrawLarge : &Draw; break;
+		case Mnemonic::SKP_VX:      operation.handler = &SkipKey; operation.terminator = true; break;
+		case Mnemonic::SKNP_VX:     operation.handler = &SkipNotKey; operation.terminator = true; break;
+		case Mnemonic::LD_VX_DT:    operation.handler = &LoadDelay; break;
+		case Mnemonic::LD_DT_VX:    operation.handler = &SetDelay; break;
+		case Mnemonic::LD_ST_VX:    operation.handler = &SetSound; break;
+		case Mnemonic::ADD_I_VX:    operation.handler = &AddAddress; break;
+		case Mnemonic::LD_F_VX:     operation.handler = &LoadFont; break;
+		// Memory writes end the block so self-modifying code is picked up by the next lookup
+		case Mnemonic::LD_B_VX:     operation.handler = &StoreBCD; operation.terminator = true; break;
+		case Mnemonic::LD_MEM_VX:   operation.handler = quirks.loadStoreKeepsI ? &StoreRegisters<true> : &StoreRegisters<false>; operation.terminator = true; break;
+		// Can fail with a bad address, which has to stop the run on this instruction
+		case Mnemonic::LD_VX_MEM:   operation.handler = quirks.loadStoreKeepsI ? &LoadRegisters<true> : &LoadRegisters<false>; operation.terminator = true; break;
+		default:
+			break;
+	}
+
+	if (&Interpret == operation.handler)
+		operation.terminator = true;
+
+	return operation.terminator;
+}
+
+int BlockCache::Interpret(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_pc = operation.pc;
+	return chip.Execute(chip.m_pc);
+}
+
+int BlockCache::FallThrough(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_pc = operation.next;
+	return 0;
+}
+
+int BlockCache::ClearScreen(Chip8& chip, const BlockOperation& /* operation */)
+{
+	chip.ClearDisplay();
+	return 0;
+}
+
+int BlockCache::Return(Chip8& chip, const BlockOperation& operation)
+{
+	int returnValue = chip.PopReturnAddress(chip.m_pc);
+	if (returnValue & 0x1)
+	{
+		chip.m_pc = operation.next;
+		chip.m_registers[0] = 13;
+	}
+	return returnValue;
+}
+
+int BlockCache::Jump(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_pc = operation.nnn;
+	return 0;
+}
+
+int BlockCache::JumpOffset(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_pc = (operation.nnn + chip.m_registers[operation.x]) & 0x0FFF;
+	return 0;
+}
+
+int BlockCache::Call(Chip8& chip, const BlockOperation& operation)
+{
+	int returnValue = chip.PushReturnAddress(operation.next);
+	chip.m_pc = operation.nnn;
+	if (returnValue & 0x1)
+	{
+		chip.m_pc = operation.next;
+		chip.m_registers[0] = 13;
+	}
+	return returnValue;
+}
+
+int BlockCache::SkipEqualConst(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_pc = operation.next + ((chip.m_registers[operation.x] == operation.nn) ? 2 : 0);
+	return 0;
+}
+
+int BlockCache::SkipNotEqualConst(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_pc = operation.next + ((chip.m_registers[operation.x] != operation.nn) ? 2 : 0);
+	return 0;
+}
+
+int BlockCache::SkipEqualRegister(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_pc = operation.next + ((chip.m_registers[operation.x] == chip.m_registers[operation.y]) ? 2 : 0);
+	return 0;
+}
+
+int BlockCache::SkipNotEqualRegister(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_pc = operation.next + ((chip.m_registers[operation.x] != chip.m_registers[operation.y]) ? 2 : 0);
+	return 0;
+}
+
+int BlockCache::SkipKey(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_pc = operation.next;
+	if (chip.TestKey(chip.m_registers[operation.x]))
+		chip.m_pc += 2;
+	return 0;
+}
+
+int BlockCache::SkipNotKey(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_pc = operation.next;
+	if (!chip.TestKey(chip.m_registers[operation.x]))
+		chip.m_pc += 2;
+	return 0;
+}
+
+int BlockCache::LoadConst(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_registers[operation.x] = operation.nn;
+	return 0;
+}
+
+int BlockCache::AddConst(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_registers[operation.x] += operation.nn;
+	return 0;
+}
+
+int BlockCache::LoadRegister(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_registers[operation.x] = chip.m_registers[operation.y];
+	return 0;
+}
+
+template <bool ResetVF>
+int BlockCache::Or(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_registers[operation.x] |= chip.m_registers[operation.y];
+	if (ResetVF)
+		chip.m_registers[15] = 0;
+	return 0;
+}
+
+template <bool ResetVF>
+int BlockCache::And(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_registers[operation.x] &= chip.m_registers[operation.y];
+	if (ResetVF)
+		chip.m_registers[15] = 0;
+	return 0;
+}
+
+template <bool ResetVF>
+int BlockCache::Xor(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_registers[operation.x] ^= chip.m_registers[operation.y];
+	if (ResetVF)
+		chip.m_registers[15] = 0;
+	return 0;
+}
+
+int BlockCache::AddRegister(Chip8& chip, const BlockOperation& operation)
+{
+	unsigned short value = (unsigned short)chip.m_registers[operation.x] + chip.m_registers[operation.y];
+	chip.m_registers[15] = (value > 0xFF) ? 1 : 0;
+	chip.m_registers[operation.x] = (unsigned char)value;
+	return 0;
+}
+
+int BlockCache::Subtract(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_registers[15] = (chip.m_registers[operation.y] > chip.m_registers[operation.x]) ? 0 : 1;
+	chip.m_registers[operation.x] -= chip.m_registers[operation.y];
+	return 0;
+}
+
+template <bool InPlace>
+int BlockCache::ShiftRight(Chip8& chip, const BlockOperation& operation)
+{
+	if (InPlace)
+	{
+		chip.m_registers[15] = chip.m_registers[operation.x] & 0x01;
+		chip.m_registers[operation.x] >>= 1;
+		return 0;
+	}
+	chip.m_registers[15] = chip.m_registers[operation.y] & 0x01;
+	chip.m_registers[operation.y] >>= 1;
+	chip.m_registers[operation.x] = chip.m_registers[operation.y];
+	return 0;
+}
+
+int BlockCache::SubtractReverse(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_registers[15] = (chip.m_registers[operation.x] > chip.m_registers[operation.y]) ? 0 : 1;
+	chip.m_registers[operation.x] = chip.m_registers[operation.y] - chip.m_registers[operation.x];
+	return 0;
+}
+
+template <bool InPlace>
+int BlockCache::ShiftLeft(Chip8& chip, const BlockOperation& operation)
+{
+	if (InPlace)
+	{
+		chip.m_registers[15] = (chip.m_registers[operation.x] & 0x80) >> 7;
+		chip.m_registers[operation.x] <<= 1;
+		return 0;
+	}
+	chip.m_registers[15] = (chip.m_registers[operation.y] & 0x80) >> 7;
+	chip.m_registers[operation.y] <<= 1;
+	chip.m_registers[operation.x] = chip.m_registers[operation.y];
+	return 0;
+}
+
+int BlockCache::LoadAddress(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_addressRegister = operation.nnn;
+	return 0;
+}
+
+int BlockCache::Random(Chip8& chip, const BlockOperation& operation)
+{
+	chip.ProcessRandom(operation.x, operation.nn);
+	return 0;
+}
+
+int BlockCache::Draw(Chip8& chip, const BlockOperation& operation)
+{
+	chip.ProcessDisplay(operation.x, operation.y, operation.n);
+	return 0x2;
+}
+
+int BlockCache::DrawLarge(Chip8& chip, const BlockOperation& operation)
+{
+	chip.ProcessLargeSprite(operation.x, operation.y);
+	return 0x2;
+}
+
+int BlockCache::LoadDelay(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_registers[operation.x] = chip.m_delayTimer;
+	return 0;
+}
+
+int BlockCache::SetDelay(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_delayTimer = chip.m_registers[operation.x];
+	return 0;
+}
+
+int BlockCache::SetSound(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_sleepTimer = chip.m_registers[operation.x];
+	return 0;
+}
+
+int BlockCache::AddAddress(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_addressRegister = (chip.m_addressRegister + chip.m_registers[operation.x]) & 0x0FFF;
+	return 0;
+}
+
+int BlockCache::LoadFont(Chip8& chip, const BlockOperation& operation)
+{
+	chip.ProcessFontOperation(operation.x);
+	return 0;
+}
+
+int BlockCache::StoreBCD(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_pc = operation.next;
+	chip.ProcessBCDOperation(operation.x);
+	return 0;
+}
+
+template <bool KeepI>
+int BlockCache::StoreRegisters(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_pc = operation.next;
+	int returnValue = chip.ProcessFillFromRegisters(operation.x);
+	if (returnValue & 0x1)
+		chip.m_registers[0] = 13;
+	else if (!KeepI)
+		chip.m_addressRegister += operation.x + 1;
+	return returnValue;
+}
+
+template <bool KeepI>
+int BlockCache::LoadRegisters(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_pc = operation.next;
+	int returnValue = chip.ProcessFillRegisters(operation.x);
+	if (returnValue & 0x1)
+		chip.m_registers[0] = 13;
+	else if (!KeepI)
+		chip.m_addressRegister += operation.x + 1;
+	return returnValue;
+}
+
+int BlockCache::LoadAddressDraw(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_addressRegister = operation.nnn;
+	chip.ProcessDisplay(operation.x, operation.y, operation.n);
+	return 0x2;
+}
+
+int BlockCache::AddConstSkipEqual(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_registers[operation.x] += operation.nn;
+	chip.m_pc = operation.next + ((chip.m_registers[operation.x2] == operation.nn2) ? 2 : 0);
+	return 0;
+}
+
+int BlockCache::AddConstSkipNotEqual(Chip8& chip, const BlockOperation& operation)
+{
+	chip.m_registers[operation.x] += operation.nn;
+	chip.m_pc = operation.next + ((chip.m_registers[operation.x2] != operation.nn2) ? 2 : 0);
+	return 0;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "Chip8.h"
+
+struct BlockOperation;
+typedef int (*BlockHandler)(Chip8& chip, const BlockOperation& operation);
+
+// One pre-resolved step of a block. A fused superinstruction covers two CHIP-8 instructions
+struct BlockOperation
+{
+	BlockHandler handler;
+	unsigned short pc;           // Address of the first instruction covered by this operation
+	unsigned short next;         // Address of the instruction after it
+	unsigned short nnn;
+	unsigned char x;
+	unsigned char y;
+	unsigned char n;
+	unsigned char nn;
+	unsigned char x2;            // Operands of the second half of a fused pair
+	unsigned char nn2;
+	unsigned char instructions;  // CHIP-8 instructions covered
+	bool terminator;             // Sets the PC and ends the block
+};
+
+struct Block
+{
+	unsigned short start;
+	unsigned short end;          // One past the last byte decoded into the block
+	unsigned int instructionCount;
+	std::vector<BlockOperation> operations;
+};
+
+class BlockCache
+{
+public:
+	BlockCache();
+	~BlockCache();
+
+	int Run(Chip8& chip, unsigned int maxInstructions, unsigned int& executed);
+	void Invalidate(unsigned short address, unsigned short length);
+	void InvalidateAll();
+
+private:
+	static constexpr int MAX_BLOCK_OPERATIONS = 64;
+	static constexpr int PAGE_SHIFT = 8;
+	static constexpr int NUMBER_OF_PAGES = CHIP_8_MEMORY_SIZE >> PAGE_SHIFT;
+
+	// Blocks are looked up directly by their start address
+	std::unique_ptr<Block> m_blocks[CHIP_8_MEMORY_SIZE];
+	// Start addresses of the blocks that cover each 256 byte page, so a write only has to look at nearby blocks
+	std::vector<unsigned short> m_blocksByPage[NUMBER_OF_PAGES];
+	// Invalidated blocks are kept alive until Run returns in case one of them is still executing
+	std::vector<std::unique_ptr<Block>> m_retired;
+
+	Block* Build(Chip8& chip, unsigned short start);
+	bool Decode(Chip8& chip, unsigned short pc, BlockOperation& operation);
+	void Remove(unsigned short start);
+
+	static int Interpret(Chip8& chip, const BlockOperation& operation);
+	static int FallThrough(Chip8& chip, const BlockOperation& operation);
+	static int ClearScreen(Chip8& chip, const BlockOperation& operation);
+	static int Return(Chip8& chip, const BlockOperation& operation);
+	static int Jump(Chip8& chip, const BlockOperation& operation);
+	static int JumpOffset(Chip8& chip, const BlockOperation& operation);
+	static int Call(Chip8& chip, const BlockOperation& operation);
+	static int SkipEqualConst(Chip8& chip, const BlockOperation& operation);
+	static int SkipNotEqualConst(Chip8& chip, const BlockOperation& operation);
+	static int SkipEqualRegister(Chip8& chip, const BlockOperation& operation);
+	static int SkipNotEqualRegister(Chip8& chip, const BlockOperation& operation);
+	static int SkipKey(Chip8& chip, const BlockOperation& operation);
+	static int SkipNotKey(Chip8& chip, const BlockOperation& operation);
+	static int LoadConst(Chip8& chip, const BlockOperation& operation);
+	static int AddConst(Chip8& chip, const BlockOperation& operation);
+	static int LoadRegister(Chip8& chip, const BlockOperation& operation);
+	template <bool ResetVF> static int Or(Chip8& chip, const BlockOperation& operation);
+	template <bool ResetVF> static int And(Chip8& chip, const BlockOperation& operation);
+	template <bool ResetVF> static int Xor(Chip8& chip, const BlockOperation& operation);
+	static int AddRegister(Chip8& chip, const BlockOperation& operation);
+	static int Subtract(Chip8& chip, const BlockOperation& operation);
+	template <bool InPlace> static int ShiftRight(Chip8& chip, const BlockOperation& operation);
+	static int SubtractReverse(Chip8& chip, const BlockOperation& operation);
+	template <bool InPlace> static int ShiftLeft(Chip8& chip, const BlockOperation& operation);
+	static int LoadAddress(Chip8& chip, const BlockOperation& operation);
+	static int Random(Chip8& chip, const BlockOperation& operation);
+	static int Draw(Chip8& chip, const BlockOperation& operation);
+	static int DrawLarge(Chip8& chip, const BlockOperation& operation);
+	static int LoadDelay(Chip8& chip, const BlockOperation& operation);
+	static int SetDelay(Chip8& chip, const BlockOperation& operation);
+	static int SetSound(Chip8& chip, const BlockOperation& operation);
+	static int AddAddress(Chip8& chip, const BlockOperation& operation);
+	static int LoadFont(Chip8& chip, const BlockOperation& operation);
+	static int StoreBCD(Chip8& chip, const BlockOperation& operation);
+	template <bool KeepI> static int StoreRegisters(Chip8& chip, const BlockOperation& operation);
+	template <bool KeepI> static int LoadRegisters(Chip8& chip, const BlockOperation& operation);
+	// Superinstructions
+	static int LoadAddressDraw(Chip8& chip, const BlockOperation& operation);
+	static int AddConstSkipEqual(Chip8& chip, const BlockOperation& operation);
+	static int AddConstSkipNotEqual(Chip8& chip, const BlockOperation& operation);
+};
@@ -1,60 +1,101 @@
-#include "stdafx.h"
 #include "Chip8.h"
+#include "BlockCache.h"
+#include "JitX64.h"
+#include "ControlFlow.h"
+#include "NativeModule.h"
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
-#include <ctime>
+#include <cstring>
+#include <random>
+#include <type_traits>
 
-Chip8 *Chip8::m_instance = 0;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define CHIP8_DRAW_SSE2 1
+#include <emmintrin.h>
+#else
+#define CHIP8_DRAW_SSE2 0
+#endif
+
+static_assert(std::is_trivially_copyable<Chip8State>::value, "Chip8State must stay a plain blob");
+
+// Sprite bytes have their leftmost pixel in the top bit, display rows in the bottom bit
+const Chip8::ReversedBits Chip8::m_reversedBits;
+const Chip8::KeyMap Chip8::m_keyMap;
+
+// The fonts are 4 bits wide so they are stored in the upper nibble of a byte
+const unsigned char Chip8::m_fonts[NUMBER_OF_FONTS * FONT_HEIGHT] = {
+	0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+	0x20, 0x60, 0x20, 0x20, 0x70, // 1
+	0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+	0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+	0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+	0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+	0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+	0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+	0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+	0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+	0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+	0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+	0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+	0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+	0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+	0xF0, 0x80, 0xF0, 0x80, 0x80, // F
+};
+
+// The SUPER-CHIP 8x10 fonts for FX30. SUPER-CHIP itself only had 0 to 9
+const unsigned char Chip8::m_largeFonts[NUMBER_OF_FONTS * LARGE_FONT_HEIGHT] = {
+	0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+	0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+	0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+	0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+	0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+	0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+	0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+	0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+	0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+	0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+	0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0, // F
+};
 
 Chip8::Chip8() :
+	m_memorySize(CHIP_8_MEMORY_SIZE),
 	m_programSize(0),
-	m_validKeys({	{'1', 0x1},
-					{'2', 0x2},
-					{'3', 0x3},
-					{'4', 0xC},
-					{'Q', 0x4},
-					{'W', 0x5},
-					{'E', 0x6},
-					{'R', 0xD},
-					{'A', 0x7},
-					{'S', 0x8},
-					{'D', 0x9},
-					{'F', 0xE},
-					{'Z', 0xA},
-					{'X', 0x0},
-					{'C', 0xB},
-					{'V', 0xF } }),
-	m_keyPressed(0xF0), // Only the range 0x0 to 0xF is valid so set to some arbitrary invalid number
-	m_executionState(STATE_INIT)
-
-{
-	m_memory = new unsigned char[CHIP_8_MEMORY_SIZE];
-
-	// The fonts are 4 bits wide so they are stored in the upper nibble of a byte
-	static const uint8_t fonts[NUMBER_OF_FONTS * FONT_HEIGHT] = {
-		0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-		0x20, 0x60, 0x20, 0x20, 0x70, // 1
-		0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-		0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-		0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-		0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-		0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-		0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-		0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-		0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-		0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-		0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-		0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-		0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-		0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-		0xF0, 0x80, 0xF0, 0x80, 0x80, // F
-	};
+	m_keysDown(0),
+	m_keysTapped(0),
+	m_executionState(STATE_INIT),
+	m_previousExecutionState(STATE_INIT),
+	m_registerToStoreKeyPress(0),
+	m_randomState(ZERO_SEED_REPLACEMENT),
+	m_randomSeed(ZERO_SEED_REPLACEMENT),
+	m_engine(ExecutionEngine::INTERPRETER),
+	m_quirkProfile(QuirkProfile::CHIP_8),
+	m_graphicsDisplay(),
+	m_highResolution(false),
+	m_planes(1),
+	m_dirtyRows(~0ULL), // Nothing has been presented yet
+	m_flags()
+
+{
+	m_memory = new unsigned char[m_memorySize + CHIP_8_MEMORY_PADDING]();
+	m_controlFlow.reset(new ControlFlowGraph);
+	MarkAllPagesDirty();
+	SetRandomSeed(std::random_device()());
+	Reset();
+
 
 	// Most modern CHIP-8 use the space reserved for the CHIP-8 interpreter to store the fonts
 	// since it would otherwise be unused
 	for (int x = 0; x < NUMBER_OF_FONTS * FONT_HEIGHT; x++)
 	{
-		m_memory[x] = fonts[x];
+		m_memory[x] = m_fonts[x];
 	}
+	std::memcpy(&m_memory[LARGE_FONT_ADDRESS], m_largeFonts, sizeof(m_largeFonts));
 
 }
 
@@ -64,42 +105,39 @@ Chip8::~Chip8()
 	delete[] m_memory;
 }
 
-Chip8* Chip8::GetInstance()
-{
-	if (NULL == m_instance)
-	{
-		m_instance = new Chip8;
-	}
-	return m_instance;
-}
-
 /*****************************************************************************************************************************************/
 // 
 // LoadProgram - Loads the chip rom into memory
 //
-// Inputs - buffer (wide character buffer holding the contents of the rom
-//          size (integer size of the buffer)
+// Inputs - program (the bytes of the rom, which can come straight from a file or a RomArchive)
+//          size (number of bytes)
 //
-// Outputs - None
+// Outputs - 0 on success, -1 if the rom does not fit between the interpreter area and the reserved space, or past the interpreter
+//           area in XO_CHIP's 64 KB
 //
-// Notes - This is a little bit ugly but I wanted to be able to open files that may make use of the wide character. However, that means
-//         that you can only read in wchar_t data which is sign extends the binary data from the file. This strips off the extra byte
-//         which is 0x00 and restores it to the binary data
+// Notes - The rest of memory above the interpreter area is cleared, so nothing of a previous rom is left behind. Roms can be an odd
+//         size, as some data only roms are; the byte after the last one reads as 0. Set the quirk profile first, it decides how
+//         much memory there is
 /*****************************************************************************************************************************************/
-int Chip8::LoadProgram(wchar_t *buffer, int size)
+int Chip8::LoadProgram(const unsigned char *program, int size)
 {
-	unsigned char *currentMemoryAddr = &(m_memory[INTERPRETER_SIZE]); // The program starts after the memory reserved for the interpreter
-
-	if (0 != size % 2)
-	{
+	int maxSize = (CHIP_8_MEMORY_SIZE == m_memorySize) ? MAX_PROGRAM_SIZE : XO_CHIP_MAX_PROGRAM_SIZE;
+	if ((size < 0) || (size > maxSize) || ((nullptr == program) && (0 != size)))
 		return -1;
-	}
 
-	for (int x = 0; x < size; x++)
-	{
-		*(currentMemoryAddr++) = (unsigned char)*(buffer++);
-	}
+	// The program starts after the memory reserved for the interpreter
+	std::memset(&m_memory[INTERPRETER_SIZE], 0, m_memorySize + CHIP_8_MEMORY_PADDING - INTERPRETER_SIZE);
+	if (0 != size)
+		std::memcpy(&m_memory[INTERPRETER_SIZE], program, size);
 	m_programSize = size;
+	MarkAllPagesDirty();
+	if (nullptr != m_blockCache)
+		m_blockCache->InvalidateAll();
+	if (nullptr != m_jit)
+		m_jit->InvalidateAll();
+	if (nullptr != m_native)
+		m_native->InvalidateAll();
+	AnalyzeProgram();
 
 	return 0;
 }
@@ -107,8 +145,9 @@ int Chip8::LoadProgram(wchar_t *buffer, int size)
 unsigned short Chip8::GetOpcode(unsigned short location)
 {
 	unsigned short returnVal = 0;
-	// Opcodes are 2 bytes, so opcode0 is at offset 0, opcode1 is at offset 2 and opcodeX is at offset X*2
-	if (location < HIGHEST_PC_VALUE )
+	// Opcodes are 2 bytes, so opcode0 is at offset 0, opcode1 is at offset 2 and opcodeX is at offset X*2. XO-CHIP reserves
+	// nothing, and an opcode at the very last address takes its second byte from the padding
+	if (location < ((CHIP_8_MEMORY_SIZE == m_memorySize) ? HIGHEST_PC_VALUE : m_memorySize))
 	{
 		returnVal = m_memory[location] << 8;
 		returnVal |= m_memory[location +1];
@@ -128,17 +167,304 @@ unsigned short Chip8::GetProgramSize()
 
 int Chip8::ExecuteNextInstruction()
 {
-	return DecodeExecute(m_pc, false, m_scratch);
+	unsigned int executed;
+	return Run(1, executed);
+}
+
+/*****************************************************************************************************************************************/
+// 
+// Run - Executes up to maxInstructions with the selected engine
+//
+// Inputs - maxInstructions (upper bound on the number of instructions to execute)
+//          executed (set to the number of instructions actually executed)
+//
+// Outputs - The status bits of every executed instruction ORed together
+//
+// Notes - Stops early after a bad opcode or when an FX0A leaves the machine waiting for a key. The timers are not ticked, that is
+//         done once per frame by RunFrame
+/*****************************************************************************************************************************************/
+int Chip8::Run(unsigned int maxInstructions, unsigned int& executed)
+{
+	// The block cache, the JIT and native modules map CHIP_8_MEMORY_SIZE, so XO-CHIP programs stay on the interpreter whatever is selected
+	if (QuirkProfile::XO_CHIP == m_quirkProfile)
+		return RunAs<QuirkProfile::XO_CHIP>(maxInstructions, executed);
+	if (ExecutionEngine::BLOCK_CACHE == m_engine)
+		return m_blockCache->Run(*this, maxInstructions, executed);
+	if (ExecutionEngine::JIT == m_engine)
+		return m_jit->Run(*this, maxInstructions, executed);
+	if (ExecutionEngine::NATIVE == m_engine)
+		return m_native->Run(*this, maxInstructions, executed);
+
+	switch (m_quirkProfile)
+	{
+		case QuirkProfile::COSMAC_VIP:
+			return RunAs<QuirkProfile::COSMAC_VIP>(maxInstructions, executed);
+		case QuirkProfile::SUPER_CHIP:
+			return RunAs<QuirkProfile::SUPER_CHIP>(maxInstructions, executed);
+		default:
+			return RunAs<QuirkProfile::CHIP_8>(maxInstructions, executed);
+	}
+}
+
+// The profile is chosen once per run, so the loop calls an ExecuteAs with every quirk already decided
+template <QuirkProfile Profile>
+int Chip8::RunAs(unsigned int maxInstructions, unsigned int& executed)
+{
+	int returnValue = 0;
+	executed = 0;
+	while (executed < maxInstructions)
+	{
+		returnValue |= ExecuteAs<Profile>(m_pc);
+		executed++;
+		if ((returnValue & 0x1) || (STATE_PAUSED_FOR_INPUT == m_executionState))
+			break;
+	}
+	return returnValue;
+}
+
+/*****************************************************************************************************************************************/
+// 
+// RunFrame - Runs one 60 Hz frame
+//
+// Inputs - cyclesPerFrame (instructions to execute in the frame)
+//          executed (set to the number of instructions actually executed)
+//
+// Outputs - Status bits for the frame: 0x1 bad opcode, 0x2 display changed, 0x4 sound timer expired, 0x8 sound timer running
+//           (the tone should be playing), 0x10 waiting for a key, 0x20 call stack overflow, 0x40 call stack underflow, 0x80 the
+//           SUPER-CHIP 00FD exit. The stack faults and the exit come with 0x1, so anything that stops on a bad opcode stops on them too
+//
+// Notes - The delay and sound timers tick once at the end of the frame whether or not the instructions ran to the end, so they
+//         count down at 60 Hz even while FX0A is waiting for a key. Nothing is executed while waiting
+/*****************************************************************************************************************************************/
+int Chip8::RunFrame(unsigned int cyclesPerFrame, unsigned int& executed)
+{
+	int returnValue = 0;
+	executed = 0;
+	if (STATE_PAUSED_FOR_INPUT != m_executionState)
+		returnValue = Run(cyclesPerFrame, executed);
+
+	returnValue |= TickTimers();
+	if (0 != m_sleepTimer)
+		returnValue |= 0x8;
+	if (STATE_PAUSED_FOR_INPUT == m_executionState)
+		returnValue |= 0x10;
+	return returnValue;
+}
+
+/*****************************************************************************************************************************************/
+// 
+// SetExecutionEngine - Chooses the engine used by Run and ExecuteNextInstruction
+//
+// Inputs - engine (engine to use from now on)
+//
+// Outputs - 0 on success, -1 if the engine is not available on this host, or for NATIVE if no module is loaded. The current engine
+//           is kept on failure
+//
+// Notes - Engines are created the first time they are selected and then kept up to date with memory writes, so switching back
+//         and forth is cheap
+/*****************************************************************************************************************************************/
+int Chip8::SetExecutionEngine(ExecutionEngine engine)
+{
+	if ((ExecutionEngine::BLOCK_CACHE == engine) && (nullptr == m_blockCache))
+	{
+		m_blockCache.reset(new BlockCache);
+	}
+	else if ((ExecutionEngine::JIT == engine) && (nullptr == m_jit))
+	{
+		m_jit.reset(new JitX64);
+		if (!m_jit->IsAvailable())
+		{
+			m_jit.reset();
+			return -1;
+		}
+	}
+	else if ((ExecutionEngine::NATIVE == engine) && ((nullptr == m_native) || !m_native->IsLoaded()))
+	{
+		return -1;
+	}
+	m_engine = engine;
+	return 0;
+}
+
+ExecutionEngine Chip8::GetExecutionEngine()
+{
+	return m_engine;
+}
+
+/*****************************************************************************************************************************************/
+// 
+// LoadNativeModule - Loads the code compiled ahead of time for the loaded program, which the NATIVE engine runs
+//
+// Inputs - path (shared object built from the source StaticRecompiler generated for this program and quirk profile)
+//
+// Outputs - 0 on success, -1 if the module cannot be loaded or was compiled from another program or under another profile. The
+//           module already loaded, if any, is kept on failure
+//
+// Notes - Loading another program afterwards leaves the module loaded but unused, the NATIVE engine then interprets everything
+/*****************************************************************************************************************************************/
+int Chip8::LoadNativeModule(const char *path)
+{
+	std::unique_ptr<NativeModule> module(new NativeModule);
+	if ((nullptr == path) || (0 != module->Load(path, *this)))
+		return -1;
+	m_native = std::move(module);
+	return 0;
+}
+
+/*****************************************************************************************************************************************/
+// 
+// SetQuirkProfile - Chooses the rules the machine runs by
+//
+// Inputs - profile (rules to use from now on)
+//
+// Outputs - 0 on success, -1 if profile is not one of the QuirkProfile values. The current profile is kept on failure
+//
+// Notes - The interpreter is built once for each profile and the block cache and JIT look the quirks up as they build their code,
+//         so none of them test a quirk while running. Changing the profile throws away the blocks built under the old one.
+//         Switching to or from XO_CHIP resizes memory, keeping what fits; a program that no longer fits is dropped
+/*****************************************************************************************************************************************/
+int Chip8::SetQuirkProfile(QuirkProfile profile)
+{
+	if ((QuirkProfile::CHIP_8 != profile) && (QuirkProfile::COSMAC_VIP != profile) && (QuirkProfile::SUPER_CHIP != profile) &&
+		(QuirkProfile::XO_CHIP != profile))
+		return -1;
+
+	if (profile != m_quirkProfile)
+	{
+		ResizeMemory(GetQuirks(profile).xoChip ? XO_CHIP_MEMORY_SIZE : CHIP_8_MEMORY_SIZE);
+		m_quirkProfile = profile;
+		if (nullptr != m_blockCache)
+			m_blockCache->InvalidateAll();
+		if (nullptr != m_jit)
+			m_jit->InvalidateAll();
+		if (nullptr != m_native)
+			m_native->InvalidateAll();
+		AnalyzeProgram();
+	}
+	return 0;
+}
+
+QuirkProfile Chip8::GetQuirkProfile()
+{
+	return m_quirkProfile;
+}
+
+void Chip8::NoteMemoryWrite(unsigned short address, unsigned short length)
+{
+	// Writes that spill into the padding past the end of memory only dirty the last page
+	unsigned int first = address / CHIP_8_PAGE_SIZE;
+	unsigned int last = (address + length - 1) / CHIP_8_PAGE_SIZE;
+	for (unsigned int page = first; (page <= last) && (page < m_memorySize / CHIP_8_PAGE_SIZE); page++)
+		m_dirtyPages[page / 64] |= 1ULL << (page % 64);
+	InvalidateEngines(address, length);
+}
+
+void Chip8::MarkAllPagesDirty()
+{
+	std::memset(m_dirtyPages, 0xFF, sizeof(m_dirtyPages));
+}
+
+// Keeps the memory both sizes have in common. The 4 KB machine keeps a 4 KB buffer, so XO-CHIP costs it nothing
+void Chip8::ResizeMemory(unsigned int size)
+{
+	if (size == m_memorySize)
+		return;
+
+	unsigned char *memory = new unsigned char[size + CHIP_8_MEMORY_PADDING]();
+	std::memcpy(memory, m_memory, (size < m_memorySize) ? size : m_memorySize);
+	delete[] m_memory;
+	m_memory = memory;
+	m_memorySize = size;
+	if (m_programSize > ((CHIP_8_MEMORY_SIZE == size) ? MAX_PROGRAM_SIZE : XO_CHIP_MAX_PROGRAM_SIZE))
+	{
+		m_programSize = 0;
+		std::memset(&m_memory[INTERPRETER_SIZE], 0, size + CHIP_8_MEMORY_PADDING - INTERPRETER_SIZE);
+	}
+
+	for (int page = 0; page < XO_CHIP_MEMORY_PAGES; page++)
+		m_pageSource[page].reset();
+	MarkAllPagesDirty();
+	if (nullptr != m_blockCache)
+		m_blockCache->InvalidateAll();
+	if (nullptr != m_jit)
+		m_jit->InvalidateAll();
+	if (nullptr != m_native)
+		m_native->InvalidateAll();
+}
+
+// Cheap enough to run on every load, a few tens of microseconds for the largest CHIP-8 program
+void Chip8::AnalyzeProgram()
+{
+	m_controlFlow->Analyze(m_memory, m_memorySize, m_programSize, m_quirkProfile);
+}
+
+ControlFlowGraph& Chip8::GetControlFlow()
+{
+	return *m_controlFlow;
+}
+
+void Chip8::InvalidateEngines(unsigned short address, unsigned short length)
+{
+	if (nullptr != m_blockCache)
+		m_blockCache->Invalidate(address, length);
+	if (nullptr != m_jit)
+		m_jit->Invalidate(address, length);
+	if (nullptr != m_native)
+		m_native->Invalidate(address, length);
 }
 
 int Chip8::DecodeInstructionAt(unsigned short programCounter, std::wostringstream& description)
 {
-	unsigned short temp = programCounter;
-	return DecodeExecute(temp, true, description);
+	Instruction instruction = Disassembler::Decode(programCounter, GetOpcode(programCounter), GetOpcode(programCounter + 2));
+	unsigned char flags = m_controlFlow->GetFlags(programCounter) | m_controlFlow->GetFlags(programCounter + 1);
+	if ((0 == (m_controlFlow->GetFlags(programCounter) & ControlFlowGraph::BYTE_INSTRUCTION)) && (flags & ControlFlowGraph::BYTE_DATA))
+		instruction.mnemonic = Mnemonic::DB;
+	Disassembler::Render(instruction, description);
+	return (Mnemonic::INVALID == instruction.mnemonic) ? 0x1 : 0;
+}
+
+/*****************************************************************************************************************************************/
+// 
+// Execute - Executes the instruction at programCounter under the current quirk profile
+//
+// Inputs - programCounter (address of the instruction, advanced past it or to the jump target)
+//
+// Outputs - The status bits of ExecuteAs
+//
+// Notes - For the block cache and the JIT, which hand the odd instruction back to the interpreter
+/*****************************************************************************************************************************************/
+int Chip8::Execute(unsigned short& programCounter)
+{
+	switch (m_quirkProfile)
+	{
+		case QuirkProfile::COSMAC_VIP:
+			return ExecuteAs<QuirkProfile::COSMAC_VIP>(programCounter);
+		case QuirkProfile::SUPER_CHIP:
+			return ExecuteAs<QuirkProfile::SUPER_CHIP>(programCounter);
+		case QuirkProfile::XO_CHIP:
+			return ExecuteAs<QuirkProfile::XO_CHIP>(programCounter);
+		default:
+			return ExecuteAs<QuirkProfile::CHIP_8>(programCounter);
+	}
 }
 
-int Chip8::DecodeExecute(unsigned short& programCounter, bool decodeOnly, std::wostringstream& description)
+/*****************************************************************************************************************************************/
+// 
+// ExecuteAs - Fetches, decodes and executes the instruction at programCounter
+//
+// Inputs - programCounter (address of the instruction, advanced past it or to the jump target)
+//
+// Outputs - Status bits: 0x1 bad opcode, 0x2 display changed, 0x4 sound timer expired, 0x20 or 0x40 with 0x1 for a CALL past
+//           CHIP_8_STACK_DEPTH or a RET with nothing to return to, 0x81 for 00FD under SUPER_CHIP and XO_CHIP
+//
+// Notes - This is the hot path so it does no formatting at all. Anything that wants to show the instruction as text goes through the
+//         Disassembler instead. Profile is a template argument and every quirk is a compile time constant, so each profile gets
+//         its own copy of the interpreter with only its own rules compiled in
+/*****************************************************************************************************************************************/
+template <QuirkProfile Profile>
+int Chip8::ExecuteAs(unsigned short& programCounter)
 {
+	constexpr Chip8Quirks quirks = GetQuirks(Profile);
 	int returnValue = 0;
 	unsigned short opcode = GetOpcode(programCounter);
 	unsigned char  operationType = (opcode & 0xF000) >> 12;
@@ -149,61 +475,77 @@ int Chip8::DecodeExecute(unsigned short& programCounter, bool decodeOnly, std::w
 	unsigned char constValue = (opcode & 0x00FF);
 	unsigned short address = (opcode & 0x0FFF);
 	bool flowControl = false; // This opcode is a flow control operation either calling or returning from the PC
+	// I wraps at the top of the address space, 4 KB or XO-CHIP's 64 KB
+	constexpr unsigned short addressMask = quirks.xoChip ? 0xFFFF : 0x0FFF;
+	// A skip passes over the next instruction. Under XO-CHIP that can be the four bytes of an F000 NNNN
+	auto skipNext = [&]() { programCounter += (quirks.xoChip && (0xF000 == GetOpcode(programCounter + 2))) ? 4 : 2; };
 
-	if (0 != m_delayTimer)
-		m_delayTimer--;
-	if (0 != m_sleepTimer)
-		if (0 == --m_sleepTimer) returnValue |= 0x4;
-
-	description << "0x" << std::uppercase << std::setfill(L'0') << std::setw(4) << std::hex <<  programCounter
-		        <<  ": 0x" << std::uppercase << std::setfill(L'0') << std::setw(4) << std::hex << opcode << "     ";
 	switch (operationType)
 	{
 		case 0x00:
 			// I'm ignore the case of 0NNN which doesn't seem to be valid for modern interpreters
-			if ((0x0 != firstRegister) || (0xE != secondRegister))
+			if (0x00E0 == opcode)
 			{
-				returnValue = 0x1;
+				ClearDisplay();
+			}
+			else if (0x00EE == opcode)
+			{
+				returnValue |= PopReturnAddress(programCounter);
+				flowControl = (0 == returnValue);
+			}
+			else if (quirks.superChip && (0x00C0 == (opcode & 0xFFF0)))
+			{
+				ScrollDown(opSubType);
+				returnValue |= 0x2;
+			}
+			else if (quirks.xoChip && (0x00D0 == (opcode & 0xFFF0)))
+			{
+				ScrollUp(opSubType);
+				returnValue |= 0x2;
+			}
+			else if (quirks.superChip && (0x00FB == opcode))
+			{
+				ScrollRight();
+				returnValue |= 0x2;
+			}
+			else if (quirks.superChip && (0x00FC == opcode))
+			{
+				ScrollLeft();
+				returnValue |= 0x2;
+			}
+			else if (quirks.superChip && (0x00FD == opcode))
+			{
+				// Exit the interpreter. The PC stays on the 00FD so the machine cannot be run on past it
+				returnValue |= 0x81;
+				flowControl = true;
+			}
+			else if (quirks.superChip && ((0x00FE == opcode) || (0x00FF == opcode)))
+			{
+				SetHighResolution(0x00FF == opcode);
+				returnValue |= 0x2;
 			}
 			else
 			{
-				if (0 == opSubType)
-				{
-					description << "CLS";
-					if (decodeOnly) break;
-					ClearDisplay();
-				}
-				else if (0xE == opSubType)
-				{
-					description << "RET";
-					if (decodeOnly) break;
-					programCounter = m_stack.top();
-					m_stack.pop();
-					flowControl = true;
-				}
-				else
-				{
-					returnValue |= 0x1;
-				}
+				returnValue |= 0x1;
 			}
 			break;
 		case 0x1:
-			description << "JP   0x" << std::uppercase << std::setfill(L'0') << std::setw(4) << std::hex << address;
-			if (decodeOnly) break;
-			if ((address > START_CHIP_8_PROGRAM) && (address < (START_CHIP_8_PROGRAM + m_programSize)))
+			if (quirks.jumpAnywhere || ((address > START_CHIP_8_PROGRAM) && (address < (START_CHIP_8_PROGRAM + m_programSize))))
 			{
 				programCounter = address;
 				flowControl = true;
 			}
 			break;
 		case 0x02:
-			description << "CALL 0x" << std::uppercase << std::setfill(L'0') << std::setw(4) << std::hex << address;
-			if (decodeOnly) break;
-			if ((address > START_CHIP_8_PROGRAM) && (address < (START_CHIP_8_PROGRAM + m_programSize)))
+			if (quirks.jumpAnywhere || ((address > START_CHIP_8_PROGRAM) && (address < (START_CHIP_8_PROGRAM + m_programSize))))
 			{
-				m_stack.push(programCounter+2); // Move to the next instruction passed the subroutine call
-				programCounter = address;
-				flowControl = true;
+				// Return to the next instruction passed the subroutine call
+				returnValue |= PushReturnAddress(programCounter + 2);
+				if (0 == returnValue)
+				{
+					programCounter = address;
+					flowControl = true;
+				}
 			}
 			else
 			{
@@ -211,83 +553,80 @@ int Chip8::DecodeExecute(unsigned short& programCounter, bool decodeOnly, std::w
 			}
 			break;
 		case 0x03:
-			description << "SE   V" << std::uppercase << std::setw(1) << std::hex << firstRegister << ", " << std::setfill(L'0') << std::setw(4) << std::hex << constValue;
-			if (decodeOnly) break;
 			if (m_registers[firstRegister] == constValue)
 			{
-				programCounter += 2; // We'll add 2 more at the end of the case skipping the next instruction
+				skipNext(); // We'll add 2 more at the end of the case skipping the next instruction
 			}
 			break;
 		case 0x04:
-			description << "SNE  V" << std::uppercase << std::setw(1) << std::hex << firstRegister << ", " << std::setfill(L'0') << std::setw(4) << std::hex << constValue;
-			if (decodeOnly) break;
 			if (m_registers[firstRegister] != constValue)
 			{
-				programCounter += 2; // We'll add 2 more at the end of the case skipping the next instruction
+				skipNext(); // We'll add 2 more at the end of the case skipping the next instruction
 			}
 			break;
 		case 0x05:
+			if (quirks.xoChip && ((0x2 == opSubType) || (0x3 == opSubType)))
+			{
+				returnValue |= ProcessRegisterRange(firstRegister, secondRegister, 0x2 == opSubType);
+				break;
+			}
 			if (opSubType != 0)
 			{
 				returnValue |= 0x1;
 				break;
 			}
-			description << "SE   V" << std::uppercase << std::setw(1) << std::hex << firstRegister << ", V" << std::setw(1) << std::hex << secondRegister << constValue;
-			if (decodeOnly) break;
 			if (m_registers[firstRegister] == m_registers[secondRegister])
 			{
-				programCounter += 2;
+				skipNext();
 			}
+			break;
 		case 0x06:
-			description << "SE   V" << std::uppercase << std::setw(1) << std::hex << firstRegister << ", 0x" << std::setfill(L'0') << std::setw(2) << std::hex << constValue;
-			if (decodeOnly) break;
 			ProcessRegisterSet(firstRegister, constValue);
 			break;
 		case 0x07:
-			description << "ADD  V" << std::uppercase << std::setw(1) << std::hex << firstRegister << ", 0x" << std::setfill(L'0') << std::setw(2) << std::hex << constValue;
-			if (decodeOnly) break;
 			ProcessRegisterAddition(firstRegister, constValue);
 			break;
 		case 0x08:
-			returnValue |= ProcessBitRegisterOperation(firstRegister, secondRegister, opSubType, description, decodeOnly);
+			returnValue |= ProcessBitRegisterOperation<Profile>(firstRegister, secondRegister, opSubType);
+			break;
+		case 0x09:
+			if (opSubType != 0)
+			{
+				returnValue |= 0x1;
+				break;
+			}
+			if (m_registers[firstRegister] != m_registers[secondRegister])
+			{
+				skipNext();
+			}
 			break;
 		case 0x0A:
-			description << "LD   I,0x" << std::uppercase << std::setfill(L'0') << std::setw(3) << std::hex << address;
-			if (decodeOnly) break;
 			ProcessAddressRegisterSet(address);
 			break;
+		case 0x0B:
+			programCounter = (address + m_registers[quirks.jumpPlusVX ? firstRegister : 0]) & addressMask;
+			flowControl = true;
+			break;
 		case 0x0C:
-			description << "RND  V" << std::uppercase << std::setw(1) << std::hex << firstRegister << ", " << std::setfill(L'0') << std::setw(2) << std::hex << constValue;
-			if (decodeOnly) break;
 			ProcessRandom(firstRegister, constValue);
 			break;
 		case 0x0D:
-			description << "DRW  V" << std::uppercase << std::setw(1) << std::hex << firstRegister << ", V" << std::uppercase << std::setw(1) << std::hex << secondRegister
-				        << ", 0x" << std::setfill(L'0') << std::setw(2) << std::hex << opSubType;
-			if (decodeOnly) break;
-			ProcessDisplay(firstRegister, secondRegister, opSubType);
+			if (quirks.superChip && (0 == opSubType))
+				ProcessLargeSprite(firstRegister, secondRegister);
+			else
+				ProcessDisplay(firstRegister, secondRegister, opSubType);
 			returnValue |= 0x2;
 			break;
 		case 0x0E:
 			if (0x9E == constValue)
 			{
-				description << "SKP  V" << std::uppercase << std::setw(1) << std::hex << firstRegister;
-				if (decodeOnly) break;
-				if (m_keyPressed == m_registers[firstRegister])
-				{
-					programCounter += 2;
-					m_keyPressed = 0xF0;
-				}
+				if (TestKey(m_registers[firstRegister]))
+					skipNext();
 			}
 			else if (0xA1 == constValue)
 			{
-				description << "SKNP V" << std::uppercase << std::setw(1) << std::hex << firstRegister;
-				if (decodeOnly) break;
-				if (m_keyPressed != m_registers[firstRegister])
-				{
-					programCounter += 2;
-					m_keyPressed = 0xF0;
-				}
+				if (!TestKey(m_registers[firstRegister]))
+					skipNext();
 			}
 			else
 			{
@@ -295,7 +634,16 @@ int Chip8::DecodeExecute(unsigned short& programCounter, bool decodeOnly, std::w
 			}
 			break;
 		case 0x0F:
-			returnValue = ProcessMemoryOperation(firstRegister, constValue, description, decodeOnly);
+			if (quirks.xoChip && (0xF000 == opcode))
+			{
+				// I = NNNN, the word after the opcode
+				m_addressRegister = GetOpcode(programCounter + 2);
+				programCounter += 2;
+			}
+			else
+			{
+				returnValue |= ProcessMemoryOperation<Profile>(firstRegister, constValue);
+			}
 			break;
 		default:
 			// handle invalid operations later
@@ -304,7 +652,7 @@ int Chip8::DecodeExecute(unsigned short& programCounter, bool decodeOnly, std::w
 	}
 	
 	if (!flowControl) programCounter += 2;
-	if (returnValue & 0x1)
+	if (0x1 == (returnValue & 0x81)) // A fault, not an exit
 		m_registers[0] = 13;
 	return returnValue;
 }
@@ -319,35 +667,33 @@ void Chip8::ProcessRegisterAddition(unsigned char registerNum, unsigned char val
 	m_registers[registerNum] = m_registers[registerNum] + value;
 }
 
-int Chip8::ProcessBitRegisterOperation(unsigned char firstRegister, unsigned char secondRegister, unsigned char opSubType, std::wostringstream& description, bool decodeOnly)
+template <QuirkProfile Profile>
+int Chip8::ProcessBitRegisterOperation(unsigned char firstRegister, unsigned char secondRegister, unsigned char opSubType)
 {
+	constexpr Chip8Quirks quirks = GetQuirks(Profile);
 	int returnValue = 0;
 	switch(opSubType)
 	{
 		case 0x00:
-			description << "LD   ";
-			if (decodeOnly) break;
 			m_registers[firstRegister] = m_registers[secondRegister];
 			break;
 		case 0x01:
-			description << "OR   ";
-			if (decodeOnly) break;
 			m_registers[firstRegister] |= m_registers[secondRegister];
+			if constexpr (quirks.logicResetsVF)
+				m_registers[15] = 0;
 			break;
 		case 0x02:
-			description << "AND  ";
-			if (decodeOnly) break;
 			m_registers[firstRegister] &= m_registers[secondRegister];
+			if constexpr (quirks.logicResetsVF)
+				m_registers[15] = 0;
 			break;
 		case 0x03:
-			description << "XOR  ";
-			if (decodeOnly) break;
 			m_registers[firstRegister] ^= m_registers[secondRegister];
+			if constexpr (quirks.logicResetsVF)
+				m_registers[15] = 0;
 			break;
 		case 0x04:
 		{
-			description << "ADD  ";
-			if (decodeOnly) break;
 			unsigned short value = (unsigned short)m_registers[firstRegister] + m_registers[secondRegister];
 			if (value > 0xFF)
 				m_registers[15] = 1;
@@ -357,8 +703,6 @@ int Chip8::ProcessBitRegisterOperation(unsigned char firstRegister, unsigned cha
 		}
 			break;
 		case 0x05:
-			description << "SUB  ";
-			if (decodeOnly) break;
 			if (m_registers[secondRegister] > m_registers[firstRegister])
 				m_registers[15] = 0;
 			else
@@ -366,15 +710,19 @@ int Chip8::ProcessBitRegisterOperation(unsigned char firstRegister, unsigned cha
 			m_registers[firstRegister] -= m_registers[secondRegister];
 			break;
 		case 0x06:
-			description << "SHR  ";
-			if (decodeOnly) break;
-			m_registers[15] = m_registers[secondRegister] & 0x01;
-			m_registers[secondRegister] >>= 1;
-			m_registers[firstRegister] = m_registers[secondRegister];
+			if constexpr (quirks.shiftInPlace)
+			{
+				m_registers[15] = m_registers[firstRegister] & 0x01;
+				m_registers[firstRegister] >>= 1;
+			}
+			else
+			{
+				m_registers[15] = m_registers[secondRegister] & 0x01;
+				m_registers[secondRegister] >>= 1;
+				m_registers[firstRegister] = m_registers[secondRegister];
+			}
 			break;
 		case 0x07:
-			description << "SUBN ";
-			if (decodeOnly) break;
 			if (m_registers[firstRegister] > m_registers[secondRegister])
 				m_registers[15] = 0;
 			else
@@ -382,17 +730,22 @@ int Chip8::ProcessBitRegisterOperation(unsigned char firstRegister, unsigned cha
 			m_registers[firstRegister] = m_registers[secondRegister] - m_registers[firstRegister];
 			break;
 		case 0x0E:
-			description << "SHL  ";
-			if (decodeOnly) break;
-			m_registers[15] = m_registers[secondRegister] & 0x80 >> 15;
-			m_registers[secondRegister] <<= 1;
-			m_registers[firstRegister] = m_registers[secondRegister];
+			if constexpr (quirks.shiftInPlace)
+			{
+				m_registers[15] = (m_registers[firstRegister] & 0x80) >> 7;
+				m_registers[firstRegister] <<= 1;
+			}
+			else
+			{
+				m_registers[15] = (m_registers[secondRegister] & 0x80) >> 7;
+				m_registers[secondRegister] <<= 1;
+				m_registers[firstRegister] = m_registers[secondRegister];
+			}
 			break;
 		default:
 			returnValue = 0x01;
 			break;
 	}
-	description << "V" << std::uppercase << std::setw(1) << std::hex << firstRegister << ", V" << std::uppercase << std::setw(1) << std::hex << secondRegister;
 	return returnValue;
 }
 
@@ -404,104 +757,483 @@ void Chip8::ProcessAddressRegisterSet(unsigned short address)
 
 void Chip8::ProcessRandom(unsigned char firstRegister, unsigned char constValue)
 {
-	std::srand((unsigned int)std::time(nullptr)); // use current time as seed for random generator
-	unsigned char random_variable = std::rand() % 255;
-	m_registers[firstRegister] = random_variable & constValue;
+	// The state lives in the machine rather than the C library so snapshots replay the same numbers and machines on different
+	// threads never share it. The top byte is the best mixed
+	m_registers[firstRegister] = (unsigned char)(NextRandom(m_randomState) >> 24) & constValue;
 }
 
+// Only XO-CHIP ever selects anything but the first plane, so everything else keeps drawing with DrawWideSprite
 void Chip8::ProcessDisplay(unsigned char firstRegister, unsigned char secondRegister, unsigned char height)
 {
-	unsigned char xCoor = m_registers[firstRegister];
-	unsigned char yCoor = m_registers[secondRegister];
-	bool collision = false;
+	bool collision = (1 == m_planes) ?
+		DrawWideSprite(m_graphicsDisplay[0], m_highResolution, &m_memory[m_addressRegister], false, m_registers[firstRegister], m_registers[secondRegister], height, m_dirtyRows) :
+		DrawPlanes(&m_memory[m_addressRegister], false, m_registers[firstRegister], m_registers[secondRegister], height);
+	m_registers[15] = (collision ? 1 : 0);
+}
+
+// DXY0 under SUPER-CHIP: 16 rows of two bytes each, in either resolution
+void Chip8::ProcessLargeSprite(unsigned char firstRegister, unsigned char secondRegister)
+{
+	bool collision = (1 == m_planes) ?
+		DrawWideSprite(m_graphicsDisplay[0], m_highResolution, &m_memory[m_addressRegister], true, m_registers[firstRegister], m_registers[secondRegister], 16, m_dirtyRows) :
+		DrawPlanes(&m_memory[m_addressRegister], true, m_registers[firstRegister], m_registers[secondRegister], 16);
+	m_registers[15] = (collision ? 1 : 0);
+}
+
+/*****************************************************************************************************************************************/
+// 
+// DrawSprite - XORs a sprite into a display
+//
+// Inputs - display (DISPLAY_HEIGHT rows of 64 pixels)
+//          sprite (one byte per row, most significant bit leftmost)
+//          xCoor, yCoor (where the top left of the sprite goes, wrapped onto the display)
+//          height (number of rows)
+//          dirtyRows (the bits of rows the sprite changed are set, others are left alone)
+//
+// Outputs - true if a lit pixel was turned off
+//
+// Notes - Static so machines that do not live in a Chip8 object, like the lanes of a LockstepBatch, draw exactly the same way
+//         DrawWideSprite does in low resolution. Pixel 0 of a row is its lowest bit, so each sprite byte is bit reversed and
+//         shifted into place as a whole row, and a collision is any overlap between the row and the old display. Pixels past the
+//         right edge are clipped, rows past the bottom wrap to the top. When the sprite does not wrap its rows are XORed two at a
+//         time with SSE2
+/*****************************************************************************************************************************************/
+bool Chip8::DrawSprite(unsigned long long *display, const unsigned char *sprite, unsigned char xCoor, unsigned char yCoor, unsigned char height, unsigned int& dirtyRows)
+{
+	unsigned int x = xCoor % DISPLAY_WIDTH;
+	unsigned int y = yCoor % DISPLAY_HEIGHT;
+	unsigned int rows = (height < MAX_SPRITE_HEIGHT) ? height : MAX_SPRITE_HEIGHT;
+	unsigned long long overlap = 0;
 
-	if (1 == height)
+	alignas(16) unsigned long long pixels[MAX_SPRITE_HEIGHT + 1];
+	unsigned int changedRows = 0;
+	for (unsigned int row = 0; row < rows; row++)
 	{
-		int yy = 32;
+		pixels[row] = (unsigned long long)m_reversedBits.bits[sprite[row]] << x;
+		changedRows |= (0 != pixels[row]) ? (1u << row) : 0;
 	}
-	for (int x = 0; x < height; x++)
+	// Rotate the changed rows into place, wrapping at the bottom of the display
+	dirtyRows |= (unsigned int)((((unsigned long long)changedRows << y) | ((unsigned long long)changedRows << y >> DISPLAY_HEIGHT)) & 0xFFFFFFFF);
+
+	unsigned int row = 0;
+	if (y + rows <= DISPLAY_HEIGHT)
+	{
+#if CHIP8_DRAW_SSE2
+		__m128i hits = _mm_setzero_si128();
+		for (; row + 2 <= rows; row += 2)
+		{
+			__m128i *target = reinterpret_cast<__m128i *>(&display[y + row]);
+			__m128i old = _mm_loadu_si128(target);
+			__m128i draw = _mm_load_si128(reinterpret_cast<const __m128i *>(&pixels[row]));
+			hits = _mm_or_si128(hits, _mm_and_si128(old, draw));
+			_mm_storeu_si128(target, _mm_xor_si128(old, draw));
+		}
+		alignas(16) unsigned long long lanes[2];
+		_mm_store_si128(reinterpret_cast<__m128i *>(lanes), hits);
+		overlap = lanes[0] | lanes[1];
+#endif
+		for (; row < rows; row++)
+		{
+			overlap |= display[y + row] & pixels[row];
+			display[y + row] ^= pixels[row];
+		}
+	}
+	else
 	{
-		unsigned char row = (yCoor + x) % DISPLAY_HEIGHT;
-		unsigned char previousSprite = (m_graphicsDisplay[row] >> xCoor) & 0xFF;
+		for (; row < rows; row++)
+		{
+			unsigned long long& target = display[(y + row) % DISPLAY_HEIGHT];
+			overlap |= target & pixels[row];
+			target ^= pixels[row];
+		}
+	}
+
+	return (0 != overlap);
+}
 
-		// We need to reverse the order of the bits as it appears that a pattern of 0x80 means that the first bit in the sprite should be set
-		unsigned char thisSprite = (unsigned char) (((m_memory[m_addressRegister + x] * 0x0802LU & 0x22110LU) | (m_memory[m_addressRegister + x]
-			                        * 0x8020LU & 0x88440LU)) * 0x10101LU >> 16);
-		m_graphicsDisplay[row] ^= ((unsigned long long) thisSprite << xCoor);
-		unsigned char changeMask = 0x80;
-		unsigned char change = thisSprite ^ previousSprite;
-		if (!collision) // No need to do this if we have already registered a collision
+/*****************************************************************************************************************************************/
+// 
+// DrawWideSprite - XORs a sprite into a display of 128 bit rows
+//
+// Inputs - display (HIRES_HEIGHT rows)
+//          highResolution (draw onto the 128x64 display rather than the top left 64x32 of it)
+//          sprite (one byte per row, or two for a 16 pixel wide sprite, most significant bit leftmost)
+//          sixteenWide (the sprite is 16x16 and height is ignored)
+//          xCoor, yCoor (where the top left of the sprite goes, wrapped onto the display)
+//          height (number of rows of an 8 pixel wide sprite)
+//          dirtyRows (the bits of rows the sprite changed are set, others are left alone)
+//
+// Outputs - true if a lit pixel was turned off
+//
+// Notes - Each sprite row is bit reversed, shifted across the two words of its display row and then XORed in and tested for a
+//         collision as a single 128 bit word with SSE2, so a 16x16 sprite costs no more per row than an 8 pixel one. An 8 pixel
+//         sprite in low resolution only ever touches the low words and skips the shifting across. Clipping and wrapping are the
+//         same as DrawSprite's, at the edges of the current resolution
+/*****************************************************************************************************************************************/
+bool Chip8::DrawWideSprite(Chip8DisplayRow *display, bool highResolution, const unsigned char *sprite, bool sixteenWide, unsigned char xCoor, unsigned char yCoor, unsigned char height, unsigned long long& dirtyRows)
+{
+	unsigned int displayHeight = highResolution ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+	// Both resolutions are powers of two, so the wraps are masks rather than divisions by a size only known at run time
+	unsigned int x = xCoor & ((highResolution ? HIRES_WIDTH : DISPLAY_WIDTH) - 1);
+	unsigned int y = yCoor & (displayHeight - 1);
+	unsigned int rows = sixteenWide ? 16 : ((height < MAX_SPRITE_HEIGHT) ? height : MAX_SPRITE_HEIGHT);
+	unsigned long long highMask = highResolution ? ~0ULL : 0; // Low resolution clips at the end of the low word
+	unsigned long long overlap = 0;
+	unsigned long long changedRows = 0;
+
+	if (!highResolution && !sixteenWide)
+	{
+		// Plain CHIP-8 drawing. The high word is always blank in low resolution, so the low word is the whole row
+		unsigned long long pixels[MAX_SPRITE_HEIGHT];
+		for (unsigned int row = 0; row < rows; row++)
 		{
-			while (0 != changeMask)
-			{
-				if ((0 == (change & changeMask)) && (1 == (previousSprite & changeMask)))
-				{
-					collision = true;
-					break;
-				}
-				changeMask >>= 1;
-			}
+			pixels[row] = (unsigned long long)m_reversedBits.bits[sprite[row]] << x;
+			changedRows |= (unsigned long long)(0 != pixels[row]) << row;
+		}
+		unsigned int unwrapped = (y + rows <= DISPLAY_HEIGHT) ? rows : DISPLAY_HEIGHT - y;
+		for (unsigned int row = 0; row < unwrapped; row++)
+		{
+			overlap |= display[y + row].low & pixels[row];
+			display[y + row].low ^= pixels[row];
+		}
+		for (unsigned int row = unwrapped; row < rows; row++)
+		{
+			overlap |= display[row - unwrapped].low & pixels[row];
+			display[row - unwrapped].low ^= pixels[row];
 		}
+	}
+	else
+	{
+		// A row shifted by x lands in the low word, carrying into the high one, or from x 64 on wholly in the high word. Masks
+		// pick which, so the loop has no branches
+		unsigned int shift = x & 63;
+		unsigned long long lowMask = (x < 64) ? ~0ULL : 0;
+#if CHIP8_DRAW_SSE2
+		__m128i hits = _mm_setzero_si128();
+#endif
+		for (unsigned int row = 0; row < rows; row++)
+		{
+			unsigned long long bits = sixteenWide ?
+				(m_reversedBits.bits[sprite[row * 2]] | ((unsigned long long)m_reversedBits.bits[sprite[row * 2 + 1]] << 8)) :
+				m_reversedBits.bits[sprite[row]];
+			unsigned long long shifted = bits << shift;
+			unsigned long long carried = (bits >> 1) >> (63 - shift);
+			unsigned long long low = shifted & lowMask;
+			unsigned long long high = ((carried & lowMask) | (shifted & ~lowMask)) & highMask;
+			changedRows |= (unsigned long long)(0 != (low | high)) << row;
 
+			// The row is built in registers, going through memory would split the 128 bit load across two 64 bit stores
+#if CHIP8_DRAW_SSE2
+			__m128i *target = reinterpret_cast<__m128i *>(&display[(y + row) & (displayHeight - 1)]);
+			__m128i old = _mm_loadu_si128(target);
+			__m128i draw = _mm_set_epi64x((long long)high, (long long)low);
+			hits = _mm_or_si128(hits, _mm_and_si128(old, draw));
+			_mm_storeu_si128(target, _mm_xor_si128(old, draw));
+#else
+			Chip8DisplayRow& target = display[(y + row) & (displayHeight - 1)];
+			overlap |= (target.low & low) | (target.high & high);
+			target.low ^= low;
+			target.high ^= high;
+#endif
+		}
+#if CHIP8_DRAW_SSE2
+		alignas(16) unsigned long long lanes[2];
+		_mm_store_si128(reinterpret_cast<__m128i *>(lanes), hits);
+		overlap = lanes[0] | lanes[1];
+#endif
 	}
 
-	m_registers[15] = (collision ? 1 : 0);
+	// Rotate the changed rows into place, wrapping at the bottom of the display
+	unsigned long long heightMask = (displayHeight < 64) ? ((1ULL << displayHeight) - 1) : ~0ULL;
+	dirtyRows |= ((changedRows << y) | ((0 == y) ? 0 : (changedRows >> (displayHeight - y)))) & heightMask;
+	return (0 != overlap);
+}
+
+/*****************************************************************************************************************************************/
+// 
+// DrawPlanes - XORs a sprite into every display plane m_planes selects
+//
+// Inputs - sprite (the bytes of the first selected plane, then those of the second)
+//          sixteenWide (the sprite is 16x16 and height is ignored)
+//          xCoor, yCoor (where the top left of the sprite goes, wrapped onto the display)
+//          height (number of rows of an 8 pixel wide sprite)
+//
+// Outputs - true if a lit pixel was turned off on any of the planes
+//
+// Notes - XO-CHIP only. Each selected plane takes the next sprite's worth of bytes, so with both selected a 16x16 sprite is 64
+//         bytes. Both planes are drawn in the same pass over the rows, with the shifting, clipping and wrapping of DrawWideSprite.
+//         With no plane selected nothing is drawn
+/*****************************************************************************************************************************************/
+bool Chip8::DrawPlanes(const unsigned char *sprite, bool sixteenWide, unsigned char xCoor, unsigned char yCoor, unsigned char height)
+{
+	unsigned int displayHeight = m_highResolution ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+	unsigned int x = xCoor & ((m_highResolution ? HIRES_WIDTH : DISPLAY_WIDTH) - 1);
+	unsigned int y = yCoor & (displayHeight - 1);
+	unsigned int rows = sixteenWide ? 16 : ((height < MAX_SPRITE_HEIGHT) ? height : MAX_SPRITE_HEIGHT);
+	unsigned int rowBytes = sixteenWide ? 2 : 1;
+	unsigned long long highMask = m_highResolution ? ~0ULL : 0;
+	unsigned int shift = x & 63;
+	unsigned long long lowMask = (x < 64) ? ~0ULL : 0;
+	unsigned long long overlap = 0;
+	unsigned long long changedRows = 0;
+
+	// Where the bytes of each plane start, or nullptr for a plane that is not drawn on
+	const unsigned char *planeSprite[XO_CHIP_PLANES];
+	for (int plane = 0; plane < XO_CHIP_PLANES; plane++)
+	{
+		planeSprite[plane] = (m_planes & (1 << plane)) ? sprite : nullptr;
+		if (nullptr != planeSprite[plane])
+			sprite += rows * rowBytes;
+	}
+
+	for (unsigned int row = 0; row < rows; row++)
+	{
+		unsigned int target = (y + row) & (displayHeight - 1);
+		for (int plane = 0; plane < XO_CHIP_PLANES; plane++)
+		{
+			if (nullptr == planeSprite[plane])
+				continue;
+			const unsigned char *bytes = &planeSprite[plane][row * rowBytes];
+			unsigned long long bits = sixteenWide ?
+				(m_reversedBits.bits[bytes[0]] | ((unsigned long long)m_reversedBits.bits[bytes[1]] << 8)) :
+				m_reversedBits.bits[bytes[0]];
+			unsigned long long shifted = bits << shift;
+			unsigned long long carried = (bits >> 1) >> (63 - shift);
+			unsigned long long low = shifted & lowMask;
+			unsigned long long high = ((carried & lowMask) | (shifted & ~lowMask)) & highMask;
+			changedRows |= (unsigned long long)(0 != (low | high)) << row;
+
+			Chip8DisplayRow& line = m_graphicsDisplay[plane][target];
+			overlap |= (line.low & low) | (line.high & high);
+			line.low ^= low;
+			line.high ^= high;
+		}
+	}
+
+	unsigned long long heightMask = (displayHeight < 64) ? ((1ULL << displayHeight) - 1) : ~0ULL;
+	m_dirtyRows |= ((changedRows << y) | ((0 == y) ? 0 : (changedRows >> (displayHeight - y)))) & heightMask;
+	return (0 != overlap);
 }
 
-unsigned long long Chip8::GetDisplayRow(unsigned char row)
+// 00CN: the rows move down N and blank rows come in at the top. Like the other scrolls it moves the selected planes
+void Chip8::ScrollDown(unsigned char rows)
 {
-	if (row < 32)
-		return m_graphicsDisplay[row];
+	unsigned int displayHeight = m_highResolution ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+	if (0 == rows)
+		return;
+	for (int plane = 0; plane < XO_CHIP_PLANES; plane++)
+	{
+		if (0 == (m_planes & (1 << plane)))
+			continue;
+		Chip8DisplayRow *display = m_graphicsDisplay[plane];
+		std::memmove(&display[rows], &display[0], (displayHeight - rows) * sizeof(Chip8DisplayRow));
+		std::memset(&display[0], 0, rows * sizeof(Chip8DisplayRow));
+	}
+	m_dirtyRows |= (displayHeight < 64) ? ((1ULL << displayHeight) - 1) : ~0ULL;
+}
+
+// 00DN under XO-CHIP: the rows move up N and blank rows come in at the bottom
+void Chip8::ScrollUp(unsigned char rows)
+{
+	unsigned int displayHeight = m_highResolution ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+	if (0 == rows)
+		return;
+	for (int plane = 0; plane < XO_CHIP_PLANES; plane++)
+	{
+		if (0 == (m_planes & (1 << plane)))
+			continue;
+		Chip8DisplayRow *display = m_graphicsDisplay[plane];
+		std::memmove(&display[0], &display[rows], (displayHeight - rows) * sizeof(Chip8DisplayRow));
+		std::memset(&display[displayHeight - rows], 0, rows * sizeof(Chip8DisplayRow));
+	}
+	m_dirtyRows |= (displayHeight < 64) ? ((1ULL << displayHeight) - 1) : ~0ULL;
+}
+
+// 00FB and 00FC move every row SCROLL_PIXELS along as one 128 bit shift. Pixels pushed off the edge are lost, in low resolution
+// at the end of the low word
+void Chip8::ScrollRight()
+{
+	unsigned int displayHeight = m_highResolution ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+	unsigned long long highMask = m_highResolution ? ~0ULL : 0;
+	for (int plane = 0; plane < XO_CHIP_PLANES; plane++)
+	{
+		if (0 == (m_planes & (1 << plane)))
+			continue;
+		for (unsigned int row = 0; row < displayHeight; row++)
+		{
+			Chip8DisplayRow& line = m_graphicsDisplay[plane][row];
+			line.high = ((line.high << SCROLL_PIXELS) | (line.low >> (64 - SCROLL_PIXELS))) & highMask;
+			line.low <<= SCROLL_PIXELS;
+		}
+	}
+	m_dirtyRows |= (displayHeight < 64) ? ((1ULL << displayHeight) - 1) : ~0ULL;
+}
+
+void Chip8::ScrollLeft()
+{
+	unsigned int displayHeight = m_highResolution ? HIRES_HEIGHT : DISPLAY_HEIGHT;
+	for (int plane = 0; plane < XO_CHIP_PLANES; plane++)
+	{
+		if (0 == (m_planes & (1 << plane)))
+			continue;
+		for (unsigned int row = 0; row < displayHeight; row++)
+		{
+			Chip8DisplayRow& line = m_graphicsDisplay[plane][row];
+			line.low = (line.low >> SCROLL_PIXELS) | (line.high << (64 - SCROLL_PIXELS));
+			line.high >>= SCROLL_PIXELS;
+		}
+	}
+	m_dirtyRows |= (displayHeight < 64) ? ((1ULL << displayHeight) - 1) : ~0ULL;
+}
+
+// 00FE and 00FF. Every plane is cleared, as the pixels of one resolution mean nothing in the other
+void Chip8::SetHighResolution(bool highResolution)
+{
+	m_highResolution = highResolution;
+	ClearPlanes(ALL_PLANES);
+	m_dirtyRows = ~0ULL;
+}
+
+bool Chip8::IsHighResolution()
+{
+	return m_highResolution;
+}
+
+Chip8DisplayRow Chip8::GetDisplayRow(unsigned char row)
+{
+	return GetPlaneRow(0, row);
+}
+
+Chip8DisplayRow Chip8::GetPlaneRow(unsigned char plane, unsigned char row)
+{
+	if ((plane < XO_CHIP_PLANES) && (row < (m_highResolution ? HIRES_HEIGHT : DISPLAY_HEIGHT)))
+		return m_graphicsDisplay[plane][row];
 	else
-		return 0;
+		return Chip8DisplayRow();
+}
+
+// Low resolution hashes the 64 bit rows it always has, so the hashes of CHIP-8 programs, and of LockstepBatch lanes, stay the same.
+// XO-CHIP adds the second plane after the first
+unsigned long long Chip8::GetDisplayHash()
+{
+	unsigned long long words[XO_CHIP_PLANES * 2 * HIRES_HEIGHT];
+	unsigned int count = 0;
+	int planes = (QuirkProfile::XO_CHIP == m_quirkProfile) ? XO_CHIP_PLANES : 1;
+	for (int plane = 0; plane < planes; plane++)
+	{
+		for (int row = 0; row < (m_highResolution ? HIRES_HEIGHT : DISPLAY_HEIGHT); row++)
+		{
+			words[count++] = m_graphicsDisplay[plane][row].low;
+			if (m_highResolution)
+				words[count++] = m_graphicsDisplay[plane][row].high;
+		}
+	}
+	return HashDisplay(words, count);
 }
 
-int Chip8::ProcessMemoryOperation(unsigned char registerNum, unsigned char constValue, std::wostringstream& description, bool decodeOnly)
+/*****************************************************************************************************************************************/
+// 
+// TakeDirtyRows - Reports which rows of the display have changed
+//
+// Inputs - None
+//
+// Outputs - Bit n set for every row n changed since the last call. The first call after the machine is created reports every row
+//
+// Notes - A presenter calls this each time it draws and only redraws the rows it returns, reading them with GetDisplayRow. A row
+//         is reported when a sprite or a clear touched it, even if it ended up back the way it was
+/*****************************************************************************************************************************************/
+unsigned long long Chip8::TakeDirtyRows()
 {
+	unsigned long long dirtyRows = m_dirtyRows;
+	m_dirtyRows = 0;
+	return dirtyRows;
+}
+
+// FNV-1a over the display words, used to compare the final frame between runs without dumping it
+unsigned long long Chip8::HashDisplay(const unsigned long long *words, unsigned int count)
+{
+	unsigned long long hash = 0xCBF29CE484222325ULL;
+	for (unsigned int word = 0; word < count; word++)
+	{
+		for (int byte = 0; byte < 8; byte++)
+		{
+			hash ^= (words[word] >> (byte * 8)) & 0xFF;
+			hash *= 0x100000001B3ULL;
+		}
+	}
+	return hash;
+}
+
+template <QuirkProfile Profile>
+int Chip8::ProcessMemoryOperation(unsigned char registerNum, unsigned char constValue)
+{
+	constexpr Chip8Quirks quirks = GetQuirks(Profile);
 	int returnValue = 0;
 	switch (constValue)
 	{
+		case 0x01:
+			// FN01 selects the planes to draw on, clear and scroll
+			if (!quirks.xoChip || (registerNum > ALL_PLANES))
+				returnValue = 0x1;
+			else
+				m_planes = registerNum;
+			break;
 		case 0x07:
-			description << "LD   V" << std::uppercase << std::setw(1) << std::hex << registerNum << ", DT";
-			if (decodeOnly) break;
 			m_registers[registerNum] = m_delayTimer;
 			break;
 		case 0x0A:
-			description << "LD   V" << std::uppercase << std::setw(1) << std::hex << registerNum << ", K";
-			if (decodeOnly) break;
 			m_previousExecutionState = m_executionState;
 			m_executionState = STATE_PAUSED_FOR_INPUT;
 			m_registerToStoreKeyPress = registerNum;
 			break;
 		case 0x15:
-			description << "LD   DT, V" << std::uppercase << std::setw(1) << std::hex << registerNum;
-			if (decodeOnly) break;
 			m_delayTimer = m_registers[registerNum];
 			break;
 		case 0x18:
-			description << "LD   ST, V" << std::uppercase << std::setw(1) << std::hex << registerNum;
-			if (decodeOnly) break;
 			m_sleepTimer = m_registers[registerNum];
 			break;
+		case 0x1E:
+			m_addressRegister = (m_addressRegister + m_registers[registerNum]) & (quirks.xoChip ? 0xFFFF : 0x0FFF);
+			break;
 		case 0x29:
-			description << "LD   F, V" << std::uppercase << std::setw(1) << std::hex << registerNum;
-			if (decodeOnly) break;
 			ProcessFontOperation(registerNum);
 			break;
+		case 0x30:
+			if (!quirks.superChip)
+				returnValue = 0x1;
+			else
+				m_addressRegister = LARGE_FONT_ADDRESS + (m_registers[registerNum] & 0xF) * LARGE_FONT_HEIGHT;
+			break;
+		case 0x75:
+			if (!quirks.superChip || (registerNum >= SUPER_CHIP_FLAGS))
+				returnValue = 0x1;
+			else
+				std::memcpy(m_flags, m_registers, registerNum + 1);
+			break;
+		case 0x85:
+			if (!quirks.superChip || (registerNum >= SUPER_CHIP_FLAGS))
+				returnValue = 0x1;
+			else
+				std::memcpy(m_registers, m_flags, registerNum + 1);
+			break;
 		case 0x33:
-			description << "LD   B, V" << std::uppercase << std::setw(1) << std::hex << registerNum;
-			if (decodeOnly) break;
 			ProcessBCDOperation(registerNum);
 			break;
 		case 0x55:
-			description << "LD   [I], V" << std::uppercase << std::setw(1) << std::hex << registerNum;
-			if (decodeOnly) break;
 			returnValue = ProcessFillFromRegisters(registerNum);
+			if constexpr (!quirks.loadStoreKeepsI)
+			{
+				if (0 == returnValue)
+					m_addressRegister += registerNum + 1;
+			}
 			break;
 		case 0x65:
-			description << "LD   V" << std::uppercase << std::setw(1) << std::hex << registerNum << ", [I]";
-			if (decodeOnly) break;
 			returnValue = ProcessFillRegisters(registerNum);
+			if constexpr (!quirks.loadStoreKeepsI)
+			{
+				if (0 == returnValue)
+					m_addressRegister += registerNum + 1;
+			}
 			break;
 		default:
 			returnValue = 0x1;
@@ -522,16 +1254,18 @@ void Chip8::ProcessBCDOperation(unsigned char registerNum)
 	m_memory[m_addressRegister] = value / 100;
 	m_memory[m_addressRegister+1] = (value / 10) % 10;
 	m_memory[m_addressRegister+2] = (value % 100) % 10;
+	NoteMemoryWrite(m_addressRegister, 3);
 }
 
 int Chip8::ProcessFillFromRegisters(unsigned char registerNum)
 {
-	if ((m_addressRegister + registerNum) >= CHIP_8_MEMORY_SIZE)
+	if ((m_addressRegister + registerNum) >= m_memorySize)
 		return 0x1;
 
+	NoteMemoryWrite(m_addressRegister, registerNum + 1);
 	for (int x = 0; x <= registerNum; x++)
 	{
-		 m_memory[m_addressRegister++] = m_registers[x];
+		 m_memory[m_addressRegister + x] = m_registers[x];
 	}
 
 	return 0;
@@ -539,12 +1273,35 @@ int Chip8::ProcessFillFromRegisters(unsigned char registerNum)
 
 int Chip8::ProcessFillRegisters(unsigned char registerNum)
 {
-	if ((m_addressRegister + registerNum) >= CHIP_8_MEMORY_SIZE)
+	if ((m_addressRegister + registerNum) >= m_memorySize)
 		return 0x1;
 
 	for (int x = 0; x <= registerNum; x++)
 	{
-		m_registers[x] = m_memory[m_addressRegister++];
+		m_registers[x] = m_memory[m_addressRegister + x];
+	}
+
+	return 0;
+}
+
+// 5XY2 and 5XY3 under XO-CHIP: VX to VY saved to or loaded from I onwards, in reverse when X is above Y. I is left alone
+int Chip8::ProcessRegisterRange(unsigned char firstRegister, unsigned char secondRegister, bool store)
+{
+	int step = (firstRegister <= secondRegister) ? 1 : -1;
+	int count = ((firstRegister <= secondRegister) ? (secondRegister - firstRegister) : (firstRegister - secondRegister)) + 1;
+	if ((m_addressRegister + (unsigned int)count) > m_memorySize)
+		return 0x1;
+
+	if (store)
+	{
+		NoteMemoryWrite(m_addressRegister, count);
+		for (int x = 0; x < count; x++)
+			m_memory[m_addressRegister + x] = m_registers[firstRegister + x * step];
+	}
+	else
+	{
+		for (int x = 0; x < count; x++)
+			m_registers[firstRegister + x * step] = m_memory[m_addressRegister + x];
 	}
 
 	return 0;
@@ -555,41 +1312,350 @@ void Chip8::Reset()
 	for (int x = 0; x < 16; x++)
 		m_registers[x] = 0;
 	m_pc = 0x200; // Start at the beginning
+	m_addressRegister = 0;
 	m_delayTimer = 0;
 	m_sleepTimer = 0;
-	while (!m_stack.empty())
-	{
-		m_stack.pop();
-	}
-	ClearDisplay();
+	m_keysTapped = 0;
+	m_randomState = m_randomSeed;
+	m_stackDepth = 0;
+	std::memset(m_stack, 0, sizeof(m_stack));
+	if (m_highResolution)
+		SetHighResolution(false);
+	m_planes = 1;
+	ClearPlanes(ALL_PLANES);
 }
 
+// 00E0 clears the selected planes
 void Chip8::ClearDisplay()
 {
-	for (int x = 0; x < 32; x++)
-		m_graphicsDisplay[x] = 0;
+	ClearPlanes(m_planes);
 }
 
-void Chip8::KeyPress(char key)
+void Chip8::ClearPlanes(unsigned char planes)
 {
-	auto it = m_validKeys.find(key);
-	if (it != m_validKeys.end())
+	for (int plane = 0; plane < XO_CHIP_PLANES; plane++)
 	{
-		m_keyPressed = it->second;
-		if (STATE_PAUSED_FOR_INPUT == m_executionState)
+		if (0 == (planes & (1 << plane)))
+			continue;
+		for (int x = 0; x < HIRES_HEIGHT; x++)
 		{
-			m_registers[m_registerToStoreKeyPress] = m_keyPressed;
-			m_keyPressed = 0xF0;
-			m_executionState = m_previousExecutionState;
+			if ((0 != m_graphicsDisplay[plane][x].low) || (0 != m_graphicsDisplay[plane][x].high))
+				m_dirtyRows |= 1ULL << x;
+			m_graphicsDisplay[plane][x] = Chip8DisplayRow();
 		}
 	}
 }
 
+// A tap that arrives while FX0A waits is used up by it
+void Chip8::KeyPress(char key)
+{
+	unsigned char mapped = m_keyMap.keys[(unsigned char)key];
+	if ((NO_KEY != mapped) && !ResumeFromKeyWait(mapped))
+		m_keysTapped |= (unsigned short)(1u << mapped);
+}
+
+void Chip8::KeyDown(char key)
+{
+	unsigned char mapped = m_keyMap.keys[(unsigned char)key];
+	if (NO_KEY != mapped)
+	{
+		m_keysDown |= (unsigned short)(1u << mapped);
+		ResumeFromKeyWait(mapped);
+	}
+}
+
+void Chip8::KeyUp(char key)
+{
+	unsigned char mapped = m_keyMap.keys[(unsigned char)key];
+	if (NO_KEY != mapped)
+		m_keysDown &= (unsigned short)~(1u << mapped);
+}
+
+void Chip8::ApplyInput(const Chip8InputEvent& event)
+{
+	switch (event.type)
+	{
+	case InputEventType::KEY_DOWN:
+		KeyDown(event.key);
+		break;
+	case InputEventType::KEY_UP:
+		KeyUp(event.key);
+		break;
+	case InputEventType::KEY_PRESS:
+		KeyPress(event.key);
+		break;
+	}
+}
+
+unsigned short Chip8::GetKeysDown()
+{
+	return m_keysDown;
+}
+
+// Finishes a waiting FX0A with key. Returns false if nothing was waiting
+bool Chip8::ResumeFromKeyWait(unsigned char key)
+{
+	if (STATE_PAUSED_FOR_INPUT != m_executionState)
+		return false;
+
+	m_registers[m_registerToStoreKeyPress] = key;
+	m_executionState = m_previousExecutionState;
+	return true;
+}
+
+void Chip8::SetRandomSeed(unsigned int seed)
+{
+	m_randomSeed = (0 == seed) ? ZERO_SEED_REPLACEMENT : seed;
+	m_randomState = m_randomSeed;
+}
+
+unsigned int Chip8::GetRandomSeed()
+{
+	return m_randomSeed;
+}
+
 unsigned short Chip8::GetPC()
 {
 	return m_pc;
 }
 
+/*****************************************************************************************************************************************/
+// 
+// SaveState - Copies the whole machine into a fixed size blob
+//
+// Inputs - state (filled in)
+//
+// Outputs - 0 on success, -1 under XO_CHIP, whose memory does not fit in the blob
+//
+// Notes - The blob includes the random generator and a pending FX0A, so loading it and running again gives exactly the same results.
+//         The selected engine is a host setting and is not part of the state, but the quirk profile is. XO-CHIP machines are saved
+//         with SaveSnapshot instead
+/*****************************************************************************************************************************************/
+int Chip8::SaveState(Chip8State& state)
+{
+	if (CHIP_8_MEMORY_SIZE != m_memorySize)
+		return -1;
+
+	SaveMachineState(state.machine);
+	std::memcpy(state.memory, m_memory, CHIP_8_MEMORY_SIZE);
+	return 0;
+}
+
+/*****************************************************************************************************************************************/
+// 
+// LoadState - Restores a machine saved by SaveState
+//
+// Inputs - state (blob to restore)
+//
+// Outputs - 0 on success, -1 if the blob is from another version or is corrupt. Nothing is changed on failure
+//
+// Notes - Only pages of memory that differ are copied, and only their compiled blocks are thrown away, so restoring a state close to
+//         the current one is cheap even with the block cache or the JIT selected
+/*****************************************************************************************************************************************/
+int Chip8::LoadState(const Chip8State& state)
+{
+	if ((0 != CheckMachineState(state.machine)) || (GetQuirks((QuirkProfile)state.machine.quirkProfile).xoChip))
+		return -1;
+
+	ResizeMemory(CHIP_8_MEMORY_SIZE);
+	bool programChanged = false;
+	for (unsigned int page = 0; page < CHIP_8_MEMORY_PAGES; page++)
+	{
+		unsigned char *current = &m_memory[page * CHIP_8_PAGE_SIZE];
+		const unsigned char *saved = &state.memory[page * CHIP_8_PAGE_SIZE];
+		if (0 != std::memcmp(current, saved, CHIP_8_PAGE_SIZE))
+		{
+			std::memcpy(current, saved, CHIP_8_PAGE_SIZE);
+			NoteMemoryWrite(page * CHIP_8_PAGE_SIZE, CHIP_8_PAGE_SIZE);
+			programChanged |= IsProgramPage(page, state.machine.programSize);
+		}
+	}
+	LoadMachineState(state.machine, programChanged);
+	return 0;
+}
+
+/*****************************************************************************************************************************************/
+// 
+// SaveSnapshot - Saves the machine with memory shared copy on write
+//
+// Inputs - snapshot (filled in)
+//
+// Outputs - 0 on success
+//
+// Notes - A page that has not been written since the last save or load is shared with the snapshot it came from instead of copied.
+//         Pages past the end of a 4 KB machine's memory are left empty
+/*****************************************************************************************************************************************/
+int Chip8::SaveSnapshot(Chip8Snapshot& snapshot)
+{
+	SaveMachineState(snapshot.machine);
+	for (unsigned int page = 0; page < XO_CHIP_MEMORY_PAGES; page++)
+	{
+		if (page >= m_memorySize / CHIP_8_PAGE_SIZE)
+		{
+			snapshot.pages[page].reset();
+			continue;
+		}
+		if ((m_dirtyPages[page / 64] & (1ULL << (page % 64))) || (nullptr == m_pageSource[page]))
+		{
+			std::shared_ptr<Chip8MemoryPage> copy = std::make_shared<Chip8MemoryPage>();
+			std::memcpy(copy->bytes, &m_memory[page * CHIP_8_PAGE_SIZE], CHIP_8_PAGE_SIZE);
+			m_pageSource[page] = copy;
+		}
+		snapshot.pages[page] = m_pageSource[page];
+	}
+	std::memset(m_dirtyPages, 0, sizeof(m_dirtyPages));
+	return 0;
+}
+
+/*****************************************************************************************************************************************/
+// 
+// LoadSnapshot - Restores a machine saved by SaveSnapshot
+//
+// Inputs - snapshot (snapshot to restore. It is not changed and can be loaded any number of times)
+//
+// Outputs - 0 on success, -1 if the snapshot is from another version, is missing pages or is corrupt. Nothing is changed on failure
+//
+// Notes - Pages already holding the snapshot's data are left alone, so going back and forth between related snapshots only copies
+//         the pages where they differ
+/*****************************************************************************************************************************************/
+int Chip8::LoadSnapshot(const Chip8Snapshot& snapshot)
+{
+	if (0 != CheckMachineState(snapshot.machine))
+		return -1;
+	unsigned int memorySize = GetQuirks((QuirkProfile)snapshot.machine.quirkProfile).xoChip ? XO_CHIP_MEMORY_SIZE : CHIP_8_MEMORY_SIZE;
+	for (unsigned int page = 0; page < memorySize / CHIP_8_PAGE_SIZE; page++)
+	{
+		if (nullptr == snapshot.pages[page])
+			return -1;
+	}
+
+	ResizeMemory(memorySize);
+	bool programChanged = false;
+	for (unsigned int page = 0; page < memorySize / CHIP_8_PAGE_SIZE; page++)
+	{
+		if ((m_dirtyPages[page / 64] & (1ULL << (page % 64))) || (m_pageSource[page] != snapshot.pages[page]))
+		{
+			std::memcpy(&m_memory[page * CHIP_8_PAGE_SIZE], snapshot.pages[page]->bytes, CHIP_8_PAGE_SIZE);
+			m_pageSource[page] = snapshot.pages[page];
+			InvalidateEngines(page * CHIP_8_PAGE_SIZE, CHIP_8_PAGE_SIZE);
+			programChanged |= IsProgramPage(page, snapshot.machine.programSize);
+		}
+	}
+	std::memset(m_dirtyPages, 0, sizeof(m_dirtyPages));
+	LoadMachineState(snapshot.machine, programChanged);
+	return 0;
+}
+
+void Chip8::SaveMachineState(Chip8MachineState& machine)
+{
+	std::memset(&machine, 0, sizeof(machine)); // Keeps unused stack entries and padding out of saved files
+	machine.version = CHIP_8_STATE_VERSION;
+	machine.programSize = m_programSize;
+	std::memcpy(machine.registers, m_registers, sizeof(m_registers));
+	machine.pc = m_pc;
+	machine.addressRegister = m_addressRegister;
+	machine.delayTimer = m_delayTimer;
+	machine.soundTimer = m_sleepTimer;
+	machine.keysDown = m_keysDown;
+	machine.keysTapped = m_keysTapped;
+	machine.registerToStoreKeyPress = m_registerToStoreKeyPress;
+	machine.executionState = m_executionState;
+	machine.previousExecutionState = m_previousExecutionState;
+	machine.randomState = m_randomState;
+	machine.randomSeed = m_randomSeed;
+	machine.quirkProfile = (unsigned int)m_quirkProfile;
+
+	machine.stackDepth = m_stackDepth;
+	std::memcpy(machine.stack, m_stack, sizeof(m_stack));
+
+	machine.highResolution = m_highResolution ? 1 : 0;
+	std::memcpy(machine.flags, m_flags, sizeof(m_flags));
+	machine.planes = m_planes;
+	std::memcpy(machine.display, m_graphicsDisplay, sizeof(m_graphicsDisplay));
+	std::memcpy(machine.memoryPadding, &m_memory[m_memorySize], CHIP_8_MEMORY_PADDING);
+}
+
+int Chip8::CheckMachineState(const Chip8MachineState& machine)
+{
+	if ((CHIP_8_STATE_VERSION != machine.version) || (machine.stackDepth > CHIP_8_STACK_DEPTH) ||
+		(machine.quirkProfile > (unsigned int)QuirkProfile::XO_CHIP) || (machine.registerToStoreKeyPress > 0xF) ||
+		(0 == machine.randomState) || (0 == machine.randomSeed) || (machine.highResolution > 1) || (machine.planes > ALL_PLANES))
+		return -1;
+	bool xoChip = GetQuirks((QuirkProfile)machine.quirkProfile).xoChip;
+	int maxSize = xoChip ? XO_CHIP_MAX_PROGRAM_SIZE : MAX_PROGRAM_SIZE;
+	if ((machine.programSize < 0) || (machine.programSize > maxSize))
+		return -1;
+	// I may be one past the last address after FX55 fills it, but no further, as FX33 and the rest write through it unchecked. BNNN
+	// can land the PC on the last address, so it and the return addresses only have to be inside memory
+	unsigned int memorySize = xoChip ? XO_CHIP_MEMORY_SIZE : CHIP_8_MEMORY_SIZE;
+	if ((machine.addressRegister > memorySize) || (machine.pc >= memorySize))
+		return -1;
+	for (unsigned int x = 0; x < machine.stackDepth; x++)
+	{
+		if (machine.stack[x] >= memorySize)
+			return -1;
+	}
+	return 0;
+}
+
+// A page of memory that holds part of a program of programSize bytes
+bool Chip8::IsProgramPage(unsigned int page, int programSize)
+{
+	return ((page + 1) * CHIP_8_PAGE_SIZE > START_CHIP_8_PROGRAM) && (page * CHIP_8_PAGE_SIZE < START_CHIP_8_PROGRAM + (unsigned int)programSize);
+}
+
+// programChanged is set when the load copied a page holding part of the program, which can be another ROM of the same size
+void Chip8::LoadMachineState(const Chip8MachineState& machine, bool programChanged)
+{
+	m_programSize = machine.programSize;
+	std::memcpy(m_registers, machine.registers, sizeof(m_registers));
+	m_pc = machine.pc;
+	m_addressRegister = machine.addressRegister;
+	m_delayTimer = machine.delayTimer;
+	m_sleepTimer = machine.soundTimer;
+	m_keysDown = machine.keysDown;
+	m_keysTapped = machine.keysTapped;
+	m_registerToStoreKeyPress = machine.registerToStoreKeyPress;
+	m_executionState = machine.executionState;
+	m_previousExecutionState = machine.previousExecutionState;
+	m_randomState = machine.randomState;
+	m_randomSeed = machine.randomSeed;
+	SetQuirkProfile((QuirkProfile)machine.quirkProfile);
+
+	m_stackDepth = machine.stackDepth;
+	std::memcpy(m_stack, machine.stack, sizeof(m_stack));
+
+	if (m_highResolution != (0 != machine.highResolution))
+		m_dirtyRows = ~0ULL;
+	m_highResolution = (0 != machine.highResolution);
+	std::memcpy(m_flags, machine.flags, sizeof(m_flags));
+	m_planes = (unsigned char)machine.planes;
+	for (int plane = 0; plane < XO_CHIP_PLANES; plane++)
+	{
+		for (int row = 0; row < HIRES_HEIGHT; row++)
+		{
+			if (m_graphicsDisplay[plane][row] != machine.display[plane][row])
+				m_dirtyRows |= 1ULL << row;
+		}
+	}
+	std::memcpy(m_graphicsDisplay, machine.display, sizeof(m_graphicsDisplay));
+	std::memcpy(&m_memory[m_memorySize], machine.memoryPadding, CHIP_8_MEMORY_PADDING);
+
+	// A state of the same program that has not written over its own code copies none of its pages, so the graph is kept
+	if (programChanged || (m_programSize != m_controlFlow->GetProgramSize()))
+		AnalyzeProgram();
+}
+
+unsigned char Chip8::GetRegister(unsigned char registerNum)
+{
+	return m_registers[registerNum & 0xF];
+}
+
+unsigned short Chip8::GetAddressRegister()
+{
+	return m_addressRegister;
+}
+
 bool Chip8::IsInit()
 {
 	return (m_executionState == STATE_INIT);
@@ -601,6 +1667,11 @@ bool Chip8::IsPaused()
 	return (m_executionState != STATE_EXECUTING);
 }
 
+bool Chip8::IsWaitingForInput()
+{
+	return (m_executionState == STATE_PAUSED_FOR_INPUT);
+}
+
 void Chip8::Pause()
 {
 	m_executionState = STATE_PAUSED;
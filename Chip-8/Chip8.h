@@ -1,9 +1,10 @@
 #pragma once
-#include <stack>
-#include <map>
 #include <sstream>
 #include <ios>
 #include <iomanip>
+#include <memory>
+#include "Disassembler.h"
+#include "InputQueue.h"
 
 #define CHIP_8_MEMORY_SIZE 4096
 #define INTERPRETER_SIZE 512
@@ -12,70 +13,383 @@
 #define RESERVED_SPACE_SIZE 96
 #define HIGHEST_PC_VALUE (CHIP_8_MEMORY_SIZE-DISPLAY_REFRESH_SIZE-RESERVED_SPACE_SIZE)
 #define MAX_PROGRAM_SIZE (CHIP_8_MEMORY_SIZE-INTERPRETER_SIZE-DISPLAY_REFRESH_SIZE-RESERVED_SPACE_SIZE)
+#define XO_CHIP_MEMORY_SIZE 65536 // XO-CHIP has nothing reserved at the top, a program can fill everything past the interpreter
+#define XO_CHIP_MAX_PROGRAM_SIZE (XO_CHIP_MEMORY_SIZE-INTERPRETER_SIZE)
+#define XO_CHIP_PLANES 2
+#define CHIP_8_MEMORY_PADDING 64 // DXY0 on both XO-CHIP planes reads up to 63 bytes past I, which may be the last address
+#define CHIP_8_DISPLAY_WIDTH 64
+#define CHIP_8_DISPLAY_HEIGHT 32
+#define CHIP_8_HIRES_WIDTH 128   // SUPER-CHIP high resolution
+#define CHIP_8_HIRES_HEIGHT 64
+#define CHIP_8_FLAG_REGISTERS 16 // Saved by FX75 and restored by FX85. SUPER-CHIP only has the first 8
+#define CHIP_8_PAGE_SIZE 256
+#define CHIP_8_MEMORY_PAGES (CHIP_8_MEMORY_SIZE/CHIP_8_PAGE_SIZE)
+#define XO_CHIP_MEMORY_PAGES (XO_CHIP_MEMORY_SIZE/CHIP_8_PAGE_SIZE)
+#ifndef CHIP_8_STACK_DEPTH
+#define CHIP_8_STACK_DEPTH 16 // Return addresses CALL can nest. A CALL past it faults with a stack overflow
+#endif
+#define CHIP_8_STATE_VERSION 7
+#define CHIP_8_KEY_COUNT 16
+
+class BlockCache;
+class JitX64;
+class ControlFlowGraph;
+class NativeModule;
+
+// The engines that can run a loaded program. They produce the same machine state and can be switched at any time
+enum class ExecutionEngine
+{
+	INTERPRETER,
+	BLOCK_CACHE,
+	JIT,          // x86-64 hosts only
+	NATIVE,       // Code compiled ahead of time for one program, see LoadNativeModule
+};
+
+// Rule sets of the interpreters CHIP-8 programs were written for. A program written for one can misbehave under another
+enum class QuirkProfile
+{
+	CHIP_8,       // The rules this emulator has always used
+	COSMAC_VIP,   // The original interpreter
+	SUPER_CHIP,   // SUPER-CHIP 1.1 on the HP 48, which most later CHIP-8 programs expect
+	XO_CHIP,      // Octo's extension of SUPER-CHIP: 64 KB of memory, two display planes and a few more instructions
+};
+
+// The behaviours that differ between the profiles
+struct Chip8Quirks
+{
+	bool shiftInPlace;     // 8XY6 and 8XYE shift VX itself. Otherwise VY is shifted and the result copied into VX
+	bool loadStoreKeepsI;  // FX55 and FX65 leave I alone. Otherwise I is left just past the last register
+	bool jumpAnywhere;     // 1NNN and 2NNN can go to any address. Otherwise only into the loaded program
+	bool jumpPlusVX;       // BXNN jumps to XNN plus VX. Otherwise BNNN jumps to NNN plus V0
+	bool logicResetsVF;    // 8XY1, 8XY2 and 8XY3 clear VF
+	bool superChip;        // The SUPER-CHIP instructions: 00CN, 00FB to 00FF, DXY0 as a 16x16 sprite, FX30, FX75 and FX85
+	bool xoChip;           // 64 KB of memory and the XO-CHIP instructions: 00DN, 5XY2, 5XY3, F000 NNNN and FN01
+};
+
+// constexpr so the engines can be specialised on a profile at compile time and still look it up at run time
+constexpr Chip8Quirks GetQuirks(QuirkProfile profile)
+{
+	return (QuirkProfile::COSMAC_VIP == profile) ? Chip8Quirks{ false, false, true, false, true, false, false } :
+		(QuirkProfile::SUPER_CHIP == profile) ? Chip8Quirks{ true, true, true, true, false, true, false } :
+		(QuirkProfile::XO_CHIP == profile) ? Chip8Quirks{ false, false, true, false, false, true, true } :
+		Chip8Quirks{ false, false, false, false, false, false, false };
+}
+
+// One row of the display as a 128 bit word. Pixel n is bit n, so pixels 0 to 63 are in low and 64 to 127 in high. In low
+// resolution only the first CHIP_8_DISPLAY_HEIGHT rows and the low words are used
+struct Chip8DisplayRow
+{
+	unsigned long long low;
+	unsigned long long high;
+
+	bool operator==(const Chip8DisplayRow& other) const { return (low == other.low) && (high == other.high); }
+	bool operator!=(const Chip8DisplayRow& other) const { return !(*this == other); }
+};
+
+// Everything about a running machine except its memory. Plain data so it can be copied with memcpy or written to disk. The
+// memory of an XO_CHIP machine is XO_CHIP_MEMORY_SIZE rather than CHIP_8_MEMORY_SIZE
+struct Chip8MachineState
+{
+	unsigned int version;                  // CHIP_8_STATE_VERSION
+	int programSize;
+	unsigned char registers[16];
+	unsigned short pc;
+	unsigned short addressRegister;
+	unsigned char delayTimer;
+	unsigned char soundTimer;
+	unsigned short keysDown;               // One bit per key held down
+	unsigned short keysTapped;             // One bit per key pressed and not yet seen by EX9E or EXA1
+	unsigned char registerToStoreKeyPress; // Register a pending FX0A stores the key in
+	int executionState;
+	int previousExecutionState;
+	unsigned int randomState;
+	unsigned int randomSeed;               // What Reset restarts the generator from
+	unsigned int quirkProfile;             // QuirkProfile the machine runs under
+	unsigned int stackDepth;
+	unsigned short stack[CHIP_8_STACK_DEPTH]; // Oldest return address first
+	unsigned int highResolution;           // 1 after 00FF, 0 after 00FE
+	unsigned char flags[CHIP_8_FLAG_REGISTERS];
+	unsigned int planes;                   // Planes FN01 selected, 1 unless XO_CHIP
+	Chip8DisplayRow display[XO_CHIP_PLANES][CHIP_8_HIRES_HEIGHT];
+	unsigned char memoryPadding[CHIP_8_MEMORY_PADDING];
+};
+
+// The complete machine in one fixed size, trivially copyable blob. It only has room for CHIP_8_MEMORY_SIZE, so XO_CHIP machines
+// are saved with snapshots instead
+struct Chip8State
+{
+	Chip8MachineState machine;
+	unsigned char memory[CHIP_8_MEMORY_SIZE];
+};
+
+struct Chip8MemoryPage
+{
+	unsigned char bytes[CHIP_8_PAGE_SIZE];
+};
+
+// The complete machine with memory held as shared, read only pages. Saving a snapshot only copies the pages written since the
+// last save or load, so snapshots taken from the same run (or forks of one snapshot) share every page they have in common. Only the
+// first CHIP_8_MEMORY_PAGES are used unless the machine is XO_CHIP
+struct Chip8Snapshot
+{
+	Chip8MachineState machine;
+	std::shared_ptr<const Chip8MemoryPage> pages[XO_CHIP_MEMORY_PAGES];
+};
 
 class Chip8
 {
 public:
-	static Chip8* GetInstance();
-	int LoadProgram(wchar_t *buffer, int size);
+	Chip8();
+	Chip8(const Chip8&) = delete;
+	Chip8& operator=(const Chip8&) = delete;
+	int LoadProgram(const unsigned char *program, int size);
 	unsigned short GetOpcode(unsigned short location);
 	unsigned short GetProgramSize();
 	void Reset();
 	int ExecuteNextInstruction();
+	int Run(unsigned int maxInstructions, unsigned int& executed);
+	int RunFrame(unsigned int cyclesPerFrame, unsigned int& executed);
+	int SetExecutionEngine(ExecutionEngine engine);
+	ExecutionEngine GetExecutionEngine();
+	// A shared object built from StaticRecompiler's source for the program that is loaded. Load the program first
+	int LoadNativeModule(const char *path);
+	// The interpreter is built once per profile and the other engines apply the quirks as they build their code, so changing the
+	// profile changes which code runs rather than adding checks to it. The profile is part of the saved state. XO_CHIP gives the
+	// machine 64 KB of memory, so set it before loading an XO-CHIP program, and always runs on the interpreter
+	int SetQuirkProfile(QuirkProfile profile);
+	QuirkProfile GetQuirkProfile();
+	// Words that no path through the program reaches as an instruction but that a sprite is drawn from are listed as data
 	int DecodeInstructionAt(unsigned short programCounter, std::wostringstream& description);
+	// The basic blocks of the program and which of its bytes are code and which sprite data. Analysed by LoadProgram, again when
+	// the profile changes, and when loading a state copies a page of the program or changes its size
+	ControlFlowGraph& GetControlFlow();
+	// Keys are keyboard characters, mapped onto the hex keypad. KeyPress is a tap that stays pressed until EX9E or EXA1 tests
+	// that key, KeyDown and KeyUp hold a key for as long as it is down
 	void KeyPress(char key);
-	unsigned long long GetDisplayRow(unsigned char row);
+	void KeyDown(char key);
+	void KeyUp(char key);
+	void ApplyInput(const Chip8InputEvent& event);
+	unsigned short GetKeysDown();
+	// The display is CHIP_8_DISPLAY_WIDTH by CHIP_8_DISPLAY_HEIGHT pixels, or CHIP_8_HIRES_WIDTH by CHIP_8_HIRES_HEIGHT in
+	// SUPER-CHIP high resolution. Rows past the current height read as blank. GetDisplayRow is the first plane, the only one
+	// outside XO_CHIP, and a pixel's colour on an XO-CHIP display is its bit in plane 0 plus twice its bit in plane 1
+	bool IsHighResolution();
+	Chip8DisplayRow GetDisplayRow(unsigned char row);
+	Chip8DisplayRow GetPlaneRow(unsigned char plane, unsigned char row);
+	unsigned long long GetDisplayHash();
+	// Bit n is set if row n of the display has changed since the last call
+	unsigned long long TakeDirtyRows();
+	unsigned char GetRegister(unsigned char registerNum);
+	unsigned short GetAddressRegister();
 	unsigned short GetPC();
+	// CXNN draws from an xorshift generator owned by the machine. Machines given the same seed, program and input run alike, and
+	// Reset restarts the generator from the seed. Each machine starts with its own seed from std::random_device
+	void SetRandomSeed(unsigned int seed);
+	unsigned int GetRandomSeed();
+	int SaveState(Chip8State& state);
+	int LoadState(const Chip8State& state);
+	int SaveSnapshot(Chip8Snapshot& snapshot);
+	int LoadSnapshot(const Chip8Snapshot& snapshot);
+	// XORs a sprite into a display the way DXYN does. Returns true if a lit pixel was turned off. DrawSprite draws into a low
+	// resolution display of 64 bit rows, DrawWideSprite into either resolution of Chip8DisplayRow rows with sprites 8 or 16 wide
+	static bool DrawSprite(unsigned long long *display, const unsigned char *sprite, unsigned char xCoor, unsigned char yCoor, unsigned char height, unsigned int& dirtyRows);
+	static bool DrawWideSprite(Chip8DisplayRow *display, bool highResolution, const unsigned char *sprite, bool sixteenWide, unsigned char xCoor, unsigned char yCoor, unsigned char height, unsigned long long& dirtyRows);
 	bool IsPaused();
+	bool IsWaitingForInput();
 	bool IsInit();
 	void Pause();
 	void Executing();
 	~Chip8();
 private:
-	Chip8();
+	friend class BlockCache;
+	friend class JitX64;
+	friend class LockstepBatch;
+	friend class NativeModule;
+	friend class StaticRecompiler;
 
 	static constexpr int FONT_HEIGHT = 5;
 	static constexpr int FONT_WIDTH = 4;
 	static constexpr int NUMBER_OF_FONTS = 16;
-	static constexpr int DISPLAY_HEIGHT = 32;
+	static constexpr int DISPLAY_WIDTH = CHIP_8_DISPLAY_WIDTH;
+	static constexpr int DISPLAY_HEIGHT = CHIP_8_DISPLAY_HEIGHT;
+	static constexpr int HIRES_WIDTH = CHIP_8_HIRES_WIDTH;
+	static constexpr int HIRES_HEIGHT = CHIP_8_HIRES_HEIGHT;
+	static constexpr int LARGE_FONT_HEIGHT = 10;
+	static constexpr int LARGE_FONT_ADDRESS = NUMBER_OF_FONTS * FONT_HEIGHT; // Straight after the small fonts
+	static constexpr int SCROLL_PIXELS = 4;                                  // 00FB and 00FC
+	static constexpr int SUPER_CHIP_FLAGS = 8;                               // Flag registers FX75 and FX85 can reach
+	static constexpr unsigned int ZERO_SEED_REPLACEMENT = 0x9E3779B9; // xorshift never leaves 0, so that seed is swapped for this
+	static const unsigned char m_fonts[NUMBER_OF_FONTS * FONT_HEIGHT];
+	static const unsigned char m_largeFonts[NUMBER_OF_FONTS * LARGE_FONT_HEIGHT];
+	static constexpr int MAX_SPRITE_HEIGHT = 15;
+	static constexpr unsigned char ALL_PLANES = (1 << XO_CHIP_PLANES) - 1;
+	static constexpr int DIRTY_PAGE_WORDS = XO_CHIP_MEMORY_PAGES / 64;
+
+	// Each byte with its bits in the opposite order, built at compile time
+	struct ReversedBits
+	{
+		unsigned char bits[256];
+		constexpr ReversedBits() : bits()
+		{
+			for (int value = 0; value < 256; value++)
+			{
+				for (int bit = 0; bit < 8; bit++)
+				{
+					if (value & (1 << bit))
+						bits[value] |= (unsigned char)(0x80 >> bit);
+				}
+			}
+		}
+	};
+	static const ReversedBits m_reversedBits;
+
+	// Hex keypad key for each keyboard character, NO_KEY for characters that are not on the keypad
+	static constexpr unsigned char NO_KEY = 0xFF;
+	struct KeyMap
+	{
+		unsigned char keys[256];
+		constexpr KeyMap() : keys()
+		{
+			const char layout[CHIP_8_KEY_COUNT + 1] = "X123QWEASDZC4RFV"; // The keyboard character for each key, 0 to F
+			for (int character = 0; character < 256; character++)
+				keys[character] = NO_KEY;
+			for (int key = 0; key < CHIP_8_KEY_COUNT; key++)
+				keys[(unsigned char)layout[key]] = (unsigned char)key;
+		}
+	};
+	static const KeyMap m_keyMap;
 
 	static constexpr int STATE_INIT   = 0x1;
 	static constexpr int STATE_PAUSED = 0x2;
 	static constexpr int STATE_PAUSED_FOR_INPUT = 0x3;
 	static constexpr int STATE_EXECUTING = 0x4;
 
-	unsigned char *m_memory;
+	unsigned char *m_memory;       // m_memorySize bytes and CHIP_8_MEMORY_PADDING past them
+	unsigned int m_memorySize;     // CHIP_8_MEMORY_SIZE, or XO_CHIP_MEMORY_SIZE under XO_CHIP
 	int m_programSize;
-	static Chip8* m_instance;
 
 	unsigned char m_registers[16]; // These are the V registers but I hate naming them V
 	unsigned short m_pc;
 	unsigned short m_addressRegister; // This is the I memory register
 	unsigned char m_delayTimer;
 	unsigned char m_sleepTimer;
-	std::stack<unsigned short> m_stack;
-	std::map<char,int> m_validKeys;
-	unsigned char m_keyPressed;
-	std::wostringstream  m_scratch; 
+	unsigned short m_stack[CHIP_8_STACK_DEPTH]; // Return addresses, oldest first
+	unsigned int m_stackDepth;
+	unsigned short m_keysDown;     // One bit per keypad key held down
+	unsigned short m_keysTapped;   // One bit per keypad key tapped and not yet tested
 	int m_executionState;
 	int m_previousExecutionState;
 	unsigned char m_registerToStoreKeyPress;
+	unsigned int m_randomState;    // xorshift state for CXNN, part of the saved state so a restored run draws the same numbers
+	unsigned int m_randomSeed;
+	ExecutionEngine m_engine;
+	QuirkProfile m_quirkProfile;
+	std::unique_ptr<BlockCache> m_blockCache;
+	std::unique_ptr<JitX64> m_jit;
+	std::unique_ptr<ControlFlowGraph> m_controlFlow;
+	std::unique_ptr<NativeModule> m_native;
+
+	// The Chip-8 display is 64x32 pixels and the SUPER-CHIP one 128x64. Store as 64 rows of 128 bits, of which low resolution
+	// only uses the top left quarter. XO-CHIP adds a second plane, the others only use the first
+	Chip8DisplayRow m_graphicsDisplay[XO_CHIP_PLANES][HIRES_HEIGHT];
+	bool m_highResolution;
+	unsigned char m_planes;         // Bit n selects plane n for drawing, clearing and scrolling
+	unsigned long long m_dirtyRows; // One bit per row changed since TakeDirtyRows last ran
+	unsigned char m_flags[CHIP_8_FLAG_REGISTERS]; // Kept by Reset, like the HP 48 flags they stand for
 
-	// The Chip-8 display is 64x32 pixels. Store as 32 colums of 64 bits (8 bytes)
-	unsigned long long m_graphicsDisplay[DISPLAY_HEIGHT];
+	// The snapshot page each page of memory was last saved to or loaded from, and which pages have been written since
+	std::shared_ptr<const Chip8MemoryPage> m_pageSource[XO_CHIP_MEMORY_PAGES];
+	unsigned long long m_dirtyPages[DIRTY_PAGE_WORDS];
 
-	int DecodeExecute(unsigned short& programCounter, bool decodeOnly, std::wostringstream& description);
+	// Execute runs one instruction under the current profile. The interpreter proper is built once per profile by the templates
+	int Execute(unsigned short& programCounter);
+	template <QuirkProfile Profile> int RunAs(unsigned int maxInstructions, unsigned int& executed);
+	template <QuirkProfile Profile> int ExecuteAs(unsigned short& programCounter);
+	void NoteMemoryWrite(unsigned short address, unsigned short length);
+	void MarkAllPagesDirty();
+	void ResizeMemory(unsigned int size);
+	void InvalidateEngines(unsigned short address, unsigned short length);
+	void AnalyzeProgram();
+	void SaveMachineState(Chip8MachineState& machine);
+	int CheckMachineState(const Chip8MachineState& machine);
+	bool IsProgramPage(unsigned int page, int programSize);
+	void LoadMachineState(const Chip8MachineState& machine, bool programChanged);
+	// Runs once per 60 Hz frame. Returns 0x4 when the sound timer expires
+	inline int TickTimers()
+	{
+		int returnValue = 0;
+		if (0 != m_delayTimer)
+			m_delayTimer--;
+		if (0 != m_sleepTimer)
+		{
+			if (m_sleepTimer > 1)
+			{
+				m_sleepTimer--;
+			}
+			else
+			{
+				m_sleepTimer = 0;
+				returnValue |= 0x4;
+			}
+		}
+		return returnValue;
+	}
+	// EX9E and EXA1. A tap is used up by the first test of its key
+	inline bool TestKey(unsigned char key)
+	{
+		if (key >= CHIP_8_KEY_COUNT)
+			return false;
+		unsigned short bit = (unsigned short)(1u << key);
+		bool pressed = (0 != ((m_keysDown | m_keysTapped) & bit));
+		m_keysTapped &= (unsigned short)~bit;
+		return pressed;
+	}
+	bool ResumeFromKeyWait(unsigned char key);
 	void ClearDisplay();
+	void ClearPlanes(unsigned char planes);
 	void ProcessRegisterSet(unsigned char registerNum, unsigned char value);
 	void ProcessRegisterAddition(unsigned char registerNum, unsigned char value);
-	int ProcessBitRegisterOperation(unsigned char firstRegister, unsigned char secondRegister, unsigned char opSubType, std::wostringstream& description, bool decodeOnly);
+	template <QuirkProfile Profile> int ProcessBitRegisterOperation(unsigned char firstRegister, unsigned char secondRegister, unsigned char opSubType);
 	void ProcessAddressRegisterSet(unsigned short address);
 	void ProcessDisplay(unsigned char firstRegister, unsigned char secondRegister, unsigned char height);
-	int ProcessMemoryOperation(unsigned char registerNum, unsigned char constValue, std::wostringstream& description, bool decodeOnly);
+	void ProcessLargeSprite(unsigned char firstRegister, unsigned char secondRegister);
+	bool DrawPlanes(const unsigned char *sprite, bool sixteenWide, unsigned char xCoor, unsigned char yCoor, unsigned char height);
+	void ScrollDown(unsigned char rows);
+	void ScrollUp(unsigned char rows);
+	void ScrollRight();
+	void ScrollLeft();
+	void SetHighResolution(bool highResolution);
+	static unsigned long long HashDisplay(const unsigned long long *words, unsigned int count);
+	template <QuirkProfile Profile> int ProcessMemoryOperation(unsigned char registerNum, unsigned char constValue);
 	void ProcessFontOperation(unsigned char registerNum);	
 	void ProcessBCDOperation(unsigned char registerNum);
+	// Neither moves I, which depends on the profile
 	int ProcessFillFromRegisters(unsigned char registerNum);
 	int ProcessFillRegisters(unsigned char registerNum);
+	int ProcessRegisterRange(unsigned char firstRegister, unsigned char secondRegister, bool store);
 	void ProcessRandom(unsigned char registerNum, unsigned char constValue);
+	// Both return 0, or the fault status bits with nothing changed
+	int PushReturnAddress(unsigned short address)
+	{
+		if (m_stackDepth >= CHIP_8_STACK_DEPTH)
+			return 0x21;
+		m_stack[m_stackDepth++] = address;
+		return 0;
+	}
+	int PopReturnAddress(unsigned short& address)
+	{
+		if (0 == m_stackDepth)
+			return 0x41;
+		address = m_stack[--m_stackDepth];
+		return 0;
+	}
+	// xorshift32, shared with LockstepBatch so a lane and a Chip8 with the same seed draw the same numbers
+	static unsigned int NextRandom(unsigned int& state)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
 };
 
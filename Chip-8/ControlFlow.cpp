@@ -0,0 +1,288 @@
+#include "ControlFlow.h"
+#include "Disassembler.h"
+
+ControlFlowGraph::ControlFlowGraph() :
+	m_programSize(0),
+	m_quirkProfile(QuirkProfile::CHIP_8)
+{
+}
+
+ControlFlowGraph::~ControlFlowGraph()
+{
+}
+
+/*****************************************************************************************************************************************/
+//
+// Analyze - Finds the basic blocks of a program and which of its bytes are code and which sprite data
+//
+// Inputs - memory (the machine's memory with the program at START_CHIP_8_PROGRAM. Read up to 4 bytes past the last instruction,
+//          which the machine's padding covers)
+//          memorySize (bytes of memory, not counting the padding)
+//          programSize (bytes of program)
+//          profile (the rules the program runs by, which decide what is a valid instruction and where jumps can go)
+//
+// Outputs - 0 on success, -1 if the program does not fit in memory. The graph is left empty on failure
+//
+// Notes - Two passes. The first follows the paths from the start of the program, marking each instruction it reaches, where
+//         blocks start and what DXYN draws, and stops a path at the first instruction another path has already been through.
+//         The second walks each block from its start to its exit on the flags alone, only decoding the instructions that end
+//         blocks again. Everything is kept in flat arrays, so it allocates nothing once they have grown to the largest program seen
+/*****************************************************************************************************************************************/
+int ControlFlowGraph::Analyze(const unsigned char *memory, unsigned int memorySize, int programSize, QuirkProfile profile)
+{
+	Clear();
+	if ((nullptr == memory) || (programSize < 0) || ((unsigned int)(START_CHIP_8_PROGRAM + programSize) > memorySize))
+		return -1;
+
+	const Chip8Quirks quirks = GetQuirks(profile);
+	m_programSize = programSize;
+	m_quirkProfile = profile;
+	m_flags.assign(programSize, 0);
+	if (0 != programSize)
+		m_pending.push_back({ START_CHIP_8_PROGRAM, -1 });
+
+	while (!m_pending.empty())
+	{
+		PendingPath path = m_pending.back();
+		m_pending.pop_back();
+		unsigned int address = path.address;
+		int addressRegister = path.addressRegister;
+		m_flags[address - START_CHIP_8_PROGRAM] |= BYTE_BLOCK_START;
+
+		bool ended = false;
+		while (InProgram(address) && (0 == (m_flags[address - START_CHIP_8_PROGRAM] & BYTE_INSTRUCTION)))
+		{
+			unsigned short length;
+			Instruction instruction = DecodeAt(memory, quirks, address, length);
+			m_flags[address - START_CHIP_8_PROGRAM] |= BYTE_INSTRUCTION;
+			for (unsigned int x = address; (x < address + length) && InProgram(x); x++)
+				m_flags[x - START_CHIP_8_PROGRAM] |= BYTE_CODE;
+
+			// Follow I as far as it can be known. Anything that moves it by a register's value loses it
+			switch (instruction.mnemonic)
+			{
+				case Mnemonic::LD_I_NNN:
+				case Mnemonic::LD_I_LONG:
+					addressRegister = instruction.nnn;
+					break;
+				case Mnemonic::ADD_I_VX:
+				case Mnemonic::LD_F_VX:
+				case Mnemonic::LD_HF_VX:
+					addressRegister = -1;
+					break;
+				case Mnemonic::LD_MEM_VX:
+				case Mnemonic::LD_VX_MEM:
+					if (!quirks.loadStoreKeepsI && (addressRegister >= 0))
+						addressRegister += instruction.x + 1;
+					break;
+				case Mnemonic::DRW_VX_VY_N:
+					if (addressRegister >= 0)
+					{
+						// With both XO-CHIP planes selected a sprite is twice this, which is not known here
+						int bytes = (quirks.superChip && (0 == instruction.n)) ? 32 : instruction.n;
+						for (int x = addressRegister; x < addressRegister + bytes; x++)
+						{
+							if (InProgram(x))
+								m_flags[x - START_CHIP_8_PROGRAM] |= BYTE_DATA;
+						}
+					}
+					break;
+				default:
+					break;
+			}
+
+			ControlFlowBlock block;
+			if (EndsBlock(memory, quirks, instruction, length, block))
+			{
+				m_flags[address - START_CHIP_8_PROGRAM] |= BYTE_BLOCK_END;
+				// A subroutine can change I, so what it is after the return is not known
+				for (int x = 0; x < block.successorCount; x++)
+				{
+					if (InProgram(block.successors[x]))
+						m_pending.push_back({ block.successors[x], ((BlockExit::CALL == block.exit) && (1 == x)) ? -1 : addressRegister });
+				}
+				ended = true;
+				break;
+			}
+			address += length;
+		}
+
+		// This path has run into one already followed, so two paths join here
+		if (!ended && InProgram(address))
+			m_flags[address - START_CHIP_8_PROGRAM] |= BYTE_BLOCK_START;
+	}
+
+	for (int offset = 0; offset < programSize; offset++)
+	{
+		if ((BYTE_INSTRUCTION | BYTE_BLOCK_START) != (m_flags[offset] & (BYTE_INSTRUCTION | BYTE_BLOCK_START)))
+			continue;
+
+		ControlFlowBlock block = {};
+		unsigned int address = START_CHIP_8_PROGRAM + offset;
+		block.start = (unsigned short)address;
+		for (;;)
+		{
+			unsigned short length = (quirks.xoChip && (0xF0 == memory[address]) && (0x00 == memory[address + 1])) ? 4 : 2;
+			block.instructions++;
+			if (m_flags[address - START_CHIP_8_PROGRAM] & BYTE_BLOCK_END)
+			{
+				EndsBlock(memory, quirks, DecodeAt(memory, quirks, address, length), length, block);
+				address += length;
+				break;
+			}
+			address += length;
+			if (!InProgram(address) || (m_flags[address - START_CHIP_8_PROGRAM] & BYTE_BLOCK_START))
+			{
+				block.exit = BlockExit::FALL_THROUGH;
+				block.successorCount = 1;
+				block.successors[0] = (unsigned short)address;
+				break;
+			}
+		}
+		block.end = (unsigned short)address;
+		m_blocks.push_back(block);
+	}
+
+	return 0;
+}
+
+void ControlFlowGraph::Clear()
+{
+	m_flags.clear();
+	m_blocks.clear();
+	m_pending.clear();
+	m_programSize = 0;
+}
+
+int ControlFlowGraph::GetProgramSize()
+{
+	return m_programSize;
+}
+
+QuirkProfile ControlFlowGraph::GetQuirkProfile()
+{
+	return m_quirkProfile;
+}
+
+const std::vector<ControlFlowBlock>& ControlFlowGraph::GetBlocks()
+{
+	return m_blocks;
+}
+
+int ControlFlowGraph::FindBlock(unsigned short address)
+{
+	// The last block starting at or before address
+	int low = 0;
+	int high = (int)m_blocks.size();
+	while (low < high)
+	{
+		int middle = (low + high) / 2;
+		if (m_blocks[middle].start <= address)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	if ((0 == low) || (address >= m_blocks[low - 1].end))
+		return -1;
+	return low - 1;
+}
+
+unsigned char ControlFlowGraph::GetFlags(unsigned short address)
+{
+	return InProgram(address) ? m_flags[address - START_CHIP_8_PROGRAM] : 0;
+}
+
+const char* ControlFlowGraph::GetExitName(BlockExit exit)
+{
+	switch (exit)
+	{
+		case BlockExit::FALL_THROUGH: return "falls through";
+		case BlockExit::JUMP:         return "jump";
+		case BlockExit::CALL:         return "call";
+		case BlockExit::SKIP:         return "skip";
+		case BlockExit::RETURN:       return "return";
+		case BlockExit::INDIRECT:     return "indirect jump";
+		case BlockExit::EXIT:         return "exit";
+		case BlockExit::FAULT:        return "fault";
+		default:                      return "unknown";
+	}
+}
+
+bool ControlFlowGraph::InProgram(unsigned int address)
+{
+	return (address >= START_CHIP_8_PROGRAM) && (address < (unsigned int)(START_CHIP_8_PROGRAM + m_programSize));
+}
+
+// Decodes the instruction at address. An XO-CHIP F000 NNNN is 4 bytes long, everything else 2
+Instruction ControlFlowGraph::DecodeAt(const unsigned char *memory, const Chip8Quirks& quirks, unsigned int address, unsigned short& length)
+{
+	unsigned short opcode = (memory[address] << 8) | memory[address + 1];
+	unsigned short nextOpcode = (memory[address + 2] << 8) | memory[address + 3];
+	Instruction instruction = Disassembler::Decode((unsigned short)address, opcode, nextOpcode);
+	length = (quirks.xoChip && (Mnemonic::LD_I_LONG == instruction.mnemonic)) ? 4 : 2;
+	return instruction;
+}
+
+// Returns true if the instruction ends a block, with the block's exit and successors filled in. The rules are the interpreter's
+bool ControlFlowGraph::EndsBlock(const unsigned char *memory, const Chip8Quirks& quirks, const Instruction& instruction, unsigned short length,
+	ControlFlowBlock& block)
+{
+	unsigned int next = instruction.address + length;
+	bool inProgram = quirks.jumpAnywhere || ((instruction.nnn > START_CHIP_8_PROGRAM) && (instruction.nnn < (START_CHIP_8_PROGRAM + m_programSize)));
+	bool superChip = (instruction.mnemonic >= Mnemonic::SCD_N) && (instruction.mnemonic <= Mnemonic::LD_VX_R);
+	bool xoChip = (instruction.mnemonic >= Mnemonic::SCU_N) && (instruction.mnemonic <= Mnemonic::PLANE_N);
+
+	block.successorCount = 0;
+	if ((Mnemonic::INVALID == instruction.mnemonic) || (superChip && !quirks.superChip) || (xoChip && !quirks.xoChip) ||
+		((Mnemonic::PLANE_N == instruction.mnemonic) && (instruction.x > 3)))
+	{
+		block.exit = BlockExit::FAULT;
+		return true;
+	}
+
+	switch (instruction.mnemonic)
+	{
+		case Mnemonic::JP:
+			// Unless the profile allows it a jump outside the program is ignored, and the block carries on
+			if (!inProgram)
+				return false;
+			block.exit = BlockExit::JUMP;
+			block.successors[block.successorCount++] = instruction.nnn;
+			return true;
+		case Mnemonic::CALL:
+			if (!inProgram)
+			{
+				block.exit = BlockExit::FAULT;
+				return true;
+			}
+			block.exit = BlockExit::CALL;
+			block.successors[block.successorCount++] = instruction.nnn;
+			block.successors[block.successorCount++] = (unsigned short)next;
+			return true;
+		case Mnemonic::SE_VX_NN:
+		case Mnemonic::SNE_VX_NN:
+		case Mnemonic::SE_VX_VY:
+		case Mnemonic::SNE_VX_VY:
+		case Mnemonic::SKP_VX:
+		case Mnemonic::SKNP_VX:
+		{
+			// XO-CHIP skips the whole of an F000 NNNN
+			bool longLoad = quirks.xoChip && (0xF0 == memory[next]) && (0x00 == memory[next + 1]);
+			block.exit = BlockExit::SKIP;
+			block.successors[block.successorCount++] = (unsigned short)next;
+			block.successors[block.successorCount++] = (unsigned short)(next + (longLoad ? 4 : 2));
+			return true;
+		}
+		case Mnemonic::RET:
+			block.exit = BlockExit::RETURN;
+			return true;
+		case Mnemonic::JP_V0_NNN:
+			block.exit = BlockExit::INDIRECT;
+			return true;
+		case Mnemonic::EXIT:
+			block.exit = BlockExit::EXIT;
+			return true;
+		default:
+			return false;
+	}
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+#include "Chip8.h"
+
+// How a basic block ends
+enum class BlockExit : unsigned char
+{
+	FALL_THROUGH, // Runs into the start of another block, its only successor
+	JUMP,         // 1NNN
+	CALL,         // 2NNN. The successors are the subroutine and the instruction the subroutine returns to
+	SKIP,         // 3XNN, 4XNN, 5XY0, 9XY0, EX9E and EXA1. The successors are the next instruction and the one after it
+	RETURN,       // 00EE, where to is only known at run time
+	INDIRECT,     // BNNN, where to is only known at run time
+	EXIT,         // SUPER-CHIP 00FD
+	FAULT,        // A bad opcode, including one the profile does not run
+};
+
+struct ControlFlowBlock
+{
+	unsigned short start;         // Address of the first instruction
+	unsigned short end;           // One past the last byte of the last instruction
+	unsigned short instructions;
+	BlockExit exit;
+	unsigned char successorCount; // Successors outside the program are listed but not analysed
+	unsigned short successors[2];
+};
+
+/*****************************************************************************************************************************************/
+//
+// ControlFlowGraph - The basic blocks of a loaded program, found without running it
+//
+// Notes - Analyze follows every path from START_CHIP_8_PROGRAM through jumps, calls, returns and skips, so only bytes that can be
+//         reached are taken as code. It also keeps track of I along each path and marks the bytes a DXYN draws from an ANNN (or
+//         XO-CHIP F000 NNNN) address as sprite data. The result describes the program as it was loaded: BNNN and returns end
+//         their paths, and code written at run time is not seen. Blocks only depend on the program and the quirk profile, so
+//         engines that cache or compile blocks can use them as they are. A full 3.5 KB program takes a few tens of microseconds
+/*****************************************************************************************************************************************/
+class ControlFlowGraph
+{
+public:
+	// Flags kept for every byte of the program
+	static constexpr unsigned char BYTE_INSTRUCTION = 0x1; // An instruction starts here
+	static constexpr unsigned char BYTE_CODE = 0x2;        // Part of a reachable instruction
+	static constexpr unsigned char BYTE_DATA = 0x4;        // Drawn as sprite data
+	static constexpr unsigned char BYTE_BLOCK_START = 0x8; // A basic block starts here
+	static constexpr unsigned char BYTE_BLOCK_END = 0x10;  // The instruction starting here ends its block
+
+	ControlFlowGraph();
+	~ControlFlowGraph();
+
+	int Analyze(const unsigned char *memory, unsigned int memorySize, int programSize, QuirkProfile profile);
+	void Clear();
+
+	int GetProgramSize();
+	QuirkProfile GetQuirkProfile();
+	// Blocks are sorted by start address
+	const std::vector<ControlFlowBlock>& GetBlocks();
+	// Index of the block holding the instruction at address, or -1
+	int FindBlock(unsigned short address);
+	// 0 for addresses outside the program
+	unsigned char GetFlags(unsigned short address);
+	static const char* GetExitName(BlockExit exit);
+
+private:
+	// A path still to be followed and the value of I along it, or -1 if that is not known
+	struct PendingPath
+	{
+		unsigned short address;
+		int addressRegister;
+	};
+
+	std::vector<unsigned char> m_flags; // One per byte of the program
+	std::vector<ControlFlowBlock> m_blocks;
+	std::vector<PendingPath> m_pending;
+	int m_programSize;
+	QuirkProfile m_quirkProfile;
+
+	bool InProgram(unsigned int address);
+	Instruction DecodeAt(const unsigned char *memory, const Chip8Quirks& quirks, unsigned int address, unsigned short& length);
+	bool EndsBlock(const unsigned char *memory, const Chip8Quirks& quirks, const Instruction& instruction, unsigned short length,
+		ControlFlowBlock& block);
+};
@@ -0,0 +1,348 @@
+#include "Disassembler.h"
+#include <cwchar>
+#include <iomanip>
+
+/*****************************************************************************************************************************************/
+//
+// Decode - Splits an opcode into a structured instruction record
+//
+// Inputs - address (where the opcode lives, kept so the record can be rendered on its own)
+//          opcode (the two byte instruction)
+//          nextOpcode (the two bytes after it, the address an XO-CHIP F000 loads into I)
+//
+// Outputs - The decoded instruction. Unknown opcodes decode to Mnemonic::INVALID
+//
+// Notes - No text is produced here. Rendering is done on demand by Render so the decoder can be used by anything that needs to
+//         reason about the program without paying for formatting
+/*****************************************************************************************************************************************/
+Instruction Disassembler::Decode(unsigned short address, unsigned short opcode, unsigned short nextOpcode)
+{
+	Instruction instruction;
+	instruction.address = address;
+	instruction.opcode = opcode;
+	instruction.x = (opcode & 0x0F00) >> 8;
+	instruction.y = (opcode & 0x00F0) >> 4;
+	instruction.n = (opcode & 0x000F);
+	instruction.nn = (opcode & 0x00FF);
+	instruction.nnn = (opcode & 0x0FFF);
+	instruction.mnemonic = Mnemonic::INVALID;
+
+	switch ((opcode & 0xF000) >> 12)
+	{
+		case 0x0:
+			if (0x00E0 == opcode)
+				instruction.mnemonic = Mnemonic::CLS;
+			else if (0x00EE == opcode)
+				instruction.mnemonic = Mnemonic::RET;
+			else if (0x00C0 == (opcode & 0xFFF0))
+				instruction.mnemonic = Mnemonic::SCD_N;
+			else if (0x00D0 == (opcode & 0xFFF0))
+				instruction.mnemonic = Mnemonic::SCU_N;
+			else if (0x00FB == opcode)
+				instruction.mnemonic = Mnemonic::SCR;
+			else if (0x00FC == opcode)
+				instruction.mnemonic = Mnemonic::SCL;
+			else if (0x00FD == opcode)
+				instruction.mnemonic = Mnemonic::EXIT;
+			else if (0x00FE == opcode)
+				instruction.mnemonic = Mnemonic::LOW;
+			else if (0x00FF == opcode)
+				instruction.mnemonic = Mnemonic::HIGH;
+			break;
+		case 0x1:
+			instruction.mnemonic = Mnemonic::JP;
+			break;
+		case 0x2:
+			instruction.mnemonic = Mnemonic::CALL;
+			break;
+		case 0x3:
+			instruction.mnemonic = Mnemonic::SE_VX_NN;
+			break;
+		case 0x4:
+			instruction.mnemonic = Mnemonic::SNE_VX_NN;
+			break;
+		case 0x5:
+			if (0 == instruction.n)
+				instruction.mnemonic = Mnemonic::SE_VX_VY;
+			else if (0x2 == instruction.n)
+				instruction.mnemonic = Mnemonic::SAVE_VX_VY;
+			else if (0x3 == instruction.n)
+				instruction.mnemonic = Mnemonic::LOAD_VX_VY;
+			break;
+		case 0x6:
+			instruction.mnemonic = Mnemonic::LD_VX_NN;
+			break;
+		case 0x7:
+			instruction.mnemonic = Mnemonic::ADD_VX_NN;
+			break;
+		case 0x8:
+		{
+			static const Mnemonic aluOperations[16] = {
+				Mnemonic::LD_VX_VY, Mnemonic::OR_VX_VY, Mnemonic::AND_VX_VY, Mnemonic::XOR_VX_VY,
+				Mnemonic::ADD_VX_VY, Mnemonic::SUB_VX_VY, Mnemonic::SHR_VX_VY, Mnemonic::SUBN_VX_VY,
+				Mnemonic::INVALID, Mnemonic::INVALID, Mnemonic::INVALID, Mnemonic::INVALID,
+				Mnemonic::INVALID, Mnemonic::INVALID, Mnemonic::SHL_VX_VY, Mnemonic::INVALID,
+			};
+			instruction.mnemonic = aluOperations[instruction.n];
+		}
+			break;
+		case 0x9:
+			if (0 == instruction.n)
+				instruction.mnemonic = Mnemonic::SNE_VX_VY;
+			break;
+		case 0xA:
+			instruction.mnemonic = Mnemonic::LD_I_NNN;
+			break;
+		case 0xB:
+			instruction.mnemonic = Mnemonic::JP_V0_NNN;
+			break;
+		case 0xC:
+			instruction.mnemonic = Mnemonic::RND_VX_NN;
+			break;
+		case 0xD:
+			instruction.mnemonic = Mnemonic::DRW_VX_VY_N;
+			break;
+		case 0xE:
+			if (0x9E == instruction.nn)
+				instruction.mnemonic = Mnemonic::SKP_VX;
+			else if (0xA1 == instruction.nn)
+				instruction.mnemonic = Mnemonic::SKNP_VX;
+			break;
+		case 0xF:
+			if (0xF000 == opcode)
+			{
+				instruction.mnemonic = Mnemonic::LD_I_LONG;
+				instruction.nnn = nextOpcode;
+				break;
+			}
+			switch (instruction.nn)
+			{
+				case 0x01: instruction.mnemonic = Mnemonic::PLANE_N; break;
+				case 0x07: instruction.mnemonic = Mnemonic::LD_VX_DT; break;
+				case 0x0A: instruction.mnemonic = Mnemonic::LD_VX_K; break;
+				case 0x15: instruction.mnemonic = Mnemonic::LD_DT_VX; break;
+				case 0x18: instruction.mnemonic = Mnemonic::LD_ST_VX; break;
+				case 0x1E: instruction.mnemonic = Mnemonic::ADD_I_VX; break;
+				case 0x29: instruction.mnemonic = Mnemonic::LD_F_VX; break;
+				case 0x33: instruction.mnemonic = Mnemonic::LD_B_VX; break;
+				case 0x55: instruction.mnemonic = Mnemonic::LD_MEM_VX; break;
+				case 0x65: instruction.mnemonic = Mnemonic::LD_VX_MEM; break;
+				case 0x30: instruction.mnemonic = Mnemonic::LD_HF_VX; break;
+				case 0x75: instruction.mnemonic = Mnemonic::LD_R_VX; break;
+				case 0x85: instruction.mnemonic = Mnemonic::LD_VX_R; break;
+			}
+			break;
+	}
+
+	return instruction;
+}
+
+const wchar_t* Disassembler::GetMnemonicName(Mnemonic mnemonic)
+{
+	switch (mnemonic)
+	{
+		case Mnemonic::CLS:         return L"CLS";
+		case Mnemonic::RET:         return L"RET";
+		case Mnemonic::JP:          return L"JP";
+		case Mnemonic::CALL:        return L"CALL";
+		case Mnemonic::SE_VX_NN:
+		case Mnemonic::SE_VX_VY:    return L"SE";
+		case Mnemonic::SNE_VX_NN:
+		case Mnemonic::SNE_VX_VY:   return L"SNE";
+		case Mnemonic::LD_VX_NN:
+		case Mnemonic::LD_VX_VY:
+		case Mnemonic::LD_I_NNN:
+		case Mnemonic::LD_VX_DT:
+		case Mnemonic::LD_VX_K:
+		case Mnemonic::LD_DT_VX:
+		case Mnemonic::LD_ST_VX:
+		case Mnemonic::LD_F_VX:
+		case Mnemonic::LD_B_VX:
+		case Mnemonic::LD_MEM_VX:
+		case Mnemonic::LD_VX_MEM:
+		case Mnemonic::LD_HF_VX:
+		case Mnemonic::LD_R_VX:
+		case Mnemonic::LD_VX_R:
+		case Mnemonic::LD_I_LONG:   return L"LD";
+		case Mnemonic::ADD_VX_NN:
+		case Mnemonic::ADD_VX_VY:
+		case Mnemonic::ADD_I_VX:    return L"ADD";
+		case Mnemonic::OR_VX_VY:    return L"OR";
+		case Mnemonic::AND_VX_VY:   return L"AND";
+		case Mnemonic::XOR_VX_VY:   return L"XOR";
+		case Mnemonic::SUB_VX_VY:   return L"SUB";
+		case Mnemonic::SHR_VX_VY:   return L"SHR";
+		case Mnemonic::SUBN_VX_VY:  return L"SUBN";
+		case Mnemonic::SHL_VX_VY:   return L"SHL";
+		case Mnemonic::JP_V0_NNN:   return L"JP";
+		case Mnemonic::RND_VX_NN:   return L"RND";
+		case Mnemonic::DRW_VX_VY_N: return L"DRW";
+		case Mnemonic::SKP_VX:      return L"SKP";
+		case Mnemonic::SKNP_VX:     return L"SKNP";
+		case Mnemonic::SCD_N:       return L"SCD";
+		case Mnemonic::SCR:         return L"SCR";
+		case Mnemonic::SCL:         return L"SCL";
+		case Mnemonic::EXIT:        return L"EXIT";
+		case Mnemonic::LOW:         return L"LOW";
+		case Mnemonic::HIGH:        return L"HIGH";
+		case Mnemonic::SCU_N:       return L"SCU";
+		case Mnemonic::SAVE_VX_VY:  return L"SAVE";
+		case Mnemonic::LOAD_VX_VY:  return L"LOAD";
+		case Mnemonic::PLANE_N:     return L"PLANE";
+		case Mnemonic::DB:          return L"DB";
+		default:                    return L"???";
+	}
+}
+
+/*****************************************************************************************************************************************/
+//
+// Render - Formats a decoded instruction for the source and debug list boxes
+//
+// Inputs - instruction (record produced by Decode)
+//          description (stream the text is appended to)
+//
+// Outputs - None
+//
+// Notes - The layout is "0xADDR: 0xOPCODE     MNEM operands"
+/*****************************************************************************************************************************************/
+void Disassembler::Render(const Instruction& instruction, std::wostringstream& description)
+{
+	const int x = instruction.x;
+	const int y = instruction.y;
+	const int n = instruction.n;
+	const int nn = instruction.nn;
+	const int nnn = instruction.nnn;
+
+	description << L"0x" << std::uppercase << std::setfill(L'0') << std::setw(4) << std::hex << instruction.address
+	            << L": 0x" << std::setw(4) << instruction.opcode << L"     " << GetMnemonicName(instruction.mnemonic);
+
+	// Line the operands up in a column after the mnemonic
+	bool hasOperands;
+	switch (instruction.mnemonic)
+	{
+		case Mnemonic::INVALID:
+		case Mnemonic::CLS:
+		case Mnemonic::RET:
+		case Mnemonic::SCR:
+		case Mnemonic::SCL:
+		case Mnemonic::EXIT:
+		case Mnemonic::LOW:
+		case Mnemonic::HIGH:
+			hasOperands = false;
+			break;
+		default:
+			hasOperands = true;
+			break;
+	}
+	if (hasOperands)
+	{
+		// At least one space, PLANE already fills the column
+		size_t column = std::wcslen(GetMnemonicName(instruction.mnemonic));
+		do
+			description << L' ';
+		while (++column < 5);
+	}
+
+	switch (instruction.mnemonic)
+	{
+		case Mnemonic::JP:
+		case Mnemonic::CALL:
+			description << L"0x" << std::setw(4) << nnn;
+			break;
+		case Mnemonic::SE_VX_NN:
+		case Mnemonic::SNE_VX_NN:
+		case Mnemonic::LD_VX_NN:
+		case Mnemonic::ADD_VX_NN:
+		case Mnemonic::RND_VX_NN:
+			description << L"V" << x << L", 0x" << std::setw(2) << nn;
+			break;
+		case Mnemonic::SE_VX_VY:
+		case Mnemonic::SNE_VX_VY:
+		case Mnemonic::LD_VX_VY:
+		case Mnemonic::OR_VX_VY:
+		case Mnemonic::AND_VX_VY:
+		case Mnemonic::XOR_VX_VY:
+		case Mnemonic::ADD_VX_VY:
+		case Mnemonic::SUB_VX_VY:
+		case Mnemonic::SHR_VX_VY:
+		case Mnemonic::SUBN_VX_VY:
+		case Mnemonic::SHL_VX_VY:
+			description << L"V" << x << L", V" << y;
+			break;
+		case Mnemonic::LD_I_NNN:
+			description << L"I, 0x" << std::setw(3) << nnn;
+			break;
+		case Mnemonic::JP_V0_NNN:
+			description << L"V0, 0x" << std::setw(3) << nnn;
+			break;
+		case Mnemonic::DRW_VX_VY_N:
+			description << L"V" << x << L", V" << y << L", 0x" << std::setw(2) << n;
+			break;
+		case Mnemonic::SKP_VX:
+		case Mnemonic::SKNP_VX:
+			description << L"V" << x;
+			break;
+		case Mnemonic::LD_VX_DT:
+			description << L"V" << x << L", DT";
+			break;
+		case Mnemonic::LD_VX_K:
+			description << L"V" << x << L", K";
+			break;
+		case Mnemonic::LD_DT_VX:
+			description << L"DT, V" << x;
+			break;
+		case Mnemonic::LD_ST_VX:
+			description << L"ST, V" << x;
+			break;
+		case Mnemonic::ADD_I_VX:
+			description << L"I, V" << x;
+			break;
+		case Mnemonic::LD_F_VX:
+			description << L"F, V" << x;
+			break;
+		case Mnemonic::LD_B_VX:
+			description << L"B, V" << x;
+			break;
+		case Mnemonic::LD_MEM_VX:
+			description << L"[I], V" << x;
+			break;
+		case Mnemonic::LD_VX_MEM:
+			description << L"V" << x << L", [I]";
+			break;
+		case Mnemonic::SCD_N:
+		case Mnemonic::SCU_N:
+			description << L"0x" << std::setw(1) << n;
+			break;
+		case Mnemonic::SAVE_VX_VY:
+		case Mnemonic::LOAD_VX_VY:
+			description << L"V" << x << L" - V" << y;
+			break;
+		case Mnemonic::LD_I_LONG:
+			description << L"I, 0x" << std::setw(4) << nnn;
+			break;
+		case Mnemonic::PLANE_N:
+			description << std::setw(1) << x;
+			break;
+		case Mnemonic::DB:
+			description << L"0x" << std::setw(2) << (instruction.opcode >> 8) << L", 0x" << std::setw(2) << (instruction.opcode & 0xFF);
+			break;
+		case Mnemonic::LD_HF_VX:
+			description << L"HF, V" << x;
+			break;
+		case Mnemonic::LD_R_VX:
+			description << L"R, V" << x;
+			break;
+		case Mnemonic::LD_VX_R:
+			description << L"V" << x << L", R";
+			break;
+		default:
+			break;
+	}
+}
+
+std::wstring Disassembler::ToString(const Instruction& instruction)
+{
+	std::wostringstream description;
+	Render(instruction, description);
+	return description.str();
+}
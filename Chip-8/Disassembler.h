@@ -0,0 +1,85 @@
+#pragma once
+#include <sstream>
+#include <string>
+
+// Every instruction the Chip8 understands. The operands each one uses are noted next to it
+enum class Mnemonic : unsigned char
+{
+	INVALID,
+	CLS,          // 00E0
+	RET,          // 00EE
+	JP,           // 1NNN
+	CALL,         // 2NNN
+	SE_VX_NN,     // 3XNN
+	SNE_VX_NN,    // 4XNN
+	SE_VX_VY,     // 5XY0
+	LD_VX_NN,     // 6XNN
+	ADD_VX_NN,    // 7XNN
+	LD_VX_VY,     // 8XY0
+	OR_VX_VY,     // 8XY1
+	AND_VX_VY,    // 8XY2
+	XOR_VX_VY,    // 8XY3
+	ADD_VX_VY,    // 8XY4
+	SUB_VX_VY,    // 8XY5
+	SHR_VX_VY,    // 8XY6
+	SUBN_VX_VY,   // 8XY7
+	SHL_VX_VY,    // 8XYE
+	SNE_VX_VY,    // 9XY0
+	LD_I_NNN,     // ANNN
+	JP_V0_NNN,    // BNNN
+	RND_VX_NN,    // CXNN
+	DRW_VX_VY_N,  // DXYN
+	SKP_VX,       // EX9E
+	SKNP_VX,      // EXA1
+	LD_VX_DT,     // FX07
+	LD_VX_K,      // FX0A
+	LD_DT_VX,     // FX15
+	LD_ST_VX,     // FX18
+	ADD_I_VX,     // FX1E
+	LD_F_VX,      // FX29
+	LD_B_VX,      // FX33
+	LD_MEM_VX,    // FX55
+	LD_VX_MEM,    // FX65
+	// SUPER-CHIP. Decoded whatever the quirk profile, only the SUPER_CHIP and XO_CHIP profiles run them
+	SCD_N,        // 00CN
+	SCR,          // 00FB
+	SCL,          // 00FC
+	EXIT,         // 00FD
+	LOW,          // 00FE
+	HIGH,         // 00FF
+	LD_HF_VX,     // FX30
+	LD_R_VX,      // FX75
+	LD_VX_R,      // FX85
+	// XO-CHIP. Decoded whatever the quirk profile, only the XO_CHIP profile runs them
+	SCU_N,        // 00DN
+	SAVE_VX_VY,   // 5XY2
+	LOAD_VX_VY,   // 5XY3
+	LD_I_LONG,    // F000 NNNN, with NNNN in nnn
+	PLANE_N,      // FN01
+	// Never decoded. Two bytes that something else, like a ControlFlowGraph, knows are not an instruction
+	DB,
+	COUNT
+};
+
+// A decoded instruction. Only the operands that the mnemonic uses are meaningful
+struct Instruction
+{
+	unsigned short address;
+	unsigned short opcode;
+	unsigned short nnn;
+	Mnemonic mnemonic;
+	unsigned char x;
+	unsigned char y;
+	unsigned char n;
+	unsigned char nn;
+};
+
+class Disassembler
+{
+public:
+	// nextOpcode is the word after opcode, only used as the operand of an F000
+	static Instruction Decode(unsigned short address, unsigned short opcode, unsigned short nextOpcode = 0);
+	static const wchar_t* GetMnemonicName(Mnemonic mnemonic);
+	static void Render(const Instruction& instruction, std::wostringstream& description);
+	static std::wstring ToString(const Instruction& instruction);
+};
@@ -0,0 +1,225 @@
+#include "EmulationThread.h"
+
+EmulationThread::EmulationThread(Chip8& chip) :
+	m_chip(chip),
+	m_movie(nullptr),
+	m_instructionsPerSecond(Pacer::DEFAULT_INSTRUCTIONS_PER_SECOND),
+	m_framesPerSecond(Pacer::DEFAULT_FRAMES_PER_SECOND),
+	m_mode(PacingMode::REAL_TIME),
+	m_multiplier(1),
+	m_settingsChanged(true),
+	m_running(false),
+	m_stopRequested(false),
+	m_events(0),
+	m_frameCount(0),
+	m_instructionCount(0)
+{
+}
+
+
+EmulationThread::~EmulationThread()
+{
+	Stop();
+}
+
+void EmulationThread::SetRate(unsigned int instructionsPerSecond, unsigned int framesPerSecond)
+{
+	std::lock_guard<std::mutex> lock(m_settingsLock);
+	m_instructionsPerSecond = instructionsPerSecond;
+	m_framesPerSecond = framesPerSecond;
+	m_settingsChanged.store(true, std::memory_order_release);
+}
+
+void EmulationThread::SetPacing(PacingMode mode, unsigned int multiplier)
+{
+	std::lock_guard<std::mutex> lock(m_settingsLock);
+	m_mode = mode;
+	m_multiplier = multiplier;
+	m_settingsChanged.store(true, std::memory_order_release);
+}
+
+int EmulationThread::Start(unsigned long long frameLimit)
+{
+	if (IsRunning())
+		return -1;
+
+	// The thread may have stopped on its own, in which case it still has to be joined
+	if (m_thread.joinable())
+		m_thread.join();
+
+	m_stopRequested.store(false, std::memory_order_relaxed);
+	m_frameCount.store(0, std::memory_order_relaxed);
+	m_instructionCount.store(0, std::memory_order_relaxed);
+	m_running.store(true, std::memory_order_release);
+	m_thread = std::thread(&EmulationThread::ThreadMain, this, frameLimit);
+	return 0;
+}
+
+void EmulationThread::Stop()
+{
+	m_stopRequested.store(true, std::memory_order_relaxed);
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+bool EmulationThread::IsRunning()
+{
+	return m_running.load(std::memory_order_acquire);
+}
+
+int EmulationThread::QueueInput(const Chip8InputEvent& event)
+{
+	if (!m_input.Push(event))
+		return -1;
+
+	// Once IsRunning is false the thread no longer touches the queue, so this thread can take over consuming it
+	if (!IsRunning())
+		ApplyInput(~0ull);
+	return 0;
+}
+
+int EmulationThread::KeyPress(char key, unsigned long long frame)
+{
+	return QueueInput({ frame, key, InputEventType::KEY_PRESS });
+}
+
+int EmulationThread::KeyDown(char key, unsigned long long frame)
+{
+	return QueueInput({ frame, key, InputEventType::KEY_DOWN });
+}
+
+int EmulationThread::KeyUp(char key, unsigned long long frame)
+{
+	return QueueInput({ frame, key, InputEventType::KEY_UP });
+}
+
+bool EmulationThread::AcquireFrame()
+{
+	return m_frames.Acquire();
+}
+
+const Chip8Frame& EmulationThread::GetFrame()
+{
+	return m_frames.GetFrontFrame();
+}
+
+int EmulationThread::TakeEvents()
+{
+	return m_events.exchange(0, std::memory_order_acq_rel);
+}
+
+int EmulationThread::SetMovie(Movie *movie)
+{
+	if (IsRunning())
+		return -1;
+	m_movie = movie;
+	return 0;
+}
+
+AudioStream& EmulationThread::GetAudio()
+{
+	return m_audio;
+}
+
+unsigned long long EmulationThread::GetFrameCount()
+{
+	return m_frameCount.load(std::memory_order_relaxed);
+}
+
+unsigned long long EmulationThread::GetInstructionCount()
+{
+	return m_instructionCount.load(std::memory_order_relaxed);
+}
+
+/*****************************************************************************************************************************************/
+//
+// ThreadMain - Runs paced frames until asked to stop, the frame limit is reached or the machine hits a bad opcode
+//
+// Inputs - frameLimit (frames to run, 0 for no limit)
+//
+// Outputs - None
+//
+// Notes - Stop can take up to one frame period to return, as the thread only checks for it between frames
+/*****************************************************************************************************************************************/
+void EmulationThread::ThreadMain(unsigned long long frameLimit)
+{
+	unsigned long long frames = 0;
+	unsigned long long instructions = 0;
+
+	ApplySettings();
+	m_pacer.Start();
+	m_chip.TakeDirtyRows();
+	PublishFrame();
+
+	while (!m_stopRequested.load(std::memory_order_relaxed))
+	{
+		if (m_settingsChanged.load(std::memory_order_acquire))
+			ApplySettings();
+
+		m_pacer.WaitForNextFrame();
+		ApplyInput(frames + 1);
+		unsigned int cycles = m_pacer.NextFrame();
+		unsigned int executed = 0;
+		int status = m_chip.RunFrame(cycles, executed);
+		if (nullptr != m_movie)
+			m_movie->RecordFrame(m_chip, cycles);
+		m_audio.GenerateFrame(0 != (status & 0xC)); // The sound timer was running when the frame's tick came
+
+		frames++;
+		instructions += executed;
+		m_frameCount.store(frames, std::memory_order_relaxed);
+		m_instructionCount.store(instructions, std::memory_order_relaxed);
+
+		if (0 != m_chip.TakeDirtyRows())
+			PublishFrame();
+		if (status & 0xE5)
+			m_events.fetch_or(status & 0xE5, std::memory_order_release);
+		if ((status & 0x1) || (frames == frameLimit))
+			break;
+	}
+
+	// The last frame carries the final pc even if the display did not change
+	PublishFrame();
+	m_running.store(false, std::memory_order_release);
+}
+
+void EmulationThread::ApplySettings()
+{
+	std::lock_guard<std::mutex> lock(m_settingsLock);
+	m_settingsChanged.store(false, std::memory_order_relaxed);
+	if ((m_pacer.GetInstructionsPerSecond() != m_instructionsPerSecond) || (m_pacer.GetFramesPerSecond() != m_framesPerSecond))
+	{
+		m_pacer.SetRate(m_instructionsPerSecond, m_framesPerSecond);
+		m_audio.SetFrameRate(m_pacer.GetFramesPerSecond());
+	}
+	if ((m_pacer.GetMode() != m_mode) || (m_pacer.GetMultiplier() != m_multiplier))
+		m_pacer.SetMode(m_mode, m_multiplier);
+}
+
+// Applies the queued events due by frame, in the order they were queued. Events are queued in frame order, so the first one
+// that is not due yet holds back the rest
+void EmulationThread::ApplyInput(unsigned long long frame)
+{
+	Chip8InputEvent event;
+	while (m_input.Peek(event) && (event.frame <= frame))
+	{
+		m_chip.ApplyInput(event);
+		if (nullptr != m_movie)
+			m_movie->RecordInput(event);
+		m_input.Pop();
+	}
+}
+
+void EmulationThread::PublishFrame()
+{
+	Chip8Frame& frame = m_frames.GetBackFrame();
+	for (unsigned char row = 0; row < CHIP_8_HIRES_HEIGHT; row++)
+	{
+		frame.rows[row] = m_chip.GetDisplayRow(row);
+		frame.planeRows[row] = m_chip.GetPlaneRow(1, row);
+	}
+	frame.highResolution = m_chip.IsHighResolution();
+	frame.number = m_frameCount.load(std::memory_order_relaxed);
+	frame.pc = m_chip.GetPC();
+	m_frames.Publish();
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "AudioStream.h"
+#include "Chip8.h"
+#include "FrameBuffer.h"
+#include "InputQueue.h"
+#include "Movie.h"
+#include "Pacer.h"
+
+/*****************************************************************************************************************************************/
+//
+// EmulationThread - Runs a Chip8 on its own thread and publishes its display through a FrameBuffer
+//
+// Notes - While the thread runs it owns the machine: the controlling thread must not call the Chip8 directly, and goes through
+//         the key functions, SetRate and SetPacing here instead. Once Stop returns, or IsRunning has returned false, the machine
+//         belongs to the controlling thread again, for single stepping, resets and so on.
+//
+//         A frame is published each time the display changes, and once more when the thread stops. The presenter picks up the
+//         newest one with AcquireFrame whenever it is ready to draw, so a slow presenter never holds up the emulator and never
+//         sees half a frame. Status bits the presenter must not miss (faults, the SUPER-CHIP exit and sound timer expired) are
+//         collected separately and read with TakeEvents. Each frame also adds its samples to an AudioStream for an audio backend to drain.
+//         A Movie given to SetMovie is told about every input event and frame, whichever thread applies them.
+/*****************************************************************************************************************************************/
+class EmulationThread
+{
+public:
+	EmulationThread(Chip8& chip);
+	~EmulationThread();
+	EmulationThread(const EmulationThread&) = delete;
+	EmulationThread& operator=(const EmulationThread&) = delete;
+
+	// Takes effect at the start of the next frame
+	void SetRate(unsigned int instructionsPerSecond, unsigned int framesPerSecond);
+	void SetPacing(PacingMode mode, unsigned int multiplier = 1);
+
+	// Returns -1 if the thread is already running. frameLimit stops the thread after that many frames, 0 runs until Stop
+	int Start(unsigned long long frameLimit = 0);
+	void Stop();
+	bool IsRunning();
+
+	// Queued for the machine and applied between frames, at the first frame numbered frame or later (0 for the next one). When
+	// the thread is not running the queue is applied straight away. Returns -1 if the queue is full
+	int QueueInput(const Chip8InputEvent& event);
+	int KeyPress(char key, unsigned long long frame = 0);
+	int KeyDown(char key, unsigned long long frame = 0);
+	int KeyUp(char key, unsigned long long frame = 0);
+
+	bool AcquireFrame();
+	const Chip8Frame& GetFrame();
+	// The 0x1, 0x4, stack fault (0x20 and 0x40) and SUPER-CHIP exit (0x80) status bits of every frame run since the last call, ORed
+	// together
+	int TakeEvents();
+	// Only while the thread is stopped, returns -1 otherwise. nullptr stops recording
+	int SetMovie(Movie *movie);
+	// The controlling thread (or an audio callback) is the consumer
+	AudioStream& GetAudio();
+
+	unsigned long long GetFrameCount();
+	unsigned long long GetInstructionCount();
+
+private:
+	Chip8& m_chip;
+	Pacer m_pacer;                         // Only used by the emulation thread while it runs
+	FrameBuffer m_frames;
+	AudioStream m_audio;
+	InputQueue m_input;                    // Consumed by whichever thread owns the machine
+	Movie *m_movie;                        // Likewise
+	std::thread m_thread;
+
+	std::mutex m_settingsLock;
+	unsigned int m_instructionsPerSecond;
+	unsigned int m_framesPerSecond;
+	PacingMode m_mode;
+	unsigned int m_multiplier;
+	std::atomic<bool> m_settingsChanged;
+
+	std::atomic<bool> m_running;
+	std::atomic<bool> m_stopRequested;
+	std::atomic<int> m_events;
+	std::atomic<unsigned long long> m_frameCount;
+	std::atomic<unsigned long long> m_instructionCount;
+
+	void ThreadMain(unsigned long long frameLimit);
+	void ApplySettings();
+	void ApplyInput(unsigned long long frame);
+	void PublishFrame();
+};
@@ -0,0 +1,462 @@
+// EngineTest.cpp : Checks the execution engines, run by ctest. Returns 0 when every check passes and 1 when any fails, printing
+//                  what went wrong.
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Chip8.h"
+#include "JitX64.h"
+#include "LockstepBatch.h"
+
+// Keyboard characters for CHIP-8 keys 0x0-0xF
+static const char keyCharacters[16] = { 'X', '1', '2', '3', 'Q', 'W', 'E', 'A', 'S', 'D', 'Z', 'C', '4', 'R', 'F', 'V' };
+
+static unsigned int NextRandom(unsigned int& state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+/*****************************************************************************************************************************************/
+//
+// RandomRom - Makes a program of random instructions that stays mostly in bounds
+//
+// Inputs - seed (the same seed always makes the same program)
+//          instructions (length of the program in instructions)
+//
+// Outputs - The program
+//
+// Notes - Jumps, calls and ANNN aim inside the program, and registers are loaded with small values often enough for key tests
+//         and skips to go both ways. Some programs still wander off or fault, which the engines have to agree on too
+/*****************************************************************************************************************************************/
+static std::vector<unsigned char> RandomRom(unsigned int seed, int instructions)
+{
+	static const unsigned short aluOperations[9] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+	unsigned int state = seed * 2654435761u + 1;
+	std::vector<unsigned char> rom;
+	for (int i = 0; i < instructions; i++)
+	{
+		unsigned short x = NextRandom(state) & 0xF;
+		unsigned short y = NextRandom(state) & 0xF;
+		unsigned short nn = NextRandom(state) & 0xFF;
+		unsigned short instruction = (unsigned short)(START_CHIP_8_PROGRAM + 2 * (NextRandom(state) % instructions));
+		unsigned short opcode = 0;
+		switch (NextRandom(state) % 28)
+		{
+			case 0:  opcode = 0x6000 | (x << 8) | ((NextRandom(state) & 1) ? nn : (nn & 0xF)); break;
+			case 1:  opcode = 0x7000 | (x << 8) | nn; break;
+			case 2:  opcode = 0x8000 | (x << 8) | (y << 4) | aluOperations[NextRandom(state) % 9]; break;
+			case 3:  opcode = 0x9000 | (x << 8) | (y << 4); break;
+			case 4:  opcode = 0x3000 | (x << 8) | (nn & 0xF); break;
+			case 5:  opcode = 0x4000 | (x << 8) | nn; break;
+			case 6:  opcode = 0x5000 | (x << 8) | (y << 4); break;
+			case 7:  opcode = 0xA000 | (START_CHIP_8_PROGRAM + NextRandom(state) % (2 * instructions)); break;
+			case 8:  opcode = 0xF01E | (x << 8); break;
+			case 9:  opcode = 0xF029 | (x << 8); break;
+			case 10: opcode = 0xF033 | (x << 8); break;
+			case 11: opcode = 0xF055 | (x << 8); break;
+			case 12: opcode = 0xF065 | (x << 8); break;
+			case 13: opcode = 0xF015 | (x << 8); break;
+			case 14: opcode = 0xF007 | (x << 8); break;
+			case 15: opcode = 0xF018 | (x << 8); break;
+			case 16:
+			case 17: opcode = 0x1000 | instruction; break;
+			case 18: opcode = 0xE09E | (x << 8); break;
+			case 19: opcode = 0xE0A1 | (x << 8); break;
+			case 20: opcode = 0xB000 | (START_CHIP_8_PROGRAM + 2 * (NextRandom(state) % (instructions / 2))); break;
+			case 21: opcode = 0xD000 | (x << 8) | (y << 4) | (nn & 0xF); break;
+			case 22: opcode = 0xF00A | (x << 8); break;
+			case 23: opcode = 0x2000 | instruction; break;
+			case 24: opcode = 0x00EE; break;
+			case 25: opcode = 0x00E0; break;
+			case 26: opcode = 0xC000 | (x << 8) | nn; break;
+			default: opcode = 0x8004 | (x << 8) | (y << 4); break;
+		}
+		rom.push_back((unsigned char)(opcode >> 8));
+		rom.push_back((unsigned char)(opcode & 0xFF));
+	}
+	return rom;
+}
+
+static bool SameState(Chip8& first, Chip8& second)
+{
+	Chip8State firstState;
+	Chip8State secondState;
+	first.SaveState(firstState);
+	second.SaveState(secondState);
+	return (0 == std::memcmp(&firstState, &secondState, sizeof(Chip8State)));
+}
+
+/*****************************************************************************************************************************************/
+//
+// TestJitCodeBuffer - Compiles the largest block there is over and over until the JIT's code buffer fills up and is flushed
+//
+// Outputs - 0 if every run left the same state as the interpreter, 1 if not. An overrun of the buffer usually crashes instead
+//
+// Notes - A block of 64 FF65 is the most code one block can need. The buffer is filled from a different starting point each round,
+//         by first compiling a one instruction block a number of times, so one of the rounds reaches the end of the buffer with
+//         less room than the block needs
+/*****************************************************************************************************************************************/
+static int TestJitCodeBuffer()
+{
+	std::vector<unsigned char> rom = { 0x12, 0x04, 0x00, 0x00 }; // A block of just the jump over the gap to the large block
+	for (int x = 0; x < 64; x++)
+	{
+		rom.push_back(0xFF);
+		rom.push_back(0x65);
+	}
+	rom.push_back(0x12);
+	rom.push_back(0x04);
+
+	Chip8 reference;
+	reference.LoadProgram(rom.data(), (int)rom.size());
+	reference.SetRandomSeed(1);
+	reference.Reset();
+	unsigned int executed = 0;
+	reference.Run(65, executed);
+
+	for (int filler = 0; filler <= 320; filler += 16)
+	{
+		JitX64 jit;
+		if (!jit.IsAvailable())
+			return 0;
+		Chip8 chip;
+		chip.LoadProgram(rom.data(), (int)rom.size());
+		chip.SetRandomSeed(1);
+		for (int x = 0; x < filler; x++)
+		{
+			jit.InvalidateAll();
+			chip.Reset();
+			jit.Run(chip, 1, executed);
+		}
+		// Each block is about 15 KB, so this goes around the 4 MB buffer more than twice
+		for (int block = 0; block < 600; block++)
+		{
+			jit.InvalidateAll();
+			chip.Reset();
+			jit.Run(chip, 65, executed);
+			if (!SameState(chip, reference))
+			{
+				std::cout << "JIT code buffer: block " << block << " after " << filler << " small blocks left a different state" << std::endl;
+				return 1;
+			}
+		}
+	}
+	std::cout << "JIT code buffer: ok" << std::endl;
+	return 0;
+}
+
+/*****************************************************************************************************************************************/
+//
+// TestEngines - Runs random programs on the interpreter, the block cache and the JIT side by side
+//
+// Inputs - roms (programs to run under each of the CHIP-8, COSMAC VIP and SUPER-CHIP profiles)
+//
+// Outputs - 0 if the saved state of every engine matched the interpreter's after every frame, 1 if not
+//
+// Notes - Each program holds one key down and taps others, and runs a different number of instructions per frame, so the
+//         engines are also made to agree where a block is cut short by the budget and across the timers ticking
+/*****************************************************************************************************************************************/
+static int TestEngines(unsigned int roms)
+{
+	static const ExecutionEngine engines[3] = { ExecutionEngine::INTERPRETER, ExecutionEngine::BLOCK_CACHE, ExecutionEngine::JIT };
+	static const char *engineNames[3] = { "interpreter", "blocks", "jit" };
+	static const QuirkProfile profiles[3] = { QuirkProfile::CHIP_8, QuirkProfile::COSMAC_VIP, QuirkProfile::SUPER_CHIP };
+	static const char *profileNames[3] = { "chip8", "vip", "schip" };
+	static const unsigned int framesizes[4] = { 1, 37, 500, 5000 };
+
+	for (int profile = 0; profile < 3; profile++)
+	{
+		for (unsigned int seed = 0; seed < roms; seed++)
+		{
+			std::vector<unsigned char> rom = RandomRom(seed, 120);
+			Chip8 machines[3];
+			int engineCount = 0;
+			for (int engine = 0; engine < 3; engine++)
+			{
+				machines[engineCount].SetQuirkProfile(profiles[profile]);
+				machines[engineCount].LoadProgram(rom.data(), (int)rom.size());
+				machines[engineCount].SetRandomSeed(seed + 1);
+				if (0 != machines[engineCount].SetExecutionEngine(engines[engine]))
+					continue;
+				machines[engineCount].Reset();
+				machines[engineCount].Executing();
+				machines[engineCount].KeyDown(keyCharacters[seed % 16]);
+				engineCount++;
+			}
+
+			unsigned int instructionsPerFrame = framesizes[seed % 4];
+			for (int frame = 0; frame < 20; frame++)
+			{
+				int status[3] = { 0, 0, 0 };
+				for (int engine = 0; engine < engineCount; engine++)
+				{
+					unsigned int executed = 0;
+					status[engine] = machines[engine].RunFrame(instructionsPerFrame, executed);
+				}
+				for (int engine = 1; engine < engineCount; engine++)
+				{
+					if ((status[engine] != status[0]) || !SameState(machines[engine], machines[0]))
+					{
+						std::cout << "engines: " << engineNames[engine] << " differs from the interpreter on ROM " << seed << " under "
+						          << profileNames[profile] << " after frame " << frame << std::endl;
+						return 1;
+					}
+				}
+				if (status[0] & 0x1)
+					break;
+				// Tap a key every few frames, and answer FX0A when a machine waits on it
+				if ((0 == frame % 3) || machines[0].IsWaitingForInput())
+				{
+					for (int engine = 0; engine < engineCount; engine++)
+						machines[engine].KeyPress(keyCharacters[(seed + frame) % 16]);
+				}
+			}
+		}
+	}
+	std::cout << "engines: " << roms << " ROMs under each profile ok" << std::endl;
+	return 0;
+}
+
+/*****************************************************************************************************************************************/
+//
+// RunLockstep - Runs a program on a LockstepBatch and on one Chip8 per lane, and compares every lane with its machine after each frame
+//
+// Inputs - rom (program to run)
+//          lanes (lanes in the batch)
+//          frames (frames to run)
+//          instructionsPerFrame (instructions in each frame)
+//          name (what to call the program when reporting a difference)
+//
+// Outputs - 0 if every lane matched its machine after every frame, 1 if not
+//
+// Notes - Lane l has seed l + 1 and taps key l % 17 at the start, so lanes with no key and lanes with the same key are both
+//         covered. Even lanes hold key 5 down. A lane waiting on FX0A gets a key that depends on the lane and the frame
+/*****************************************************************************************************************************************/
+static int RunLockstep(const std::vector<unsigned char>& rom, unsigned int lanes, int frames, unsigned int instructionsPerFrame, const std::string& name)
+{
+	LockstepBatch batch(lanes);
+	if (0 != batch.LoadProgram(rom.data(), (int)rom.size()))
+	{
+		std::cout << "lockstep: " << name << " did not load" << std::endl;
+		return 1;
+	}
+
+	std::vector<std::unique_ptr<Chip8>> machines;
+	std::vector<bool> stopped(lanes, false);
+	for (unsigned int lane = 0; lane < lanes; lane++)
+	{
+		machines.emplace_back(new Chip8);
+		Chip8& chip = *machines.back();
+		chip.LoadProgram(rom.data(), (int)rom.size());
+		chip.SetRandomSeed(lane + 1);
+		chip.Reset();
+		chip.Executing();
+		if (lane % 17 < 16)
+		{
+			batch.KeyPress(lane, (unsigned char)(lane % 17));
+			chip.KeyPress(keyCharacters[lane % 17]);
+		}
+		if (0 == lane % 2)
+		{
+			batch.KeyDown(lane, 5);
+			chip.KeyDown(keyCharacters[5]);
+		}
+	}
+
+	for (int frame = 0; frame < frames; frame++)
+	{
+		unsigned int steps = 0;
+		batch.RunFrame(instructionsPerFrame, steps);
+		for (unsigned int lane = 0; lane < lanes; lane++)
+		{
+			// A stopped lane still has its timers ticked by the batch
+			unsigned int executed = 0;
+			if (stopped[lane])
+				machines[lane]->RunFrame(0, executed);
+			else if (machines[lane]->RunFrame(instructionsPerFrame, executed) & 0x1)
+				stopped[lane] = true;
+		}
+
+		for (unsigned int lane = 0; lane < lanes; lane++)
+		{
+			Chip8& chip = *machines[lane];
+			bool same = (stopped[lane] == batch.IsStopped(lane)) && (chip.GetPC() == batch.GetPC(lane)) &&
+				(chip.GetAddressRegister() == batch.GetAddressRegister(lane)) && (chip.GetDisplayHash() == batch.GetDisplayHash(lane));
+			for (unsigned char x = 0; x < 16; x++)
+				same = same && (chip.GetRegister(x) == batch.GetRegister(lane, x));
+			if (!same)
+			{
+				std::cout << "lockstep: lane " << lane << " differs from its Chip8 on " << name << " after frame " << frame << std::endl;
+				return 1;
+			}
+			if (batch.IsWaitingForInput(lane))
+			{
+				unsigned char key = (unsigned char)((lane * 7 + frame) % 16);
+				batch.KeyPress(lane, key);
+				chip.KeyPress(keyCharacters[key]);
+			}
+		}
+	}
+	return 0;
+}
+
+/*****************************************************************************************************************************************/
+//
+// TestLockstep - Checks that every lane of a LockstepBatch ends up where a Chip8 running the same program does
+//
+// Inputs - roms (random programs to run)
+//
+// Outputs - 0 if every lane matched, 1 if not
+//
+// Notes - Besides the random programs, one program is written to split the lanes on purpose: each lane rewrites one of its own
+//         instructions from its random numbers, so the lanes hold different code, and the lanes not holding key 5 wait on FX0A.
+//         Another writes past the last address of memory, which the random programs never reach
+/*****************************************************************************************************************************************/
+static int TestLockstep(unsigned int roms)
+{
+	static const unsigned int framesizes[4] = { 1, 3, 50, 400 };
+
+	std::vector<unsigned char> split = {
+		0x00, 0xE0,  // 200: CLS, so the loop can come back to 202
+		0xC0, 0x01,  // 202: V0 = random & 1
+		0xA2, 0x1C,  // 204: I = 21C, the two opcodes to pick from
+		0xF0, 0x1E,  // 206: I += V0
+		0xF0, 0x65,  // 208: V0 = 64 or 65
+		0xA2, 0x10,  // 20A: I = 210
+		0xF0, 0x55,  // 20C: rewrite the first byte of the next instruction
+		0x00, 0xE0,  // 20E: CLS
+		0x64, 0x77,  // 210: becomes V4 = 77 or V5 = 77
+		0x68, 0x05,  // 212: V8 = 5
+		0xE8, 0x9E,  // 214: skip the wait if key 5 is held
+		0xF1, 0x0A,  // 216: V1 = key
+		0x71, 0x01,  // 218: V1 += 1
+		0x12, 0x02,  // 21A: again
+		0x64, 0x65,  // 21C: the opcodes
+	};
+	if (0 != RunLockstep(split, 40, 40, 7, "the splitting ROM"))
+		return 1;
+
+	// FX55 from the last address leaves I one past the end of memory, and the FX33 after it writes into the padding
+	std::vector<unsigned char> padding = {
+		0x00, 0xE0,  // 200: CLS
+		0xAF, 0xFF,  // 202: I = FFF
+		0xF0, 0x55,  // 204: store V0, leaving I = 1000
+		0xF0, 0x33,  // 206: BCD of V0 at 1000-1002
+		0x12, 0x08,  // 208: stay here
+	};
+	if (0 != RunLockstep(padding, 40, 4, 5, "the padding ROM"))
+		return 1;
+
+	for (unsigned int seed = 0; seed < roms; seed++)
+	{
+		if (0 != RunLockstep(RandomRom(seed, 120), 40, 40, framesizes[seed % 4], "ROM " + std::to_string(seed)))
+			return 1;
+	}
+	std::cout << "lockstep: " << roms << " ROMs ok" << std::endl;
+	return 0;
+}
+
+/*****************************************************************************************************************************************/
+//
+// TestStateChecks - Loads saved states with the addresses in them corrupted
+//
+// Outputs - 0 if every corrupt state was refused without changing the machine and the edge cases that can happen were taken, 1 if not
+//
+// Notes - A state read from a file is not to be trusted, and I, the PC or a return address past the end of memory would have the
+//         next instruction read or write outside it
+/*****************************************************************************************************************************************/
+static int TestStateChecks()
+{
+	struct Case
+	{
+		const char *name;
+		unsigned short addressRegister;
+		unsigned short pc;
+		unsigned int stackDepth;
+		unsigned short returnAddress;     // The first entry on the stack
+		int expected;
+	};
+	static const Case cases[] = {
+		{ "I far past memory", 0xFFF0, 0x202, 0, 0, -1 },
+		{ "I one past memory", 0x1001, 0x202, 0, 0, -1 },
+		{ "I at the end of memory", 0x1000, 0x202, 0, 0, 0 },
+		{ "PC past memory", 0x300, 0x1000, 0, 0, -1 },
+		{ "PC on the last address", 0x300, 0x0FFF, 0, 0, 0 },
+		{ "return address past memory", 0x300, 0x202, 1, 0x1000, -1 },
+		{ "return address above the stack", 0x300, 0x202, 0, 0xFFFF, 0 },
+	};
+
+	std::vector<unsigned char> rom = RandomRom(1, 120);
+	Chip8 chip;
+	chip.LoadProgram(rom.data(), (int)rom.size());
+	chip.SetRandomSeed(1);
+	chip.Reset();
+	unsigned int executed = 0;
+	chip.Run(50, executed);
+	Chip8State good;
+	chip.SaveState(good);
+
+	for (const Case& test : cases)
+	{
+		Chip8State state = good;
+		state.machine.addressRegister = test.addressRegister;
+		state.machine.pc = test.pc;
+		state.machine.stackDepth = test.stackDepth;
+		state.machine.stack[0] = test.returnAddress;
+		Chip8 copy;
+		copy.LoadProgram(rom.data(), (int)rom.size());
+		copy.SetRandomSeed(1);
+		copy.Reset();
+		copy.Run(50, executed);
+		if ((test.expected != copy.LoadState(state)) || ((-1 == test.expected) && !SameState(copy, chip)))
+		{
+			std::cout << "state checks: loading a state with " << test.name << " did not " << ((0 == test.expected) ? "succeed" : "fail")
+			          << " cleanly" << std::endl;
+			return 1;
+		}
+
+		Chip8Snapshot snapshot;
+		chip.SaveSnapshot(snapshot);
+		snapshot.machine = state.machine;
+		if (test.expected != copy.LoadSnapshot(snapshot))
+		{
+			std::cout << "state checks: loading a snapshot with " << test.name << " did not " << ((0 == test.expected) ? "succeed" : "fail")
+			          << std::endl;
+			return 1;
+		}
+	}
+	std::cout << "state checks: ok" << std::endl;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int roms = 1000;
+	for (int i = 1; i < argc; i++)
+	{
+		if ((0 == strcmp(argv[i], "--roms")) && (i + 1 < argc))
+		{
+			roms = (unsigned int)strtoul(argv[++i], nullptr, 0);
+		}
+		else
+		{
+			std::cerr << "Usage: " << argv[0] << " [--roms N]" << std::endl
+			          << "  --roms N          Random ROMs to run under each quirk profile (default 1000)" << std::endl;
+			return 1;
+		}
+	}
+
+	int failures = 0;
+	failures += TestEngines(roms);
+	failures += TestLockstep(roms);
+	failures += TestStateChecks();
+	failures += TestJitCodeBuffer();
+	return (0 == failures) ? 0 : 1;
+}
@@ -0,0 +1,39 @@
+#include "FrameBuffer.h"
+
+FrameBuffer::FrameBuffer() :
+	m_slots(),
+	m_middle(1),
+	m_back(0),
+	m_front(2)
+{
+}
+
+
+FrameBuffer::~FrameBuffer()
+{
+}
+
+Chip8Frame& FrameBuffer::GetBackFrame()
+{
+	return m_slots[m_back].frame;
+}
+
+// The release half of the exchange makes the finished back frame visible to the reader that picks it up
+void FrameBuffer::Publish()
+{
+	m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+}
+
+bool FrameBuffer::Acquire()
+{
+	if (0 == (m_middle.load(std::memory_order_relaxed) & FRESH))
+		return false;
+
+	m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX_MASK;
+	return true;
+}
+
+const Chip8Frame& FrameBuffer::GetFrontFrame()
+{
+	return m_slots[m_front].frame;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include "Chip8.h"
+
+// One complete display as published by the emulator
+struct Chip8Frame
+{
+	Chip8DisplayRow rows[CHIP_8_HIRES_HEIGHT]; // Only the first CHIP_8_DISPLAY_HEIGHT are used in low resolution
+	Chip8DisplayRow planeRows[CHIP_8_HIRES_HEIGHT]; // The second XO-CHIP plane, blank under the other profiles
+	bool highResolution;
+	unsigned long long number;             // Frames the emulator had run when this one was published
+	unsigned short pc;
+};
+
+/*****************************************************************************************************************************************/
+//
+// FrameBuffer - Hands complete frames from one writer thread to one reader thread without locks
+//
+// Notes - Three frames are kept. The writer fills the back frame and Publish swaps it with the middle one, the reader's Acquire
+//         swaps the middle frame with the front one if something new was published. Each side only ever touches the frame it
+//         owns, so the reader always sees a whole frame and neither side waits for the other. Frames published faster than the
+//         reader acquires them are dropped, only the newest is kept.
+/*****************************************************************************************************************************************/
+class FrameBuffer
+{
+public:
+	FrameBuffer();
+	~FrameBuffer();
+	FrameBuffer(const FrameBuffer&) = delete;
+	FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+	// Writer side
+	Chip8Frame& GetBackFrame();
+	void Publish();
+
+	// Reader side. Acquire returns true if a newer frame was published since the last call
+	bool Acquire();
+	const Chip8Frame& GetFrontFrame();
+
+private:
+	static constexpr unsigned int INDEX_MASK = 0x3;
+	static constexpr unsigned int FRESH = 0x4;  // Set in m_middle when it holds a frame the reader has not seen
+
+	struct alignas(64) Slot
+	{
+		Chip8Frame frame;
+	};
+
+	Slot m_slots[3];
+	alignas(64) std::atomic<unsigned int> m_middle;
+	alignas(64) unsigned int m_back;       // Only used by the writer
+	alignas(64) unsigned int m_front;      // Only used by the reader
+};
@@ -0,0 +1,474 @@
+// Headless.cpp : Command line runner for the Chip8 core. Loads a ROM, runs it as fast as possible and reports throughput
+//                so the core can be measured on machines without the Win32 front end.
+//
+
+#include <bitset>
+#include <chrono>
+#include <ctime>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <thread>
+#include "AudioStream.h"
+#include "Chip8.h"
+#include "ControlFlow.h"
+#include "EmulationThread.h"
+#include "Movie.h"
+#include "RomArchive.h"
+#include "Pacer.h"
+#include "Rewind.h"
+#include "WavWriter.h"
+
+static void PrintUsage(const char *program)
+{
+	std::cerr << "Usage: " << program << " <rom> [--instructions N | --frames N] [--ipf N] [--engine interpreter|blocks|jit] [--quirks chip8|vip|schip|xochip] [--pace turbo|realtime|N] [--seed N] [--rewind KB] [--threaded] [--wav FILE] [--record FILE] [--archive FILE] [--native FILE] [--disassemble]" << std::endl
+	          << "       " << program << " --replay FILE [--engine interpreter|blocks|jit]" << std::endl
+	          << "  --instructions N  Execute N instructions (default 1000000)" << std::endl
+	          << "  --frames N        Execute N frames of --ipf instructions each" << std::endl
+	          << "  --ipf N           Instructions per 60 Hz frame (default 10)" << std::endl
+	          << "  --engine E        Execution engine: interpreter (default), blocks or jit" << std::endl
+	          << "  --quirks Q        Rules to run by: chip8 (default), vip for the COSMAC VIP, schip for SUPER-CHIP or xochip for XO-CHIP" << std::endl
+	          << "  --pace P          turbo runs unthrottled (default), realtime at 60 frames a second, N at N times that" << std::endl
+	          << "  --seed N          Random seed for CXNN (default a new one each run, printed so the run can be repeated)" << std::endl
+	          << "  --rewind KB       Record every frame into a rewind history of KB kilobytes and report its size and seek time (not with xochip)" << std::endl
+	          << "  --threaded        Run the frames on an emulation thread and present them from this one (needs --frames)" << std::endl
+	          << "  --wav FILE        Write the sound the ROM makes to FILE as 44.1 kHz 16 bit mono PCM (not with --threaded)" << std::endl
+	          << "  --record FILE     Record the run as a movie in FILE (not with xochip)" << std::endl
+	          << "  --replay FILE     Replay the movie in FILE unthrottled and check it against the hashes it recorded" << std::endl
+	          << "  --archive FILE    Take the ROM by name from the archive FILE" << std::endl
+	          << "  --native FILE     Run on the native module in FILE, built from chip8-recompile's output for this ROM and --quirks" << std::endl
+	          << "  --disassemble     List the ROM instead of running it" << std::endl;
+}
+
+// Why a status with 0x1 set stopped the machine
+static const char* GetFaultName(int status)
+{
+	if (status & 0x80)
+		return "exited";
+	if (status & 0x20)
+		return "stack overflow";
+	if (status & 0x40)
+		return "stack underflow";
+	return "bad opcode";
+}
+
+static bool ReadRom(const char *path, std::vector<unsigned char>& rom, size_t maxSize)
+{
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return rom.size() <= maxSize;
+}
+
+// The movie holds the machine's start state, ROM included, so nothing else is needed to replay it
+static int ReplayMovie(const char *path, ExecutionEngine engine)
+{
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	Movie movie;
+	if (!file.is_open() || (0 != movie.Load(file)))
+	{
+		std::cerr << "Unable to read movie " << path << std::endl;
+		return 1;
+	}
+
+	Chip8 chip;
+	if (0 != chip.SetExecutionEngine(engine))
+	{
+		std::cerr << "The requested engine is not available on this host" << std::endl;
+		return 1;
+	}
+
+	MovieReplayResult result;
+	auto start = std::chrono::steady_clock::now();
+	int replayed = movie.Replay(chip, result);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (0 != replayed)
+	{
+		std::cerr << "The movie " << path << " is damaged" << std::endl;
+		return 1;
+	}
+
+	std::cout << "movie:              " << path << std::endl
+	          << "frames:             " << result.frames << std::endl
+	          << "checkpoints:        " << result.checkpoints << " matched" << std::endl;
+	if (0 != result.mismatchFrame)
+		std::cout << "mismatch:           frame " << result.mismatchFrame << std::endl;
+	std::cout << "instructions:       " << result.instructions << std::endl
+	          << "seconds:            " << std::fixed << std::setprecision(6) << seconds << std::endl
+	          << "instructions/sec:   " << std::setprecision(0) << (seconds > 0 ? result.instructions / seconds : 0.0) << std::endl
+	          << "framebuffer hash:   0x" << std::hex << std::uppercase << std::setfill('0') << std::setw(16) << chip.GetDisplayHash() << std::dec << std::endl;
+	return (0 == result.mismatchFrame) ? 0 : 2;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *romPath = nullptr;
+	unsigned long long instructions = 1000000;
+	unsigned long long frames = 0;
+	unsigned long long instructionsPerFrame = 10;
+	bool disassemble = false;
+	bool threaded = false;
+	const char *wavPath = nullptr;
+	const char *recordPath = nullptr;
+	const char *seedText = nullptr;
+	const char *archivePath = nullptr;
+	const char *replayPath = nullptr;
+	const char *nativePath = nullptr;
+	size_t rewindKilobytes = 0;
+	PacingMode pacing = PacingMode::TURBO;
+	unsigned int fastForward = 1;
+	ExecutionEngine engine = ExecutionEngine::INTERPRETER;
+	QuirkProfile quirks = QuirkProfile::CHIP_8;
+
+	for (int x = 1; x < argc; x++)
+	{
+		if ((0 == std::strcmp(argv[x], "--instructions")) && (x + 1 < argc))
+			instructions = std::strtoull(argv[++x], nullptr, 0);
+		else if ((0 == std::strcmp(argv[x], "--frames")) && (x + 1 < argc))
+			frames = std::strtoull(argv[++x], nullptr, 0);
+		else if ((0 == std::strcmp(argv[x], "--ipf")) && (x + 1 < argc))
+			instructionsPerFrame = std::strtoull(argv[++x], nullptr, 0);
+		else if ((0 == std::strcmp(argv[x], "--engine")) && (x + 1 < argc))
+		{
+			const char *name = argv[++x];
+			if (0 == std::strcmp(name, "interpreter"))
+				engine = ExecutionEngine::INTERPRETER;
+			else if (0 == std::strcmp(name, "blocks"))
+				engine = ExecutionEngine::BLOCK_CACHE;
+			else if (0 == std::strcmp(name, "jit"))
+				engine = ExecutionEngine::JIT;
+			else
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+		}
+		else if ((0 == std::strcmp(argv[x], "--quirks")) && (x + 1 < argc))
+		{
+			const char *name = argv[++x];
+			if (0 == std::strcmp(name, "chip8"))
+				quirks = QuirkProfile::CHIP_8;
+			else if (0 == std::strcmp(name, "vip"))
+				quirks = QuirkProfile::COSMAC_VIP;
+			else if (0 == std::strcmp(name, "schip"))
+				quirks = QuirkProfile::SUPER_CHIP;
+			else if (0 == std::strcmp(name, "xochip"))
+				quirks = QuirkProfile::XO_CHIP;
+			else
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+		}
+		else if ((0 == std::strcmp(argv[x], "--pace")) && (x + 1 < argc))
+		{
+			const char *name = argv[++x];
+			if (0 == std::strcmp(name, "turbo"))
+				pacing = PacingMode::TURBO;
+			else if (0 == std::strcmp(name, "realtime"))
+				pacing = PacingMode::REAL_TIME;
+			else if (0 != (fastForward = (unsigned int)std::strtoul(name, nullptr, 0)))
+				pacing = PacingMode::FAST_FORWARD;
+			else
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+		}
+		else if ((0 == std::strcmp(argv[x], "--archive")) && (x + 1 < argc))
+			archivePath = argv[++x];
+		else if ((0 == std::strcmp(argv[x], "--seed")) && (x + 1 < argc))
+			seedText = argv[++x];
+		else if ((0 == std::strcmp(argv[x], "--rewind")) && (x + 1 < argc))
+			rewindKilobytes = std::strtoull(argv[++x], nullptr, 0);
+		else if ((0 == std::strcmp(argv[x], "--wav")) && (x + 1 < argc))
+			wavPath = argv[++x];
+		else if ((0 == std::strcmp(argv[x], "--record")) && (x + 1 < argc))
+			recordPath = argv[++x];
+		else if ((0 == std::strcmp(argv[x], "--replay")) && (x + 1 < argc))
+			replayPath = argv[++x];
+		else if ((0 == std::strcmp(argv[x], "--native")) && (x + 1 < argc))
+			nativePath = argv[++x];
+		else if (0 == std::strcmp(argv[x], "--threaded"))
+			threaded = true;
+		else if (0 == std::strcmp(argv[x], "--disassemble"))
+			disassemble = true;
+		else if ('-' != argv[x][0] && nullptr == romPath)
+			romPath = argv[x];
+		else
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((nullptr != replayPath) && (nullptr == romPath) && (nullptr == recordPath))
+		return ReplayMovie(replayPath, engine);
+
+	// Rewind histories and movies hold a Chip8State, which only has room for 4 KB of memory
+	if ((nullptr == romPath) || (0 == instructionsPerFrame) || (threaded && ((0 == frames) || (0 != rewindKilobytes) || (nullptr != wavPath))) ||
+		((QuirkProfile::XO_CHIP == quirks) && ((0 != rewindKilobytes) || (nullptr != recordPath))))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	size_t maxSize = (QuirkProfile::XO_CHIP == quirks) ? XO_CHIP_MAX_PROGRAM_SIZE : MAX_PROGRAM_SIZE;
+	std::vector<unsigned char> romFile;
+	RomArchive archive;
+	const unsigned char *rom = nullptr;
+	int romSize = 0;
+	if (nullptr != archivePath)
+	{
+		int index = -1;
+		if ((0 != archive.Open(archivePath)) || (-1 == (index = archive.Find(romPath))))
+		{
+			std::cerr << "Unable to find ROM " << romPath << " in archive " << archivePath << std::endl;
+			return 1;
+		}
+		rom = archive.GetRom(index, romSize);
+	}
+	else if (ReadRom(romPath, romFile, maxSize))
+	{
+		rom = romFile.data();
+		romSize = (int)romFile.size();
+	}
+	else
+	{
+		std::cerr << "Unable to read ROM " << romPath << " (max size is " << maxSize << " bytes)" << std::endl;
+		return 1;
+	}
+
+	// The profile goes first, XO-CHIP needs its 64 KB of memory before the ROM is loaded
+	Chip8 chip;
+	chip.SetQuirkProfile(quirks);
+	if (0 != chip.LoadProgram(rom, romSize))
+	{
+		std::cerr << "Invalid ROM file " << romPath << std::endl;
+		return 1;
+	}
+
+	if (disassemble)
+	{
+		// Each basic block the analysis found is headed by where it goes
+		ControlFlowGraph& graph = chip.GetControlFlow();
+		int codeBytes = 0;
+		int dataBytes = 0;
+		for (unsigned short pc = START_CHIP_8_PROGRAM; pc < START_CHIP_8_PROGRAM + romSize; pc += 2)
+		{
+			int block = graph.FindBlock(pc);
+			if ((-1 != block) && (pc == graph.GetBlocks()[block].start))
+			{
+				const ControlFlowBlock& found = graph.GetBlocks()[block];
+				std::wcout << L"; block of " << std::dec << found.instructions << L", " << ControlFlowGraph::GetExitName(found.exit);
+				for (int x = 0; x < found.successorCount; x++)
+					std::wcout << (0 == x ? L" to 0x" : L" or 0x") << std::hex << std::uppercase << std::setw(4) << std::setfill(L'0') << found.successors[x];
+				std::wcout << std::endl;
+			}
+			std::wostringstream line;
+			chip.DecodeInstructionAt(pc, line);
+			std::wcout << line.str() << std::endl;
+		}
+		for (unsigned short address = START_CHIP_8_PROGRAM; address < START_CHIP_8_PROGRAM + romSize; address++)
+		{
+			codeBytes += (graph.GetFlags(address) & ControlFlowGraph::BYTE_CODE) ? 1 : 0;
+			dataBytes += (graph.GetFlags(address) & ControlFlowGraph::BYTE_DATA) ? 1 : 0;
+		}
+		std::wcout << std::dec << L"; " << graph.GetBlocks().size() << L" blocks, " << codeBytes << L" bytes of code, " << dataBytes
+		           << L" bytes of sprite data, " << (romSize - codeBytes - dataBytes) << L" bytes not reached" << std::endl;
+		return 0;
+	}
+
+	if (nullptr != seedText)
+		chip.SetRandomSeed((unsigned int)std::strtoul(seedText, nullptr, 0));
+	chip.Reset();
+	if (nullptr != nativePath)
+	{
+		if (0 != chip.LoadNativeModule(nativePath))
+		{
+			std::cerr << "Unable to load native module " << nativePath << ", or it was built from another ROM or profile" << std::endl;
+			return 1;
+		}
+		engine = ExecutionEngine::NATIVE;
+	}
+	if (0 != chip.SetExecutionEngine(engine))
+	{
+		std::cerr << "The requested engine is not available on this host" << std::endl;
+		return 1;
+	}
+	chip.Executing();
+
+	if (0 != frames)
+		instructions = frames * instructionsPerFrame;
+
+	std::unique_ptr<Rewind> rewind;
+	if (0 != rewindKilobytes)
+		rewind.reset(new Rewind(rewindKilobytes * 1024));
+
+	Pacer pacer;
+	pacer.SetRate((unsigned int)(instructionsPerFrame * Pacer::DEFAULT_FRAMES_PER_SECOND), Pacer::DEFAULT_FRAMES_PER_SECOND);
+	pacer.SetMode(pacing, fastForward);
+
+	// The stream is drained into the file every frame, so it never fills up however fast the frames run
+	std::unique_ptr<AudioStream> audio;
+	WavWriter wav;
+	unsigned long long toneFrames = 0;
+	bool audioWritten = true;
+	if (nullptr != wavPath)
+	{
+		audio.reset(new AudioStream);
+		audio->SetFrameRate(pacer.GetFramesPerSecond());
+		if (0 != wav.Open(wavPath, audio->GetSampleRate()))
+		{
+			std::cerr << "Unable to write " << wavPath << std::endl;
+			return 1;
+		}
+	}
+
+	Movie movie;
+	if (nullptr != recordPath)
+		movie.Begin(chip);
+
+	const char *stopReason = "completed";
+	unsigned long long executed = 0;
+	unsigned long long dirtyRows = 0;
+	unsigned long long framesRun = 0;
+	unsigned long long framesPresented = 0;
+	bool frameMatches = true;
+	chip.TakeDirtyRows();
+	std::clock_t cpuStart = std::clock();
+	auto start = std::chrono::steady_clock::now();
+	pacer.Start();
+	if (threaded)
+	{
+		// This thread stands in for a presenter, picking up the newest frame about once a millisecond
+		EmulationThread emulation(chip);
+		emulation.SetRate(pacer.GetInstructionsPerSecond(), pacer.GetFramesPerSecond());
+		emulation.SetPacing(pacing, fastForward);
+		if (nullptr != recordPath)
+			emulation.SetMovie(&movie);
+		emulation.Start(frames);
+		while (emulation.IsRunning())
+		{
+			if (emulation.AcquireFrame())
+				framesPresented++;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		emulation.Stop();
+		if (emulation.AcquireFrame())
+			framesPresented++;
+
+		executed = emulation.GetInstructionCount();
+		framesRun = emulation.GetFrameCount();
+		int events = emulation.TakeEvents();
+		if (events & 0x1)
+			stopReason = GetFaultName(events);
+		frameMatches = (emulation.GetFrame().highResolution == chip.IsHighResolution());
+		for (unsigned char row = 0; row < CHIP_8_HIRES_HEIGHT; row++)
+			frameMatches = frameMatches && (emulation.GetFrame().rows[row] == chip.GetDisplayRow(row)) &&
+				(emulation.GetFrame().planeRows[row] == chip.GetPlaneRow(1, row));
+	}
+	while (!threaded && (executed < instructions))
+	{
+		pacer.WaitForNextFrame();
+		unsigned long long frameInstructions = pacer.NextFrame();
+		unsigned long long remaining = instructions - executed;
+		unsigned int cycles = (unsigned int)((remaining < frameInstructions) ? remaining : frameInstructions);
+		unsigned int ran = 0;
+		int status = chip.RunFrame(cycles, ran);
+		executed += ran;
+		if (nullptr != recordPath)
+			movie.RecordFrame(chip, cycles);
+		dirtyRows += std::bitset<64>(chip.TakeDirtyRows()).count(); // What a presenter would have to redraw after this frame
+		if (rewind)
+			rewind->Record(chip);
+		if (audio)
+		{
+			short samples[AudioStream::DEFAULT_SAMPLE_RATE / 10];
+			bool soundOn = (0 != (status & 0xC));
+			toneFrames += soundOn ? 1 : 0;
+			audio->GenerateFrame(soundOn);
+			wav.Write(samples, audio->Read(samples, sizeof(samples) / sizeof(samples[0])));
+		}
+		if (status & 0x1)
+		{
+			stopReason = GetFaultName(status);
+			break;
+		}
+		if (status & 0x10)
+		{
+			stopReason = "waiting for input";
+			break;
+		}
+	}
+	if (!threaded)
+		framesRun = pacer.GetFrameCount();
+	auto end = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+	double cpuSeconds = (double)(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+	// Time seeking to every held frame, then go back to the newest so the state reported below is the final one
+	double seekMicroseconds = 0;
+	if (rewind && (0 != rewind->GetFrameCount()))
+	{
+		auto seekStart = std::chrono::steady_clock::now();
+		for (unsigned int framesBack = rewind->GetFrameCount(); framesBack > 0; framesBack--)
+			rewind->Seek(chip, framesBack - 1);
+		seekMicroseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - seekStart).count() / rewind->GetFrameCount();
+		rewind->Seek(chip, 0);
+	}
+
+	std::cout << "rom:                " << romPath << std::endl
+	          << "stopped:            " << stopReason << " at pc 0x" << std::hex << std::uppercase << std::setfill('0') << std::setw(4) << chip.GetPC() << std::dec << std::endl
+	          << "instructions:       " << executed << std::endl;
+	static const char *engineNames[] = { "interpreter", "blocks", "jit", "native" };
+	static const char *quirkNames[] = { "chip8", "vip", "schip", "xochip" };
+	std::cout << "engine:             " << engineNames[(int)engine] << std::endl
+	          << "quirks:             " << quirkNames[(int)quirks] << std::endl
+	          << "seed:               " << chip.GetRandomSeed() << std::endl;
+	if (0 != frames)
+	{
+		std::cout << "frames:             " << framesRun << std::endl;
+		if (threaded)
+			std::cout << "frames presented:   " << framesPresented << (frameMatches ? " (last matches the machine)" : " (last does not match the machine)") << std::endl;
+		else
+			std::cout << "dirty rows/frame:   " << std::fixed << std::setprecision(2) << (double)dirtyRows / framesRun << " of " << (chip.IsHighResolution() ? CHIP_8_HIRES_HEIGHT : CHIP_8_DISPLAY_HEIGHT) << std::endl;
+	}
+	if (audio)
+	{
+		unsigned long long samples = wav.GetSampleCount();
+		audioWritten = (0 == wav.Close());
+		std::cout << "audio:              " << samples << " samples, " << toneFrames << " frames of tone"
+		          << (audioWritten ? " written to " : " could not be written to ") << wavPath << std::endl;
+	}
+	bool movieWritten = true;
+	if (nullptr != recordPath)
+	{
+		std::ofstream file(recordPath, std::ios::out | std::ios::binary);
+		movieWritten = file.is_open() && (0 == movie.Save(file));
+		std::cout << "movie:              " << movie.GetFrameCount() << " frames, " << movie.GetCheckpointCount() << " checkpoints"
+		          << (movieWritten ? " written to " : " could not be written to ") << recordPath << std::endl;
+	}
+	if (rewind)
+	{
+		std::cout << "rewind frames:      " << rewind->GetFrameCount() << " (" << rewind->GetKeyframeCount() << " keyframes)" << std::endl
+		          << "rewind memory:      " << rewind->GetMemoryUsed() << " of " << rewind->GetMemoryBudget() << " bytes" << std::endl
+		          << "rewind seek:        " << std::fixed << std::setprecision(2) << seekMicroseconds << " us average" << std::endl;
+	}
+	std::cout << "seconds:            " << std::fixed << std::setprecision(6) << seconds << std::endl
+	          << "cpu seconds:        " << cpuSeconds << std::endl
+	          << "instructions/sec:   " << std::setprecision(0) << (seconds > 0 ? executed / seconds : 0.0) << std::endl
+	          << "framebuffer hash:   0x" << std::hex << std::setw(16) << chip.GetDisplayHash() << std::endl
+	          << "registers:         ";
+	for (unsigned char x = 0; x < 16; x++)
+		std::cout << " " << std::setw(2) << (int)chip.GetRegister(x);
+	std::cout << " I=" << std::setw(3) << chip.GetAddressRegister() << std::dec << std::endl;
+
+	return ((('c' == stopReason[0]) || ('e' == stopReason[0])) && frameMatches && audioWritten && movieWritten) ? 0 : 2;
+}
@@ -0,0 +1,55 @@
+#include "InputQueue.h"
+
+InputQueue::InputQueue(size_t capacity) :
+	m_mask(0),
+	m_tail(0),
+	m_cachedHead(0),
+	m_head(0),
+	m_cachedTail(0)
+{
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	m_events.reset(new Chip8InputEvent[size]);
+	m_mask = size - 1;
+}
+
+
+InputQueue::~InputQueue()
+{
+}
+
+bool InputQueue::Push(const Chip8InputEvent& event)
+{
+	size_t tail = m_tail.load(std::memory_order_relaxed);
+	if (tail - m_cachedHead > m_mask)
+	{
+		m_cachedHead = m_head.load(std::memory_order_acquire);
+		if (tail - m_cachedHead > m_mask)
+			return false;
+	}
+
+	m_events[tail & m_mask] = event;
+	m_tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+bool InputQueue::Peek(Chip8InputEvent& event)
+{
+	size_t head = m_head.load(std::memory_order_relaxed);
+	if (head == m_cachedTail)
+	{
+		m_cachedTail = m_tail.load(std::memory_order_acquire);
+		if (head == m_cachedTail)
+			return false;
+	}
+
+	event = m_events[head & m_mask];
+	return true;
+}
+
+// Only valid after a Peek that returned true
+void InputQueue::Pop()
+{
+	m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
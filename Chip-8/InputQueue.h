@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+enum class InputEventType : unsigned char
+{
+	KEY_DOWN,
+	KEY_UP,
+	KEY_PRESS,    // A tap, pressed until the machine tests the key
+};
+
+struct Chip8InputEvent
+{
+	unsigned long long frame;              // First frame the event applies to, 0 for the next frame
+	char key;                              // Keyboard character, as passed to Chip8::KeyPress
+	InputEventType type;
+};
+
+/*****************************************************************************************************************************************/
+//
+// InputQueue - Carries input events from one producer thread to one consumer thread without locks
+//
+// Notes - A fixed ring of events with the producer and consumer positions on their own cache lines. Each side keeps a copy of
+//         the other's position and only reloads it when the ring looks full or empty, so in the common case Push and Peek touch
+//         no memory the other thread writes. Push fails rather than waits when the ring is full.
+//
+//         Events carry the frame they are meant for. The consumer applies them between frames, so input is seen by the machine
+//         at the same point in its run however the threads happen to be scheduled.
+/*****************************************************************************************************************************************/
+class InputQueue
+{
+public:
+	// capacity is rounded up to a power of two
+	InputQueue(size_t capacity = DEFAULT_CAPACITY);
+	~InputQueue();
+	InputQueue(const InputQueue&) = delete;
+	InputQueue& operator=(const InputQueue&) = delete;
+
+	// Producer side
+	bool Push(const Chip8InputEvent& event);
+
+	// Consumer side. Peek returns false when the queue is empty
+	bool Peek(Chip8InputEvent& event);
+	void Pop();
+
+	static constexpr size_t DEFAULT_CAPACITY = 256;
+
+private:
+	std::unique_ptr<Chip8InputEvent[]> m_events;
+	size_t m_mask;
+
+	alignas(64) std::atomic<size_t> m_tail;   // Next slot the producer writes
+	size_t m_cachedHead;                       // Producer's copy of m_head
+	alignas(64) std::atomic<size_t> m_head;   // Next slot the consumer reads
+	size_t m_cachedTail;                       // Consumer's copy of m_tail
+};
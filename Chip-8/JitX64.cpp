@@ -0,0 +1,606 @@
+#include "JitX64.h"
+#include <cstring>
+
+#if CHIP8_JIT_SUPPORTED
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+namespace
+{
+	// Host registers used by the generated code
+	enum HostRegister
+	{
+		RAX = 0, RCX = 1, RDX = 2, RBX = 3,
+	};
+
+	// Minimal x86-64 encoder for the handful of instruction forms the translator needs. Machine state operands are always
+	// [rbx + disp32]
+	class Emitter
+	{
+	public:
+		Emitter(unsigned char *code) : m_start(code), m_cursor(code) {}
+
+		unsigned char* Cursor() { return m_cursor; }
+		size_t Size() { return m_cursor - m_start; }
+
+		void Byte(unsigned char value) { *m_cursor++ = value; }
+		void Bytes(std::initializer_list<unsigned char> values) { for (unsigned char value : values) Byte(value); }
+		void Word(unsigned short value) { Byte(value & 0xFF); Byte(value >> 8); }
+		void Dword(unsigned int value) { for (int x = 0; x < 4; x++) Byte((value >> (x * 8)) & 0xFF); }
+
+		// ModRM for [rbx + disp32] with the given reg field
+		void State(int reg, int displacement) { Byte(0x80 | (reg << 3) | RBX); Dword((unsigned int)displacement); }
+
+		void MovByteStateImm(int displacement, unsigned char value) { Byte(0xC6); State(0, displacement); Byte(value); }
+		void AddByteStateImm(int displacement, unsigned char value) { Byte(0x80); State(0, displacement); Byte(value); }
+		void CmpByteStateImm(int displacement, unsigned char value) { Byte(0x80); State(7, displacement); Byte(value); }
+		void MovRegState8(int reg, int displacement) { Byte(0x8A); State(reg, displacement); }
+		void MovStateReg8(int displacement, int reg) { Byte(0x88); State(reg, displacement); }
+		void OrStateReg8(int displacement, int reg) { Byte(0x08); State(reg, displacement); }
+		void AndStateReg8(int displacement, int reg) { Byte(0x20); State(reg, displacement); }
+		void XorStateReg8(int displacement, int reg) { Byte(0x30); State(reg, displacement); }
+		void SubStateReg8(int displacement, int reg) { Byte(0x28); State(reg, displacement); }
+		void SubRegState8(int reg, int displacement) { Byte(0x2A); State(reg, displacement); }
+		void CmpRegState8(int reg, int displacement) { Byte(0x3A); State(reg, displacement); }
+		void MovzxRegState8(int reg, int displacement) { Bytes({ 0x0F, 0xB6 }); State(reg, displacement); }
+		void MovzxRegState16(int reg, int displacement) { Bytes({ 0x0F, 0xB7 }); State(reg, displacement); }
+		void MovWordStateImm(int displacement, unsigned short value) { Bytes({ 0x66, 0xC7 }); State(0, displacement); Word(value); }
+		void MovWordStateReg(int displacement, int reg) { Bytes({ 0x66, 0x89 }); State(reg, displacement); }
+		void AddWordStateImm(int displacement, unsigned short value) { Bytes({ 0x66, 0x81 }); State(0, displacement); Word(value); }
+
+		// Budget counter in r12
+		void CmpBudget(unsigned int value) { Bytes({ 0x49, 0x81, 0xFC }); Dword(value); }
+		void SubBudget(unsigned int value) { Bytes({ 0x49, 0x81, 0xEC }); Dword(value); }
+		void AddBudget(unsigned int value) { Bytes({ 0x49, 0x81, 0xC4 }); Dword(value); }
+
+		// Relative branches. Returns the location of the displacement so it can be patched
+		unsigned char* Jcc(unsigned char condition, const unsigned char *target = nullptr)
+		{
+			Bytes({ 0x0F, condition });
+			unsigned char *patch = m_cursor;
+			Dword(0);
+			if (nullptr != target)
+				Patch(patch, target);
+			return patch;
+		}
+		unsigned char* Jmp(const unsigned char *target = nullptr)
+		{
+			Byte(0xE9);
+			unsigned char *patch = m_cursor;
+			Dword(0);
+			if (nullptr != target)
+				Patch(patch, target);
+			return patch;
+		}
+		static void Patch(unsigned char *patch, const unsigned char *target)
+		{
+			int relative = (int)(target - (patch + 4));
+			std::memcpy(patch, &relative, 4);
+		}
+
+	private:
+		unsigned char *m_start;
+		unsigned char *m_cursor;
+	};
+
+	const unsigned char JB = 0x82;
+	const unsigned char JAE = 0x83;
+	const unsigned char JE = 0x84;
+	const unsigned char JNE = 0x85;
+	const unsigned char JA = 0x87;
+}
+
+JitX64::JitX64() :
+	m_code(nullptr),
+	m_codeUsed(0),
+	m_codeReset(0),
+	m_exit(nullptr),
+	m_enter(nullptr),
+	m_registersOffset(0),
+	m_addressRegisterOffset(0),
+	m_pcOffset(0),
+	m_keysDownOffset(0),
+	m_keysTappedOffset(0)
+{
+#if CHIP8_JIT_SUPPORTED
+#ifdef _WIN32
+	m_code = (unsigned char *)VirtualAlloc(nullptr, CODE_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+	void *code = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	m_code = (MAP_FAILED == code) ? nullptr : (unsigned char *)code;
+#endif
+#endif
+	for (int x = 0; x < CHIP_8_MEMORY_SIZE; x++)
+	{
+		m_table[x] = nullptr;
+		m_blockEnd[x] = 0;
+		m_uncompilable[x] = false;
+	}
+	if (nullptr != m_code)
+		GenerateTrampoline();
+}
+
+JitX64::~JitX64()
+{
+#if CHIP8_JIT_SUPPORTED
+	if (nullptr != m_code)
+	{
+#ifdef _WIN32
+		VirtualFree(m_code, 0, MEM_RELEASE);
+#else
+		munmap(m_code, CODE_BUFFER_SIZE);
+#endif
+	}
+#endif
+}
+
+bool JitX64::IsAvailable()
+{
+	return (nullptr != m_code);
+}
+
+/*****************************************************************************************************************************************/
+//
+// GenerateTrampoline - Emits the entry and exit code shared by every block
+//
+// Inputs - None
+//
+// Outputs - None
+//
+// Notes - Entry saves the callee saved registers, loads rbx = chip, rbp = context, r12 = budget, r13 = memory, r14 = table and jumps
+//         to context->entry. Exit writes the remaining budget back to the context and returns. The generated code never calls out,
+//         so the stack alignment and shadow space rules do not matter
+/*****************************************************************************************************************************************/
+void JitX64::GenerateTrampoline()
+{
+	Emitter emit(m_code);
+
+	m_enter = (void (*)(Chip8 *, JitContext *))emit.Cursor();
+	emit.Bytes({ 0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57 }); // push rbx, rbp, r12, r13, r14, r15
+#ifdef _WIN32
+	emit.Bytes({ 0x48, 0x89, 0xCB });             // mov rbx, rcx
+	emit.Bytes({ 0x48, 0x89, 0xD5 });             // mov rbp, rdx
+#else
+	emit.Bytes({ 0x48, 0x89, 0xFB });             // mov rbx, rdi
+	emit.Bytes({ 0x48, 0x89, 0xF5 });             // mov rbp, rsi
+#endif
+	emit.Bytes({ 0x4C, 0x8B, 0x65, 0x08 });       // mov r12, [rbp + budget]
+	emit.Bytes({ 0x4C, 0x8B, 0x6D, 0x10 });       // mov r13, [rbp + memory]
+	emit.Bytes({ 0x4C, 0x8B, 0x75, 0x18 });       // mov r14, [rbp + table]
+	emit.Bytes({ 0xFF, 0x65, 0x00 });             // jmp [rbp + entry]
+
+	m_exit = emit.Cursor();
+	emit.Bytes({ 0x4C, 0x89, 0x65, 0x08 });       // mov [rbp + budget], r12
+	emit.Bytes({ 0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B }); // pop r15, r14, r13, r12, rbp, rbx
+	emit.Byte(0xC3);                              // ret
+
+	m_codeUsed = m_codeReset = (emit.Size() + 15) & ~(size_t)15;
+}
+
+/*****************************************************************************************************************************************/
+//
+// Run - Executes up to maxInstructions, natively where possible
+//
+// Inputs - chip (machine to run)
+//          maxInstructions (upper bound on the number of instructions to execute)
+//          executed (set to the number of instructions actually executed)
+//
+// Outputs - The status bits of every executed instruction ORed together, the same as the interpreter returns
+//
+// Notes - Every block checks the remaining budget before it runs, so native code stops on exactly the same instruction the
+//         interpreter would
+/*****************************************************************************************************************************************/
+int JitX64::Run(Chip8& chip, unsigned int maxInstructions, unsigned int& executed)
+{
+	int returnValue = 0;
+	executed = 0;
+
+	m_registersOffset = (int)((char *)&chip.m_registers[0] - (char *)&chip);
+	m_addressRegisterOffset = (int)((char *)&chip.m_addressRegister - (char *)&chip);
+	m_pcOffset = (int)((char *)&chip.m_pc - (char *)&chip);
+	m_keysDownOffset = (int)((char *)&chip.m_keysDown - (char *)&chip);
+	m_keysTappedOffset = (int)((char *)&chip.m_keysTapped - (char *)&chip);
+
+	while (executed < maxInstructions)
+	{
+		unsigned short pc = chip.m_pc;
+		const unsigned char *entry = nullptr;
+		if (pc < CHIP_8_MEMORY_SIZE)
+		{
+			entry = m_table[pc];
+			if ((nullptr == entry) && !m_uncompilable[pc])
+				entry = Compile(chip, pc);
+		}
+
+		unsigned int ran = 0;
+		if (nullptr != entry)
+		{
+			JitContext context;
+			context.entry = entry;
+			context.budget = maxInstructions - executed;
+			context.memory = chip.m_memory;
+			context.table = m_table;
+			m_enter(&chip, &context);
+			ran = (unsigned int)((maxInstructions - executed) - context.budget);
+			executed += ran;
+		}
+
+		// Either the next instruction cannot be compiled or the block did not fit in what is left of the budget
+		if ((0 == ran) && (executed < maxInstructions))
+		{
+			returnValue |= chip.Execute(chip.m_pc);
+			executed++;
+			if ((returnValue & 0x1) || (Chip8::STATE_PAUSED_FOR_INPUT == chip.m_executionState))
+				break;
+		}
+	}
+
+	return returnValue;
+}
+
+void JitX64::Invalidate(unsigned short address, unsigned short length)
+{
+	if ((0 == length) || (address >= CHIP_8_MEMORY_SIZE))
+		return;
+
+	unsigned int last = address + length - 1;
+	if (last >= CHIP_8_MEMORY_SIZE)
+		last = CHIP_8_MEMORY_SIZE - 1;
+
+	for (unsigned int x = address; x <= last; x++)
+		m_uncompilable[x] = false;
+	// An instruction straddling the first written byte starts one byte earlier
+	if (address > 0)
+		m_uncompilable[address - 1] = false;
+
+	for (unsigned int page = address >> PAGE_SHIFT; page <= (last >> PAGE_SHIFT); page++)
+	{
+		std::vector<unsigned short>& starts = m_blocksByPage[page];
+		for (size_t x = 0; x < starts.size(); )
+		{
+			unsigned short start = starts[x];
+			if ((start <= last) && (m_blockEnd[start] > address))
+			{
+				// The code itself stays in the buffer until the next flush, nothing can reach it once the table entry is gone
+				m_table[start] = nullptr;
+				starts[x] = starts.back();
+				starts.pop_back();
+			}
+			else
+			{
+				x++;
+			}
+		}
+	}
+}
+
+void JitX64::InvalidateAll()
+{
+	for (int x = 0; x < CHIP_8_MEMORY_SIZE; x++)
+	{
+		m_table[x] = nullptr;
+		m_uncompilable[x] = false;
+	}
+	for (int page = 0; page < NUMBER_OF_PAGES; page++)
+		m_blocksByPage[page].clear();
+}
+
+void JitX64::Flush()
+{
+	InvalidateAll();
+	m_codeUsed = m_codeReset;
+}
+
+/*****************************************************************************************************************************************/
+//
+// Compile - Translates the basic block starting at start
+//
+// Inputs - chip (machine whose memory holds the code)
+//          start (address of the first instruction)
+//
+// Outputs - The native entry point, or null if the first instruction has to be interpreted
+//
+// Notes - Every exit stores the next PC before it leaves so the interpreter can pick up from there. Static successors are found
+//         through the table at run time, so blocks compiled later are chained without patching
+/*****************************************************************************************************************************************/
+const unsigned char* JitX64::Compile(Chip8& chip, unsigned short start)
+{
+	if (m_codeUsed + MAX_BLOCK_CODE_SIZE > CODE_BUFFER_SIZE)
+		Flush();
+
+	Emitter emit(m_code + m_codeUsed);
+	const unsigned char *entry = emit.Cursor();
+	const int V = m_registersOffset;
+	const int I = m_addressRegisterOffset;
+	const int PC = m_pcOffset;
+	const int VF = V + 15;
+	// The quirks are settled as the code is generated, so the code for one profile holds nothing of the others
+	const Chip8Quirks quirks = GetQuirks(chip.m_quirkProfile);
+
+	// Stores the PC and continues in the block compiled for it, or leaves if there is none yet
+	auto chain = [&](unsigned short target)
+	{
+		emit.MovWordStateImm(PC, target);
+		if (target >= CHIP_8_MEMORY_SIZE)
+		{
+			emit.Jmp(m_exit);
+			return;
+		}
+		emit.Bytes({ 0x49, 0x8B, 0x86 }); emit.Dword(target * 8); // mov rax, [r14 + target * 8]
+		emit.Bytes({ 0x48, 0x85, 0xC0 });                        // test rax, rax
+		emit.Jcc(JE, m_exit);
+		emit.Bytes({ 0xFF, 0xE0 });                              // jmp rax
+	};
+
+	// Conditional skip: falls through to next when the condition code is false, skips the next instruction when it is true
+	auto skip = [&](unsigned char takenCondition, unsigned short next)
+	{
+		unsigned char *taken = emit.Jcc(takenCondition);
+		chain(next);
+		Emitter::Patch(taken, emit.Cursor());
+		chain(next + 2);
+	};
+
+	emit.CmpBudget(0);
+	unsigned char *budgetCheck = emit.Cursor() - 4;
+	emit.Jcc(JB, m_exit);
+	emit.SubBudget(0);
+	unsigned char *budgetCharge = emit.Cursor() - 4;
+
+	unsigned int count = 0;
+	unsigned short pc = start;
+	bool ended = false;
+
+	while (!ended && (count < MAX_BLOCK_INSTRUCTIONS))
+	{
+		Instruction instruction = Disassembler::Decode(pc, chip.GetOpcode(pc));
+		const int X = V + instruction.x;
+		const int Y = V + instruction.y;
+		const unsigned short next = pc + 2;
+		bool compiled = true;
+
+		switch (instruction.mnemonic)
+		{
+			case Mnemonic::LD_VX_NN:
+				emit.MovByteStateImm(X, instruction.nn);
+				break;
+			case Mnemonic::ADD_VX_NN:
+				emit.AddByteStateImm(X, instruction.nn);
+				break;
+			case Mnemonic::LD_VX_VY:
+				emit.MovRegState8(RAX, Y);
+				emit.MovStateReg8(X, RAX);
+				break;
+			case Mnemonic::OR_VX_VY:
+				emit.MovRegState8(RAX, Y);
+				emit.OrStateReg8(X, RAX);
+				if (quirks.logicResetsVF)
+					emit.MovByteStateImm(VF, 0);
+				break;
+			case Mnemonic::AND_VX_VY:
+				emit.MovRegState8(RAX, Y);
+				emit.AndStateReg8(X, RAX);
+				if (quirks.logicResetsVF)
+					emit.MovByteStateImm(VF, 0);
+				break;
+			case Mnemonic::XOR_VX_VY:
+				emit.MovRegState8(RAX, Y);
+				emit.XorStateReg8(X, RAX);
+				if (quirks.logicResetsVF)
+					emit.MovByteStateImm(VF, 0);
+				break;
+			case Mnemonic::ADD_VX_VY:
+				// Sum from the old values, then the carry into VF, then the sum into VX (which wins when X is F)
+				emit.MovzxRegState8(RAX, X);
+				emit.MovzxRegState8(RCX, Y);
+				emit.Bytes({ 0x01, 0xC8 });                  // add eax, ecx
+				emit.Bytes({ 0x3D, 0xFF, 0x00, 0x00, 0x00 }); // cmp eax, 0xFF
+				emit.Bytes({ 0x0F, 0x97, 0xC2 });            // seta dl
+				emit.MovStateReg8(VF, RDX);
+				emit.MovStateReg8(X, RAX);
+				break;
+			case Mnemonic::SUB_VX_VY:
+				// VF is written first and the subtraction reads the registers again, as the interpreter does
+				emit.MovzxRegState8(RAX, Y);
+				emit.MovzxRegState8(RCX, X);
+				emit.Bytes({ 0x39, 0xC8 });                  // cmp eax, ecx
+				emit.Bytes({ 0x0F, 0x96, 0xC2 });            // setbe dl
+				emit.MovStateReg8(VF, RDX);
+				emit.MovRegState8(RAX, Y);
+				emit.SubStateReg8(X, RAX);
+				break;
+			case Mnemonic::SUBN_VX_VY:
+				emit.MovzxRegState8(RAX, X);
+				emit.MovzxRegState8(RCX, Y);
+				emit.Bytes({ 0x39, 0xC8 });                  // cmp eax, ecx
+				emit.Bytes({ 0x0F, 0x96, 0xC2 });            // setbe dl
+				emit.MovStateReg8(VF, RDX);
+				emit.MovRegState8(RAX, Y);
+				emit.SubRegState8(RAX, X);
+				emit.MovStateReg8(X, RAX);
+				break;
+			case Mnemonic::SHR_VX_VY:
+			{
+				// Shifting in place is the same code with VX as the source and no copy
+				const int source = quirks.shiftInPlace ? X : Y;
+				emit.MovRegState8(RAX, source);
+				emit.Bytes({ 0x24, 0x01 });                  // and al, 1
+				emit.MovStateReg8(VF, RAX);
+				emit.MovRegState8(RAX, source);
+				emit.Bytes({ 0xD0, 0xE8 });                  // shr al, 1
+				emit.MovStateReg8(source, RAX);
+				if (!quirks.shiftInPlace)
+					emit.MovStateReg8(X, RAX);
+				break;
+			}
+			case Mnemonic::SHL_VX_VY:
+			{
+				const int source = quirks.shiftInPlace ? X : Y;
+				emit.MovRegState8(RAX, source);
+				emit.Bytes({ 0xC0, 0xE8, 0x07 });            // shr al, 7
+				emit.MovStateReg8(VF, RAX);
+				emit.MovRegState8(RAX, source);
+				emit.Bytes({ 0x00, 0xC0 });                  // add al, al
+				emit.MovStateReg8(source, RAX);
+				if (!quirks.shiftInPlace)
+					emit.MovStateReg8(X, RAX);
+				break;
+			}
+			case Mnemonic::LD_I_NNN:
+				emit.MovWordStateImm(I, instruction.nnn);
+				break;
+			case Mnemonic::ADD_I_VX:
+				emit.MovzxRegState8(RAX, X);
+				emit.MovzxRegState16(RCX, I);
+				emit.Bytes({ 0x01, 0xC8 });                  // add eax, ecx
+				emit.Bytes({ 0x25, 0xFF, 0x0F, 0x00, 0x00 }); // and eax, 0xFFF
+				emit.MovWordStateReg(I, RAX);
+				break;
+			case Mnemonic::LD_F_VX:
+				emit.MovzxRegState8(RAX, X);
+				emit.Bytes({ 0x8D, 0x04, 0x80 });            // lea eax, [rax + rax * 4]
+				emit.MovWordStateReg(I, RAX);
+				break;
+			case Mnemonic::LD_VX_MEM:
+			{
+				// Out of range loads are a bad opcode, which the interpreter reports. Leave before the instruction and hand
+				// back the part of the budget that was charged for it and everything after it
+				emit.MovzxRegState16(RAX, I);
+				emit.Bytes({ 0x8D, 0x48, instruction.x });   // lea ecx, [rax + x]
+				emit.Bytes({ 0x81, 0xF9 }); emit.Dword(CHIP_8_MEMORY_SIZE); // cmp ecx, 4096
+				unsigned char *inRange = emit.Jcc(JB);
+				emit.AddBudget(0);
+				unsigned char *refund = emit.Cursor() - 4;
+				emit.MovWordStateImm(PC, pc);
+				emit.Jmp(m_exit);
+				Emitter::Patch(inRange, emit.Cursor());
+				for (int x = 0; x <= instruction.x; x++)
+				{
+					emit.Bytes({ 0x41, 0x8A, 0x54, 0x05, (unsigned char)x }); // mov dl, [r13 + rax + x]
+					emit.MovStateReg8(V + x, RDX);
+				}
+				if (!quirks.loadStoreKeepsI)
+					emit.AddWordStateImm(I, instruction.x + 1);
+				// The refund is this and every later instruction, which is only known once the block is finished. Park the
+				// count of earlier instructions in the placeholder until then
+				std::memcpy(refund, &count, 4);
+				m_refunds.push_back(refund);
+				break;
+			}
+			case Mnemonic::JP:
+			{
+				bool inProgram = quirks.jumpAnywhere || ((instruction.nnn > START_CHIP_8_PROGRAM) && (instruction.nnn < (START_CHIP_8_PROGRAM + chip.m_programSize)));
+				chain(inProgram ? instruction.nnn : next);
+				ended = true;
+				break;
+			}
+			case Mnemonic::JP_V0_NNN:
+				emit.MovzxRegState8(RAX, quirks.jumpPlusVX ? X : V);
+				emit.Bytes({ 0x05 }); emit.Dword(instruction.nnn); // add eax, nnn
+				emit.Bytes({ 0x25, 0xFF, 0x0F, 0x00, 0x00 });      // and eax, 0xFFF
+				emit.MovWordStateReg(PC, RAX);
+				emit.Bytes({ 0x49, 0x8B, 0x04, 0xC6 });            // mov rax, [r14 + rax * 8]
+				emit.Bytes({ 0x48, 0x85, 0xC0 });                  // test rax, rax
+				emit.Jcc(JE, m_exit);
+				emit.Bytes({ 0xFF, 0xE0 });                        // jmp rax
+				ended = true;
+				break;
+			case Mnemonic::SE_VX_NN:
+				emit.CmpByteStateImm(X, instruction.nn);
+				skip(JE, next);
+				ended = true;
+				break;
+			case Mnemonic::SNE_VX_NN:
+				emit.CmpByteStateImm(X, instruction.nn);
+				skip(JNE, next);
+				ended = true;
+				break;
+			case Mnemonic::SE_VX_VY:
+				emit.MovRegState8(RAX, X);
+				emit.CmpRegState8(RAX, Y);
+				skip(JE, next);
+				ended = true;
+				break;
+			case Mnemonic::SNE_VX_VY:
+				emit.MovRegState8(RAX, X);
+				emit.CmpRegState8(RAX, Y);
+				skip(JNE, next);
+				ended = true;
+				break;
+			case Mnemonic::SKP_VX:
+			case Mnemonic::SKNP_VX:
+			{
+				// Same as Chip8::TestKey: VX above 0xF is never pressed, otherwise the key is pressed if it is held or tapped and a
+				// tap is used up by the test
+				bool skipIfPressed = (Mnemonic::SKP_VX == instruction.mnemonic);
+				emit.MovzxRegState8(RAX, X);
+				emit.Bytes({ 0x83, 0xF8, 0x0F });                         // cmp eax, 0xF
+				unsigned char *notKey = emit.Jcc(JA);
+				emit.MovzxRegState16(RCX, m_keysDownOffset);
+				emit.MovzxRegState16(RDX, m_keysTappedOffset);
+				emit.Bytes({ 0x09, 0xD1 });                               // or ecx, edx
+				emit.Bytes({ 0x66, 0x0F, 0xB3 }); emit.State(RAX, m_keysTappedOffset); // btr word [rbx + tapped], ax
+				emit.Bytes({ 0x0F, 0xA3, 0xC1 });                         // bt ecx, eax
+				unsigned char *taken = emit.Jcc(skipIfPressed ? JB : JAE);
+				if (skipIfPressed)
+					Emitter::Patch(notKey, emit.Cursor());
+				chain(next);
+				Emitter::Patch(taken, emit.Cursor());
+				if (!skipIfPressed)
+					Emitter::Patch(notKey, emit.Cursor());
+				chain(next + 2);
+				ended = true;
+				break;
+			}
+			default:
+				compiled = false;
+				break;
+		}
+
+		if (!compiled)
+		{
+			if (0 == count)
+			{
+				m_refunds.clear();
+				m_uncompilable[start] = true;
+				return nullptr;
+			}
+			// Leave the instruction for the interpreter
+			emit.MovWordStateImm(PC, pc);
+			emit.Jmp(m_exit);
+			ended = true;
+			break;
+		}
+
+		count++;
+		pc = next;
+	}
+
+	// Ran out of room in the block rather than reaching the end of it
+	if (!ended)
+		chain(pc);
+
+	std::memcpy(budgetCheck, &count, 4);
+	std::memcpy(budgetCharge, &count, 4);
+	for (unsigned char *refund : m_refunds)
+	{
+		unsigned int before;
+		std::memcpy(&before, refund, 4);
+		unsigned int value = count - before;
+		std::memcpy(refund, &value, 4);
+	}
+	m_refunds.clear();
+
+	m_codeUsed += (emit.Size() + 15) & ~(size_t)15;
+	m_table[start] = entry;
+	m_blockEnd[start] = pc;
+	for (unsigned int page = start >> PAGE_SHIFT; page <= (unsigned int)((pc - 1) >> PAGE_SHIFT) && page < NUMBER_OF_PAGES; page++)
+		m_blocksByPage[page].push_back(start);
+
+	return entry;
+}
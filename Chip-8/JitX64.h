@@ -0,0 +1,72 @@
+#pragma once
+#include <vector>
+#include "Chip8.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT_SUPPORTED 1
+#else
+#define CHIP8_JIT_SUPPORTED 0
+#endif
+
+// Passed to the generated entry trampoline. The layout is baked into the generated code so do not reorder it
+struct JitContext
+{
+	const unsigned char *entry;     // Block to jump to
+	unsigned long long budget;      // Instructions left on entry, instructions still unused on exit
+	unsigned char *memory;
+	const unsigned char **table;    // Native entry point for each CHIP-8 address, or null
+};
+
+/*****************************************************************************************************************************************/
+//
+// JitX64 - Translates basic blocks of CHIP-8 code into x86-64
+//
+// Notes - The V registers, I and the PC stay in the Chip8 object and are addressed off a host register, so the machine state is
+//         always the same as the interpreter's whenever control is back in C++. Blocks chain to each other through an address
+//         indexed table without returning to C++. Anything that needs a call (DXYN, CXNN, CALL/RET, the timers, FX0A, FX33, FX55)
+//         ends the block and is run by the interpreter.
+/*****************************************************************************************************************************************/
+class JitX64
+{
+public:
+	JitX64();
+	~JitX64();
+
+	bool IsAvailable();
+	int Run(Chip8& chip, unsigned int maxInstructions, unsigned int& executed);
+	void Invalidate(unsigned short address, unsigned short length);
+	void InvalidateAll();
+
+private:
+	static constexpr int CODE_BUFFER_SIZE = 4 * 1024 * 1024;
+	static constexpr int MAX_BLOCK_INSTRUCTIONS = 64;
+	// The longest instruction is FX65 with X of F at about 230 bytes. The budget check at the top of a block and the chain or exit
+	// at the bottom fit in what is left over
+	static constexpr int MAX_INSTRUCTION_CODE_SIZE = 256;
+	static constexpr int MAX_BLOCK_CODE_SIZE = MAX_BLOCK_INSTRUCTIONS * MAX_INSTRUCTION_CODE_SIZE + 128;
+	static constexpr int PAGE_SHIFT = 8;
+	static constexpr int NUMBER_OF_PAGES = CHIP_8_MEMORY_SIZE >> PAGE_SHIFT;
+
+	unsigned char *m_code;
+	size_t m_codeUsed;
+	size_t m_codeReset;            // Everything below this is the trampoline and exit stub, which are never flushed
+	const unsigned char *m_exit;
+	void (*m_enter)(Chip8 *chip, JitContext *context);
+
+	const unsigned char *m_table[CHIP_8_MEMORY_SIZE];
+	unsigned short m_blockEnd[CHIP_8_MEMORY_SIZE];
+	bool m_uncompilable[CHIP_8_MEMORY_SIZE]; // The first instruction at this address has to be interpreted
+	std::vector<unsigned short> m_blocksByPage[NUMBER_OF_PAGES];
+	std::vector<unsigned char *> m_refunds;  // Budget refunds to fix up for the block being compiled
+
+	// Offsets of the machine state from the Chip8 object, which the generated code addresses through RBX
+	int m_registersOffset;
+	int m_addressRegisterOffset;
+	int m_pcOffset;
+	int m_keysDownOffset;
+	int m_keysTappedOffset;
+
+	void GenerateTrampoline();
+	const unsigned char* Compile(Chip8& chip, unsigned short start);
+	void Flush();
+};
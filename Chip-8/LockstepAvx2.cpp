@@ -0,0 +1,319 @@
+#include "LockstepKernels.h"
+
+#if CHIP8_LOCKSTEP_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CHIP8_AVX2_TARGET
+#else
+// Only these functions are built for AVX2, so the rest of the program still runs on hosts without it
+#define CHIP8_AVX2_TARGET __attribute__((target("avx2,popcnt")))
+#endif
+
+// AVX2 kernels. One register holds a byte of machine state for each of the 32 lanes of a chunk, or a 16 bit I for 16 of them.
+// Results are blended in under the lane mask so lanes outside the group keep their state
+namespace
+{
+	static constexpr short FONT_HEIGHT = 5;
+
+	CHIP8_AVX2_TARGET inline __m256i Load(const unsigned char *lanes, size_t offset)
+	{
+		return _mm256_loadu_si256((const __m256i *)(lanes + offset));
+	}
+
+	CHIP8_AVX2_TARGET inline void Store(unsigned char *lanes, size_t offset, __m256i value)
+	{
+		_mm256_storeu_si256((__m256i *)(lanes + offset), value);
+	}
+
+	// Writes value to the lanes selected by mask, in the same order as the interpreter writes a register
+	CHIP8_AVX2_TARGET inline void StoreMasked(unsigned char *lanes, size_t offset, __m256i value, __m256i mask)
+	{
+		Store(lanes, offset, _mm256_blendv_epi8(Load(lanes, offset), value, mask));
+	}
+
+	CHIP8_AVX2_TARGET inline __m256i ShiftRightOne(__m256i value)
+	{
+		return _mm256_and_si256(_mm256_srli_epi16(value, 1), _mm256_set1_epi8(0x7F));
+	}
+
+	CHIP8_AVX2_TARGET inline __m256i TopBit(__m256i value)
+	{
+		return _mm256_and_si256(_mm256_srli_epi16(value, 7), _mm256_set1_epi8(0x01));
+	}
+
+	// 0xFF where a >= b, unsigned
+	CHIP8_AVX2_TARGET inline __m256i GreaterOrEqual(__m256i a, __m256i b)
+	{
+		return _mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a);
+	}
+
+	CHIP8_AVX2_TARGET void LoadConst(const LockstepLanes& lanes, unsigned char *vx, unsigned char value)
+	{
+		const __m256i constant = _mm256_set1_epi8((char)value);
+		for (size_t chunk = 0; chunk < lanes.chunkCount; chunk++)
+		{
+			size_t offset = (size_t)lanes.chunks[chunk] * LOCKSTEP_CHUNK_LANES;
+			StoreMasked(vx, offset, constant, Load(lanes.mask, offset));
+		}
+	}
+
+	CHIP8_AVX2_TARGET void AddConst(const LockstepLanes& lanes, unsigned char *vx, unsigned char value)
+	{
+		const __m256i constant = _mm256_set1_epi8((char)value);
+		for (size_t chunk = 0; chunk < lanes.chunkCount; chunk++)
+		{
+			size_t offset = (size_t)lanes.chunks[chunk] * LOCKSTEP_CHUNK_LANES;
+			__m256i x = Load(vx, offset);
+			Store(vx, offset, _mm256_blendv_epi8(x, _mm256_add_epi8(x, constant), Load(lanes.mask, offset)));
+		}
+	}
+
+	CHIP8_AVX2_TARGET void Copy(const LockstepLanes& lanes, unsigned char *destination, const unsigned char *source)
+	{
+		for (size_t chunk = 0; chunk < lanes.chunkCount; chunk++)
+		{
+			size_t offset = (size_t)lanes.chunks[chunk] * LOCKSTEP_CHUNK_LANES;
+			StoreMasked(destination, offset, Load(source, offset), Load(lanes.mask, offset));
+		}
+	}
+
+	// Registers are reloaded after every store because VX, VY and VF may be the same array
+	CHIP8_AVX2_TARGET void Alu(const LockstepLanes& lanes, unsigned char operation, unsigned char *vx, unsigned char *vy, unsigned char *vf)
+	{
+		const __m256i one = _mm256_set1_epi8(1);
+		for (size_t chunk = 0; chunk < lanes.chunkCount; chunk++)
+		{
+			size_t offset = (size_t)lanes.chunks[chunk] * LOCKSTEP_CHUNK_LANES;
+			__m256i mask = Load(lanes.mask, offset);
+			__m256i x = Load(vx, offset);
+			__m256i y = Load(vy, offset);
+			switch (operation)
+			{
+				case 0x0:
+					StoreMasked(vx, offset, y, mask);
+					break;
+				case 0x1:
+					StoreMasked(vx, offset, _mm256_or_si256(x, y), mask);
+					break;
+				case 0x2:
+					StoreMasked(vx, offset, _mm256_and_si256(x, y), mask);
+					break;
+				case 0x3:
+					StoreMasked(vx, offset, _mm256_xor_si256(x, y), mask);
+					break;
+				case 0x4:
+				{
+					__m256i sum = _mm256_add_epi8(x, y);
+					__m256i noCarry = GreaterOrEqual(sum, x);
+					StoreMasked(vf, offset, _mm256_andnot_si256(noCarry, one), mask);
+					StoreMasked(vx, offset, sum, mask);
+				}
+					break;
+				case 0x5:
+					StoreMasked(vf, offset, _mm256_and_si256(GreaterOrEqual(x, y), one), mask);
+					x = Load(vx, offset);
+					y = Load(vy, offset);
+					StoreMasked(vx, offset, _mm256_sub_epi8(x, y), mask);
+					break;
+				case 0x6:
+					StoreMasked(vf, offset, _mm256_and_si256(y, one), mask);
+					StoreMasked(vy, offset, ShiftRightOne(Load(vy, offset)), mask);
+					StoreMasked(vx, offset, Load(vy, offset), mask);
+					break;
+				case 0x7:
+					StoreMasked(vf, offset, _mm256_and_si256(GreaterOrEqual(y, x), one), mask);
+					x = Load(vx, offset);
+					y = Load(vy, offset);
+					StoreMasked(vx, offset, _mm256_sub_epi8(y, x), mask);
+					break;
+				case 0xE:
+					StoreMasked(vf, offset, TopBit(y), mask);
+					y = Load(vy, offset);
+					StoreMasked(vy, offset, _mm256_add_epi8(y, y), mask);
+					StoreMasked(vx, offset, Load(vy, offset), mask);
+					break;
+			}
+		}
+	}
+
+	CHIP8_AVX2_TARGET inline unsigned int StoreSkip(unsigned char *skip, size_t offset, __m256i taken)
+	{
+		Store(skip, offset, taken);
+		return (unsigned int)_mm_popcnt_u32((unsigned int)_mm256_movemask_epi8(taken));
+	}
+
+	CHIP8_AVX2_TARGET unsigned int SkipConst(const LockstepLanes& lanes, const unsigned char *vx, unsigned char value, bool equal, unsigned char *skip)
+	{
+		const __m256i constant = _mm256_set1_epi8((char)value);
+		const __m256i invert = equal ? _mm256_setzero_si256() : _mm256_set1_epi8(-1);
+		unsigned int count = 0;
+		for (size_t chunk = 0; chunk < lanes.chunkCount; chunk++)
+		{
+			size_t offset = (size_t)lanes.chunks[chunk] * LOCKSTEP_CHUNK_LANES;
+			__m256i taken = _mm256_xor_si256(_mm256_cmpeq_epi8(Load(vx, offset), constant), invert);
+			count += StoreSkip(skip, offset, _mm256_and_si256(taken, Load(lanes.mask, offset)));
+		}
+		return count;
+	}
+
+	CHIP8_AVX2_TARGET unsigned int SkipRegister(const LockstepLanes& lanes, const unsigned char *vx, const unsigned char *vy, bool equal, unsigned char *skip)
+	{
+		const __m256i invert = equal ? _mm256_setzero_si256() : _mm256_set1_epi8(-1);
+		unsigned int count = 0;
+		for (size_t chunk = 0; chunk < lanes.chunkCount; chunk++)
+		{
+			size_t offset = (size_t)lanes.chunks[chunk] * LOCKSTEP_CHUNK_LANES;
+			__m256i taken = _mm256_xor_si256(_mm256_cmpeq_epi8(Load(vx, offset), Load(vy, offset)), invert);
+			count += StoreSkip(skip, offset, _mm256_and_si256(taken, Load(lanes.mask, offset)));
+		}
+		return count;
+	}
+
+	// The bit for VX is looked up with a byte shuffle and picked out of the low or high key plane, so no lane needs a variable shift
+	CHIP8_AVX2_TARGET unsigned int SkipKey(const LockstepLanes& lanes, const unsigned char *vx, const unsigned char *down, unsigned char *tapped, size_t plane, bool equal, unsigned char *skip)
+	{
+		const __m256i invert = equal ? _mm256_set1_epi8(-1) : _mm256_setzero_si256();
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+		                                      1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+		unsigned int count = 0;
+		for (size_t chunk = 0; chunk < lanes.chunkCount; chunk++)
+		{
+			size_t offset = (size_t)lanes.chunks[chunk] * LOCKSTEP_CHUNK_LANES;
+			__m256i mask = Load(lanes.mask, offset);
+			__m256i key = Load(vx, offset);
+			__m256i isKey = _mm256_cmpeq_epi8(_mm256_and_si256(key, _mm256_set1_epi8((char)0xF0)), zero);
+			__m256i bit = _mm256_and_si256(_mm256_shuffle_epi8(bits, _mm256_and_si256(key, _mm256_set1_epi8(0x0F))), isKey);
+			__m256i high = _mm256_cmpeq_epi8(_mm256_and_si256(key, _mm256_set1_epi8(0x08)), _mm256_set1_epi8(0x08));
+			__m256i lowBit = _mm256_andnot_si256(high, bit);
+			__m256i highBit = _mm256_and_si256(high, bit);
+
+			__m256i tappedLow = Load(tapped, offset);
+			__m256i tappedHigh = Load(tapped + plane, offset);
+			__m256i hit = _mm256_or_si256(_mm256_and_si256(_mm256_or_si256(Load(down, offset), tappedLow), lowBit),
+			                              _mm256_and_si256(_mm256_or_si256(Load(down + plane, offset), tappedHigh), highBit));
+			// cmpeq gives 0xFF where nothing was hit, so the inversion for EX9E is the one that flips it
+			__m256i taken = _mm256_and_si256(_mm256_xor_si256(_mm256_cmpeq_epi8(hit, zero), invert), mask);
+			Store(tapped, offset, _mm256_andnot_si256(_mm256_and_si256(lowBit, mask), tappedLow));
+			Store(tapped + plane, offset, _mm256_andnot_si256(_mm256_and_si256(highBit, mask), tappedHigh));
+			count += StoreSkip(skip, offset, taken);
+		}
+		return count;
+	}
+
+	CHIP8_AVX2_TARGET bool TickTimers(const LockstepLanes& lanes, unsigned char *delay, unsigned char *sound, unsigned char count)
+	{
+		const __m256i ticks = _mm256_set1_epi8((char)count);
+		const __m256i zero = _mm256_setzero_si256();
+		__m256i expired = zero;
+		for (size_t chunk = 0; chunk < lanes.chunkCount; chunk++)
+		{
+			size_t offset = (size_t)lanes.chunks[chunk] * LOCKSTEP_CHUNK_LANES;
+			__m256i mask = Load(lanes.mask, offset);
+			StoreMasked(delay, offset, _mm256_subs_epu8(Load(delay, offset), ticks), mask);
+
+			// A running sound timer expires when it is no bigger than the ticks
+			__m256i timer = Load(sound, offset);
+			__m256i ending = _mm256_andnot_si256(_mm256_cmpeq_epi8(timer, zero), GreaterOrEqual(ticks, timer));
+			expired = _mm256_or_si256(expired, _mm256_and_si256(ending, mask));
+			Store(sound, offset, _mm256_blendv_epi8(timer, _mm256_subs_epu8(timer, ticks), mask));
+		}
+		return 0 != _mm256_movemask_epi8(expired);
+	}
+
+	// I is 16 bits, so a chunk of lanes covers two registers and the byte mask is widened to match
+	CHIP8_AVX2_TARGET inline __m256i WidenMask(__m256i mask, int half)
+	{
+		return _mm256_cvtepi8_epi16(half ? _mm256_extracti128_si256(mask, 1) : _mm256_castsi256_si128(mask));
+	}
+
+	CHIP8_AVX2_TARGET inline __m256i WidenRegister(__m256i value, int half)
+	{
+		return _mm256_cvtepu8_epi16(half ? _mm256_extracti128_si256(value, 1) : _mm256_castsi256_si128(value));
+	}
+
+	CHIP8_AVX2_TARGET inline void StoreAddress(unsigned short *addressRegister, size_t lane, __m256i value, __m256i mask)
+	{
+		__m256i *location = (__m256i *)(addressRegister + lane);
+		_mm256_storeu_si256(location, _mm256_blendv_epi8(_mm256_loadu_si256(location), value, mask));
+	}
+
+	CHIP8_AVX2_TARGET void LoadAddress(const LockstepLanes& lanes, unsigned short *addressRegister, unsigned short value)
+	{
+		const __m256i constant = _mm256_set1_epi16((short)value);
+		for (size_t chunk = 0; chunk < lanes.chunkCount; chunk++)
+		{
+			size_t offset = (size_t)lanes.chunks[chunk] * LOCKSTEP_CHUNK_LANES;
+			__m256i mask = Load(lanes.mask, offset);
+			for (int half = 0; half < 2; half++)
+				StoreAddress(addressRegister, offset + half * 16, constant, WidenMask(mask, half));
+		}
+	}
+
+	CHIP8_AVX2_TARGET void AddAddress(const LockstepLanes& lanes, unsigned short *addressRegister, const unsigned char *vx)
+	{
+		const __m256i wrap = _mm256_set1_epi16(0x0FFF);
+		for (size_t chunk = 0; chunk < lanes.chunkCount; chunk++)
+		{
+			size_t offset = (size_t)lanes.chunks[chunk] * LOCKSTEP_CHUNK_LANES;
+			__m256i mask = Load(lanes.mask, offset);
+			__m256i x = Load(vx, offset);
+			for (int half = 0; half < 2; half++)
+			{
+				__m256i address = _mm256_loadu_si256((const __m256i *)(addressRegister + offset + half * 16));
+				address = _mm256_and_si256(_mm256_add_epi16(address, WidenRegister(x, half)), wrap);
+				StoreAddress(addressRegister, offset + half * 16, address, WidenMask(mask, half));
+			}
+		}
+	}
+
+	CHIP8_AVX2_TARGET void LoadFont(const LockstepLanes& lanes, unsigned short *addressRegister, const unsigned char *vx)
+	{
+		const __m256i height = _mm256_set1_epi16(FONT_HEIGHT);
+		for (size_t chunk = 0; chunk < lanes.chunkCount; chunk++)
+		{
+			size_t offset = (size_t)lanes.chunks[chunk] * LOCKSTEP_CHUNK_LANES;
+			__m256i mask = Load(lanes.mask, offset);
+			__m256i x = Load(vx, offset);
+			for (int half = 0; half < 2; half++)
+				StoreAddress(addressRegister, offset + half * 16, _mm256_mullo_epi16(WidenRegister(x, half), height), WidenMask(mask, half));
+		}
+	}
+
+	bool HostSupportsAvx2()
+	{
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		__cpuid(info, 1);
+		// OSXSAVE and AVX, then check the OS saves the YMM registers
+		if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 0x6) != 0x6)
+			return false;
+		__cpuidex(info, 7, 0);
+		return 0 != (info[1] & (1 << 5));
+#else
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#endif
+	}
+}
+
+const LockstepKernels* GetAvx2LockstepKernels()
+{
+	static const LockstepKernels kernels = {
+		LoadConst, AddConst, Copy, Alu, SkipConst, SkipRegister, SkipKey, TickTimers, LoadAddress, AddAddress, LoadFont,
+	};
+	static const bool supported = HostSupportsAvx2();
+	return supported ? &kernels : nullptr;
+}
+
+#else
+
+const LockstepKernels* GetAvx2LockstepKernels()
+{
+	return nullptr;
+}
+
+#endif
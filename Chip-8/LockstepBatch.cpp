@@ -0,0 +1,806 @@
+#include "LockstepBatch.h"
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <iterator>
+
+namespace
+{
+	inline unsigned long long LoadLanes(const unsigned char *mask)
+	{
+		unsigned long long lanes;
+		std::memcpy(&lanes, mask, sizeof(lanes));
+		return lanes;
+	}
+
+	inline void StoreLanes(unsigned char *mask, unsigned long long lanes)
+	{
+		std::memcpy(mask, &lanes, sizeof(lanes));
+	}
+}
+
+LockstepBatch::LockstepBatch(unsigned int lanes) :
+	m_programSize(0)
+{
+	if (0 == lanes)
+		lanes = 1;
+	m_laneCount = lanes;
+	m_chunkCount = (lanes + LOCKSTEP_CHUNK_LANES - 1) / LOCKSTEP_CHUNK_LANES;
+	m_paddedLanes = m_chunkCount * LOCKSTEP_CHUNK_LANES;
+
+	m_kernels = GetAvx2LockstepKernels();
+	m_avx2 = (nullptr != m_kernels);
+	if (!m_avx2)
+		m_kernels = &GetGenericLockstepKernels();
+
+	m_registers.reset(new unsigned char[16 * (size_t)m_paddedLanes]());
+	m_addressRegister.reset(new unsigned short[m_paddedLanes]());
+	m_delayTimer.reset(new unsigned char[m_paddedLanes]());
+	m_soundTimer.reset(new unsigned char[m_paddedLanes]());
+	m_keysDown.reset(new unsigned char[2 * (size_t)m_paddedLanes]());
+	m_keysTapped.reset(new unsigned char[2 * (size_t)m_paddedLanes]());
+	m_waiting.reset(new unsigned char[m_paddedLanes]());
+	m_seed.reset(new unsigned int[m_paddedLanes]());
+	m_random.reset(new unsigned int[m_paddedLanes]());
+	m_memory.reset(new unsigned char[(size_t)m_paddedLanes * LANE_MEMORY_SIZE]());
+	m_display.reset(new unsigned long long[(size_t)m_paddedLanes * Chip8::DISPLAY_HEIGHT]());
+	m_scratch.reset(new unsigned char[m_paddedLanes]());
+	m_targets.reset(new unsigned short[m_paddedLanes]());
+	m_groupAtPC.assign(CHIP_8_MEMORY_SIZE + 4, -1);
+	// A group always has at least one lane, so this is enough to keep references to groups valid across a split
+	m_groups.reserve(m_laneCount);
+
+	for (unsigned int lane = 0; lane < m_paddedLanes; lane++)
+		SetRandomSeed(lane, lane + 1);
+
+	std::memset(m_image, 0, sizeof(m_image));
+	std::memcpy(m_image, Chip8::m_fonts, sizeof(Chip8::m_fonts));
+	std::memcpy(&m_image[Chip8::LARGE_FONT_ADDRESS], Chip8::m_largeFonts, sizeof(Chip8::m_largeFonts));
+	Reset();
+}
+
+LockstepBatch::~LockstepBatch()
+{
+}
+
+/*****************************************************************************************************************************************/
+//
+// LoadProgram - Loads the ROM every lane runs
+//
+// Inputs - program (ROM bytes)
+//          size (number of bytes)
+//
+// Outputs - 0 on success, -1 if the ROM is too big
+//
+// Notes - The lanes are reset onto the new program
+/*****************************************************************************************************************************************/
+int LockstepBatch::LoadProgram(const unsigned char *program, int size)
+{
+	if ((size < 0) || (size > MAX_PROGRAM_SIZE) || ((nullptr == program) && (0 != size)))
+		return -1;
+
+	std::memset(&m_image[INTERPRETER_SIZE], 0, CHIP_8_MEMORY_SIZE - INTERPRETER_SIZE);
+	if (0 != size)
+		std::memcpy(&m_image[INTERPRETER_SIZE], program, size);
+	m_programSize = size;
+	Reset();
+	return 0;
+}
+
+/*****************************************************************************************************************************************/
+//
+// Reset - Puts every lane back at the start of the program in a single group
+//
+// Inputs - None
+//
+// Outputs - None
+//
+// Notes - Each lane's random generator restarts from the seed given to SetRandomSeed
+/*****************************************************************************************************************************************/
+void LockstepBatch::Reset()
+{
+	std::memset(m_registers.get(), 0, 16 * (size_t)m_paddedLanes);
+	std::memset(m_display.get(), 0, (size_t)m_paddedLanes * Chip8::DISPLAY_HEIGHT * sizeof(unsigned long long));
+	std::memset(m_written, 0, sizeof(m_written));
+	for (unsigned int lane = 0; lane < m_paddedLanes; lane++)
+	{
+		m_addressRegister[lane] = 0;
+		m_delayTimer[lane] = 0;
+		m_soundTimer[lane] = 0;
+		m_keysTapped[lane] = 0;
+		m_keysTapped[m_paddedLanes + lane] = 0;
+		m_waiting[lane] = 0;
+		m_random[lane] = m_seed[lane];
+		std::memcpy(Memory(lane), m_image, CHIP_8_MEMORY_SIZE);
+	}
+
+	m_groups.clear();
+	LockstepGroup group;
+	group.pc = START_CHIP_8_PROGRAM;
+	group.state = GROUP_RUNNING;
+	group.keyRegister = 0;
+	group.members = m_laneCount;
+	group.mask.assign(m_paddedLanes, 0);
+	std::memset(group.mask.data(), 0xFF, m_laneCount);
+	UpdateChunks(group);
+	m_groups.push_back(std::move(group));
+}
+
+/*****************************************************************************************************************************************/
+//
+// Run - Executes the running lanes in lockstep
+//
+// Inputs - maxSteps (instructions to execute on each running lane)
+//          steps (set to the number of steps taken)
+//
+// Outputs - Status bits of every lane ORed together: 0x1 a lane hit a bad opcode (with 0x20 or 0x40 for a stack overflow or
+//           underflow, as for Chip8), 0x2 a display changed
+//
+// Notes - Unlike Chip8::Run this does not stop when a lane waits for input or hits a bad opcode. Those lanes drop out and the rest
+//         carry on. It returns early only when no lane is left running. As with Chip8::Run the timers are left to RunFrame
+/*****************************************************************************************************************************************/
+int LockstepBatch::Run(unsigned int maxSteps, unsigned int& steps)
+{
+	int returnValue = 0;
+	steps = 0;
+	ResumeWaitingLanes();
+
+	while (steps < maxSteps)
+	{
+		// Groups split off during this step have already executed it, so only visit the ones that existed at the start
+		size_t groupCount = m_groups.size();
+		bool running = false;
+		for (size_t group = 0; group < groupCount; group++)
+		{
+			if (GROUP_RUNNING != m_groups[group].state)
+				continue;
+			running = true;
+			returnValue |= Step((int)group);
+		}
+		if (!running)
+			break;
+		steps++;
+
+		if (m_groups.size() > 1)
+			MergeGroups();
+	}
+	return returnValue;
+}
+
+/*****************************************************************************************************************************************/
+//
+// RunFrame - Runs one 60 Hz frame on every lane
+//
+// Inputs - cyclesPerFrame (instructions to execute on each running lane)
+//          steps (set to the number of steps taken)
+//
+// Outputs - Status bits as for Run, plus 0x8 if a lane's sound timer is running and 0x10 if a lane is waiting for a key
+//
+// Notes - Every lane's timers tick once at the end of the frame, including lanes that are waiting or stopped, in the same way as
+//         Chip8::RunFrame
+/*****************************************************************************************************************************************/
+int LockstepBatch::RunFrame(unsigned int cyclesPerFrame, unsigned int& steps)
+{
+	int returnValue = Run(cyclesPerFrame, steps);
+
+	for (auto& group : m_groups)
+	{
+		if (m_kernels->tickTimers(Lanes(group), m_delayTimer.get(), m_soundTimer.get(), 1))
+			returnValue |= 0x4;
+		if (GROUP_WAITING == group.state)
+			returnValue |= 0x10;
+	}
+	for (unsigned int lane = 0; lane < m_laneCount; lane++)
+	{
+		if (0 != m_soundTimer[lane])
+		{
+			returnValue |= 0x8;
+			break;
+		}
+	}
+	return returnValue;
+}
+
+void LockstepBatch::SetRandomSeed(unsigned int lane, unsigned int seed)
+{
+	if (lane >= m_paddedLanes)
+		return;
+	m_seed[lane] = (0 == seed) ? Chip8::ZERO_SEED_REPLACEMENT : seed;
+	m_random[lane] = m_seed[lane];
+}
+
+void LockstepBatch::KeyPress(unsigned int lane, unsigned char key)
+{
+	if ((lane >= m_laneCount) || (key > 0xF))
+		return;
+
+	if (!ResumeFromKeyWait(lane, key))
+		m_keysTapped[((key & 0x8) ? m_paddedLanes : 0) + lane] |= (unsigned char)(1u << (key & 0x7));
+}
+
+void LockstepBatch::KeyDown(unsigned int lane, unsigned char key)
+{
+	if ((lane >= m_laneCount) || (key > 0xF))
+		return;
+
+	m_keysDown[((key & 0x8) ? m_paddedLanes : 0) + lane] |= (unsigned char)(1u << (key & 0x7));
+	ResumeFromKeyWait(lane, key);
+}
+
+void LockstepBatch::KeyUp(unsigned int lane, unsigned char key)
+{
+	if ((lane >= m_laneCount) || (key > 0xF))
+		return;
+
+	m_keysDown[((key & 0x8) ? m_paddedLanes : 0) + lane] &= (unsigned char)~(1u << (key & 0x7));
+}
+
+bool LockstepBatch::ResumeFromKeyWait(unsigned int lane, unsigned char key)
+{
+	if (!m_waiting[lane])
+		return false;
+
+	int group = FindGroup(lane);
+	Register(m_groups[group].keyRegister)[lane] = key;
+	m_waiting[lane] = 0;
+	return true;
+}
+
+bool LockstepBatch::UsingAvx2()
+{
+	return m_avx2;
+}
+
+unsigned int LockstepBatch::GetLaneCount()
+{
+	return m_laneCount;
+}
+
+unsigned int LockstepBatch::GetGroupCount()
+{
+	return (unsigned int)m_groups.size();
+}
+
+unsigned char LockstepBatch::GetRegister(unsigned int lane, unsigned char registerNum)
+{
+	return (lane < m_laneCount) ? Register(registerNum & 0xF)[lane] : 0;
+}
+
+unsigned short LockstepBatch::GetAddressRegister(unsigned int lane)
+{
+	return (lane < m_laneCount) ? m_addressRegister[lane] : 0;
+}
+
+unsigned short LockstepBatch::GetPC(unsigned int lane)
+{
+	int group = FindGroup(lane);
+	return (group < 0) ? 0 : m_groups[group].pc;
+}
+
+unsigned long long LockstepBatch::GetDisplayRow(unsigned int lane, unsigned char row)
+{
+	return ((lane < m_laneCount) && (row < Chip8::DISPLAY_HEIGHT)) ? Display(lane)[row] : 0;
+}
+
+unsigned long long LockstepBatch::GetDisplayHash(unsigned int lane)
+{
+	return (lane < m_laneCount) ? Chip8::HashDisplay(Display(lane), Chip8::DISPLAY_HEIGHT) : 0;
+}
+
+bool LockstepBatch::IsWaitingForInput(unsigned int lane)
+{
+	return (lane < m_laneCount) && (0 != m_waiting[lane]);
+}
+
+bool LockstepBatch::IsStopped(unsigned int lane)
+{
+	int group = FindGroup(lane);
+	return (group >= 0) && (GROUP_STOPPED == m_groups[group].state);
+}
+
+template <typename Operation>
+void LockstepBatch::ForEachLane(const LockstepGroup& group, Operation operation)
+{
+	for (unsigned int chunk : group.chunks)
+	{
+		unsigned int first = chunk * LOCKSTEP_CHUNK_LANES;
+		for (unsigned int lane = first; lane < first + LOCKSTEP_CHUNK_LANES; lane++)
+		{
+			if (group.mask[lane])
+				operation(lane);
+		}
+	}
+}
+
+/*****************************************************************************************************************************************/
+//
+// Step - Executes one instruction on every lane of a group
+//
+// Inputs - groupIndex (group to step)
+//
+// Outputs - Status bits, the same as Chip8::Execute
+//
+// Notes - Mirrors Chip8::Execute. The opcode comes from the shared program image unless some lane has written to it, in which case
+//         it is read from each lane and the group is split if the lanes no longer agree
+/*****************************************************************************************************************************************/
+int LockstepBatch::Step(int groupIndex)
+{
+	LockstepGroup& group = m_groups[groupIndex];
+	unsigned short pc = group.pc;
+	unsigned short opcode;
+	if (pc >= HIGHEST_PC_VALUE)
+	{
+		opcode = 0xFFFF; // Same as Chip8::GetOpcode
+	}
+	else if (!m_written[pc] && !m_written[pc + 1])
+	{
+		opcode = (m_image[pc] << 8) | m_image[pc + 1];
+	}
+	else
+	{
+		std::vector<std::pair<int, unsigned short>> parts;
+		SplitBy(groupIndex, [this, pc](unsigned int lane) { return (unsigned short)((Memory(lane)[pc] << 8) | Memory(lane)[pc + 1]); }, parts);
+		if (parts.size() > 1)
+		{
+			int returnValue = 0;
+			for (auto& part : parts)
+				returnValue |= Execute(part.first, part.second);
+			return returnValue;
+		}
+		opcode = parts[0].second;
+	}
+	return Execute(groupIndex, opcode);
+}
+
+int LockstepBatch::Execute(int groupIndex, unsigned short opcode)
+{
+	LockstepGroup& group = m_groups[groupIndex];
+	const LockstepLanes lanes = Lanes(group);
+	unsigned char  operationType = (opcode & 0xF000) >> 12;
+	unsigned char firstRegister = (opcode & 0x0F00) >> 8;
+	unsigned char secondRegister = (opcode & 0x00F0) >> 4;
+	unsigned char opSubType = (opcode & 0x000F);
+	unsigned char constValue = (opcode & 0x00FF);
+	unsigned short address = (opcode & 0x0FFF);
+	unsigned char *vx = Register(firstRegister);
+	unsigned char *vy = Register(secondRegister);
+	int returnValue = 0;
+	bool flowControl = false;
+	unsigned int skipping = 0;
+
+	switch (operationType)
+	{
+		case 0x0:
+			if (0x00E0 == opcode)
+			{
+				ForEachLane(group, [this](unsigned int lane) { std::memset(Display(lane), 0, Chip8::DISPLAY_HEIGHT * sizeof(unsigned long long)); });
+			}
+			else if (0x00EE == opcode)
+			{
+				if (group.stack.empty())
+					return Stop(groupIndex, 0x41);
+				group.pc = group.stack.back();
+				group.stack.pop_back();
+				flowControl = true;
+			}
+			else
+			{
+				return Stop(groupIndex);
+			}
+			break;
+		case 0x1:
+			if ((address > START_CHIP_8_PROGRAM) && (address < (START_CHIP_8_PROGRAM + m_programSize)))
+			{
+				group.pc = address;
+				flowControl = true;
+			}
+			break;
+		case 0x2:
+			if ((address > START_CHIP_8_PROGRAM) && (address < (START_CHIP_8_PROGRAM + m_programSize)))
+			{
+				if (group.stack.size() >= CHIP_8_STACK_DEPTH)
+					return Stop(groupIndex, 0x21);
+				group.stack.push_back(group.pc + 2);
+				group.pc = address;
+				flowControl = true;
+			}
+			else
+			{
+				return Stop(groupIndex);
+			}
+			break;
+		case 0x3:
+		case 0x4:
+			skipping = m_kernels->skipConst(lanes, vx, constValue, (0x3 == operationType), m_scratch.get());
+			Diverge(groupIndex, skipping);
+			break;
+		case 0x5:
+		case 0x9:
+			if (0 != opSubType)
+				return Stop(groupIndex);
+			skipping = m_kernels->skipRegister(lanes, vx, vy, (0x5 == operationType), m_scratch.get());
+			Diverge(groupIndex, skipping);
+			break;
+		case 0x6:
+			m_kernels->loadConst(lanes, vx, constValue);
+			break;
+		case 0x7:
+			m_kernels->addConst(lanes, vx, constValue);
+			break;
+		case 0x8:
+			if ((opSubType > 0x7) && (0xE != opSubType))
+				return Stop(groupIndex);
+			m_kernels->alu(lanes, opSubType, vx, vy, Register(15));
+			break;
+		case 0xA:
+			m_kernels->loadAddress(lanes, m_addressRegister.get(), address);
+			break;
+		case 0xB:
+		{
+			const unsigned char *v0 = Register(0);
+			std::vector<std::pair<int, unsigned short>> parts;
+			SplitBy(groupIndex, [v0, address](unsigned int lane) { return (unsigned short)((address + v0[lane]) & 0x0FFF); }, parts);
+			for (auto& part : parts)
+				m_groups[part.first].pc = part.second;
+			flowControl = true;
+		}
+			break;
+		case 0xC:
+			ForEachLane(group, [this, vx, constValue](unsigned int lane) { vx[lane] = (unsigned char)(Chip8::NextRandom(m_random[lane]) >> 24) & constValue; });
+			break;
+		case 0xD:
+		{
+			unsigned char *vf = Register(15);
+			unsigned int dirtyRows = 0; // Lanes are not presented, so which rows changed is not kept
+			ForEachLane(group, [&](unsigned int lane)
+			{
+				bool collision = Chip8::DrawSprite(Display(lane), &Memory(lane)[m_addressRegister[lane]], vx[lane], vy[lane], opSubType, dirtyRows);
+				vf[lane] = (collision ? 1 : 0);
+			});
+			returnValue |= 0x2;
+		}
+			break;
+		case 0xE:
+			if ((0x9E != constValue) && (0xA1 != constValue))
+				return Stop(groupIndex);
+			skipping = m_kernels->skipKey(lanes, vx, m_keysDown.get(), m_keysTapped.get(), m_paddedLanes, (0x9E == constValue), m_scratch.get());
+			Diverge(groupIndex, skipping);
+			break;
+		case 0xF:
+			switch (constValue)
+			{
+				case 0x07:
+					m_kernels->copy(lanes, vx, m_delayTimer.get());
+					break;
+				case 0x0A:
+					group.state = GROUP_WAITING;
+					group.keyRegister = firstRegister;
+					ForEachLane(group, [this](unsigned int lane) { m_waiting[lane] = 1; });
+					break;
+				case 0x15:
+					m_kernels->copy(lanes, m_delayTimer.get(), vx);
+					break;
+				case 0x18:
+					m_kernels->copy(lanes, m_soundTimer.get(), vx);
+					break;
+				case 0x1E:
+					m_kernels->addAddress(lanes, m_addressRegister.get(), vx);
+					break;
+				case 0x29:
+					m_kernels->loadFont(lanes, m_addressRegister.get(), vx);
+					break;
+				case 0x33:
+					ForEachLane(group, [this, vx](unsigned int lane)
+					{
+						unsigned short addressRegister = m_addressRegister[lane];
+						unsigned char *memory = Memory(lane);
+						memory[addressRegister] = vx[lane] / 100;
+						memory[addressRegister + 1] = (vx[lane] / 10) % 10;
+						memory[addressRegister + 2] = (vx[lane] % 100) % 10;
+						m_written[addressRegister] = m_written[addressRegister + 1] = m_written[addressRegister + 2] = true;
+					});
+					break;
+				case 0x55:
+				case 0x65:
+					// Lanes whose copy would run off the end of memory fail with a bad opcode, as they do in Chip8
+					if (0 != StopOutOfRange(groupIndex, firstRegister))
+					{
+						returnValue |= 0x1;
+						if (GROUP_STOPPED == group.state)
+							return returnValue;
+					}
+					if (0x55 == constValue)
+					{
+						ForEachLane(group, [this, firstRegister](unsigned int lane)
+						{
+							unsigned char *memory = Memory(lane);
+							for (int x = 0; x <= firstRegister; x++)
+							{
+								memory[m_addressRegister[lane]] = Register(x)[lane];
+								m_written[m_addressRegister[lane]++] = true;
+							}
+						});
+					}
+					else
+					{
+						ForEachLane(group, [this, firstRegister](unsigned int lane)
+						{
+							const unsigned char *memory = Memory(lane);
+							for (int x = 0; x <= firstRegister; x++)
+								Register(x)[lane] = memory[m_addressRegister[lane]++];
+						});
+					}
+					break;
+				default:
+					return Stop(groupIndex);
+			}
+			break;
+	}
+
+	if (!flowControl)
+		group.pc += 2;
+	return returnValue;
+}
+
+// Applies a skip that some, all or none of the group's lanes take. The lanes taking it are marked in m_scratch
+void LockstepBatch::Diverge(int groupIndex, unsigned int skipping)
+{
+	LockstepGroup& group = m_groups[groupIndex];
+	if (skipping == group.members)
+	{
+		group.pc += 2;
+	}
+	else if (0 != skipping)
+	{
+		int split = SplitOff(groupIndex, m_scratch.get());
+		m_groups[split].pc += 4; // The split has finished the instruction, the caller moves the rest of the group on by 2
+	}
+}
+
+// Splits off and stops the lanes where FX55/FX65 with this register would go past the end of memory. Returns how many there were
+unsigned int LockstepBatch::StopOutOfRange(int groupIndex, unsigned char registerNum)
+{
+	LockstepGroup& group = m_groups[groupIndex];
+	unsigned int count = 0;
+	ForEachLane(group, [&](unsigned int lane)
+	{
+		bool outOfRange = ((m_addressRegister[lane] + registerNum) >= CHIP_8_MEMORY_SIZE);
+		m_scratch[lane] = outOfRange ? 0xFF : 0;
+		count += outOfRange;
+	});
+
+	if (count == group.members)
+		Stop(groupIndex);
+	else if (0 != count)
+		Stop(SplitOff(groupIndex, m_scratch.get()));
+	return count;
+}
+
+// The group hit a bad opcode. Like Chip8::Execute, V0 is set to 13 and the PC moves past the instruction
+int LockstepBatch::Stop(int groupIndex, int status)
+{
+	LockstepGroup& group = m_groups[groupIndex];
+	m_kernels->loadConst(Lanes(group), Register(0), 13);
+	group.pc += 2;
+	group.state = GROUP_STOPPED;
+	return status;
+}
+
+/*****************************************************************************************************************************************/
+//
+// SplitOff - Moves some of a group's lanes into a new group
+//
+// Inputs - groupIndex (group to split)
+//          selected (non-zero for the lanes to move. Lanes outside the group are ignored)
+//
+// Outputs - Index of the new group, which starts with the same PC, stack and state
+//
+// Notes - The caller makes sure some but not all of the group's lanes are selected
+/*****************************************************************************************************************************************/
+int LockstepBatch::SplitOff(int groupIndex, const unsigned char *selected)
+{
+	LockstepGroup& group = m_groups[groupIndex];
+	LockstepGroup split;
+	split.pc = group.pc;
+	split.stack = group.stack;
+	split.state = group.state;
+	split.keyRegister = group.keyRegister;
+	split.members = 0;
+	split.mask = TakeMask();
+	split.chunks.reserve(group.chunks.size());
+
+	// Mask bytes are 0x00 or 0xFF, so lanes are moved eight at a time
+	size_t kept = 0;
+	for (unsigned int chunk : group.chunks)
+	{
+		unsigned long long staying = 0;
+		unsigned long long leaving = 0;
+		for (size_t offset = chunk * LOCKSTEP_CHUNK_LANES; offset < (chunk + 1) * LOCKSTEP_CHUNK_LANES; offset += 8)
+		{
+			unsigned long long lanes = LoadLanes(&group.mask[offset]);
+			unsigned long long moving = lanes & LoadLanes(&selected[offset]);
+			StoreLanes(&group.mask[offset], lanes & ~moving);
+			StoreLanes(&split.mask[offset], moving);
+			split.members += (unsigned int)(std::bitset<64>(moving).count() / 8);
+			staying |= lanes & ~moving;
+			leaving |= moving;
+		}
+		if (0 != staying)
+			group.chunks[kept++] = chunk;
+		if (0 != leaving)
+			split.chunks.push_back(chunk);
+	}
+	group.chunks.resize(kept);
+	group.members -= split.members;
+
+	m_groups.push_back(std::move(split));
+	return (int)m_groups.size() - 1;
+}
+
+// Returns an all clear lane mask, reusing one left over from a merge when there is one
+std::vector<unsigned char> LockstepBatch::TakeMask()
+{
+	if (m_spareMasks.empty())
+		return std::vector<unsigned char>(m_paddedLanes, 0);
+
+	std::vector<unsigned char> mask = std::move(m_spareMasks.back());
+	m_spareMasks.pop_back();
+	return mask;
+}
+
+// Splits a group so each part has the same value for every lane. Each part is returned with its value; the original group is first
+template <typename Value>
+void LockstepBatch::SplitBy(int groupIndex, Value value, std::vector<std::pair<int, unsigned short>>& parts)
+{
+	parts.clear();
+	unsigned short first = 0;
+	bool haveFirst = false;
+	unsigned int others = 0;
+	ForEachLane(m_groups[groupIndex], [&](unsigned int lane)
+	{
+		m_targets[lane] = value(lane);
+		if (!haveFirst)
+		{
+			first = m_targets[lane];
+			haveFirst = true;
+		}
+		others += (m_targets[lane] != first);
+	});
+	parts.push_back(std::make_pair(groupIndex, first));
+
+	// Peel off one value at a time until only the first lane's value is left in the original group
+	while (0 != others)
+	{
+		unsigned short next = first;
+		ForEachLane(m_groups[groupIndex], [&](unsigned int lane)
+		{
+			if ((next == first) && (m_targets[lane] != first))
+				next = m_targets[lane];
+		});
+		ForEachLane(m_groups[groupIndex], [&](unsigned int lane) { m_scratch[lane] = (m_targets[lane] == next) ? 0xFF : 0; });
+		int split = SplitOff(groupIndex, m_scratch.get());
+		others -= m_groups[split].members;
+		parts.push_back(std::make_pair(split, next));
+	}
+}
+
+void LockstepBatch::UpdateChunks(LockstepGroup& group)
+{
+	group.chunks.clear();
+	for (unsigned int chunk = 0; chunk < m_chunkCount; chunk++)
+	{
+		const unsigned char *mask = &group.mask[chunk * LOCKSTEP_CHUNK_LANES];
+		for (int lane = 0; lane < LOCKSTEP_CHUNK_LANES; lane++)
+		{
+			if (mask[lane])
+			{
+				group.chunks.push_back(chunk);
+				break;
+			}
+		}
+	}
+}
+
+int LockstepBatch::FindGroup(unsigned int lane)
+{
+	if (lane >= m_laneCount)
+		return -1;
+	for (size_t group = 0; group < m_groups.size(); group++)
+	{
+		if (m_groups[group].mask[lane])
+			return (int)group;
+	}
+	return -1;
+}
+
+// Lanes that were given a key while waiting on FX0A run again. If only some lanes of a group have a key they are split off
+void LockstepBatch::ResumeWaitingLanes()
+{
+	size_t groupCount = m_groups.size();
+	for (size_t group = 0; group < groupCount; group++)
+	{
+		if (GROUP_WAITING != m_groups[group].state)
+			continue;
+
+		unsigned int resumed = 0;
+		ForEachLane(m_groups[group], [&](unsigned int lane)
+		{
+			m_scratch[lane] = m_waiting[lane] ? 0 : 0xFF;
+			resumed += !m_waiting[lane];
+		});
+		if (resumed == m_groups[group].members)
+			m_groups[group].state = GROUP_RUNNING;
+		else if (0 != resumed)
+			m_groups[SplitOff((int)group, m_scratch.get())].state = GROUP_RUNNING;
+	}
+}
+
+/*****************************************************************************************************************************************/
+//
+// MergeGroups - Joins running groups that have come back together
+//
+// Inputs - None
+//
+// Outputs - None
+//
+// Notes - Two groups can merge when they are at the same PC with the same call stack, as from then on they take the same path until
+//         something splits them again
+/*****************************************************************************************************************************************/
+void LockstepBatch::MergeGroups()
+{
+	bool merged = false;
+	for (size_t group = 0; group < m_groups.size(); group++)
+	{
+		LockstepGroup& current = m_groups[group];
+		if ((GROUP_RUNNING != current.state) || (current.pc >= m_groupAtPC.size()))
+			continue;
+
+		int& other = m_groupAtPC[current.pc];
+		if (other < 0)
+		{
+			other = (int)group;
+			continue;
+		}
+
+		LockstepGroup& target = m_groups[other];
+		if (target.stack != current.stack)
+			continue;
+
+		for (unsigned int chunk : current.chunks)
+		{
+			for (size_t offset = chunk * LOCKSTEP_CHUNK_LANES; offset < (chunk + 1) * LOCKSTEP_CHUNK_LANES; offset += 8)
+			{
+				StoreLanes(&target.mask[offset], LoadLanes(&target.mask[offset]) | LoadLanes(&current.mask[offset]));
+				StoreLanes(&current.mask[offset], 0);
+			}
+		}
+		std::vector<unsigned int> chunks;
+		chunks.reserve(target.chunks.size() + current.chunks.size());
+		std::set_union(target.chunks.begin(), target.chunks.end(), current.chunks.begin(), current.chunks.end(), std::back_inserter(chunks));
+		target.chunks.swap(chunks);
+		target.members += current.members;
+		current.members = 0;
+		m_spareMasks.push_back(std::move(current.mask));
+		merged = true;
+	}
+
+	for (auto& group : m_groups)
+	{
+		if (group.pc < m_groupAtPC.size())
+			m_groupAtPC[group.pc] = -1;
+	}
+	if (merged)
+	{
+		size_t kept = 0;
+		for (size_t group = 0; group < m_groups.size(); group++)
+		{
+			if (0 != m_groups[group].members)
+			{
+				if (kept != group)
+					m_groups[kept] = std::move(m_groups[group]);
+				kept++;
+			}
+		}
+		m_groups.erase(m_groups.begin() + kept, m_groups.end());
+	}
+}
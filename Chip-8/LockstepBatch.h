@@ -0,0 +1,121 @@
+#pragma once
+#include <memory>
+#include <utility>
+#include <vector>
+#include "Chip8.h"
+#include "LockstepKernels.h"
+
+// A set of lanes that have taken exactly the same path through the program so far, so they share the PC and the call stack
+struct LockstepGroup
+{
+	unsigned short pc;
+	std::vector<unsigned short> stack;
+	int state;                          // One of the LockstepBatch::GROUP_* states
+	unsigned char keyRegister;          // Register FX0A stores the key in while waiting
+	unsigned int members;
+	std::vector<unsigned char> mask;    // 0xFF for every lane in the group
+	std::vector<unsigned int> chunks;   // Chunks of LOCKSTEP_CHUNK_LANES lanes with at least one member
+};
+
+/*****************************************************************************************************************************************/
+//
+// LockstepBatch - Runs many copies of one ROM side by side
+//
+// Notes - The registers, I, timers and keys of every lane are stored as arrays indexed by lane (structure of arrays), so one
+//         instruction is executed for a whole group of lanes with the data parallel LockstepKernels (AVX2 when the host has it).
+//         Lanes start in one group. A skip that goes different ways for different lanes (3XNN, 4XNN, 5XY0, 9XY0, EX9E, EXA1), a BNNN
+//         or an FX0A splits the group, and groups that arrive back at the same PC with the same call stack are merged again.
+//         Every running lane executes one instruction per step, so lanes stay aligned and re-merge as soon as their paths rejoin.
+//
+//         Each lane produces exactly the state a Chip8 running the same program with the same key presses would, provided the
+//         Chip8 is given the lane's SetRandomSeed seed: CXNN draws from the same xorshift generator, one per lane. Lanes always
+//         run by the QuirkProfile::CHIP_8 rules.
+/*****************************************************************************************************************************************/
+class LockstepBatch
+{
+public:
+	explicit LockstepBatch(unsigned int lanes);
+	~LockstepBatch();
+	LockstepBatch(const LockstepBatch&) = delete;
+	LockstepBatch& operator=(const LockstepBatch&) = delete;
+
+	int LoadProgram(const unsigned char *program, int size);
+	void Reset();
+	// Runs every running lane for up to maxSteps instructions. Returns the status bits of all of them ORed together
+	int Run(unsigned int maxSteps, unsigned int& steps);
+	// Runs a 60 Hz frame of cyclesPerFrame steps and then ticks the timers of every lane
+	int RunFrame(unsigned int cyclesPerFrame, unsigned int& steps);
+	void SetRandomSeed(unsigned int lane, unsigned int seed);
+	// CHIP-8 key 0x0-0xF on one lane, as Chip8::KeyPress, KeyDown and KeyUp. A press completes an FX0A the lane is waiting on
+	void KeyPress(unsigned int lane, unsigned char key);
+	void KeyDown(unsigned int lane, unsigned char key);
+	void KeyUp(unsigned int lane, unsigned char key);
+	bool UsingAvx2();
+
+	unsigned int GetLaneCount();
+	unsigned int GetGroupCount();
+	unsigned char GetRegister(unsigned int lane, unsigned char registerNum);
+	unsigned short GetAddressRegister(unsigned int lane);
+	unsigned short GetPC(unsigned int lane);
+	unsigned long long GetDisplayRow(unsigned int lane, unsigned char row);
+	unsigned long long GetDisplayHash(unsigned int lane);
+	bool IsWaitingForInput(unsigned int lane);
+	bool IsStopped(unsigned int lane);      // The lane hit a bad opcode
+
+	static constexpr int GROUP_RUNNING = 0;
+	static constexpr int GROUP_WAITING = 1; // Waiting on FX0A
+	static constexpr int GROUP_STOPPED = 2; // Hit a bad opcode
+
+private:
+	static constexpr unsigned int LANE_MEMORY_SIZE = CHIP_8_MEMORY_SIZE + CHIP_8_MEMORY_PADDING;
+
+	unsigned int m_laneCount;           // Lanes requested
+	unsigned int m_paddedLanes;         // Rounded up to whole chunks
+	unsigned int m_chunkCount;
+	const LockstepKernels *m_kernels;
+	bool m_avx2;
+
+	int m_programSize;
+	unsigned char m_image[CHIP_8_MEMORY_SIZE]; // Memory every lane starts with
+	bool m_written[LANE_MEMORY_SIZE];          // Addresses some lane has written, where the lanes can hold different code. FX33 after
+	                                           // FX55 fills the last address writes into the padding, as it does in Chip8
+
+	// Per lane state, m_registers is 16 arrays of m_paddedLanes bytes
+	std::unique_ptr<unsigned char[]> m_registers;
+	std::unique_ptr<unsigned short[]> m_addressRegister;
+	std::unique_ptr<unsigned char[]> m_delayTimer;
+	std::unique_ptr<unsigned char[]> m_soundTimer;
+	std::unique_ptr<unsigned char[]> m_keysDown;      // Keys 0-7 then keys 8-F, m_paddedLanes bytes each
+	std::unique_ptr<unsigned char[]> m_keysTapped;    // Laid out the same way
+	std::unique_ptr<unsigned char[]> m_waiting;
+	std::unique_ptr<unsigned int[]> m_seed;
+	std::unique_ptr<unsigned int[]> m_random;
+	std::unique_ptr<unsigned char[]> m_memory;        // LANE_MEMORY_SIZE bytes per lane
+	std::unique_ptr<unsigned long long[]> m_display;  // Chip8::DISPLAY_HEIGHT rows per lane
+	std::unique_ptr<unsigned char[]> m_scratch;       // Lane mask produced by the skip kernels
+	std::unique_ptr<unsigned short[]> m_targets;      // Per lane values used while splitting a group
+
+	std::vector<LockstepGroup> m_groups;
+	std::vector<int> m_groupAtPC;       // Used while merging, -1 or the group found at each PC
+	std::vector<std::vector<unsigned char>> m_spareMasks; // Cleared masks of merged groups
+
+	unsigned char* Register(unsigned char registerNum) { return &m_registers[(size_t)registerNum * m_paddedLanes]; }
+	unsigned char* Memory(unsigned int lane) { return &m_memory[(size_t)lane * LANE_MEMORY_SIZE]; }
+	unsigned long long* Display(unsigned int lane) { return &m_display[(size_t)lane * Chip8::DISPLAY_HEIGHT]; }
+	LockstepLanes Lanes(const LockstepGroup& group) { return { group.mask.data(), group.chunks.data(), group.chunks.size() }; }
+	template <typename Operation> void ForEachLane(const LockstepGroup& group, Operation operation);
+
+	int Step(int groupIndex);
+	int Execute(int groupIndex, unsigned short opcode);
+	void Diverge(int groupIndex, unsigned int skipping);
+	unsigned int StopOutOfRange(int groupIndex, unsigned char registerNum);
+	int Stop(int groupIndex, int status = 0x1); // status is what the caller reports, 0x1 with any stack fault bit
+	int SplitOff(int groupIndex, const unsigned char *selected);
+	std::vector<unsigned char> TakeMask();
+	template <typename Value> void SplitBy(int groupIndex, Value value, std::vector<std::pair<int, unsigned short>>& parts);
+	void UpdateChunks(LockstepGroup& group);
+	bool ResumeFromKeyWait(unsigned int lane, unsigned char key);
+	int FindGroup(unsigned int lane);
+	void ResumeWaitingLanes();
+	void MergeGroups();
+};
@@ -0,0 +1,176 @@
+#include "LockstepKernels.h"
+
+// Portable kernels. They are written lane by lane in the same way as the interpreter so they double as the reference for the AVX2
+// versions, and compilers can still vectorise the simple ones
+namespace
+{
+	static constexpr unsigned char FONT_HEIGHT = 5;
+
+	template <typename Operation>
+	inline void ForEachLane(const LockstepLanes& lanes, Operation operation)
+	{
+		for (size_t chunk = 0; chunk < lanes.chunkCount; chunk++)
+		{
+			size_t first = (size_t)lanes.chunks[chunk] * LOCKSTEP_CHUNK_LANES;
+			for (size_t lane = first; lane < first + LOCKSTEP_CHUNK_LANES; lane++)
+			{
+				if (lanes.mask[lane])
+					operation(lane);
+			}
+		}
+	}
+
+	void LoadConst(const LockstepLanes& lanes, unsigned char *vx, unsigned char value)
+	{
+		ForEachLane(lanes, [=](size_t lane) { vx[lane] = value; });
+	}
+
+	void AddConst(const LockstepLanes& lanes, unsigned char *vx, unsigned char value)
+	{
+		ForEachLane(lanes, [=](size_t lane) { vx[lane] = (unsigned char)(vx[lane] + value); });
+	}
+
+	void Copy(const LockstepLanes& lanes, unsigned char *destination, const unsigned char *source)
+	{
+		ForEachLane(lanes, [=](size_t lane) { destination[lane] = source[lane]; });
+	}
+
+	void Alu(const LockstepLanes& lanes, unsigned char operation, unsigned char *vx, unsigned char *vy, unsigned char *vf)
+	{
+		switch (operation)
+		{
+			case 0x0:
+				ForEachLane(lanes, [=](size_t lane) { vx[lane] = vy[lane]; });
+				break;
+			case 0x1:
+				ForEachLane(lanes, [=](size_t lane) { vx[lane] |= vy[lane]; });
+				break;
+			case 0x2:
+				ForEachLane(lanes, [=](size_t lane) { vx[lane] &= vy[lane]; });
+				break;
+			case 0x3:
+				ForEachLane(lanes, [=](size_t lane) { vx[lane] ^= vy[lane]; });
+				break;
+			case 0x4:
+				ForEachLane(lanes, [=](size_t lane)
+				{
+					unsigned short value = (unsigned short)vx[lane] + vy[lane];
+					vf[lane] = (value > 0xFF) ? 1 : 0;
+					vx[lane] = (unsigned char)value;
+				});
+				break;
+			case 0x5:
+				ForEachLane(lanes, [=](size_t lane)
+				{
+					vf[lane] = (vy[lane] > vx[lane]) ? 0 : 1;
+					vx[lane] = (unsigned char)(vx[lane] - vy[lane]);
+				});
+				break;
+			case 0x6:
+				ForEachLane(lanes, [=](size_t lane)
+				{
+					vf[lane] = vy[lane] & 0x01;
+					vy[lane] >>= 1;
+					vx[lane] = vy[lane];
+				});
+				break;
+			case 0x7:
+				ForEachLane(lanes, [=](size_t lane)
+				{
+					vf[lane] = (vx[lane] > vy[lane]) ? 0 : 1;
+					vx[lane] = (unsigned char)(vy[lane] - vx[lane]);
+				});
+				break;
+			case 0xE:
+				ForEachLane(lanes, [=](size_t lane)
+				{
+					vf[lane] = (vy[lane] & 0x80) >> 7;
+					vy[lane] = (unsigned char)(vy[lane] << 1);
+					vx[lane] = vy[lane];
+				});
+				break;
+		}
+	}
+
+	unsigned int SkipConst(const LockstepLanes& lanes, const unsigned char *vx, unsigned char value, bool equal, unsigned char *skip)
+	{
+		unsigned int count = 0;
+		ForEachLane(lanes, [&](size_t lane)
+		{
+			bool taken = ((vx[lane] == value) == equal);
+			skip[lane] = taken ? 0xFF : 0;
+			count += taken;
+		});
+		return count;
+	}
+
+	unsigned int SkipRegister(const LockstepLanes& lanes, const unsigned char *vx, const unsigned char *vy, bool equal, unsigned char *skip)
+	{
+		unsigned int count = 0;
+		ForEachLane(lanes, [&](size_t lane)
+		{
+			bool taken = ((vx[lane] == vy[lane]) == equal);
+			skip[lane] = taken ? 0xFF : 0;
+			count += taken;
+		});
+		return count;
+	}
+
+	unsigned int SkipKey(const LockstepLanes& lanes, const unsigned char *vx, const unsigned char *down, unsigned char *tapped, size_t plane, bool equal, unsigned char *skip)
+	{
+		unsigned int count = 0;
+		ForEachLane(lanes, [&](size_t lane)
+		{
+			bool pressed = false;
+			if (vx[lane] < 16)
+			{
+				size_t index = lane + ((vx[lane] & 0x8) ? plane : 0);
+				unsigned char bit = (unsigned char)(1u << (vx[lane] & 0x7));
+				pressed = (0 != ((down[index] | tapped[index]) & bit));
+				tapped[index] &= (unsigned char)~bit;
+			}
+			bool taken = (pressed == equal);
+			skip[lane] = taken ? 0xFF : 0;
+			count += taken;
+		});
+		return count;
+	}
+
+	bool TickTimers(const LockstepLanes& lanes, unsigned char *delay, unsigned char *sound, unsigned char count)
+	{
+		bool expired = false;
+		ForEachLane(lanes, [&](size_t lane)
+		{
+			delay[lane] = (delay[lane] > count) ? (unsigned char)(delay[lane] - count) : 0;
+			if (0 != sound[lane])
+			{
+				expired |= (sound[lane] <= count);
+				sound[lane] = (sound[lane] > count) ? (unsigned char)(sound[lane] - count) : 0;
+			}
+		});
+		return expired;
+	}
+
+	void LoadAddress(const LockstepLanes& lanes, unsigned short *addressRegister, unsigned short value)
+	{
+		ForEachLane(lanes, [=](size_t lane) { addressRegister[lane] = value; });
+	}
+
+	void AddAddress(const LockstepLanes& lanes, unsigned short *addressRegister, const unsigned char *vx)
+	{
+		ForEachLane(lanes, [=](size_t lane) { addressRegister[lane] = (addressRegister[lane] + vx[lane]) & 0x0FFF; });
+	}
+
+	void LoadFont(const LockstepLanes& lanes, unsigned short *addressRegister, const unsigned char *vx)
+	{
+		ForEachLane(lanes, [=](size_t lane) { addressRegister[lane] = vx[lane] * FONT_HEIGHT; });
+	}
+}
+
+const LockstepKernels& GetGenericLockstepKernels()
+{
+	static const LockstepKernels kernels = {
+		LoadConst, AddConst, Copy, Alu, SkipConst, SkipRegister, SkipKey, TickTimers, LoadAddress, AddAddress, LoadFont,
+	};
+	return kernels;
+}
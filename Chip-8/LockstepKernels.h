@@ -0,0 +1,49 @@
+#pragma once
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CHIP8_LOCKSTEP_AVX2 1
+#else
+#define CHIP8_LOCKSTEP_AVX2 0
+#endif
+
+// Lanes are processed in chunks of this many, one byte per lane, which is one AVX2 register
+#define LOCKSTEP_CHUNK_LANES 32
+
+// The lanes a kernel works on. Every per lane array is indexed by lane number, so the kernels only touch the listed chunks and
+// only change lanes whose mask byte is 0xFF
+struct LockstepLanes
+{
+	const unsigned char *mask;
+	const unsigned int *chunks;
+	size_t chunkCount;
+};
+
+/*****************************************************************************************************************************************/
+//
+// LockstepKernels - The data parallel operations of a LockstepBatch
+//
+// Notes - Each kernel does what the interpreter does for one instruction, for every lane in the group at once. Register arguments
+//         may alias (VX may be VF, VX may be VY) and the kernels write them in the same order the interpreter does, so the results
+//         match it exactly. The skip kernels return the number of lanes that take the skip and mark them in skip.
+/*****************************************************************************************************************************************/
+struct LockstepKernels
+{
+	void (*loadConst)(const LockstepLanes& lanes, unsigned char *vx, unsigned char value);
+	void (*addConst)(const LockstepLanes& lanes, unsigned char *vx, unsigned char value);
+	void (*copy)(const LockstepLanes& lanes, unsigned char *destination, const unsigned char *source);
+	void (*alu)(const LockstepLanes& lanes, unsigned char operation, unsigned char *vx, unsigned char *vy, unsigned char *vf);
+	unsigned int (*skipConst)(const LockstepLanes& lanes, const unsigned char *vx, unsigned char value, bool equal, unsigned char *skip);
+	unsigned int (*skipRegister)(const LockstepLanes& lanes, const unsigned char *vx, const unsigned char *vy, bool equal, unsigned char *skip);
+	// down and tapped hold one bit per key, keys 0-7 at [lane] and 8-F at [plane + lane]. A tap of the key tested is used up
+	unsigned int (*skipKey)(const LockstepLanes& lanes, const unsigned char *vx, const unsigned char *down, unsigned char *tapped, size_t plane, bool equal, unsigned char *skip);
+	// Counts over 255 have the same effect as 255. Returns true if a sound timer ran out
+	bool (*tickTimers)(const LockstepLanes& lanes, unsigned char *delay, unsigned char *sound, unsigned char count);
+	void (*loadAddress)(const LockstepLanes& lanes, unsigned short *addressRegister, unsigned short value);
+	void (*addAddress)(const LockstepLanes& lanes, unsigned short *addressRegister, const unsigned char *vx);
+	void (*loadFont)(const LockstepLanes& lanes, unsigned short *addressRegister, const unsigned char *vx);
+};
+
+const LockstepKernels& GetGenericLockstepKernels();
+// Returns nullptr when the host cannot run AVX2
+const LockstepKernels* GetAvx2LockstepKernels();
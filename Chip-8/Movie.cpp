@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <cstring>
+#include "Movie.h"
+
+namespace
+{
+	const char MOVIE_MAGIC[4] = { 'C', '8', 'M', 'V' };
+
+	void PutLittleEndian(std::ostream& out, unsigned long long value, int bytes)
+	{
+		for (int x = 0; x < bytes; x++)
+			out.put((char)(unsigned char)(value >> (x * 8)));
+	}
+
+	bool GetLittleEndian(std::istream& in, unsigned long long& value, int bytes)
+	{
+		value = 0;
+		for (int x = 0; x < bytes; x++)
+		{
+			int byte = in.get();
+			if (std::istream::traits_type::eof() == byte)
+				return false;
+			value |= (unsigned long long)(unsigned char)byte << (x * 8);
+		}
+		return true;
+	}
+
+	// Reads the records written by AddVarint and AddHash. Each returns false at the end of the records
+	bool ReadVarint(const std::vector<unsigned char>& records, size_t& position, unsigned long long& value)
+	{
+		value = 0;
+		for (int shift = 0; (shift < 64) && (position < records.size()); shift += 7)
+		{
+			unsigned char byte = records[position++];
+			value |= (unsigned long long)(byte & 0x7F) << shift;
+			if (0 == (byte & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	bool ReadHash(const std::vector<unsigned char>& records, size_t& position, unsigned long long& hash)
+	{
+		if (records.size() - position < 8)
+			return false;
+		hash = 0;
+		for (int x = 0; x < 8; x++)
+			hash |= (unsigned long long)records[position++] << (x * 8);
+		return true;
+	}
+}
+
+Movie::Movie() :
+	m_recording(false),
+	m_start(),
+	m_checkpointInterval(DEFAULT_CHECKPOINT_INTERVAL),
+	m_frames(0),
+	m_lastRecordFrame(0),
+	m_cycles(0),
+	m_events(0),
+	m_checkpoints(0),
+	m_endHash(0)
+{
+}
+
+
+Movie::~Movie()
+{
+}
+
+int Movie::Begin(Chip8& chip, unsigned int checkpointInterval)
+{
+	m_recording = false;
+	if (0 != chip.SaveState(m_start))
+		return -1;
+
+	m_checkpointInterval = (0 == checkpointInterval) ? DEFAULT_CHECKPOINT_INTERVAL : checkpointInterval;
+	m_records.clear();
+	m_frames = 0;
+	m_lastRecordFrame = 0;
+	m_cycles = 0;
+	m_events = 0;
+	m_checkpoints = 0;
+	m_endHash = chip.GetDisplayHash();
+	m_recording = true;
+	return 0;
+}
+
+bool Movie::IsRecording()
+{
+	return m_recording;
+}
+
+// The event was applied after the frames recorded so far, before the next one
+void Movie::RecordInput(const Chip8InputEvent& event)
+{
+	if (!m_recording)
+		return;
+
+	switch (event.type)
+	{
+	case InputEventType::KEY_DOWN:
+		AddRecord(TAG_KEY_DOWN);
+		break;
+	case InputEventType::KEY_UP:
+		AddRecord(TAG_KEY_UP);
+		break;
+	case InputEventType::KEY_PRESS:
+		AddRecord(TAG_KEY_PRESS);
+		break;
+	}
+	m_records.push_back((unsigned char)event.key);
+	m_events++;
+}
+
+/*****************************************************************************************************************************************/
+//
+// RecordFrame - Notes that a frame has run
+//
+// Inputs - chip (the machine, after the frame)
+//          cyclesPerFrame (the instructions the frame was given)
+//
+// Outputs - None
+//
+// Notes - A change of instructions per frame is recorded against the frame count before this frame, so a replay picks it up
+//         before running the frame. Checkpoints are recorded against the count after it
+/*****************************************************************************************************************************************/
+void Movie::RecordFrame(Chip8& chip, unsigned int cyclesPerFrame)
+{
+	if (!m_recording)
+		return;
+
+	if (cyclesPerFrame != m_cycles)
+	{
+		AddRecord(TAG_CYCLES);
+		AddVarint(cyclesPerFrame);
+		m_cycles = cyclesPerFrame;
+	}
+
+	m_frames++;
+	m_endHash = chip.GetDisplayHash();
+	if (0 == (m_frames % m_checkpointInterval))
+	{
+		AddRecord(TAG_CHECKPOINT);
+		AddHash(m_endHash);
+		m_checkpoints++;
+	}
+}
+
+unsigned long long Movie::GetFrameCount()
+{
+	return m_frames;
+}
+
+unsigned int Movie::GetEventCount()
+{
+	return m_events;
+}
+
+unsigned int Movie::GetCheckpointCount()
+{
+	return m_checkpoints;
+}
+
+int Movie::Save(std::ostream& out)
+{
+	// The end record goes on a copy so recording can carry on after a save
+	std::vector<unsigned char> records(m_records);
+	std::swap(records, m_records);
+	unsigned long long lastRecordFrame = m_lastRecordFrame;
+	AddRecord(TAG_END);
+	AddHash(m_endHash);
+	std::swap(records, m_records);
+	m_lastRecordFrame = lastRecordFrame;
+
+	out.write(MOVIE_MAGIC, sizeof(MOVIE_MAGIC));
+	PutLittleEndian(out, CHIP_8_MOVIE_VERSION, 4);
+	PutLittleEndian(out, sizeof(m_start), 4);
+	out.write((const char *)&m_start, sizeof(m_start));
+	PutLittleEndian(out, m_checkpointInterval, 4);
+	PutLittleEndian(out, records.size(), 8);
+	out.write((const char *)records.data(), records.size());
+	return out.good() ? 0 : -1;
+}
+
+// The loaded movie can be replayed but not recorded on to
+int Movie::Load(std::istream& in)
+{
+	char magic[sizeof(MOVIE_MAGIC)];
+	unsigned long long version;
+	unsigned long long stateSize;
+	unsigned long long checkpointInterval;
+	unsigned long long recordsSize;
+
+	m_recording = false;
+	if (!in.read(magic, sizeof(magic)) || (0 != std::memcmp(magic, MOVIE_MAGIC, sizeof(magic))))
+		return -1;
+	if (!GetLittleEndian(in, version, 4) || (CHIP_8_MOVIE_VERSION != version))
+		return -1;
+	if (!GetLittleEndian(in, stateSize, 4) || (sizeof(m_start) != stateSize))
+		return -1;
+	if (!in.read((char *)&m_start, sizeof(m_start)))
+		return -1;
+	if (!GetLittleEndian(in, checkpointInterval, 4) || (0 == checkpointInterval) || !GetLittleEndian(in, recordsSize, 8))
+		return -1;
+
+	m_records.clear();
+	unsigned char buffer[4096];
+	while (m_records.size() < recordsSize)
+	{
+		size_t chunk = (size_t)std::min<unsigned long long>(sizeof(buffer), recordsSize - m_records.size());
+		if (!in.read((char *)buffer, chunk))
+			return -1;
+		m_records.insert(m_records.end(), buffer, buffer + chunk);
+	}
+
+	m_checkpointInterval = (unsigned int)checkpointInterval;
+	m_frames = 0;
+	m_lastRecordFrame = 0;
+	m_cycles = 0;
+	m_events = 0;
+	m_checkpoints = 0;
+	return 0;
+}
+
+/*****************************************************************************************************************************************/
+//
+// Replay - Runs the recorded frames on chip as fast as it can and checks the display against the recorded hashes
+//
+// Inputs - chip (loaded with the start state, then run)
+//          result (filled in)
+//
+// Outputs - 0 if the whole movie was replayed, whether or not it matched. -1 if the records are damaged
+//
+// Notes - Replay stops at the first checkpoint that does not match, as everything after it is from a different run
+/*****************************************************************************************************************************************/
+int Movie::Replay(Chip8& chip, MovieReplayResult& result)
+{
+	result = MovieReplayResult();
+	if (0 != chip.LoadState(m_start))
+		return -1;
+
+	size_t position = 0;
+	unsigned long long frame = 0;
+	unsigned int cycles = 0;
+	while (position < m_records.size())
+	{
+		unsigned char tag = m_records[position++];
+		unsigned long long delta;
+		if (!ReadVarint(m_records, position, delta))
+			return -1;
+
+		for (unsigned long long target = frame + delta; frame < target; frame++)
+		{
+			unsigned int executed;
+			chip.RunFrame(cycles, executed);
+			result.instructions += executed;
+		}
+		result.frames = frame;
+
+		unsigned long long value;
+		switch (tag)
+		{
+		case TAG_KEY_DOWN:
+		case TAG_KEY_UP:
+		case TAG_KEY_PRESS:
+		{
+			if (position >= m_records.size())
+				return -1;
+			static const InputEventType types[] = { InputEventType::KEY_DOWN, InputEventType::KEY_UP, InputEventType::KEY_PRESS };
+			chip.ApplyInput({ frame, (char)m_records[position++], types[tag] });
+			break;
+		}
+		case TAG_CYCLES:
+			if (!ReadVarint(m_records, position, value))
+				return -1;
+			cycles = (unsigned int)value;
+			break;
+		case TAG_CHECKPOINT:
+		case TAG_END:
+			if (!ReadHash(m_records, position, value))
+				return -1;
+			if (value != chip.GetDisplayHash())
+			{
+				result.mismatchFrame = frame;
+				return 0;
+			}
+			if (TAG_END == tag)
+				return 0;
+			result.checkpoints++;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	// A movie always finishes with an end record
+	return -1;
+}
+
+void Movie::AddRecord(unsigned char tag)
+{
+	m_records.push_back(tag);
+	AddVarint(m_frames - m_lastRecordFrame);
+	m_lastRecordFrame = m_frames;
+}
+
+void Movie::AddVarint(unsigned long long value)
+{
+	while (value >= 0x80)
+	{
+		m_records.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	m_records.push_back((unsigned char)value);
+}
+
+void Movie::AddHash(unsigned long long hash)
+{
+	for (int x = 0; x < 8; x++)
+		m_records.push_back((unsigned char)(hash >> (x * 8)));
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <istream>
+#include <ostream>
+#include <vector>
+#include "Chip8.h"
+#include "InputQueue.h"
+
+#define CHIP_8_MOVIE_VERSION 1
+
+struct MovieReplayResult
+{
+	unsigned long long frames;             // Frames replayed
+	unsigned long long instructions;
+	unsigned int checkpoints;              // Checkpoints that matched
+	unsigned long long mismatchFrame;      // First frame whose display hash did not match, 0 if none
+};
+
+/*****************************************************************************************************************************************/
+//
+// Movie - Records the input a Chip8 is given so the run can be replayed exactly
+//
+// Notes - Begin takes the machine's complete state, so a movie can start from power on or from any save state. After that the
+//         recorder is told about every input event as it is applied and about every frame as it ends. Events are stamped with
+//         the number of frames run before them; since the machine only takes input between frames, that and the instructions
+//         each frame ran are all a replay needs. A display hash is stored every checkpointInterval frames and at the end.
+//
+//         The records after the start state are a byte stream: a tag, the frames since the previous record as a varint, then
+//         the record's data. A key event is three bytes in the common case. The instructions per frame are only recorded when
+//         they change.
+//
+//         Replay loads the start state and runs every frame unthrottled, applying the events at their frames and checking each
+//         checkpoint. Frames single stepped by hand are not frames, so a movie recorded across single stepping will not replay.
+/*****************************************************************************************************************************************/
+class Movie
+{
+public:
+	Movie();
+	~Movie();
+	Movie(const Movie&) = delete;
+	Movie& operator=(const Movie&) = delete;
+
+	// Starts a new recording from the current state of chip. Returns -1 if the state cannot be saved
+	int Begin(Chip8& chip, unsigned int checkpointInterval = DEFAULT_CHECKPOINT_INTERVAL);
+	bool IsRecording();
+	void RecordInput(const Chip8InputEvent& event);
+	void RecordFrame(Chip8& chip, unsigned int cyclesPerFrame);
+
+	unsigned long long GetFrameCount();
+	unsigned int GetEventCount();
+	unsigned int GetCheckpointCount();
+
+	// Both return -1 on a stream error, Load also if the stream is not a movie this version can read
+	int Save(std::ostream& out);
+	int Load(std::istream& in);
+
+	// Returns -1 if the movie is damaged or its start state cannot be loaded, otherwise 0 with the outcome in result
+	int Replay(Chip8& chip, MovieReplayResult& result);
+
+	static constexpr unsigned int DEFAULT_CHECKPOINT_INTERVAL = 60;
+
+private:
+	enum RecordTag : unsigned char
+	{
+		TAG_KEY_DOWN = 0x00,
+		TAG_KEY_UP = 0x01,
+		TAG_KEY_PRESS = 0x02,
+		TAG_CYCLES = 0x10,
+		TAG_CHECKPOINT = 0x20,
+		TAG_END = 0xFF,
+	};
+
+	bool m_recording;
+	Chip8State m_start;
+	unsigned int m_checkpointInterval;
+	std::vector<unsigned char> m_records;
+	unsigned long long m_frames;
+	unsigned long long m_lastRecordFrame;
+	unsigned int m_cycles;                 // Instructions per frame in effect at the end of the records
+	unsigned int m_events;
+	unsigned int m_checkpoints;
+	unsigned long long m_endHash;
+
+	void AddRecord(unsigned char tag);
+	void AddVarint(unsigned long long value);
+	void AddHash(unsigned long long hash);
+};
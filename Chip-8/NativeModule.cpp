@@ -0,0 +1,201 @@
+#include "NativeModule.h"
+#include <cstring>
+#include "Chip8.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+NativeModule::NativeModule() :
+	m_library(nullptr),
+	m_info(nullptr)
+{
+}
+
+NativeModule::~NativeModule()
+{
+	Unload();
+}
+
+/*****************************************************************************************************************************************/
+//
+// Load - Loads a shared object built from the source StaticRecompiler generated
+//
+// Inputs - path (file name of the shared object)
+//          chip (machine the module is for, with its program already loaded)
+//
+// Outputs - 0 on success, -1 if the file cannot be loaded, is not a module for this version, or was compiled from another program
+//           or under another quirk profile. A module already loaded is unloaded first, so nothing is loaded on failure
+//
+// Notes - The whole program is compared, so a module can only be used by the ROM it was made from
+/*****************************************************************************************************************************************/
+int NativeModule::Load(const char *path, Chip8& chip)
+{
+	Unload();
+
+	Chip8NativeModuleFunction function = nullptr;
+#ifdef _WIN32
+	HMODULE library = LoadLibraryA(path);
+	if (nullptr != library)
+		function = (Chip8NativeModuleFunction)GetProcAddress(library, CHIP_8_NATIVE_MODULE_SYMBOL);
+#else
+	void *library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (nullptr != library)
+		function = (Chip8NativeModuleFunction)dlsym(library, CHIP_8_NATIVE_MODULE_SYMBOL);
+#endif
+	if (nullptr == library)
+		return -1;
+	m_library = (void *)library;
+
+	const Chip8NativeModuleInfo *info = (nullptr != function) ? function() : nullptr;
+	if ((nullptr == info) || (CHIP_8_NATIVE_ABI_VERSION != info->abiVersion) || (nullptr == info->run) ||
+		(info->quirkProfile != (unsigned int)chip.m_quirkProfile) || (info->programSize != chip.m_programSize) || (0 == info->programSize) ||
+		(0 != std::memcmp(info->program, &chip.m_memory[START_CHIP_8_PROGRAM], info->programSize)))
+	{
+		Unload();
+		return -1;
+	}
+
+	// The entries have to lie inside the program, in order and apart, for the checks against it to mean anything
+	unsigned int programEnd = START_CHIP_8_PROGRAM + ((info->programSize + 1) & ~1);
+	for (unsigned int x = 0; x < info->entryCount; x++)
+	{
+		const Chip8NativeEntry& entry = info->entries[x];
+		if ((entry.start < START_CHIP_8_PROGRAM) || (entry.end <= entry.start) || (entry.end > programEnd) ||
+			((0 != x) && (entry.start < info->entries[x - 1].end)))
+		{
+			Unload();
+			return -1;
+		}
+	}
+
+	m_info = info;
+	m_entryAt.assign(MEMORY_SIZE, -1);
+	m_entryState.assign(info->entryCount, ENTRY_UNCHECKED);
+	for (unsigned int x = 0; x < info->entryCount; x++)
+	{
+		const Chip8NativeEntry& entry = info->entries[x];
+		m_entryAt[entry.start] = (short)x;
+		for (unsigned int page = entry.start >> PAGE_SHIFT; page <= (unsigned int)((entry.end - 1) >> PAGE_SHIFT); page++)
+			m_entriesByPage[page].push_back((unsigned short)x);
+	}
+	return 0;
+}
+
+void NativeModule::Unload()
+{
+	m_info = nullptr;
+	m_entryAt.clear();
+	m_entryState.clear();
+	for (int page = 0; page < NUMBER_OF_PAGES; page++)
+		m_entriesByPage[page].clear();
+	if (nullptr != m_library)
+	{
+#ifdef _WIN32
+		FreeLibrary((HMODULE)m_library);
+#else
+		dlclose(m_library);
+#endif
+		m_library = nullptr;
+	}
+}
+
+bool NativeModule::IsLoaded()
+{
+	return (nullptr != m_info);
+}
+
+/*****************************************************************************************************************************************/
+//
+// Run - Executes up to maxInstructions, in the module's code where it has an entry and on the interpreter everywhere else
+//
+// Inputs - chip (machine to run)
+//          maxInstructions (upper bound on the number of instructions to execute)
+//          executed (set to the number of instructions actually executed)
+//
+// Outputs - The status bits of every executed instruction ORed together, the same as the interpreter returns
+//
+// Notes - A module compiled for another program or profile than the machine now has runs nothing, the interpreter does it all
+/*****************************************************************************************************************************************/
+int NativeModule::Run(Chip8& chip, unsigned int maxInstructions, unsigned int& executed)
+{
+	int returnValue = 0;
+	executed = 0;
+	bool usable = (nullptr != m_info) && (m_info->programSize == chip.m_programSize) && (m_info->quirkProfile == (unsigned int)chip.m_quirkProfile);
+
+	Chip8NativeContext context;
+	context.registers = chip.m_registers;
+	context.addressRegister = &chip.m_addressRegister;
+	context.programCounter = &chip.m_pc;
+	context.memory = chip.m_memory;
+	context.delayTimer = &chip.m_delayTimer;
+	context.soundTimer = &chip.m_sleepTimer;
+	context.keysDown = &chip.m_keysDown;
+	context.keysTapped = &chip.m_keysTapped;
+	context.entryState = m_entryState.data();
+
+	while (executed < maxInstructions)
+	{
+		unsigned short pc = chip.m_pc;
+		int entry = (usable && (pc < MEMORY_SIZE)) ? m_entryAt[pc] : -1;
+
+		unsigned int ran = 0;
+		if ((-1 != entry) && Check(chip, entry))
+		{
+			context.budget = maxInstructions - executed;
+			m_info->run(&context);
+			ran = (unsigned int)((maxInstructions - executed) - context.budget);
+			executed += ran;
+		}
+
+		// Either there is no compiled code for the next instruction or the entry did not fit in what is left of the budget
+		if ((0 == ran) && (executed < maxInstructions))
+		{
+			returnValue |= chip.Execute(chip.m_pc);
+			executed++;
+			if ((returnValue & 0x1) || (Chip8::STATE_PAUSED_FOR_INPUT == chip.m_executionState))
+				break;
+		}
+	}
+
+	return returnValue;
+}
+
+void NativeModule::Invalidate(unsigned short address, unsigned short length)
+{
+	if ((nullptr == m_info) || (0 == length) || (address >= MEMORY_SIZE))
+		return;
+
+	unsigned int last = address + length - 1;
+	if (last >= MEMORY_SIZE)
+		last = MEMORY_SIZE - 1;
+	for (unsigned int page = address >> PAGE_SHIFT; page <= (last >> PAGE_SHIFT); page++)
+	{
+		for (unsigned short entry : m_entriesByPage[page])
+		{
+			if ((m_info->entries[entry].start <= last) && (m_info->entries[entry].end > address))
+				m_entryState[entry] = ENTRY_UNCHECKED;
+		}
+	}
+}
+
+void NativeModule::InvalidateAll()
+{
+	std::memset(m_entryState.data(), ENTRY_UNCHECKED, m_entryState.size());
+}
+
+// Compares the memory under an entry with the code it was compiled from the first time it is reached after a write, so writing
+// the same bytes back, as loading an earlier state does, makes an entry usable again
+bool NativeModule::Check(Chip8& chip, int entry)
+{
+	if (ENTRY_UNCHECKED == m_entryState[entry])
+	{
+		const Chip8NativeEntry& range = m_info->entries[entry];
+		bool same = (0 == std::memcmp(&chip.m_memory[range.start], &m_info->program[range.start - START_CHIP_8_PROGRAM], range.end - range.start));
+		m_entryState[entry] = same ? ENTRY_VALID : ENTRY_CHANGED;
+	}
+	return (ENTRY_VALID == m_entryState[entry]);
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+// The interface between NativeModule and the code StaticRecompiler generates. The generated source includes this header and
+// nothing else, so it builds quickly and never depends on the layout of Chip8. Bump the version whenever these structs change
+#define CHIP_8_NATIVE_ABI_VERSION 1
+#define CHIP_8_NATIVE_MODULE_SYMBOL "Chip8NativeModule"
+
+#ifdef _WIN32
+#define CHIP_8_NATIVE_EXPORT extern "C" __declspec(dllexport)
+#else
+#define CHIP_8_NATIVE_EXPORT extern "C" __attribute__((visibility("default")))
+#endif
+
+// The machine state the generated code works on, all of it owned by the Chip8
+struct Chip8NativeContext
+{
+	unsigned char *registers;        // V0 to VF
+	unsigned short *addressRegister;
+	unsigned short *programCounter;  // Where to start on entry, where the interpreter picks up on exit
+	const unsigned char *memory;     // Only read. Anything that writes memory is left to the interpreter
+	unsigned char *delayTimer;
+	unsigned char *soundTimer;
+	unsigned short *keysDown;
+	unsigned short *keysTapped;
+	const unsigned char *entryState; // One per entry, 1 once the memory under it is known to hold the code it was compiled from
+	unsigned long long budget;       // Instructions left on entry, instructions still unused on exit
+};
+
+// A straight run of compiled instructions. Control can only come into the generated code at the start of an entry
+struct Chip8NativeEntry
+{
+	unsigned short start;
+	unsigned short end;              // One past the last byte of the last instruction
+};
+
+struct Chip8NativeModuleInfo
+{
+	unsigned int abiVersion;         // CHIP_8_NATIVE_ABI_VERSION
+	unsigned int quirkProfile;       // QuirkProfile the code was compiled for
+	int programSize;
+	const unsigned char *program;    // The program the code was compiled from, rounded up to a whole instruction
+	unsigned int entryCount;
+	const Chip8NativeEntry *entries; // Sorted by start address
+	void (*run)(Chip8NativeContext *context);
+};
+
+typedef const Chip8NativeModuleInfo* (*Chip8NativeModuleFunction)();
+
+class Chip8;
+
+/*****************************************************************************************************************************************/
+//
+// NativeModule - Runs a program on code compiled ahead of time by StaticRecompiler into a shared object
+//
+// Notes - The module only runs the program it was compiled from under the profile it was compiled for, and every entry is checked
+//         against the bytes it was compiled from before it is used, so code that has been written over, and anything the
+//         analysis did not reach, runs on the interpreter instead. Entries chain to each other inside the generated code, which
+//         keeps the V registers and I in host registers across blocks. Like the JIT, instructions that need more than a few host
+//         instructions (DXYN, CXNN, CALL/RET, FX0A, FX33, FX55 and most SUPER-CHIP ones) are left to the interpreter
+/*****************************************************************************************************************************************/
+class NativeModule
+{
+public:
+	NativeModule();
+	~NativeModule();
+
+	int Load(const char *path, Chip8& chip);
+	void Unload();
+	bool IsLoaded();
+	int Run(Chip8& chip, unsigned int maxInstructions, unsigned int& executed);
+	void Invalidate(unsigned short address, unsigned short length);
+	void InvalidateAll();
+
+private:
+	// CHIP_8_MEMORY_SIZE, which would need Chip8.h in the generated code. XO-CHIP programs are never compiled
+	static constexpr int MEMORY_SIZE = 4096;
+	static constexpr int PAGE_SHIFT = 8;
+	static constexpr int NUMBER_OF_PAGES = MEMORY_SIZE >> PAGE_SHIFT;
+	// What is known about the memory under each entry. The generated code only goes on into ENTRY_VALID ones
+	static constexpr unsigned char ENTRY_UNCHECKED = 0;
+	static constexpr unsigned char ENTRY_VALID = 1;
+	static constexpr unsigned char ENTRY_CHANGED = 2;
+
+	void *m_library;
+	const Chip8NativeModuleInfo *m_info;
+	std::vector<short> m_entryAt;                  // Entry starting at each address, or -1
+	std::vector<unsigned char> m_entryState;
+	std::vector<unsigned short> m_entriesByPage[NUMBER_OF_PAGES];
+
+	bool Check(Chip8& chip, int entry);
+};
@@ -0,0 +1,365 @@
+// OpcodeBench.cpp : Measures what each group of opcodes costs on each execution engine. Every benchmark is a small ROM built here
+//                   that runs one group of opcodes in a tight loop, and a few more are written the way real programs are. The
+//                   time per instruction is sampled several times so its spread shows, and --csv writes the results out so they
+//                   can be compared between commits.
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <initializer_list>
+#include <vector>
+#include "Chip8.h"
+
+// Assembles a ROM from opcodes. Jumps forward are emitted with a placeholder and patched once the target is known. The core
+// does not jump back to the first address of a program, so every ROM starts with a CLS and its loops come after it
+class RomBuilder
+{
+public:
+	RomBuilder() { Emit(0x00E0); }
+	unsigned short Here() { return (unsigned short)(START_CHIP_8_PROGRAM + m_bytes.size()); }
+	void Emit(unsigned short opcode)
+	{
+		m_bytes.push_back((unsigned char)(opcode >> 8));
+		m_bytes.push_back((unsigned char)(opcode & 0xFF));
+	}
+	void Emit(std::initializer_list<unsigned short> opcodes) { for (unsigned short opcode : opcodes) Emit(opcode); }
+	// Unrolled so the jump back to the top of a loop costs little next to the group being measured
+	void Repeat(std::initializer_list<unsigned short> opcodes, int times) { for (int x = 0; x < times; x++) Emit(opcodes); }
+	void Data(std::initializer_list<unsigned char> bytes) { m_bytes.insert(m_bytes.end(), bytes.begin(), bytes.end()); }
+	void Patch(unsigned short address, unsigned short opcode)
+	{
+		m_bytes[address - START_CHIP_8_PROGRAM] = (unsigned char)(opcode >> 8);
+		m_bytes[address - START_CHIP_8_PROGRAM + 1] = (unsigned char)(opcode & 0xFF);
+	}
+	const std::vector<unsigned char>& Bytes() { return m_bytes; }
+
+private:
+	std::vector<unsigned char> m_bytes;
+};
+
+static unsigned short Jump(unsigned short address)
+{
+	return (unsigned short)(0x1000 | address);
+}
+
+struct Benchmark
+{
+	const char *name;
+	const char *group;        // The opcodes it measures, or "program" for the ones written like real programs
+	std::vector<unsigned char> rom;
+	const char *keysHeld;     // Keyboard keys held down for the whole run
+};
+
+static std::vector<Benchmark> BuildBenchmarks()
+{
+	std::vector<Benchmark> benchmarks;
+
+	{
+		// Every 8XYN, with VF both read and written
+		RomBuilder rom;
+		rom.Emit({ 0x6001, 0x6103, 0x6207, 0x630F, 0x641F, 0x653F, 0x667F, 0x67FF });
+		unsigned short loop = rom.Here();
+		rom.Repeat({ 0x8014, 0x8125, 0x8236, 0x8347, 0x845E, 0x8561, 0x8672, 0x8783, 0x8F04, 0x8010 }, 8);
+		rom.Emit(Jump(loop));
+		benchmarks.push_back({ "alu", "8XYN", rom.Bytes(), "" });
+	}
+	{
+		// 3XNN, 4XNN, 5XY0 and 9XY0, half of them taken, each passing over a 7XNN
+		RomBuilder rom;
+		rom.Emit({ 0x6000, 0x6101 });
+		unsigned short loop = rom.Here();
+		rom.Repeat({ 0x3000, 0x7201, 0x3001, 0x7201, 0x4000, 0x7201, 0x4001, 0x7201, 0x5010, 0x7201, 0x9010, 0x7201 }, 8);
+		rom.Emit(Jump(loop));
+		benchmarks.push_back({ "skips", "3XNN 4XNN 5XY0 9XY0", rom.Bytes(), "" });
+	}
+	{
+		// Calls two deep
+		RomBuilder rom;
+		unsigned short loop = rom.Here();
+		rom.Repeat({ 0x2000 }, 16);
+		rom.Emit(Jump(loop));
+		unsigned short outer = rom.Here();
+		rom.Emit({ 0x2000, 0x00EE });
+		unsigned short inner = rom.Here();
+		rom.Emit(0x00EE);
+		for (int x = 0; x < 16; x++)
+			rom.Patch(loop + x * 2, 0x2000 | outer);
+		rom.Patch(outer, 0x2000 | inner);
+		benchmarks.push_back({ "call", "2NNN 00EE", rom.Bytes(), "" });
+	}
+	{
+		// A 5 row sprite moved about the screen, wrapping at the edges
+		RomBuilder rom;
+		unsigned short load = rom.Here();
+		rom.Emit({ 0xA000, 0x6000, 0x6100 });
+		unsigned short loop = rom.Here();
+		rom.Repeat({ 0xD015, 0x7007, 0x7103 }, 16);
+		rom.Emit(Jump(loop));
+		rom.Patch(load, 0xA000 | rom.Here());
+		rom.Data({ 0xF0, 0x90, 0x90, 0x90, 0xF0 });
+		benchmarks.push_back({ "draw-short", "DXY5", rom.Bytes(), "" });
+	}
+	{
+		// The same with the tallest sprite there is
+		RomBuilder rom;
+		unsigned short load = rom.Here();
+		rom.Emit({ 0xA000, 0x6000, 0x6100 });
+		unsigned short loop = rom.Here();
+		rom.Repeat({ 0xD01F, 0x7007, 0x7103 }, 16);
+		rom.Emit(Jump(loop));
+		rom.Patch(load, 0xA000 | rom.Here());
+		rom.Data({ 0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF });
+		benchmarks.push_back({ "draw-tall", "DXYF", rom.Bytes(), "" });
+	}
+	{
+		// BCD, store and load through a scratch area away from the code, so the engines that compile code are not made to
+		// throw any of it away. I is set again each time as FX55 and FX65 move it
+		RomBuilder rom;
+		unsigned short loop = rom.Here();
+		rom.Repeat({ 0xA380, 0xF533, 0xA380, 0xF355, 0xA380, 0xF365, 0x7501 }, 8);
+		rom.Emit(Jump(loop));
+		benchmarks.push_back({ "memory", "FX33 FX55 FX65", rom.Bytes(), "" });
+	}
+	{
+		RomBuilder rom;
+		unsigned short loop = rom.Here();
+		rom.Repeat({ 0xC0FF, 0xC10F, 0xC2F0, 0xC37F }, 16);
+		rom.Emit(Jump(loop));
+		benchmarks.push_back({ "random", "CXNN", rom.Bytes(), "" });
+	}
+	{
+		// Key 1 is held, so half the tests find their key down. Each passes over a 7XNN
+		RomBuilder rom;
+		rom.Emit({ 0x6001, 0x6102, 0x6201, 0x6302 });
+		unsigned short loop = rom.Here();
+		rom.Repeat({ 0xE09E, 0x7401, 0xE1A1, 0x7401, 0xE2A1, 0x7401, 0xE39E, 0x7401 }, 8);
+		rom.Emit(Jump(loop));
+		benchmarks.push_back({ "keys", "EX9E EXA1", rom.Bytes(), "1" });
+	}
+	{
+		// Random diagonal lines filling the screen, then again from the top, like the well known maze demo
+		RomBuilder rom;
+		unsigned short start = rom.Here();
+		rom.Emit({ 0x00E0, 0x6000, 0x6100 });
+		unsigned short loop = rom.Here();
+		unsigned short first = rom.Here();
+		rom.Emit({ 0xA000, 0xC201, 0x3201 });
+		unsigned short second = rom.Here();
+		rom.Emit({ 0xA000, 0xD014, 0x7004, 0x3040, Jump(loop), 0x6000, 0x7104, 0x3120, Jump(loop), Jump(start) });
+		rom.Patch(first, 0xA000 | rom.Here());
+		rom.Data({ 0x80, 0x40, 0x20, 0x10 });
+		rom.Patch(second, 0xA000 | rom.Here());
+		rom.Data({ 0x10, 0x20, 0x40, 0x80 });
+		benchmarks.push_back({ "maze", "program", rom.Bytes(), "" });
+	}
+	{
+		// A ball bouncing about a cleared screen with a three digit frame count, waiting on the delay timer between frames
+		RomBuilder rom;
+		unsigned short ball = rom.Here();
+		rom.Emit({ 0xA000, 0x6A20, 0x6B10, 0x6C01, 0x6D01, 0x6E00 });
+		unsigned short frame = rom.Here();
+		rom.Emit({ 0x00E0, 0x0000, 0xDAB4, 0x8AC4, 0x8BD4 });
+		rom.Emit({ 0x4A3C, 0x6CFF, 0x4A00, 0x6C01, 0x4B1C, 0x6DFF, 0x4B00, 0x6D01 });
+		rom.Emit({ 0x7E01, 0xA3F0, 0xFE33, 0xF265, 0x6300, 0x6400 });
+		rom.Emit({ 0xF029, 0xD345, 0x7305, 0xF129, 0xD345, 0x7305, 0xF229, 0xD345 });
+		rom.Emit({ 0x6502, 0xF515 });
+		unsigned short wait = rom.Here();
+		rom.Emit({ 0xF507, 0x3500, Jump(wait), Jump(frame) });
+		unsigned short sprite = rom.Here();
+		rom.Data({ 0x60, 0xF0, 0xF0, 0x60 });
+		rom.Patch(ball, 0xA000 | sprite);
+		rom.Patch(frame + 2, 0xA000 | sprite);
+		benchmarks.push_back({ "bouncing-ball", "program", rom.Bytes(), "" });
+	}
+	{
+		// Bubble sort of 16 random bytes, filled again once a pass finds nothing to swap
+		RomBuilder rom;
+		unsigned short fill = rom.Here();
+		rom.Emit({ 0xA380, 0xC0FF, 0xC1FF, 0xC2FF, 0xC3FF, 0xC4FF, 0xC5FF, 0xC6FF, 0xC7FF, 0xC8FF, 0xC9FF, 0xCAFF, 0xCBFF, 0xCCFF, 0xCDFF,
+			0xCEFF, 0xCFFF, 0xFF55 });
+		unsigned short pass = rom.Here();
+		rom.Emit({ 0x6E00, 0x6C00 });
+		unsigned short compare = rom.Here();
+		rom.Emit({ 0xA380, 0xFE1E, 0xF165, 0x8D10, 0x8D05, 0x3F00, 0x0000 });
+		unsigned short inOrder = rom.Here() - 2;
+		rom.Emit({ 0x8D00, 0x8010, 0x81D0, 0xA380, 0xFE1E, 0xF155, 0x6C01 });
+		rom.Patch(inOrder, Jump(rom.Here()));
+		rom.Emit({ 0x7E01, 0x3E0F, Jump(compare), 0x3C00, Jump(pass), Jump(fill) });
+		benchmarks.push_back({ "bubble-sort", "program", rom.Bytes(), "" });
+	}
+
+	return benchmarks;
+}
+
+static void PrintUsage(const char *program)
+{
+	std::cerr << "Usage: " << program << " [--instructions N] [--samples N] [--ipf N] [--engine interpreter|blocks|jit|all] [--only NAME] [--csv FILE]" << std::endl
+	          << "  --instructions N  Instructions in each timed sample (default 2000000)" << std::endl
+	          << "  --samples N       Timed samples of each benchmark on each engine (default 10)" << std::endl
+	          << "  --ipf N           Instructions per 60 Hz frame, the timers tick between frames (default 1000)" << std::endl
+	          << "  --engine E        Engine to measure: interpreter, blocks, jit or all of them (default all)" << std::endl
+	          << "  --only NAME       Only run the benchmark called NAME" << std::endl
+	          << "  --csv FILE        Also write the results to FILE, one line per benchmark and engine" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long instructions = 2000000;
+	unsigned int samples = 10;
+	unsigned int instructionsPerFrame = 1000;
+	const char *only = nullptr;
+	const char *csvPath = nullptr;
+	std::vector<ExecutionEngine> engines = { ExecutionEngine::INTERPRETER, ExecutionEngine::BLOCK_CACHE, ExecutionEngine::JIT };
+	static const char *engineNames[] = { "interpreter", "blocks", "jit" };
+
+	for (int i = 1; i < argc; i++)
+	{
+		if ((0 == strcmp(argv[i], "--instructions")) && (i + 1 < argc))
+		{
+			instructions = strtoull(argv[++i], nullptr, 0);
+		}
+		else if ((0 == strcmp(argv[i], "--samples")) && (i + 1 < argc))
+		{
+			samples = (unsigned int)strtoul(argv[++i], nullptr, 0);
+		}
+		else if ((0 == strcmp(argv[i], "--ipf")) && (i + 1 < argc))
+		{
+			instructionsPerFrame = (unsigned int)strtoul(argv[++i], nullptr, 0);
+		}
+		else if ((0 == strcmp(argv[i], "--engine")) && (i + 1 < argc))
+		{
+			const char *name = argv[++i];
+			engines.clear();
+			for (int engine = 0; engine < 3; engine++)
+			{
+				if ((0 == strcmp(name, "all")) || (0 == strcmp(name, engineNames[engine])))
+					engines.push_back((ExecutionEngine)engine);
+			}
+			if (engines.empty())
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+		}
+		else if ((0 == strcmp(argv[i], "--only")) && (i + 1 < argc))
+		{
+			only = argv[++i];
+		}
+		else if ((0 == strcmp(argv[i], "--csv")) && (i + 1 < argc))
+		{
+			csvPath = argv[++i];
+		}
+		else
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+	if ((0 == instructions) || (0 == samples) || (0 == instructionsPerFrame))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	std::ofstream csv;
+	if (nullptr != csvPath)
+	{
+		csv.open(csvPath, std::ios::out | std::ios::trunc);
+		if (!csv.is_open())
+		{
+			std::cerr << "Unable to write " << csvPath << std::endl;
+			return 1;
+		}
+		csv << "benchmark,group,engine,instructions,samples,mean_ns,stddev_ns,min_ns,max_ns" << std::endl;
+	}
+
+	std::cout << std::left << std::setw(16) << "benchmark" << std::setw(22) << "group" << std::setw(13) << "engine" << std::right
+	          << std::setw(10) << "ns/instr" << std::setw(9) << "stddev" << std::setw(9) << "min" << std::setw(9) << "max" << std::endl;
+
+	int failures = 0;
+	bool found = false;
+	for (const Benchmark& benchmark : BuildBenchmarks())
+	{
+		if ((nullptr != only) && (0 != strcmp(only, benchmark.name)))
+			continue;
+		found = true;
+
+		for (ExecutionEngine engine : engines)
+		{
+			Chip8 chip;
+			chip.SetRandomSeed(1);
+			if ((0 != chip.LoadProgram(benchmark.rom.data(), (int)benchmark.rom.size())) || (0 != chip.SetExecutionEngine(engine)))
+			{
+				std::cout << std::left << std::setw(16) << benchmark.name << std::setw(22) << benchmark.group << std::setw(13)
+				          << engineNames[(int)engine] << "not available" << std::right << std::endl;
+				continue;
+			}
+			chip.Reset();
+			for (const char *key = benchmark.keysHeld; '\0' != *key; key++)
+				chip.KeyDown(*key);
+			chip.Executing();
+
+			// One untimed sample first, so the engines that build code have built it all and the caches are warm
+			std::vector<double> nanoseconds;
+			int status = 0;
+			for (unsigned int sample = 0; (sample <= samples) && (0 == (status & 0x1)); sample++)
+			{
+				unsigned long long executed = 0;
+				auto start = std::chrono::steady_clock::now();
+				while ((executed < instructions) && (0 == (status & 0x1)))
+				{
+					unsigned int frameExecuted = 0;
+					status |= chip.RunFrame(instructionsPerFrame, frameExecuted);
+					executed += frameExecuted;
+				}
+				double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				if (0 != sample)
+					nanoseconds.push_back(seconds * 1e9 / executed);
+			}
+			if (status & 0x1)
+			{
+				std::cout << std::left << std::setw(16) << benchmark.name << std::setw(22) << benchmark.group << std::setw(13)
+				          << engineNames[(int)engine] << "stopped at pc 0x" << std::hex << std::uppercase << chip.GetPC() << std::dec
+				          << std::right << std::endl;
+				failures++;
+				continue;
+			}
+
+			double mean = 0;
+			double minimum = nanoseconds[0];
+			double maximum = nanoseconds[0];
+			for (double value : nanoseconds)
+			{
+				mean += value;
+				minimum = (value < minimum) ? value : minimum;
+				maximum = (value > maximum) ? value : maximum;
+			}
+			mean /= nanoseconds.size();
+			double variance = 0;
+			for (double value : nanoseconds)
+				variance += (value - mean) * (value - mean);
+			double deviation = (nanoseconds.size() > 1) ? std::sqrt(variance / (nanoseconds.size() - 1)) : 0.0;
+
+			std::cout << std::left << std::setw(16) << benchmark.name << std::setw(22) << benchmark.group << std::setw(13) << engineNames[(int)engine]
+			          << std::right << std::fixed << std::setprecision(2) << std::setw(10) << mean << std::setw(9) << deviation
+			          << std::setw(9) << minimum << std::setw(9) << maximum << std::endl;
+			if (csv.is_open())
+			{
+				csv << benchmark.name << "," << benchmark.group << "," << engineNames[(int)engine] << "," << instructions << "," << samples << ","
+				    << std::fixed << std::setprecision(3) << mean << "," << deviation << "," << minimum << "," << maximum << std::endl;
+			}
+		}
+	}
+
+	if (!found)
+	{
+		std::cerr << "There is no benchmark called " << only << std::endl;
+		return 1;
+	}
+	return (0 == failures) ? 0 : 2;
+}
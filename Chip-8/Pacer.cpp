@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <thread>
+#include "Pacer.h"
+
+constexpr std::chrono::milliseconds Pacer::MAX_LAG;
+
+Pacer::Pacer() :
+	m_instructionsPerSecond(DEFAULT_INSTRUCTIONS_PER_SECOND),
+	m_framesPerSecond(DEFAULT_FRAMES_PER_SECOND),
+	m_mode(PacingMode::REAL_TIME),
+	m_multiplier(1),
+	m_rate(DEFAULT_FRAMES_PER_SECOND),
+	m_remainder(0),
+	m_frames(0),
+	m_resyncs(0)
+{
+	Start();
+}
+
+
+Pacer::~Pacer()
+{
+}
+
+void Pacer::SetRate(unsigned int instructionsPerSecond, unsigned int framesPerSecond)
+{
+	m_instructionsPerSecond = instructionsPerSecond;
+	m_framesPerSecond = (0 == framesPerSecond) ? DEFAULT_FRAMES_PER_SECOND : framesPerSecond;
+	m_remainder = 0;
+	m_rate = (unsigned long long)m_framesPerSecond * m_multiplier;
+	Restart(std::max(m_nextFrame, Clock::now()));
+}
+
+unsigned int Pacer::GetInstructionsPerSecond()
+{
+	return m_instructionsPerSecond;
+}
+
+unsigned int Pacer::GetFramesPerSecond()
+{
+	return m_framesPerSecond;
+}
+
+void Pacer::SetMode(PacingMode mode, unsigned int multiplier)
+{
+	m_mode = mode;
+	m_multiplier = (PacingMode::FAST_FORWARD == mode) ? ((0 == multiplier) ? 1 : multiplier) : 1;
+	m_rate = (unsigned long long)m_framesPerSecond * m_multiplier;
+	// The frame already scheduled keeps its time. Turbo does not keep a schedule, so coming out of it the next frame is due now
+	Restart(std::max(m_nextFrame, Clock::now()));
+}
+
+PacingMode Pacer::GetMode()
+{
+	return m_mode;
+}
+
+unsigned int Pacer::GetMultiplier()
+{
+	return m_multiplier;
+}
+
+// Restarts the schedule with the first frame due now
+void Pacer::Start()
+{
+	Restart(Clock::now());
+}
+
+bool Pacer::IsFrameDue()
+{
+	return (PacingMode::TURBO == m_mode) || (Clock::now() >= m_nextFrame);
+}
+
+long long Pacer::GetMicrosecondsUntilNextFrame()
+{
+	if (PacingMode::TURBO == m_mode)
+		return 0;
+
+	long long wait = std::chrono::duration_cast<std::chrono::microseconds>(m_nextFrame - Clock::now()).count();
+	return (wait > 0) ? wait : 0;
+}
+
+void Pacer::WaitForNextFrame()
+{
+	if (PacingMode::TURBO != m_mode)
+		std::this_thread::sleep_until(m_nextFrame);
+}
+
+/*****************************************************************************************************************************************/
+//
+// NextFrame - Moves the schedule on by one frame
+//
+// Inputs - None
+//
+// Outputs - Instructions to run in the frame that is starting
+//
+// Notes - The next frame is due one period after this one was due, not one period from now. Only when this frame is more than
+//         MAX_LAG late is the schedule moved up to now
+/*****************************************************************************************************************************************/
+unsigned int Pacer::NextFrame()
+{
+	if (PacingMode::TURBO != m_mode)
+	{
+		Clock::time_point now = Clock::now();
+		if (now - m_nextFrame > MAX_LAG)
+		{
+			Restart(now);
+			m_resyncs++;
+		}
+		m_scheduled++;
+		m_nextFrame = m_epoch + std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(m_scheduled * 1000000000ull / m_rate));
+	}
+	m_frames++;
+
+	unsigned int instructions = m_instructionsPerSecond / m_framesPerSecond;
+	m_remainder += m_instructionsPerSecond % m_framesPerSecond;
+	if (m_remainder >= m_framesPerSecond)
+	{
+		m_remainder -= m_framesPerSecond;
+		instructions++;
+	}
+	return instructions;
+}
+
+unsigned long long Pacer::GetFrameCount()
+{
+	return m_frames;
+}
+
+unsigned long long Pacer::GetResyncCount()
+{
+	return m_resyncs;
+}
+
+void Pacer::Restart(Clock::time_point epoch)
+{
+	m_epoch = epoch;
+	m_scheduled = 0;
+	m_nextFrame = epoch;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <chrono>
+
+enum class PacingMode
+{
+	REAL_TIME,       // Frames at the configured frame rate
+	FAST_FORWARD,    // Frames at a multiple of the frame rate
+	TURBO,           // Frames as fast as the host can run them
+};
+
+/*****************************************************************************************************************************************/
+//
+// Pacer - Decides when each frame runs and how many instructions it gets
+//
+// Notes - Frames are scheduled against a monotonic clock at fixed times from when the schedule started, not a fixed delay after
+//         the previous frame, so late wake ups and the time spent emulating never add up to drift. The due time of frame n is
+//         worked out from n directly, so rounding does not build up either. If the host falls more than MAX_LAG behind (a
+//         debugger break, a dragged window) the schedule restarts from now instead of running a burst of frames to catch up.
+//
+//         The instructions per frame are spread so exactly the configured number run per emulated second even when it does not
+//         divide by the frame rate. Fast forward runs more frames per second, so the timers speed up with the instructions.
+//
+//         WaitForNextFrame sleeps until the frame is due. Hosts with their own event loop use GetMicrosecondsUntilNextFrame to set
+//         a timer instead. Either way a paced machine that is ahead of schedule uses no CPU.
+/*****************************************************************************************************************************************/
+class Pacer
+{
+public:
+	Pacer();
+	~Pacer();
+
+	void SetRate(unsigned int instructionsPerSecond, unsigned int framesPerSecond);
+	unsigned int GetInstructionsPerSecond();
+	unsigned int GetFramesPerSecond();
+	// multiplier is only used by FAST_FORWARD
+	void SetMode(PacingMode mode, unsigned int multiplier = 1);
+	PacingMode GetMode();
+	unsigned int GetMultiplier();
+
+	void Start();
+	bool IsFrameDue();
+	long long GetMicrosecondsUntilNextFrame();
+	void WaitForNextFrame();
+	// Called as each frame starts. Returns the number of instructions to run in it
+	unsigned int NextFrame();
+
+	unsigned long long GetFrameCount();
+	unsigned long long GetResyncCount();   // Times the schedule was restarted after falling behind
+
+	static constexpr unsigned int DEFAULT_INSTRUCTIONS_PER_SECOND = 600;
+	static constexpr unsigned int DEFAULT_FRAMES_PER_SECOND = 60;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	static constexpr std::chrono::milliseconds MAX_LAG = std::chrono::milliseconds(100);
+
+	unsigned int m_instructionsPerSecond;
+	unsigned int m_framesPerSecond;
+	PacingMode m_mode;
+	unsigned int m_multiplier;
+	unsigned long long m_rate;             // Frames per second after the multiplier
+	Clock::time_point m_epoch;             // When the schedule was last restarted
+	unsigned long long m_scheduled;        // Frames scheduled since m_epoch
+	Clock::time_point m_nextFrame;
+	unsigned int m_remainder;              // Instructions per second left over by the division, carried frame to frame
+	unsigned long long m_frames;
+	unsigned long long m_resyncs;
+
+	void Restart(Clock::time_point epoch);
+};
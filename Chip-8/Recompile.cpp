@@ -0,0 +1,88 @@
+// Recompile.cpp : Ahead of time compiler for the Chip8 core. Recovers the basic blocks of a ROM and writes them out as C++ for a
+//                 NativeModule, to be built into a shared object and loaded with chip8-headless --native.
+//
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include "Chip8.h"
+#include "ControlFlow.h"
+#include "StaticRecompiler.h"
+
+static void PrintUsage(const char *program)
+{
+	std::cerr << "Usage: " << program << " <rom> <output.cpp> [--quirks chip8|vip|schip]" << std::endl
+	          << "  --quirks Q        Rules the ROM runs by: chip8 (default), vip for the COSMAC VIP or schip for SUPER-CHIP. The module" << std::endl
+	          << "                    only runs under the same rules" << std::endl
+	          << "Build the output into a shared object with NativeModule.h on the include path, for example" << std::endl
+	          << "  c++ -O2 -shared -fPIC -I Chip-8 output.cpp -o rom.so" << std::endl
+	          << "or list the ROM in CHIP8_NATIVE_ROMS when configuring with CMake." << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *romPath = nullptr;
+	const char *outputPath = nullptr;
+	QuirkProfile quirks = QuirkProfile::CHIP_8;
+
+	for (int x = 1; x < argc; x++)
+	{
+		if ((0 == std::strcmp(argv[x], "--quirks")) && (x + 1 < argc))
+		{
+			const char *name = argv[++x];
+			if (0 == std::strcmp(name, "chip8"))
+				quirks = QuirkProfile::CHIP_8;
+			else if (0 == std::strcmp(name, "vip"))
+				quirks = QuirkProfile::COSMAC_VIP;
+			else if (0 == std::strcmp(name, "schip"))
+				quirks = QuirkProfile::SUPER_CHIP;
+			else
+			{
+				PrintUsage(argv[0]);
+				return 1;
+			}
+		}
+		else if (('-' != argv[x][0]) && (nullptr == romPath))
+			romPath = argv[x];
+		else if (('-' != argv[x][0]) && (nullptr == outputPath))
+			outputPath = argv[x];
+		else
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((nullptr == romPath) || (nullptr == outputPath))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	std::ifstream file(romPath, std::ios::in | std::ios::binary);
+	std::vector<unsigned char> rom;
+	if (file.is_open())
+		rom.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	Chip8 chip;
+	chip.SetQuirkProfile(quirks);
+	if (!file.is_open() || rom.empty() || (0 != chip.LoadProgram(rom.data(), (int)rom.size())))
+	{
+		std::cerr << "Unable to read ROM " << romPath << " (max size is " << MAX_PROGRAM_SIZE << " bytes)" << std::endl;
+		return 1;
+	}
+
+	std::ofstream output(outputPath, std::ios::out | std::ios::trunc);
+	if (!output.is_open() || (0 != StaticRecompiler::Generate(chip, romPath, output)))
+	{
+		std::cerr << "Unable to write " << outputPath << std::endl;
+		return 1;
+	}
+
+	ControlFlowGraph& graph = chip.GetControlFlow();
+	int codeBytes = 0;
+	for (unsigned short address = START_CHIP_8_PROGRAM; address < START_CHIP_8_PROGRAM + rom.size(); address++)
+		codeBytes += (graph.GetFlags(address) & ControlFlowGraph::BYTE_CODE) ? 1 : 0;
+	std::cout << outputPath << ": " << graph.GetBlocks().size() << " blocks, " << codeBytes << " bytes of code" << std::endl;
+	return 0;
+}
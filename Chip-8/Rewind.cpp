@@ -0,0 +1,306 @@
+#include <cstring>
+#include "Rewind.h"
+
+// Encoded states are a list of (unchanged run, changed run) pairs. Both lengths are stored 7 bits per byte, low bits first, and the
+// changed run is followed by the XOR of its bytes. A changed run only ends at three or more unchanged bytes, which is where starting
+// a new pair stops costing more than it saves
+static constexpr size_t MIN_UNCHANGED_RUN = 3;
+
+static const unsigned char s_emptyState[sizeof(Chip8State)] = {};
+
+static unsigned char* PutLength(unsigned char *output, size_t length)
+{
+	while (length >= 0x80)
+	{
+		*(output++) = (unsigned char)(length | 0x80);
+		length >>= 7;
+	}
+	*(output++) = (unsigned char)length;
+	return output;
+}
+
+static const unsigned char* GetLength(const unsigned char *input, size_t& length)
+{
+	length = 0;
+	for (unsigned int shift = 0; ; shift += 7)
+	{
+		unsigned char byte = *(input++);
+		length |= (size_t)(byte & 0x7F) << shift;
+		if (0 == (byte & 0x80))
+			return input;
+	}
+}
+
+Rewind::Rewind(size_t memoryBudget, unsigned int keyframeInterval) :
+	m_budget((memoryBudget < MIN_MEMORY_BUDGET) ? MIN_MEMORY_BUDGET : ((memoryBudget > MAX_MEMORY_BUDGET) ? MAX_MEMORY_BUDGET : memoryBudget)),
+	m_keyframeInterval((0 == keyframeInterval) ? 1 : keyframeInterval),
+	m_buffer(new unsigned char[m_budget]),
+	m_keyframes(0),
+	m_sinceKeyframe(0),
+	m_position(0)
+{
+	std::memset(&m_newest, 0, sizeof(m_newest));
+	std::memset(&m_current, 0, sizeof(m_current));
+}
+
+/*****************************************************************************************************************************************/
+//
+// Record - Adds a frame to the history
+//
+// Inputs - chip (machine to record)
+//
+// Outputs - 0 on success, -1 if the machine's state cannot be saved
+//
+// Notes - Frames after the current position, left over from a Seek, are thrown away first. The oldest frames are dropped as needed
+//         to keep the history within the memory budget
+/*****************************************************************************************************************************************/
+int Rewind::Record(Chip8& chip)
+{
+	Truncate();
+	if (0 != chip.SaveState(m_current))
+	{
+		m_current = m_newest;
+		return -1;
+	}
+
+	const unsigned char *current = reinterpret_cast<const unsigned char *>(&m_current);
+	const unsigned char *previous = m_frames.empty() ? s_emptyState : reinterpret_cast<const unsigned char *>(&m_newest);
+	bool keyframe = m_frames.empty() || (m_sinceKeyframe + 1 >= m_keyframeInterval);
+
+	RewindFrame frame;
+	frame.deltaSize = (unsigned short)Encode(previous, current, m_scratch);
+	frame.imageSize = keyframe ? (unsigned short)Encode(s_emptyState, current, &m_scratch[frame.deltaSize]) : 0;
+	frame.offset = (unsigned int)Allocate(frame.deltaSize + frame.imageSize);
+	std::memcpy(&m_buffer[frame.offset], m_scratch, frame.deltaSize + frame.imageSize);
+	m_frames.push_back(frame);
+
+	if (keyframe)
+	{
+		m_keyframes++;
+		m_sinceKeyframe = 0;
+	}
+	else
+		m_sinceKeyframe++;
+	m_newest = m_current;
+	return 0;
+}
+
+/*****************************************************************************************************************************************/
+//
+// Seek - Loads an earlier frame into a machine
+//
+// Inputs - chip (machine to load the frame into)
+//          framesBack (0 for the newest frame, 1 for the one before it and so on)
+//
+// Outputs - 0 on success, -1 if the frame is no longer held. chip is not changed on failure
+//
+// Notes - The frame is rebuilt from whichever of the newest frame, the frame last sought to or the keyframe before it needs the
+//         fewest delta bytes applied. Stepping one frame at a time costs one delta per step
+/*****************************************************************************************************************************************/
+int Rewind::Seek(Chip8& chip, unsigned int framesBack)
+{
+	if (framesBack >= m_frames.size())
+		return -1;
+
+	size_t newest = m_frames.size() - 1;
+	size_t target = newest - framesBack;
+	size_t position = newest - m_position;
+
+	size_t keyframe = target;
+	while ((0 == m_frames[keyframe].imageSize) && (keyframe > 0))
+		keyframe--;
+	size_t keyframeCost = (0 != m_frames[keyframe].imageSize) ? m_frames[keyframe].imageSize + WalkCost(keyframe, target) : (size_t)-1;
+	size_t newestCost = WalkCost(newest, target);
+	size_t positionCost = WalkCost(position, target);
+
+	unsigned char *state = reinterpret_cast<unsigned char *>(&m_current);
+	if ((positionCost <= newestCost) && (positionCost <= keyframeCost))
+		Walk(position, target, state);
+	else if (newestCost <= keyframeCost)
+	{
+		m_current = m_newest;
+		Walk(newest, target, state);
+	}
+	else
+	{
+		const RewindFrame& frame = m_frames[keyframe];
+		std::memset(state, 0, STATE_SIZE);
+		Apply(&m_buffer[frame.offset + frame.deltaSize], frame.imageSize, state);
+		Walk(keyframe, target, state);
+	}
+	m_position = framesBack;
+
+	return chip.LoadState(m_current);
+}
+
+void Rewind::Clear()
+{
+	m_frames.clear();
+	m_keyframes = 0;
+	m_sinceKeyframe = 0;
+	m_position = 0;
+}
+
+unsigned int Rewind::GetFrameCount()
+{
+	return (unsigned int)m_frames.size();
+}
+
+unsigned int Rewind::GetKeyframeCount()
+{
+	return m_keyframes;
+}
+
+unsigned int Rewind::GetPosition()
+{
+	return m_position;
+}
+
+size_t Rewind::GetMemoryBudget()
+{
+	return m_budget;
+}
+
+size_t Rewind::GetMemoryUsed()
+{
+	if (m_frames.empty())
+		return 0;
+
+	// Bytes from the start of the oldest frame to the end of the newest, including any tail skipped when the buffer wrapped
+	const RewindFrame& oldest = m_frames.front();
+	const RewindFrame& newest = m_frames.back();
+	size_t end = newest.offset + newest.deltaSize + newest.imageSize;
+	size_t history = (newest.offset >= oldest.offset) ? end - oldest.offset : m_budget - oldest.offset + end;
+	return history + m_frames.size() * sizeof(RewindFrame);
+}
+
+// Finds room for a new frame after the newest one, wrapping to the start of the buffer and dropping the oldest frames until both
+// the frame data and the index fit in the budget
+size_t Rewind::Allocate(size_t size)
+{
+	for (;; DropOldest())
+	{
+		if (m_frames.empty())
+			return 0;
+		if (GetMemoryUsed() + size + sizeof(RewindFrame) > m_budget)
+			continue;
+
+		size_t head = m_frames.front().offset;
+		const RewindFrame& newest = m_frames.back();
+		size_t tail = newest.offset + newest.deltaSize + newest.imageSize;
+		if (newest.offset >= head)
+		{
+			if (m_budget - tail >= size)
+				return tail;
+			if (head >= size)
+				return 0;
+		}
+		else if (head - tail >= size)
+			return tail;
+	}
+}
+
+// Oldest frames are only ever reached by walking back from newer ones, so dropping one never leaves the rest unreachable
+void Rewind::DropOldest()
+{
+	if (0 != m_frames.front().imageSize)
+		m_keyframes--;
+	m_frames.pop_front();
+}
+
+// Drops the frames after the one last sought to, so recording carries on from it
+void Rewind::Truncate()
+{
+	if (0 == m_position)
+		return;
+
+	for (; m_position > 0; m_position--)
+	{
+		if (0 != m_frames.back().imageSize)
+			m_keyframes--;
+		m_frames.pop_back();
+	}
+	m_newest = m_current;
+
+	m_sinceKeyframe = 0;
+	for (size_t frame = m_frames.size(); (frame > 0) && (0 == m_frames[frame - 1].imageSize); frame--)
+		m_sinceKeyframe++;
+}
+
+size_t Rewind::WalkCost(size_t from, size_t to)
+{
+	size_t cost = 0;
+	for (size_t frame = from; frame > to; frame--)
+		cost += m_frames[frame].deltaSize;
+	for (size_t frame = from + 1; frame <= to; frame++)
+		cost += m_frames[frame].deltaSize;
+	return cost;
+}
+
+// Turns the state of frame from into the state of frame to. A frame's delta is its XOR with the frame before, so applying it steps
+// either way
+void Rewind::Walk(size_t from, size_t to, unsigned char *state)
+{
+	for (size_t frame = from; frame > to; frame--)
+		Apply(&m_buffer[m_frames[frame].offset], m_frames[frame].deltaSize, state);
+	for (size_t frame = from + 1; frame <= to; frame++)
+		Apply(&m_buffer[m_frames[frame].offset], m_frames[frame].deltaSize, state);
+}
+
+size_t Rewind::Encode(const unsigned char *previous, const unsigned char *current, unsigned char *output)
+{
+	unsigned char *start = output;
+	size_t x = 0;
+	while (x < STATE_SIZE)
+	{
+		size_t unchanged = x;
+		while ((x < STATE_SIZE) && (previous[x] == current[x]))
+			x++;
+		if (STATE_SIZE == x)
+		{
+			if (x != unchanged)
+			{
+				output = PutLength(output, x - unchanged);
+				output = PutLength(output, 0);
+			}
+			break;
+		}
+
+		size_t changed = x;
+		while (x < STATE_SIZE)
+		{
+			if (previous[x] != current[x])
+			{
+				x++;
+				continue;
+			}
+			size_t run = 1;
+			while ((run < MIN_UNCHANGED_RUN) && (x + run < STATE_SIZE) && (previous[x + run] == current[x + run]))
+				run++;
+			if ((MIN_UNCHANGED_RUN == run) || (STATE_SIZE == x + run))
+				break;
+			x += run;
+		}
+
+		output = PutLength(output, changed - unchanged);
+		output = PutLength(output, x - changed);
+		for (size_t y = changed; y < x; y++)
+			*(output++) = previous[y] ^ current[y];
+	}
+	return output - start;
+}
+
+void Rewind::Apply(const unsigned char *delta, size_t size, unsigned char *state)
+{
+	const unsigned char *end = delta + size;
+	size_t x = 0;
+	while (delta < end)
+	{
+		size_t unchanged, changed;
+		delta = GetLength(delta, unchanged);
+		delta = GetLength(delta, changed);
+		x += unchanged;
+		for (size_t y = 0; y < changed; y++)
+			state[x++] ^= *(delta++);
+	}
+}
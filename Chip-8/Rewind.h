@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include "Chip8.h"
+
+// One recorded frame. Its data in the history buffer is the delta from the previous frame followed, for keyframes, by a full image
+struct RewindFrame
+{
+	unsigned int offset;
+	unsigned short deltaSize;
+	unsigned short imageSize;    // 0 unless this is a keyframe
+};
+
+/*****************************************************************************************************************************************/
+//
+// Rewind - Bounded history of a running Chip8 that can be stepped back through
+//
+// Notes - Record is called once per frame. Each frame is stored as the XOR of its Chip8State with the previous frame's, run length
+//         encoded, so a frame that only moves a sprite costs a few dozen bytes. Every keyframeInterval frames a full (also run length
+//         encoded) image is stored as well. Because XOR deltas work in both directions, a frame is rebuilt either by walking back
+//         from the newest frame or forward from the nearest keyframe before it, whichever touches fewer bytes.
+//
+//         Frames are kept in a ring buffer of memoryBudget bytes and the oldest are dropped to make room. Seeking does not drop
+//         anything, so the history can be stepped back and forward through, but recording after a seek throws away the frames that
+//         came after the one sought to.
+/*****************************************************************************************************************************************/
+class Rewind
+{
+public:
+	// memoryBudget bounds the history and its frame index together
+	explicit Rewind(size_t memoryBudget = 4 * 1024 * 1024, unsigned int keyframeInterval = 60);
+	Rewind(const Rewind&) = delete;
+	Rewind& operator=(const Rewind&) = delete;
+
+	// Adds the current state of chip as the newest frame. Returns -1 if the state cannot be saved
+	int Record(Chip8& chip);
+	// Loads the frame framesBack frames before the newest into chip. Returns -1 if it is no longer held
+	int Seek(Chip8& chip, unsigned int framesBack);
+	void Clear();
+
+	unsigned int GetFrameCount();
+	unsigned int GetKeyframeCount();
+	unsigned int GetPosition();              // Frames between the newest frame and the last one recorded or sought to
+	size_t GetMemoryBudget();
+	size_t GetMemoryUsed();
+
+private:
+	static constexpr size_t STATE_SIZE = sizeof(Chip8State);
+	static constexpr size_t MAX_ENCODED_SIZE = STATE_SIZE + 16;  // Worst case of Encode, every byte different
+	static constexpr size_t MIN_MEMORY_BUDGET = 4 * MAX_ENCODED_SIZE;
+	static constexpr size_t MAX_MEMORY_BUDGET = 0xFFFFFFFF;           // Offsets are 32 bit
+
+	size_t m_budget;
+	unsigned int m_keyframeInterval;
+	std::unique_ptr<unsigned char[]> m_buffer; // Ring of frame data, m_budget bytes
+	std::deque<RewindFrame> m_frames;
+	unsigned int m_keyframes;
+	unsigned int m_sinceKeyframe;
+	unsigned int m_position;
+
+	Chip8State m_newest;                     // State of m_frames.back()
+	Chip8State m_current;                    // State of the frame at m_position
+	unsigned char m_scratch[2 * MAX_ENCODED_SIZE];
+
+	size_t Allocate(size_t size);
+	void DropOldest();
+	void Truncate();
+	size_t WalkCost(size_t from, size_t to);
+	void Walk(size_t from, size_t to, unsigned char *state);
+	static size_t Encode(const unsigned char *previous, const unsigned char *current, unsigned char *output);
+	static void Apply(const unsigned char *delta, size_t size, unsigned char *state);
+};
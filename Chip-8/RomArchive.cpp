@@ -0,0 +1,262 @@
+#include "RomArchive.h"
+#include "Chip8.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	const char ARCHIVE_MAGIC[4] = { 'C', '8', 'R', 'A' };
+
+	void PutU32(std::vector<unsigned char>& bytes, size_t offset, unsigned int value)
+	{
+		for (int x = 0; x < 4; x++)
+			bytes[offset + x] = (unsigned char)(value >> (x * 8));
+	}
+}
+
+RomArchive::RomArchive() :
+	m_data(nullptr),
+	m_size(0),
+	m_count(0)
+#ifdef _WIN32
+	,
+	m_file(INVALID_HANDLE_VALUE),
+	m_mapping(nullptr)
+#endif
+{
+}
+
+
+RomArchive::~RomArchive()
+{
+	Close();
+}
+
+/*****************************************************************************************************************************************/
+//
+// Open - Maps an archive into memory
+//
+// Inputs - path (archive written by Write)
+//
+// Outputs - 0 on success, -1 if the file cannot be mapped or its header or index are bad. An archive already open is closed first
+//
+// Notes - The index is checked here, once, so the accessors can trust it. Nothing else is read until a ROM is asked for, so opening
+//         a large archive only touches its first few pages
+/*****************************************************************************************************************************************/
+int RomArchive::Open(const char *path)
+{
+	Close();
+
+#ifdef _WIN32
+	m_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER size;
+	if ((INVALID_HANDLE_VALUE == m_file) || !GetFileSizeEx(m_file, &size) || (size.QuadPart < (LONGLONG)HEADER_SIZE))
+	{
+		Close();
+		return -1;
+	}
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	m_data = (nullptr == m_mapping) ? nullptr : (const unsigned char *)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	m_size = (size_t)size.QuadPart;
+#else
+	int file = open(path, O_RDONLY);
+	struct stat status;
+	if ((file < 0) || (0 != fstat(file, &status)) || (status.st_size < (off_t)HEADER_SIZE))
+	{
+		if (file >= 0)
+			close(file);
+		return -1;
+	}
+	// The mapping holds its own reference to the file
+	void *data = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	m_data = (MAP_FAILED == data) ? nullptr : (const unsigned char *)data;
+	m_size = (size_t)status.st_size;
+#endif
+
+	if ((nullptr == m_data) || (0 != CheckIndex()))
+	{
+		Close();
+		return -1;
+	}
+	return 0;
+}
+
+void RomArchive::Close()
+{
+#ifdef _WIN32
+	if (nullptr != m_data)
+		UnmapViewOfFile(m_data);
+	if (nullptr != m_mapping)
+		CloseHandle(m_mapping);
+	if (INVALID_HANDLE_VALUE != m_file)
+		CloseHandle(m_file);
+	m_mapping = nullptr;
+	m_file = INVALID_HANDLE_VALUE;
+#else
+	if (nullptr != m_data)
+		munmap((void *)m_data, m_size);
+#endif
+	m_data = nullptr;
+	m_size = 0;
+	m_count = 0;
+}
+
+bool RomArchive::IsOpen()
+{
+	return (nullptr != m_data);
+}
+
+unsigned int RomArchive::GetCount()
+{
+	return m_count;
+}
+
+const char* RomArchive::GetName(unsigned int index)
+{
+	if (index >= m_count)
+		return nullptr;
+	return (const char *)&m_data[ReadU32(Entry(index))];
+}
+
+const unsigned char* RomArchive::GetRom(unsigned int index, int& size)
+{
+	size = 0;
+	if (index >= m_count)
+		return nullptr;
+	const unsigned char *entry = Entry(index);
+	size = (int)ReadU32(entry + 12);
+	return &m_data[ReadU32(entry + 8)];
+}
+
+// The index is sorted by name, so this is a binary search
+int RomArchive::Find(const char *name)
+{
+	unsigned int low = 0;
+	unsigned int high = m_count;
+	while (low < high)
+	{
+		unsigned int middle = low + (high - low) / 2;
+		int order = std::strcmp(GetName(middle), name);
+		if (0 == order)
+			return (int)middle;
+		if (order < 0)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return -1;
+}
+
+/*****************************************************************************************************************************************/
+//
+// Write - Packs ROMs into an archive file
+//
+// Inputs - path (file to write, replaced if it exists)
+//          roms (the ROMs, in any order)
+//
+// Outputs - 0 on success, -1 if two ROMs have the same name, a ROM is bigger than XO_CHIP_MAX_PROGRAM_SIZE or the file cannot be
+//           written
+//
+// Notes - The archive is built in memory and written in one go
+/*****************************************************************************************************************************************/
+int RomArchive::Write(const char *path, const std::vector<RomArchiveFile>& roms)
+{
+	std::vector<size_t> order(roms.size());
+	for (size_t x = 0; x < order.size(); x++)
+		order[x] = x;
+	std::sort(order.begin(), order.end(), [&roms](size_t a, size_t b) { return std::strcmp(roms[a].name.c_str(), roms[b].name.c_str()) < 0; });
+
+	size_t namesSize = 0;
+	size_t romsSize = 0;
+	for (size_t x = 0; x < order.size(); x++)
+	{
+		const RomArchiveFile& rom = roms[order[x]];
+		if ((rom.bytes.size() > XO_CHIP_MAX_PROGRAM_SIZE) || ((x > 0) && (rom.name == roms[order[x - 1]].name)))
+			return -1;
+		namesSize += rom.name.size() + 1;
+		romsSize += rom.bytes.size();
+	}
+	size_t total = HEADER_SIZE + roms.size() * ENTRY_SIZE + namesSize + romsSize;
+	if (total > 0xFFFFFFFFu)
+		return -1;
+
+	std::vector<unsigned char> archive(total, 0);
+	std::memcpy(archive.data(), ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+	PutU32(archive, 4, CHIP_8_ROM_ARCHIVE_VERSION);
+	PutU32(archive, 8, (unsigned int)roms.size());
+
+	size_t name = HEADER_SIZE + roms.size() * ENTRY_SIZE;
+	size_t data = name + namesSize;
+	for (size_t x = 0; x < order.size(); x++)
+	{
+		const RomArchiveFile& rom = roms[order[x]];
+		size_t entry = HEADER_SIZE + x * ENTRY_SIZE;
+		PutU32(archive, entry, (unsigned int)name);
+		PutU32(archive, entry + 4, (unsigned int)rom.name.size());
+		PutU32(archive, entry + 8, (unsigned int)data);
+		PutU32(archive, entry + 12, (unsigned int)rom.bytes.size());
+
+		std::memcpy(&archive[name], rom.name.c_str(), rom.name.size() + 1);
+		if (!rom.bytes.empty())
+			std::memcpy(&archive[data], rom.bytes.data(), rom.bytes.size());
+		name += rom.name.size() + 1;
+		data += rom.bytes.size();
+	}
+
+	std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return -1;
+	file.write((const char *)archive.data(), archive.size());
+	return file.good() ? 0 : -1;
+}
+
+unsigned int RomArchive::ReadU32(const unsigned char *bytes)
+{
+	return (unsigned int)bytes[0] | ((unsigned int)bytes[1] << 8) | ((unsigned int)bytes[2] << 16) | ((unsigned int)bytes[3] << 24);
+}
+
+const unsigned char* RomArchive::Entry(unsigned int index)
+{
+	return &m_data[HEADER_SIZE + (size_t)index * ENTRY_SIZE];
+}
+
+// Every name and ROM has to lie inside the file, names have to be NUL terminated and in order, and no ROM can be too big to load
+int RomArchive::CheckIndex()
+{
+	if ((0 != std::memcmp(m_data, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC))) || (CHIP_8_ROM_ARCHIVE_VERSION != ReadU32(m_data + 4)))
+		return -1;
+
+	unsigned int count = ReadU32(m_data + 8);
+	if ((m_size - HEADER_SIZE) / ENTRY_SIZE < count)
+		return -1;
+
+	for (unsigned int index = 0; index < count; index++)
+	{
+		const unsigned char *entry = &m_data[HEADER_SIZE + (size_t)index * ENTRY_SIZE];
+		size_t nameOffset = ReadU32(entry);
+		size_t nameLength = ReadU32(entry + 4);
+		size_t romOffset = ReadU32(entry + 8);
+		size_t romSize = ReadU32(entry + 12);
+		if ((nameOffset >= m_size) || (nameLength >= m_size - nameOffset) || (0 != m_data[nameOffset + nameLength]) ||
+			(std::strlen((const char *)&m_data[nameOffset]) != nameLength))
+			return -1;
+		if ((romOffset > m_size) || (romSize > m_size - romOffset) || (romSize > XO_CHIP_MAX_PROGRAM_SIZE))
+			return -1;
+		if ((index > 0) && (std::strcmp((const char *)&m_data[ReadU32(entry - ENTRY_SIZE)], (const char *)&m_data[nameOffset]) >= 0))
+			return -1;
+	}
+	m_count = count;
+	return 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#define CHIP_8_ROM_ARCHIVE_VERSION 1
+
+// A ROM to pack into an archive
+struct RomArchiveFile
+{
+	std::string name;
+	std::vector<unsigned char> bytes;
+};
+
+/*****************************************************************************************************************************************/
+//
+// RomArchive - A read only, memory mapped pack of many ROMs
+//
+// Notes - The file is a 16 byte header ("C8RA", version, ROM count, 0), an index of one 16 byte entry per ROM (name offset, name
+//         length, ROM offset, ROM size) sorted by name, the names as NUL terminated strings and then the ROMs back to back. All
+//         numbers are 32 bit little endian and every offset is from the start of the file.
+//
+//         Open maps the whole file and checks the index once, after which GetName and GetRom hand out pointers straight into the
+//         mapping: loading a ROM from the archive is a single copy into the machine's memory, with no file opened per ROM. The
+//         pointers stay valid until the archive is closed or destroyed, and the archive can be read from any number of threads.
+/*****************************************************************************************************************************************/
+class RomArchive
+{
+public:
+	RomArchive();
+	~RomArchive();
+	RomArchive(const RomArchive&) = delete;
+	RomArchive& operator=(const RomArchive&) = delete;
+
+	// Returns -1 if the file cannot be mapped or is not an archive this version can read
+	int Open(const char *path);
+	void Close();
+	bool IsOpen();
+
+	unsigned int GetCount();
+	// Both return nullptr for an index past the end
+	const char* GetName(unsigned int index);
+	const unsigned char* GetRom(unsigned int index, int& size);
+	// Index of the ROM with the given name, or -1
+	int Find(const char *name);
+
+	// Writes roms to path as an archive. Returns -1 if a name is repeated, a ROM is too big or the file cannot be written
+	static int Write(const char *path, const std::vector<RomArchiveFile>& roms);
+
+	static constexpr size_t HEADER_SIZE = 16;
+	static constexpr size_t ENTRY_SIZE = 16;
+
+private:
+	const unsigned char *m_data;
+	size_t m_size;
+	unsigned int m_count;
+#ifdef _WIN32
+	void *m_file;
+	void *m_mapping;
+#endif
+
+	static unsigned int ReadU32(const unsigned char *bytes);
+	const unsigned char* Entry(unsigned int index);
+	int CheckIndex();
+};
@@ -0,0 +1,193 @@
+// SpriteBench.cpp : Measures Chip8::DrawSprite against the byte at a time blitter it replaced and checks that both draw the
+//                   same pixels. The old blitter only noticed a collision on the leftmost pixel, so collisions are counted
+//                   for each rather than compared. Chip8::DrawWideSprite is timed too, in low resolution, where it has to
+//                   draw exactly what DrawSprite does.
+//
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "Chip8.h"
+
+struct SpriteDraw
+{
+	unsigned char x;
+	unsigned char y;
+	unsigned char height;
+	unsigned short offset;   // Into the sprite data
+};
+
+// The blitter DrawSprite replaced, kept as it was apart from taking the rows it reads as a parameter
+static bool LegacyDrawSprite(unsigned long long *display, const unsigned char *sprite, unsigned char xCoor, unsigned char yCoor, unsigned char height)
+{
+	bool collision = false;
+
+	for (int x = 0; x < height; x++)
+	{
+		unsigned char row = (yCoor + x) % CHIP_8_DISPLAY_HEIGHT;
+		unsigned char previousSprite = (display[row] >> xCoor) & 0xFF;
+
+		unsigned char thisSprite = (unsigned char) (((sprite[x] * 0x0802LU & 0x22110LU) | (sprite[x]
+			                        * 0x8020LU & 0x88440LU)) * 0x10101LU >> 16);
+		display[row] ^= ((unsigned long long) thisSprite << xCoor);
+		unsigned char changeMask = 0x80;
+		unsigned char change = thisSprite ^ previousSprite;
+		if (!collision)
+		{
+			while (0 != changeMask)
+			{
+				if ((0 == (change & changeMask)) && (1 == (previousSprite & changeMask)))
+				{
+					collision = true;
+					break;
+				}
+				changeMask >>= 1;
+			}
+		}
+	}
+
+	return collision;
+}
+
+static void PrintUsage(const char *program)
+{
+	std::cerr << "Usage: " << program << " [--draws N] [--height N] [--seed N]" << std::endl
+	          << "  --draws N   Sprites drawn by each blitter (default 10000000)" << std::endl
+	          << "  --height N  Rows per sprite, 1 to 15, or 0 for a random height (default 0)" << std::endl
+	          << "  --seed N    Seed for the sprites and positions (default 1)" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long draws = 10000000;
+	unsigned int height = 0;
+	unsigned int seed = 1;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if ((0 == strcmp(argv[i], "--draws")) && (i + 1 < argc))
+		{
+			draws = strtoull(argv[++i], nullptr, 0);
+		}
+		else if ((0 == strcmp(argv[i], "--height")) && (i + 1 < argc))
+		{
+			height = (unsigned int)strtoul(argv[++i], nullptr, 0);
+		}
+		else if ((0 == strcmp(argv[i], "--seed")) && (i + 1 < argc))
+		{
+			seed = (unsigned int)strtoul(argv[++i], nullptr, 0);
+		}
+		else
+		{
+			PrintUsage(argv[0]);
+			return 1;
+		}
+	}
+	if ((0 == draws) || (height > 15) || (0 == seed))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	// A fixed set of draws, replayed until the count is reached, so generating them is not timed
+	const size_t DRAW_SET_SIZE = 4096;
+	const size_t SPRITE_DATA_SIZE = 4096;
+	std::vector<unsigned char> spriteData(SPRITE_DATA_SIZE + 16);
+	std::vector<SpriteDraw> drawSet(DRAW_SET_SIZE);
+	unsigned int random = seed;
+	auto next = [&random]()
+	{
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		return random;
+	};
+	for (unsigned char& byte : spriteData)
+		byte = (unsigned char)next();
+	for (SpriteDraw& draw : drawSet)
+	{
+		draw.x = (unsigned char)(next() % CHIP_8_DISPLAY_WIDTH);
+		draw.y = (unsigned char)(next() % CHIP_8_DISPLAY_HEIGHT);
+		draw.height = (unsigned char)((0 == height) ? (next() % 15) + 1 : height);
+		draw.offset = (unsigned short)(next() % SPRITE_DATA_SIZE);
+	}
+
+	unsigned long long legacyDisplay[CHIP_8_DISPLAY_HEIGHT] = {};
+	unsigned long long display[CHIP_8_DISPLAY_HEIGHT] = {};
+	Chip8DisplayRow wideDisplay[CHIP_8_HIRES_HEIGHT] = {};
+	unsigned long long legacyCollisions = 0;
+	unsigned long long collisions = 0;
+	unsigned long long wideCollisions = 0;
+	unsigned long long mismatches = 0;
+	unsigned int dirtyRows = 0;
+	unsigned long long wideDirtyRows = 0;
+
+	// Both displays are checked after every draw of the first pass, then left alone while timing
+	for (const SpriteDraw& draw : drawSet)
+	{
+		LegacyDrawSprite(legacyDisplay, &spriteData[draw.offset], draw.x, draw.y, draw.height);
+		bool collision = Chip8::DrawSprite(display, &spriteData[draw.offset], draw.x, draw.y, draw.height, dirtyRows);
+		if (0 != memcmp(legacyDisplay, display, sizeof(display)))
+		{
+			mismatches++;
+			memcpy(display, legacyDisplay, sizeof(display));
+		}
+		bool wideCollision = Chip8::DrawWideSprite(wideDisplay, false, &spriteData[draw.offset], false, draw.x, draw.y, draw.height, wideDirtyRows);
+		bool wideMatches = (collision == wideCollision);
+		for (int row = 0; row < CHIP_8_DISPLAY_HEIGHT; row++)
+		{
+			wideMatches = wideMatches && (display[row] == wideDisplay[row].low) && (0 == wideDisplay[row].high);
+			wideDisplay[row].low = display[row];
+			wideDisplay[row].high = 0;
+		}
+		mismatches += wideMatches ? 0 : 1;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned long long i = 0; i < draws; i++)
+	{
+		const SpriteDraw& draw = drawSet[i % DRAW_SET_SIZE];
+		legacyCollisions += LegacyDrawSprite(legacyDisplay, &spriteData[draw.offset], draw.x, draw.y, draw.height) ? 1 : 0;
+	}
+	auto middle = std::chrono::steady_clock::now();
+	for (unsigned long long i = 0; i < draws; i++)
+	{
+		const SpriteDraw& draw = drawSet[i % DRAW_SET_SIZE];
+		collisions += Chip8::DrawSprite(display, &spriteData[draw.offset], draw.x, draw.y, draw.height, dirtyRows) ? 1 : 0;
+	}
+	auto end = std::chrono::steady_clock::now();
+	for (unsigned long long i = 0; i < draws; i++)
+	{
+		const SpriteDraw& draw = drawSet[i % DRAW_SET_SIZE];
+		wideCollisions += Chip8::DrawWideSprite(wideDisplay, false, &spriteData[draw.offset], false, draw.x, draw.y, draw.height, wideDirtyRows) ? 1 : 0;
+	}
+	auto wideEnd = std::chrono::steady_clock::now();
+
+	double legacySeconds = std::chrono::duration<double>(middle - start).count();
+	double seconds = std::chrono::duration<double>(end - middle).count();
+	double wideSeconds = std::chrono::duration<double>(wideEnd - end).count();
+	if (0 != memcmp(legacyDisplay, display, sizeof(display)))
+		mismatches++;
+	for (int row = 0; row < CHIP_8_DISPLAY_HEIGHT; row++)
+	{
+		if (display[row] != wideDisplay[row].low)
+		{
+			mismatches++;
+			break;
+		}
+	}
+	if (collisions != wideCollisions)
+		mismatches++;
+
+	std::cout << std::fixed << std::setprecision(2)
+	          << "legacy blitter:     " << (draws / legacySeconds) / 1e6 << " M sprites/s, " << legacyCollisions << " collisions" << std::endl
+	          << "DrawSprite:         " << (draws / seconds) / 1e6 << " M sprites/s, " << collisions << " collisions" << std::endl
+	          << "DrawWideSprite:     " << (draws / wideSeconds) / 1e6 << " M sprites/s, " << wideCollisions << " collisions" << std::endl
+	          << "speedup:            " << legacySeconds / seconds << "x" << std::endl
+	          << "pixel mismatches:   " << mismatches << std::endl;
+
+	return (0 == mismatches) ? 0 : 2;
+}
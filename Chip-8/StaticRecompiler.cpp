@@ -0,0 +1,386 @@
+#include "StaticRecompiler.h"
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include "ControlFlow.h"
+#include "NativeModule.h"
+
+/*****************************************************************************************************************************************/
+//
+// Generate - Writes the C++ source of a NativeModule for the program loaded in chip
+//
+// Inputs - chip (machine with the program loaded under the quirk profile it is to run by)
+//          name (what the program is called, only used in the comment at the top of the source)
+//          source (stream the source is written to)
+//
+// Outputs - 0 on success, -1 if there is no program or it is an XO-CHIP one, which always runs on the interpreter
+//
+// Notes - Every instruction the generated code runs does exactly what the interpreter does under the same profile, the quirks
+//         being settled here. Each entry checks that it is still valid and that the rest of the budget covers all of it before
+//         it starts, so the generated code stops on the same instruction the interpreter would. The load from memory FX65 is
+//         the one instruction that can fault part way through an entry, which then leaves before it and hands the budget back
+/*****************************************************************************************************************************************/
+int StaticRecompiler::Generate(Chip8& chip, const std::string& name, std::ostream& source)
+{
+	const Chip8Quirks quirks = GetQuirks(chip.m_quirkProfile);
+	const int programSize = chip.m_programSize;
+	if ((0 == programSize) || quirks.xoChip)
+		return -1;
+
+	// Split the blocks into entries. An entry ends at the end of its block or before an instruction it cannot run
+	ControlFlowGraph& graph = chip.GetControlFlow();
+	std::vector<Entry> entries;
+	for (const ControlFlowBlock& block : graph.GetBlocks())
+	{
+		bool open = false;
+		for (unsigned short pc = block.start; pc < block.end; pc += 2)
+		{
+			Instruction instruction = Disassembler::Decode(pc, chip.GetOpcode(pc));
+			if (!CanCompile(instruction, quirks))
+			{
+				open = false;
+				continue;
+			}
+			if (!open)
+			{
+				entries.push_back({ pc, pc, {} });
+				open = true;
+			}
+			entries.back().instructions.push_back(instruction);
+			entries.back().end = pc + 2;
+		}
+	}
+
+	// Rounded up to a whole instruction, the byte past an odd sized program being the 0 LoadProgram leaves there
+	int programBytes = (programSize + 1) & ~1;
+	source << "// " << name << " compiled by chip8-recompile for quirk profile " << (unsigned int)chip.m_quirkProfile << ". Do not edit" << std::endl
+	       << std::endl
+	       << "#include \"NativeModule.h\"" << std::endl
+	       << std::endl
+	       << "static const unsigned char program[" << programBytes << "] =" << std::endl
+	       << "{";
+	for (int x = 0; x < programBytes; x++)
+		source << ((0 == (x % 16)) ? "\n\t" : " ") << Hex(chip.m_memory[START_CHIP_8_PROGRAM + x], 2) << ",";
+	source << std::endl << "};" << std::endl << std::endl;
+
+	// An empty array is not allowed, so a program with nothing to compile still gets one entry that is never used
+	source << "static const Chip8NativeEntry entries[" << (entries.empty() ? 1 : entries.size()) << "] =" << std::endl << "{" << std::endl;
+	for (const Entry& entry : entries)
+		source << "\t{ " << Hex(entry.start, 4) << ", " << Hex(entry.end, 4) << " }," << std::endl;
+	if (entries.empty())
+		source << "\t{ 0, 0 }," << std::endl;
+	source << "};" << std::endl << std::endl;
+
+	bool indirect = false;
+	std::ostringstream body;
+	for (size_t index = 0; index < entries.size(); index++)
+	{
+		const Entry& entry = entries[index];
+		unsigned int count = (unsigned int)entry.instructions.size();
+		body << "entry_" << index << ":" << std::endl
+		     << "\tif ((1 != context->entryState[" << index << "]) || (budget < " << count << "))" << std::endl
+		     << "\t{" << std::endl
+		     << "\t\tpc = " << Hex(entry.start, 4) << ";" << std::endl
+		     << "\t\tgoto leave;" << std::endl
+		     << "\t}" << std::endl
+		     << "\tbudget -= " << count << ";" << std::endl;
+		for (unsigned int x = 0; x < count; x++)
+		{
+			const Instruction& instruction = entry.instructions[x];
+			std::wostringstream text;
+			Disassembler::Render(instruction, text);
+			body << "\t// ";
+			for (wchar_t character : text.str())
+				body << (char)character;
+			body << std::endl;
+			GenerateInstruction(instruction, quirks, programSize, count - x, entries, body);
+			indirect |= (Mnemonic::JP_V0_NNN == instruction.mnemonic);
+		}
+		if (!IsTransfer(entry.instructions.back(), quirks, programSize))
+			body << "\t" << GoTo(entry.end, entries) << std::endl;
+		body << std::endl;
+	}
+
+	// The registers are copied into locals so the host compiler can keep them in host registers for the whole run
+	source << "static void Run(Chip8NativeContext *context)" << std::endl
+	       << "{" << std::endl
+	       << "\tunsigned char v[16];" << std::endl
+	       << "\tfor (int x = 0; x < 16; x++)" << std::endl
+	       << "\t\tv[x] = context->registers[x];" << std::endl
+	       << "\tunsigned short i = *context->addressRegister;" << std::endl
+	       << "\tunsigned short pc = *context->programCounter;" << std::endl
+	       << "\tunsigned long long budget = context->budget;" << std::endl
+	       << std::endl;
+	if (indirect)
+		source << "dispatch:" << std::endl;
+	source << "\tswitch (pc)" << std::endl << "\t{" << std::endl;
+	for (size_t index = 0; index < entries.size(); index++)
+		source << "\t\tcase " << Hex(entries[index].start, 4) << ": goto entry_" << index << ";" << std::endl;
+	source << "\t\tdefault: goto leave;" << std::endl
+	       << "\t}" << std::endl
+	       << std::endl
+	       << body.str()
+	       << "leave:" << std::endl
+	       << "\tfor (int x = 0; x < 16; x++)" << std::endl
+	       << "\t\tcontext->registers[x] = v[x];" << std::endl
+	       << "\t*context->addressRegister = i;" << std::endl
+	       << "\t*context->programCounter = pc;" << std::endl
+	       << "\tcontext->budget = budget;" << std::endl
+	       << "}" << std::endl
+	       << std::endl
+	       << "static const Chip8NativeModuleInfo info =" << std::endl
+	       << "{" << std::endl
+	       << "\tCHIP_8_NATIVE_ABI_VERSION, " << (unsigned int)chip.m_quirkProfile << ", " << programSize << ", program, " << entries.size()
+	       << ", entries, Run," << std::endl
+	       << "};" << std::endl
+	       << std::endl
+	       << "CHIP_8_NATIVE_EXPORT const Chip8NativeModuleInfo* Chip8NativeModule()" << std::endl
+	       << "{" << std::endl
+	       << "\treturn &info;" << std::endl
+	       << "}" << std::endl;
+	return source.good() ? 0 : -1;
+}
+
+// The instructions the generated code runs itself. The rest need the display, the stack, the random generator, a key wait or a
+// memory write, and go to the interpreter
+bool StaticRecompiler::CanCompile(const Instruction& instruction, const Chip8Quirks& quirks)
+{
+	switch (instruction.mnemonic)
+	{
+		case Mnemonic::JP:
+		case Mnemonic::SE_VX_NN:
+		case Mnemonic::SNE_VX_NN:
+		case Mnemonic::SE_VX_VY:
+		case Mnemonic::LD_VX_NN:
+		case Mnemonic::ADD_VX_NN:
+		case Mnemonic::LD_VX_VY:
+		case Mnemonic::OR_VX_VY:
+		case Mnemonic::AND_VX_VY:
+		case Mnemonic::XOR_VX_VY:
+		case Mnemonic::ADD_VX_VY:
+		case Mnemonic::SUB_VX_VY:
+		case Mnemonic::SHR_VX_VY:
+		case Mnemonic::SUBN_VX_VY:
+		case Mnemonic::SHL_VX_VY:
+		case Mnemonic::SNE_VX_VY:
+		case Mnemonic::LD_I_NNN:
+		case Mnemonic::JP_V0_NNN:
+		case Mnemonic::SKP_VX:
+		case Mnemonic::SKNP_VX:
+		case Mnemonic::LD_VX_DT:
+		case Mnemonic::LD_DT_VX:
+		case Mnemonic::LD_ST_VX:
+		case Mnemonic::ADD_I_VX:
+		case Mnemonic::LD_F_VX:
+		case Mnemonic::LD_VX_MEM:
+			return true;
+		case Mnemonic::LD_HF_VX:
+			return quirks.superChip;
+		default:
+			return false;
+	}
+}
+
+// True for the instructions that leave an entry themselves rather than going on to the next instruction
+bool StaticRecompiler::IsTransfer(const Instruction& instruction, const Chip8Quirks& quirks, int programSize)
+{
+	switch (instruction.mnemonic)
+	{
+		case Mnemonic::JP:
+			// Unless the profile allows it a jump outside the program does nothing
+			return quirks.jumpAnywhere || ((instruction.nnn > START_CHIP_8_PROGRAM) && (instruction.nnn < (START_CHIP_8_PROGRAM + programSize)));
+		case Mnemonic::SE_VX_NN:
+		case Mnemonic::SNE_VX_NN:
+		case Mnemonic::SE_VX_VY:
+		case Mnemonic::SNE_VX_VY:
+		case Mnemonic::SKP_VX:
+		case Mnemonic::SKNP_VX:
+		case Mnemonic::JP_V0_NNN:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*****************************************************************************************************************************************/
+//
+// GenerateInstruction - Writes the C++ for one instruction, following the interpreter statement by statement
+//
+// Inputs - instruction (the instruction, which CanCompile accepts)
+//          quirks (rules of the profile the code is for)
+//          programSize (bytes of program, which decides where a jump can go under CHIP_8)
+//          refund (this and the instructions after it in the entry, handed back to the budget if the instruction faults)
+//          entries (every entry of the module, to jump to directly)
+//          source (stream the code is written to)
+//
+// Outputs - None
+//
+// Notes - The statements are in the interpreter's order, so an instruction that names VF as one of its operands ends up with
+//         the same result
+/*****************************************************************************************************************************************/
+void StaticRecompiler::GenerateInstruction(const Instruction& instruction, const Chip8Quirks& quirks, int programSize, unsigned int refund,
+	const std::vector<Entry>& entries, std::ostream& source)
+{
+	const std::string vx = "v[" + Hex(instruction.x, 1) + "]";
+	const std::string vy = "v[" + Hex(instruction.y, 1) + "]";
+	const std::string nn = Hex(instruction.nn, 2);
+	const unsigned short next = instruction.address + 2;
+	// Skips fall through to next when the condition is false and pass over it when it is true
+	auto skip = [&](const std::string& condition)
+	{
+		source << "\tif (" << condition << ")" << std::endl
+		       << "\t\t" << GoTo(next + 2, entries) << std::endl
+		       << "\t" << GoTo(next, entries) << std::endl;
+	};
+	auto resetVF = [&]()
+	{
+		if (quirks.logicResetsVF)
+			source << "\tv[0xF] = 0;" << std::endl;
+	};
+
+	switch (instruction.mnemonic)
+	{
+		case Mnemonic::JP:
+			if (IsTransfer(instruction, quirks, programSize))
+				source << "\t" << GoTo(instruction.nnn, entries) << std::endl;
+			break;
+		case Mnemonic::JP_V0_NNN:
+			source << "\tpc = (unsigned short)((" << Hex(instruction.nnn, 3) << " + v[" << Hex(quirks.jumpPlusVX ? instruction.x : 0, 1) << "]) & 0xFFF);" << std::endl
+			       << "\tgoto dispatch;" << std::endl;
+			break;
+		case Mnemonic::SE_VX_NN:
+			skip(vx + " == " + nn);
+			break;
+		case Mnemonic::SNE_VX_NN:
+			skip(vx + " != " + nn);
+			break;
+		case Mnemonic::SE_VX_VY:
+			skip(vx + " == " + vy);
+			break;
+		case Mnemonic::SNE_VX_VY:
+			skip(vx + " != " + vy);
+			break;
+		case Mnemonic::SKP_VX:
+		case Mnemonic::SKNP_VX:
+			// Chip8::TestKey. VX above 0xF is never pressed, otherwise a held or tapped key is, and a tap is used up by the test
+			source << "\t{" << std::endl
+			       << "\t\tbool pressed = false;" << std::endl
+			       << "\t\tif (" << vx << " < 16)" << std::endl
+			       << "\t\t{" << std::endl
+			       << "\t\t\tunsigned short bit = (unsigned short)(1u << " << vx << ");" << std::endl
+			       << "\t\t\tpressed = (0 != ((*context->keysDown | *context->keysTapped) & bit));" << std::endl
+			       << "\t\t\t*context->keysTapped &= (unsigned short)~bit;" << std::endl
+			       << "\t\t}" << std::endl
+			       << "\t\tif (" << ((Mnemonic::SKP_VX == instruction.mnemonic) ? "pressed" : "!pressed") << ")" << std::endl
+			       << "\t\t\t" << GoTo(next + 2, entries) << std::endl
+			       << "\t\t" << GoTo(next, entries) << std::endl
+			       << "\t}" << std::endl;
+			break;
+		case Mnemonic::LD_VX_NN:
+			source << "\t" << vx << " = " << nn << ";" << std::endl;
+			break;
+		case Mnemonic::ADD_VX_NN:
+			source << "\t" << vx << " = (unsigned char)(" << vx << " + " << nn << ");" << std::endl;
+			break;
+		case Mnemonic::LD_VX_VY:
+			source << "\t" << vx << " = " << vy << ";" << std::endl;
+			break;
+		case Mnemonic::OR_VX_VY:
+			source << "\t" << vx << " |= " << vy << ";" << std::endl;
+			resetVF();
+			break;
+		case Mnemonic::AND_VX_VY:
+			source << "\t" << vx << " &= " << vy << ";" << std::endl;
+			resetVF();
+			break;
+		case Mnemonic::XOR_VX_VY:
+			source << "\t" << vx << " ^= " << vy << ";" << std::endl;
+			resetVF();
+			break;
+		case Mnemonic::ADD_VX_VY:
+			source << "\t{" << std::endl
+			       << "\t\tunsigned int sum = " << vx << " + " << vy << ";" << std::endl
+			       << "\t\tv[0xF] = (sum > 0xFF) ? 1 : 0;" << std::endl
+			       << "\t\t" << vx << " = (unsigned char)sum;" << std::endl
+			       << "\t}" << std::endl;
+			break;
+		case Mnemonic::SUB_VX_VY:
+			source << "\tv[0xF] = (" << vy << " > " << vx << ") ? 0 : 1;" << std::endl
+			       << "\t" << vx << " = (unsigned char)(" << vx << " - " << vy << ");" << std::endl;
+			break;
+		case Mnemonic::SUBN_VX_VY:
+			source << "\tv[0xF] = (" << vx << " > " << vy << ") ? 0 : 1;" << std::endl
+			       << "\t" << vx << " = (unsigned char)(" << vy << " - " << vx << ");" << std::endl;
+			break;
+		case Mnemonic::SHR_VX_VY:
+		{
+			const std::string& shifted = quirks.shiftInPlace ? vx : vy;
+			source << "\tv[0xF] = " << shifted << " & 0x01;" << std::endl
+			       << "\t" << shifted << " >>= 1;" << std::endl;
+			if (!quirks.shiftInPlace)
+				source << "\t" << vx << " = " << vy << ";" << std::endl;
+			break;
+		}
+		case Mnemonic::SHL_VX_VY:
+		{
+			const std::string& shifted = quirks.shiftInPlace ? vx : vy;
+			source << "\tv[0xF] = (" << shifted << " & 0x80) >> 7;" << std::endl
+			       << "\t" << shifted << " = (unsigned char)(" << shifted << " << 1);" << std::endl;
+			if (!quirks.shiftInPlace)
+				source << "\t" << vx << " = " << vy << ";" << std::endl;
+			break;
+		}
+		case Mnemonic::LD_I_NNN:
+			source << "\ti = " << Hex(instruction.nnn, 3) << ";" << std::endl;
+			break;
+		case Mnemonic::LD_VX_DT:
+			source << "\t" << vx << " = *context->delayTimer;" << std::endl;
+			break;
+		case Mnemonic::LD_DT_VX:
+			source << "\t*context->delayTimer = " << vx << ";" << std::endl;
+			break;
+		case Mnemonic::LD_ST_VX:
+			source << "\t*context->soundTimer = " << vx << ";" << std::endl;
+			break;
+		case Mnemonic::ADD_I_VX:
+			source << "\ti = (unsigned short)((i + " << vx << ") & 0xFFF);" << std::endl;
+			break;
+		case Mnemonic::LD_F_VX:
+			source << "\ti = (unsigned short)(" << vx << " * " << Chip8::FONT_HEIGHT << ");" << std::endl;
+			break;
+		case Mnemonic::LD_HF_VX:
+			source << "\ti = (unsigned short)(" << Chip8::LARGE_FONT_ADDRESS << " + (" << vx << " & 0xF) * " << Chip8::LARGE_FONT_HEIGHT << ");" << std::endl;
+			break;
+		case Mnemonic::LD_VX_MEM:
+			// Past the end of memory is a bad opcode, which is left for the interpreter to report
+			source << "\tif ((i + " << (unsigned int)instruction.x << ") >= " << CHIP_8_MEMORY_SIZE << ")" << std::endl
+			       << "\t{" << std::endl
+			       << "\t\tbudget += " << refund << ";" << std::endl
+			       << "\t\tpc = " << Hex(instruction.address, 4) << ";" << std::endl
+			       << "\t\tgoto leave;" << std::endl
+			       << "\t}" << std::endl;
+			for (int x = 0; x <= instruction.x; x++)
+				source << "\tv[" << Hex(x, 1) << "] = context->memory[i + " << x << "];" << std::endl;
+			if (!quirks.loadStoreKeepsI)
+				source << "\ti = (unsigned short)(i + " << (instruction.x + 1) << ");" << std::endl;
+			break;
+		default:
+			break;
+	}
+}
+
+// Straight to the entry at address if there is one, otherwise back to NativeModule with the PC there
+std::string StaticRecompiler::GoTo(unsigned short address, const std::vector<Entry>& entries)
+{
+	auto found = std::lower_bound(entries.begin(), entries.end(), address, [](const Entry& entry, unsigned short start) { return entry.start < start; });
+	if ((entries.end() != found) && (address == found->start))
+		return "goto entry_" + std::to_string(found - entries.begin()) + ";";
+	return "{ pc = " + Hex(address, 4) + "; goto leave; }";
+}
+
+std::string StaticRecompiler::Hex(unsigned int value, int digits)
+{
+	std::ostringstream text;
+	text << "0x" << std::uppercase << std::hex << std::setfill('0') << std::setw(digits) << value;
+	return text.str();
+}
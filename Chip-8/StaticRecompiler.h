@@ -0,0 +1,36 @@
+#pragma once
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Chip8.h"
+
+/*****************************************************************************************************************************************/
+//
+// StaticRecompiler - Turns a loaded program into C++ source for a NativeModule
+//
+// Notes - The basic blocks come from the machine's ControlFlowGraph. Each block is split into entries, straight runs of the
+//         instructions the generated code can run itself, and the instructions between them are left to the interpreter. All the
+//         entries go into one function, joined by gotos, so the host compiler sees every path through the program at once. The
+//         source only includes NativeModule.h and is built into a shared object with any C++ compiler, see chip8-recompile
+/*****************************************************************************************************************************************/
+class StaticRecompiler
+{
+public:
+	static int Generate(Chip8& chip, const std::string& name, std::ostream& source);
+
+private:
+	// An entry of the module and the instructions it runs, the last of which may be the jump or skip that ends its block
+	struct Entry
+	{
+		unsigned short start;
+		unsigned short end;
+		std::vector<Instruction> instructions;
+	};
+
+	static bool CanCompile(const Instruction& instruction, const Chip8Quirks& quirks);
+	static bool IsTransfer(const Instruction& instruction, const Chip8Quirks& quirks, int programSize);
+	static void GenerateInstruction(const Instruction& instruction, const Chip8Quirks& quirks, int programSize, unsigned int refund,
+		const std::vector<Entry>& entries, std::ostream& source);
+	static std::string GoTo(unsigned short address, const std::vector<Entry>& entries);
+	static std::string Hex(unsigned int value, int digits);
+};
@@ -0,0 +1,110 @@
+#include "WavWriter.h"
+
+namespace
+{
+	// WAV is little endian whatever the host is
+	void PutLittleEndian(unsigned char *out, unsigned int value, int bytes)
+	{
+		for (int x = 0; x < bytes; x++)
+			out[x] = (unsigned char)(value >> (x * 8));
+	}
+}
+
+WavWriter::WavWriter() :
+	m_file(nullptr),
+	m_sampleRate(0),
+	m_samples(0),
+	m_failed(false)
+{
+}
+
+
+WavWriter::~WavWriter()
+{
+	Close();
+}
+
+int WavWriter::Open(const char *path, unsigned int sampleRate)
+{
+	Close();
+	m_file = fopen(path, "wb");
+	if (nullptr == m_file)
+		return -1;
+
+	m_sampleRate = sampleRate;
+	m_samples = 0;
+	m_failed = false;
+	return WriteHeader();
+}
+
+int WavWriter::Write(const short *samples, size_t count)
+{
+	if ((nullptr == m_file) || m_failed)
+		return -1;
+
+	unsigned char buffer[4096];
+	size_t written = 0;
+	while (written < count)
+	{
+		size_t chunk = count - written;
+		if (chunk > sizeof(buffer) / 2)
+			chunk = sizeof(buffer) / 2;
+		for (size_t x = 0; x < chunk; x++)
+			PutLittleEndian(&buffer[x * 2], (unsigned short)samples[written + x], 2);
+		if (fwrite(buffer, 2, chunk, m_file) != chunk)
+		{
+			m_failed = true;
+			return -1;
+		}
+		written += chunk;
+	}
+	m_samples += count;
+	return 0;
+}
+
+// Fills in the sizes in the header and closes the file. Does nothing if no file is open
+int WavWriter::Close()
+{
+	if (nullptr == m_file)
+		return 0;
+
+	int returnValue = m_failed ? -1 : 0;
+	if ((0 == returnValue) && ((0 != fseek(m_file, 0, SEEK_SET)) || (0 != WriteHeader())))
+		returnValue = -1;
+	if (0 != fclose(m_file))
+		returnValue = -1;
+	m_file = nullptr;
+	return returnValue;
+}
+
+unsigned long long WavWriter::GetSampleCount()
+{
+	return m_samples;
+}
+
+int WavWriter::WriteHeader()
+{
+	unsigned int dataSize = (unsigned int)(m_samples * 2);
+	unsigned char header[HEADER_SIZE];
+
+	PutLittleEndian(&header[0], 0x46464952, 4);   // "RIFF"
+	PutLittleEndian(&header[4], HEADER_SIZE - 8 + dataSize, 4);
+	PutLittleEndian(&header[8], 0x45564157, 4);   // "WAVE"
+	PutLittleEndian(&header[12], 0x20746D66, 4);  // "fmt "
+	PutLittleEndian(&header[16], 16, 4);          // Size of the format chunk
+	PutLittleEndian(&header[20], 1, 2);           // PCM
+	PutLittleEndian(&header[22], 1, 2);           // Mono
+	PutLittleEndian(&header[24], m_sampleRate, 4);
+	PutLittleEndian(&header[28], m_sampleRate * 2, 4);  // Bytes per second
+	PutLittleEndian(&header[32], 2, 2);           // Bytes per sample
+	PutLittleEndian(&header[34], 16, 2);          // Bits per sample
+	PutLittleEndian(&header[36], 0x61746164, 4);  // "data"
+	PutLittleEndian(&header[40], dataSize, 4);
+
+	if (fwrite(header, 1, sizeof(header), m_file) != sizeof(header))
+	{
+		m_failed = true;
+		return -1;
+	}
+	return 0;
+}
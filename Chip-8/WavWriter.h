@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdio>
+
+/*****************************************************************************************************************************************/
+//
+// WavWriter - Writes 16 bit mono PCM to a .wav file as it is produced
+//
+// Notes - The header is written with zero sizes when the file is opened and filled in by Close, so samples can be streamed to
+//         disk without knowing how many there will be
+/*****************************************************************************************************************************************/
+class WavWriter
+{
+public:
+	WavWriter();
+	~WavWriter();
+	WavWriter(const WavWriter&) = delete;
+	WavWriter& operator=(const WavWriter&) = delete;
+
+	// All return 0 on success and -1 if the file could not be written
+	int Open(const char *path, unsigned int sampleRate);
+	int Write(const short *samples, size_t count);
+	int Close();
+
+	unsigned long long GetSampleCount();
+
+private:
+	static constexpr unsigned int HEADER_SIZE = 44;
+
+	FILE *m_file;
+	unsigned int m_sampleRate;
+	unsigned long long m_samples;
+	bool m_failed;
+
+	int WriteHeader();
+};
@@ -0,0 +1,133 @@
+#include "WorkStealingPool.h"
+
+WorkStealingPool::WorkStealingPool(unsigned int threads) :
+	m_task(nullptr),
+	m_batch(0),
+	m_workersBusy(0),
+	m_stopping(false)
+{
+	if (0 == threads)
+		threads = std::thread::hardware_concurrency();
+	if (0 == threads)
+		threads = 1;
+
+	m_threadCount = threads;
+	m_queues.reset(new WorkerQueue[threads]);
+	for (unsigned int x = 0; x < threads; x++)
+		m_threads.emplace_back(&WorkStealingPool::WorkerLoop, this, x);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(m_lock);
+		m_stopping = true;
+	}
+	m_start.notify_all();
+	for (auto& thread : m_threads)
+		thread.join();
+}
+
+unsigned int WorkStealingPool::GetThreadCount()
+{
+	return m_threadCount;
+}
+
+/*****************************************************************************************************************************************/
+//
+// ForEach - Runs a batch of tasks across the workers
+//
+// Inputs - count (number of tasks, passed to task as 0 to count-1)
+//          task (called once per index on one of the worker threads, along with the number of the worker running it)
+//
+// Outputs - None. Returns once every task has finished
+//
+// Notes - The batch is split into one contiguous slice per worker up front. Any imbalance after that is evened out by stealing
+/*****************************************************************************************************************************************/
+void WorkStealingPool::ForEach(size_t count, const Task& task)
+{
+	if (0 == count)
+		return;
+
+	std::lock_guard<std::mutex> batchGuard(m_batchLock);
+
+	for (unsigned int worker = 0; worker < m_threadCount; worker++)
+	{
+		size_t first = count * worker / m_threadCount;
+		size_t last = count * (worker + 1) / m_threadCount;
+		std::lock_guard<std::mutex> guard(m_queues[worker].lock);
+		for (size_t index = first; index < last; index++)
+			m_queues[worker].tasks.push_back(index);
+	}
+
+	std::unique_lock<std::mutex> guard(m_lock);
+	m_task = &task;
+	m_workersBusy = m_threadCount;
+	m_batch++;
+	m_start.notify_all();
+	m_finished.wait(guard, [this] { return 0 == m_workersBusy; });
+	m_task = nullptr;
+}
+
+void WorkStealingPool::WorkerLoop(unsigned int worker)
+{
+	unsigned long long batchSeen = 0;
+	for (;;)
+	{
+		const Task *task;
+		{
+			std::unique_lock<std::mutex> guard(m_lock);
+			m_start.wait(guard, [this, batchSeen] { return m_stopping || (m_batch != batchSeen); });
+			if (m_stopping)
+				return;
+			batchSeen = m_batch;
+			task = m_task;
+		}
+
+		size_t index;
+		while (TakeTask(worker, index))
+			(*task)(index, worker);
+
+		std::lock_guard<std::mutex> guard(m_lock);
+		if (0 == --m_workersBusy)
+			m_finished.notify_one();
+	}
+}
+
+/*****************************************************************************************************************************************/
+//
+// TakeTask - Finds the next task for a worker
+//
+// Inputs - worker (the worker looking for work)
+//          index (set to the task to run)
+//
+// Outputs - false when every queue is empty
+//
+// Notes - The owner works from the back of its queue and thieves take from the front, so the two only meet on the last task
+/*****************************************************************************************************************************************/
+bool WorkStealingPool::TakeTask(unsigned int worker, size_t& index)
+{
+	{
+		WorkerQueue& own = m_queues[worker];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.tasks.empty())
+		{
+			index = own.tasks.back();
+			own.tasks.pop_back();
+			return true;
+		}
+	}
+
+	for (unsigned int offset = 1; offset < m_threadCount; offset++)
+	{
+		WorkerQueue& victim = m_queues[(worker + offset) % m_threadCount];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.tasks.empty())
+		{
+			index = victim.tasks.front();
+			victim.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
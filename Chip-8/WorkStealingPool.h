@@ -0,0 +1,56 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*****************************************************************************************************************************************/
+//
+// WorkStealingPool - A fixed set of worker threads that run an indexed batch of independent tasks
+//
+// Notes - Each worker owns a queue that is seeded with a contiguous slice of the batch. A worker takes tasks from the back of its own
+//         queue and, once that is empty, steals from the front of the other queues, so a few long running tasks do not leave the
+//         rest of the machine idle. Tasks never add work, so a worker that finds every queue empty is done with the batch.
+/*****************************************************************************************************************************************/
+class WorkStealingPool
+{
+public:
+	typedef std::function<void(size_t index, unsigned int worker)> Task;
+
+	explicit WorkStealingPool(unsigned int threads = 0); // 0 uses one thread per hardware thread
+	~WorkStealingPool();
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+	unsigned int GetThreadCount();
+	// Runs task for every index in [0, count) and returns once they have all finished. Only one batch runs at a time
+	void ForEach(size_t count, const Task& task);
+
+private:
+	// Padded so the queues of neighbouring workers do not share a cache line
+	struct alignas(64) WorkerQueue
+	{
+		std::mutex lock;
+		std::deque<size_t> tasks;
+	};
+
+	std::vector<std::thread> m_threads;
+	std::unique_ptr<WorkerQueue[]> m_queues;
+	unsigned int m_threadCount;
+
+	std::mutex m_lock;
+	std::condition_variable m_start;
+	std::condition_variable m_finished;
+	const Task *m_task;
+	unsigned long long m_batch;     // Bumped to release the workers into a new batch
+	unsigned int m_workersBusy;
+	bool m_stopping;
+	std::mutex m_batchLock;         // Serialises callers of ForEach
+
+	void WorkerLoop(unsigned int worker);
+	bool TakeTask(unsigned int worker, size_t& index);
+};